@@ -0,0 +1,116 @@
+/*
+ * CSV Selector
+ *
+ * Scratch memory that's handed out by bumping a pointer, and given back all
+ * at once.
+ *
+ * The memory comes in blocks, kept in a list. An allocation is taken from the
+ * current block if it fits, or else from the next one, which is allocated if
+ * there isn't one big enough already. Resetting goes back to the first block
+ * and keeps them all, so an arena that's reset for every row stops touching
+ * the heap once it has grown to what a row needs.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// what allocations are aligned for
+typedef union {
+    long double ld;
+    long long   ll;
+    void*       p;
+} arena_align;
+
+typedef struct _arena_block {
+    struct _arena_block* next;
+    size_t               size;  // bytes in data
+    arena_align          data[];
+} arena_block;
+
+struct _arena {
+    arena_block* first;
+    arena_block* current;       // block being allocated from, or NULL
+    size_t       used;          // bytes of it allocated
+    size_t       block_size;
+};
+
+/**
+ * Create an arena.
+ *
+ * Arguments:
+ *   block_size	- size of the blocks to get memory in; bigger allocations get
+ *		  a block of their own size
+ *
+ * Return Value:
+ *   The arena, or NULL if out of memory.
+ */
+arena* arena_create(size_t block_size)
+{
+    arena* a = calloc(1, sizeof(arena));
+    if (NULL == a) {
+        return NULL;
+    }
+
+    a->block_size = block_size;
+    return a;
+}
+
+void arena_free(arena* a)
+{
+    if (NULL != a) {
+        arena_block* block = a->first;
+        while (NULL != block) {
+            arena_block* next = block->next;
+            free(block);
+            block = next;
+        }
+        free(a);
+    }
+}
+
+/**
+ * Allocate memory from an arena. It stays good until the arena is reset or
+ * freed.
+ *
+ * Return Value:
+ *   The memory, aligned for any type, or NULL if out of memory.
+ */
+void* arena_alloc(arena* a, size_t size)
+{
+    // keep every allocation aligned
+    size = (size + sizeof(arena_align) - 1) & ~(sizeof(arena_align) - 1);
+
+    if (NULL == a->current || a->current->size - a->used < size) {
+        arena_block** link = (NULL == a->current) ? &a->first : &a->current->next;
+
+        if (NULL == *link || (*link)->size < size) {
+            size_t block_size = (size > a->block_size) ? size : a->block_size;
+            arena_block* block = malloc(sizeof(arena_block) + block_size);
+            if (NULL == block) {
+                return NULL;
+            }
+            block->size = block_size;
+            block->next = *link;
+            *link = block;
+        }
+
+        a->current = *link;
+        a->used = 0;
+    }
+
+    void* p = (char*)a->current->data + a->used;
+    a->used += size;
+    return p;
+}
+
+/**
+ * Give back everything allocated from an arena, keeping its blocks to be
+ * allocated from again.
+ */
+void arena_reset(arena* a)
+{
+    a->current = NULL;
+    a->used = 0;
+}
@@ -0,0 +1,20 @@
+/*
+ * CSV Selector
+ *
+ * Scratch memory that's handed out by bumping a pointer, and given back all
+ * at once.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct _arena arena;
+
+arena* arena_create(size_t block_size);
+void   arena_free(arena* a);
+void*  arena_alloc(arena* a, size_t size);
+void   arena_reset(arena* a);
+
+#endif //ARENA_H
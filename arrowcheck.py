@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+# CSV Selector
+#
+# Checks --output-format arrow against pyarrow: each query's Arrow output
+# must be a valid IPC stream that holds the same rows as its CSV output.
+# Needs pyarrow installed, and csvsel built.
+#
+# usage: arrowcheck.py [csvsel [input.csv]]
+#
+
+import csv
+import io
+import subprocess
+import sys
+
+try:
+    import pyarrow.ipc
+except ImportError:
+    sys.exit("arrowcheck.py needs pyarrow (pip install pyarrow)")
+
+CSVSEL = sys.argv[1] if len(sys.argv) > 1 else "./csvsel"
+INPUT = sys.argv[2] if len(sys.argv) > 2 else "test.csv"
+
+QUERIES = [
+    'select %1, strlen(%1), %#, %%',
+    'select %3, strlen(%2), 2.5 where strlen(%1) > 6 order by %2 desc, %1',
+    'select %2, upper(%1), 1, 2.5, "x" order by %# desc limit 10',
+]
+
+OPTIONS = [[], ["-j", "4", "-b", "256"], ["-m", "1k"]]
+
+
+def run(args):
+    return subprocess.run([CSVSEL, "-f", INPUT] + args,
+                          stdout=subprocess.PIPE, check=True).stdout
+
+
+def check(query, options, batch_size):
+    text = run(options + [query]).decode("utf-8", "surrogateescape")
+    expected = list(csv.reader(io.StringIO(text, newline="")))
+
+    table = pyarrow.ipc.open_stream(run(options + [
+        "--output-format", "arrow", "--batch-size", batch_size, query])).read_all()
+    table.validate(full=True)
+
+    if table.num_rows != len(expected):
+        return "%d rows, not %d" % (table.num_rows, len(expected))
+
+    for n, (row, csv_row) in enumerate(zip(table.to_pylist(), expected)):
+        for value, field in zip(row.values(), csv_row):
+            # CSV prints floats with six decimal places
+            printed = ("%f" % value) if isinstance(value, float) else str(value)
+            if printed != field:
+                return "row %d: %r, not %r" % (n, value, field)
+
+    return None
+
+
+failed = False
+for query in QUERIES:
+    for options in OPTIONS:
+        for batch_size in ["1", "7", "65536"]:
+            error = check(query, options, batch_size)
+            if error is not None:
+                print("FAIL: %s %s --batch-size %s: %s"
+                      % (" ".join(options), query, batch_size, error))
+                failed = True
+
+print("FAIL" if failed else "pass")
+sys.exit(1 if failed else 0)
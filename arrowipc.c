@@ -0,0 +1,784 @@
+/*
+ * CSV Selector
+ *
+ * Query results as an Apache Arrow IPC stream.
+ *
+ * The stream is a Schema message, a RecordBatch message for every so many
+ * rows, and an end-of-stream marker. Each message is
+ *
+ *   0xFFFFFFFF, int32 size of the metadata, metadata, body
+ *
+ * where the metadata is a Message flatbuffer (see Message.fbs and Schema.fbs
+ * in the Arrow format), padded so the body starts 8-byte aligned, and the
+ * body is the buffers of the columns, each padded to 8 bytes too. There are
+ * only a few small flatbuffers to write, so they're put together by hand here
+ * rather than with the Arrow or flatbuffers libraries.
+ *
+ * Rows reach the writer through a stream, the same way CSV rows reach an
+ * output file, so that they can be held by the sorter or by the chunks of a
+ * parallel read on the way. Each value of a row is encoded as its column's
+ * type: an int64 or a double as 8 bytes, a string as a uint32 length and then
+ * the bytes. The stream decodes the rows into the columns of the batch being
+ * built.
+ *
+ * Columns are int64, float64 or utf8, and never null. Flatbuffers are always
+ * little-endian; column data is in the byte order of the machine, which the
+ * schema says.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "growbuf.h"
+#include "queryparse.h"
+#include "arrowipc.h"
+
+#define DEBUG if (false)
+//#define DEBUG
+
+//
+// Values from the Arrow format's flatbuffer schemas.
+//
+
+#define METADATA_V5             4
+#define HEADER_SCHEMA           1
+#define HEADER_RECORD_BATCH     3
+#define TYPE_TYPE_INT           2
+#define TYPE_TYPE_FLOATING      3
+#define TYPE_TYPE_UTF8          5
+#define PRECISION_DOUBLE        2
+#define ENDIANNESS_LITTLE       0
+#define ENDIANNESS_BIG          1
+
+#define CONTINUATION_MARKER     0xFFFFFFFF
+
+/**
+ * Most fields any table written here has.
+ */
+#define MAX_TABLE_FIELDS 8
+
+/**
+ * A flatbuffer being put together, front to back.
+ */
+typedef struct {
+    growbuf* buf;
+    bool     failed;    // an allocation failed, so the buffer is incomplete
+} fb_builder;
+
+/**
+ * A field of a flatbuffer table.
+ */
+typedef struct {
+    uint8_t  size;      // 1, 2, 4 or 8 bytes; 0 if the field is left out
+    uint64_t value;     // 0 for an offset, filled in with fb_point() later
+} fb_field;
+
+typedef struct {
+    char*    name;
+    type     type;
+    growbuf* values;    // int64_t or double values; int32_t string offsets
+    growbuf* data;      // string bytes
+} arrow_column;
+
+struct _arrow_writer {
+    FILE*         output;
+    size_t        batch_rows;   // rows in a full batch
+    arrow_column* columns;
+    size_t        num_columns;
+    size_t        batch_len;    // rows in the batch being built
+    growbuf*      pending;      // start of a row that hasn't all arrived yet
+    fb_builder    fb;
+    FILE*         rows;         // where rows are written to
+    int           error;
+};
+
+static void put_le(uint8_t* p, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void fb_append(fb_builder* b, const void* bytes, size_t len)
+{
+    if (0 != growbuf_append(b->buf, bytes, len)) {
+        b->failed = true;
+    }
+}
+
+static void fb_append_le(fb_builder* b, uint64_t value, size_t size)
+{
+    uint8_t bytes[8];
+    put_le(bytes, value, size);
+    fb_append(b, bytes, size);
+}
+
+/**
+ * Pad with zeros until the buffer size plus some amount is a multiple of an
+ * alignment.
+ */
+static void fb_pad(fb_builder* b, size_t alignment, size_t plus)
+{
+    static const uint8_t zeros[8] = {0};
+    size_t len = (alignment - (b->buf->size + plus) % alignment) % alignment;
+    fb_append(b, zeros, len);
+}
+
+/**
+ * Fill in an offset written earlier, to point at something after it.
+ */
+static void fb_point(fb_builder* b, size_t at, size_t target)
+{
+    if (!b->failed) {
+        put_le((uint8_t*)b->buf->buf + at, target - at, 4);
+    }
+}
+
+/**
+ * Write a table, with its vtable in front of it.
+ *
+ * The fields are laid out largest first, and the table placed so that
+ * 8-byte fields are 8-byte aligned. Fields that are offsets are left zero,
+ * for fb_point() to fill in once what they point to is written.
+ *
+ * Arguments:
+ *   b		- the flatbuffer
+ *   fields	- the table's fields, in order of field id
+ *   num_fields	- how many
+ *   positions	- receives the position of each field in the buffer; may be
+ *		  NULL if none are offsets
+ *
+ * Return Value:
+ *   Position of the table.
+ */
+static size_t fb_table(fb_builder* b, const fb_field* fields, size_t num_fields, size_t* positions)
+{
+    size_t field_offsets[MAX_TABLE_FIELDS] = {0};
+    uint8_t image[8 + MAX_TABLE_FIELDS * 8] = {0};
+    bool has_8 = false;
+
+    for (size_t i = 0; i < num_fields; i++) {
+        has_8 = has_8 || (8 == fields[i].size);
+    }
+
+    fb_pad(b, 2, 0);
+    size_t vtable_start = b->buf->size;
+    size_t vtable_size = 4 + 2 * num_fields;
+    size_t table_start = (vtable_start + vtable_size + 3) & ~(size_t)3;
+    if (has_8 && 4 != table_start % 8) {
+        table_start += 4;
+    }
+
+    // after the table's soffset to its vtable
+    size_t table_size = 4;
+    for (size_t size = 8; size > 0; size /= 2) {
+        for (size_t i = 0; i < num_fields; i++) {
+            if (size == fields[i].size) {
+                size_t at = (table_start + table_size + size - 1) & ~(size - 1);
+                table_size = at - table_start;
+                field_offsets[i] = table_size;
+                put_le(image + table_size, fields[i].value, size);
+                table_size += size;
+            }
+        }
+    }
+
+    fb_append_le(b, vtable_size, 2);
+    fb_append_le(b, table_size, 2);
+    for (size_t i = 0; i < num_fields; i++) {
+        fb_append_le(b, field_offsets[i], 2);
+    }
+
+    if (b->buf->size < table_start) {
+        static const uint8_t zeros[8] = {0};
+        fb_append(b, zeros, table_start - b->buf->size);
+    }
+    put_le(image, table_start - vtable_start, 4);
+    fb_append(b, image, table_size);
+
+    for (size_t i = 0; NULL != positions && i < num_fields; i++) {
+        positions[i] = table_start + field_offsets[i];
+    }
+
+    return table_start;
+}
+
+/**
+ * Write a vector of zeroed elements, to be filled in afterwards.
+ *
+ * Return Value:
+ *   Position of the vector; its elements start 4 bytes after it.
+ */
+static size_t fb_vector(fb_builder* b, size_t count, size_t elem_size, size_t alignment)
+{
+    fb_pad(b, alignment, 4);
+    size_t vector = b->buf->size;
+    fb_append_le(b, count, 4);
+    for (size_t i = 0; i < count * elem_size; i++) {
+        fb_append_le(b, 0, 1);
+    }
+    return vector;
+}
+
+static size_t fb_string(fb_builder* b, const char* str)
+{
+    size_t len = strlen(str);
+
+    fb_pad(b, 4, 0);
+    size_t string = b->buf->size;
+    fb_append_le(b, len, 4);
+    fb_append(b, str, len + 1);
+    return string;
+}
+
+/**
+ * Start a Message flatbuffer.
+ *
+ * Return Value:
+ *   Position of the offset to the message header, for the caller to point
+ *   at the header it writes.
+ */
+static size_t fb_message(fb_builder* b, uint8_t header_type, uint64_t body_len)
+{
+    fb_field fields[] = {
+        { 2, METADATA_V5 },  // version
+        { 1, header_type },  // header_type
+        { 4, 0 },            // header
+        { 8, body_len },     // bodyLength
+    };
+    size_t positions[4];
+
+    b->buf->size = 0;
+    b->failed = false;
+
+    // offset to the root table
+    fb_append_le(b, 0, 4);
+    size_t message = fb_table(b, fields, 4, positions);
+    fb_point(b, 0, message);
+
+    return positions[2];
+}
+
+static void write_padding(size_t len, FILE* output)
+{
+    static const char zeros[8] = {0};
+    fwrite(zeros, 1, (8 - len % 8) % 8, output);
+}
+
+/**
+ * Write the message put together in the writer's flatbuffer, up to its body.
+ */
+static int write_message(arrow_writer* w)
+{
+    uint8_t prefix[8];
+
+    if (w->fb.failed) {
+        fprintf(stderr, "malloc failed\n");
+        return EX_OSERR;
+    }
+
+    size_t size = w->fb.buf->size;
+    put_le(prefix, CONTINUATION_MARKER, 4);
+    put_le(prefix + 4, (size + 7) & ~(size_t)7, 4);
+
+    fwrite(prefix, 1, sizeof(prefix), w->output);
+    fwrite(w->fb.buf->buf, 1, size, w->output);
+    write_padding(size, w->output);
+
+    return 0;
+}
+
+static bool host_is_big_endian(void)
+{
+    uint16_t one = 1;
+    return 0 == *(uint8_t*)&one;
+}
+
+static int write_schema(arrow_writer* w)
+{
+    fb_builder* b = &w->fb;
+    size_t schema_positions[2];
+
+    size_t header = fb_message(b, HEADER_SCHEMA, 0);
+
+    fb_field schema_fields[] = {
+        { 2, host_is_big_endian() ? ENDIANNESS_BIG : ENDIANNESS_LITTLE },
+        { 4, 0 },            // fields
+    };
+    size_t schema = fb_table(b, schema_fields, 2, schema_positions);
+    fb_point(b, header, schema);
+
+    size_t fields = fb_vector(b, w->num_columns, 4, 4);
+    fb_point(b, schema_positions[1], fields);
+
+    for (size_t i = 0; i < w->num_columns; i++) {
+        arrow_column* c = &w->columns[i];
+        uint8_t type_type = TYPE_TYPE_UTF8;
+        fb_field type_fields[2] = {{0}};
+        size_t num_type_fields = 0;
+        size_t positions[6];
+
+        if (TYPE_LONG == c->type) {
+            type_type = TYPE_TYPE_INT;
+            type_fields[0] = (fb_field){ 4, 64 };  // bitWidth
+            type_fields[1] = (fb_field){ 1, 1 };   // is_signed
+            num_type_fields = 2;
+        }
+        else if (TYPE_DOUBLE == c->type) {
+            type_type = TYPE_TYPE_FLOATING;
+            type_fields[0] = (fb_field){ 2, PRECISION_DOUBLE };  // precision
+            num_type_fields = 1;
+        }
+
+        fb_field field_fields[] = {
+            { 4, 0 },            // name
+            { 1, 0 },            // nullable
+            { 1, type_type },    // type_type
+            { 4, 0 },            // type
+            { 0, 0 },            // dictionary
+            { 4, 0 },            // children
+        };
+        size_t field = fb_table(b, field_fields, 6, positions);
+        fb_point(b, fields + 4 + 4 * i, field);
+
+        size_t name = fb_string(b, c->name);
+        fb_point(b, positions[0], name);
+
+        size_t type_table = fb_table(b, type_fields, num_type_fields, NULL);
+        fb_point(b, positions[3], type_table);
+
+        size_t children = fb_vector(b, 0, 4, 4);
+        fb_point(b, positions[5], children);
+    }
+
+    return write_message(w);
+}
+
+/**
+ * Empty the columns, for the next batch.
+ */
+static int reset_columns(arrow_writer* w)
+{
+    int32_t zero = 0;
+
+    w->batch_len = 0;
+    for (size_t i = 0; i < w->num_columns; i++) {
+        arrow_column* c = &w->columns[i];
+        c->values->size = 0;
+        c->data->size = 0;
+        if (TYPE_STRING == c->type && 0 != growbuf_append(c->values, &zero, sizeof(zero))) {
+            return EX_OSERR;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Write the rows gathered so far as a record batch, if there are any.
+ */
+static int write_batch(arrow_writer* w)
+{
+    fb_builder* b = &w->fb;
+    size_t batch_positions[3];
+    uint64_t body_len = 0;
+    size_t num_buffers = 0;
+    int retval;
+
+    if (0 == w->batch_len) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < w->num_columns; i++) {
+        arrow_column* c = &w->columns[i];
+        num_buffers += (TYPE_STRING == c->type) ? 3 : 2;
+        body_len += (c->values->size + 7) & ~(size_t)7;
+        body_len += (c->data->size + 7) & ~(size_t)7;
+    }
+
+    size_t header = fb_message(b, HEADER_RECORD_BATCH, body_len);
+
+    fb_field batch_fields[] = {
+        { 8, w->batch_len }, // length
+        { 4, 0 },            // nodes
+        { 4, 0 },            // buffers
+    };
+    size_t batch = fb_table(b, batch_fields, 3, batch_positions);
+    fb_point(b, header, batch);
+
+    size_t nodes = fb_vector(b, w->num_columns, 16, 8);
+    fb_point(b, batch_positions[1], nodes);
+
+    size_t buffers = fb_vector(b, num_buffers, 16, 8);
+    fb_point(b, batch_positions[2], buffers);
+
+    if (!b->failed) {
+        uint8_t* node = (uint8_t*)b->buf->buf + nodes + 4;
+        uint8_t* buffer = (uint8_t*)b->buf->buf + buffers + 4;
+        uint64_t offset = 0;
+
+        for (size_t i = 0; i < w->num_columns; i++) {
+            arrow_column* c = &w->columns[i];
+
+            // length; null_count is zero
+            put_le(node, w->batch_len, 8);
+            node += 16;
+
+            // validity bitmap: left out, since nothing is null
+            put_le(buffer, offset, 8);
+            buffer += 16;
+
+            put_le(buffer, offset, 8);
+            put_le(buffer + 8, c->values->size, 8);
+            offset += (c->values->size + 7) & ~(size_t)7;
+            buffer += 16;
+
+            if (TYPE_STRING == c->type) {
+                put_le(buffer, offset, 8);
+                put_le(buffer + 8, c->data->size, 8);
+                offset += (c->data->size + 7) & ~(size_t)7;
+                buffer += 16;
+            }
+        }
+    }
+
+    retval = write_message(w);
+    if (0 != retval) {
+        return retval;
+    }
+
+    for (size_t i = 0; i < w->num_columns; i++) {
+        arrow_column* c = &w->columns[i];
+        fwrite(c->values->buf, 1, c->values->size, w->output);
+        write_padding(c->values->size, w->output);
+        if (TYPE_STRING == c->type) {
+            fwrite(c->data->buf, 1, c->data->size, w->output);
+            write_padding(c->data->size, w->output);
+        }
+    }
+
+    DEBUG fprintf(stderr, "arrow: wrote a batch of %zu rows\n", w->batch_len);
+
+    return reset_columns(w);
+}
+
+/**
+ * Size of the encoded row at the start of some data, or 0 if it hasn't all
+ * arrived yet.
+ */
+static size_t row_length(const arrow_writer* w, const char* data, size_t len)
+{
+    size_t pos = 0;
+
+    for (size_t i = 0; i < w->num_columns; i++) {
+        if (TYPE_STRING == w->columns[i].type) {
+            uint32_t str_len;
+            if (pos + sizeof(str_len) > len) {
+                return 0;
+            }
+            memcpy(&str_len, data + pos, sizeof(str_len));
+            pos += sizeof(str_len) + str_len;
+        }
+        else {
+            pos += 8;
+        }
+
+        if (pos > len) {
+            return 0;
+        }
+    }
+
+    return pos;
+}
+
+/**
+ * Add an encoded row to the batch being built, first writing the batch out
+ * if the row doesn't fit in it. A column's strings can only take up 2 GiB in
+ * a batch, because of their int32 offsets.
+ */
+static int add_row(arrow_writer* w, const char* row)
+{
+    const char* p = row;
+    bool fits = true;
+
+    for (size_t i = 0; i < w->num_columns; i++) {
+        if (TYPE_STRING == w->columns[i].type) {
+            uint32_t len;
+            memcpy(&len, p, sizeof(len));
+            if (len > INT32_MAX) {
+                fprintf(stderr, "value too long for an Arrow string\n");
+                return EX_DATAERR;
+            }
+            if (w->columns[i].data->size + len > INT32_MAX) {
+                fits = false;
+            }
+            p += sizeof(len) + len;
+        }
+        else {
+            p += 8;
+        }
+    }
+
+    if (!fits) {
+        int retval = write_batch(w);
+        if (0 != retval) {
+            return retval;
+        }
+    }
+
+    p = row;
+    for (size_t i = 0; i < w->num_columns; i++) {
+        arrow_column* c = &w->columns[i];
+        int err;
+
+        if (TYPE_STRING == c->type) {
+            uint32_t len;
+            memcpy(&len, p, sizeof(len));
+            p += sizeof(len);
+
+            err = growbuf_append(c->data, p, len);
+            int32_t end = (int32_t)c->data->size;
+            err = err || growbuf_append(c->values, &end, sizeof(end));
+            p += len;
+        }
+        else {
+            err = growbuf_append(c->values, p, 8);
+            p += 8;
+        }
+
+        if (0 != err) {
+            return EX_OSERR;
+        }
+    }
+
+    if (++w->batch_len == w->batch_rows) {
+        return write_batch(w);
+    }
+
+    return 0;
+}
+
+/**
+ * Write function of the rows stream: decode the rows, keeping any part of
+ * one at the end until the rest of it is written.
+ */
+static ssize_t rows_write(void* cookie, const char* buf, size_t size)
+{
+    arrow_writer* w = (arrow_writer*)cookie;
+    const char* data = buf;
+    size_t len = size;
+    size_t used = 0;
+
+    if (0 != w->error) {
+        return -1;
+    }
+
+    if (w->pending->size > 0) {
+        if (0 != growbuf_append(w->pending, buf, size)) {
+            w->error = EX_OSERR;
+            return -1;
+        }
+        data = w->pending->buf;
+        len = w->pending->size;
+    }
+
+    for (;;) {
+        size_t row_len = row_length(w, data + used, len - used);
+        if (0 == row_len) {
+            break;
+        }
+
+        w->error = add_row(w, data + used);
+        if (0 != w->error) {
+            return -1;
+        }
+        used += row_len;
+    }
+
+    if (data == w->pending->buf) {
+        memmove(w->pending->buf, data + used, len - used);
+        w->pending->size = len - used;
+    }
+    else if (0 != growbuf_append(w->pending, data + used, len - used)) {
+        w->error = EX_OSERR;
+        return -1;
+    }
+
+    return size;
+}
+
+/**
+ * Create a writer, which writes nothing until it's opened.
+ *
+ * Arguments:
+ *   output	- where to write the stream
+ *   batch_rows	- rows in each record batch; 0 for the default
+ *
+ * Return Value:
+ *   The writer, or NULL if out of memory.
+ */
+arrow_writer* arrow_writer_create(FILE* output, size_t batch_rows)
+{
+    arrow_writer* w = calloc(1, sizeof(arrow_writer));
+    if (NULL == w) {
+        return NULL;
+    }
+
+    w->output = output;
+    w->batch_rows = (0 == batch_rows) ? ARROW_DEFAULT_BATCH_ROWS : batch_rows;
+    w->pending = growbuf_create(0);
+    w->fb.buf = growbuf_create(1024);
+
+    if (NULL == w->pending || NULL == w->fb.buf) {
+        arrow_writer_free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void arrow_writer_free(arrow_writer* w)
+{
+    if (NULL == w) {
+        return;
+    }
+
+    if (NULL != w->rows) {
+        fclose(w->rows);
+    }
+
+    for (size_t i = 0; i < w->num_columns; i++) {
+        free(w->columns[i].name);
+        growbuf_free(w->columns[i].values);
+        growbuf_free(w->columns[i].data);
+    }
+    free(w->columns);
+    growbuf_free(w->pending);
+    growbuf_free(w->fb.buf);
+    free(w);
+}
+
+/**
+ * Add a column to a writer that hasn't been opened yet.
+ *
+ * Arguments:
+ *   w		- the writer
+ *   name	- name of the column; copied
+ *   type	- type of its values
+ *
+ * Return Value:
+ *   0 on success, EX_OSERR if out of memory.
+ */
+int arrow_writer_add_column(arrow_writer* w, const char* name, type type)
+{
+    arrow_column* columns = realloc(w->columns, (w->num_columns + 1) * sizeof(arrow_column));
+    if (NULL == columns) {
+        return EX_OSERR;
+    }
+    w->columns = columns;
+
+    arrow_column* c = &columns[w->num_columns];
+    c->name = strdup(name);
+    c->type = type;
+    c->values = growbuf_create(0);
+    c->data = growbuf_create(0);
+    w->num_columns++;
+
+    if (NULL == c->name || NULL == c->values || NULL == c->data) {
+        return EX_OSERR;
+    }
+
+    return 0;
+}
+
+/**
+ * Write the schema, and open the stream rows are written to, encoded with
+ * arrow_encode_long() and the like, one value for each column in order.
+ *
+ * Return Value:
+ *   The stream, or NULL on failure. It's closed by arrow_writer_finish().
+ */
+FILE* arrow_writer_open(arrow_writer* w)
+{
+    cookie_io_functions_t io = {
+        .read = NULL,
+        .write = &rows_write,
+        .seek = NULL,
+        .close = NULL,
+    };
+
+    if (0 == w->num_columns || 0 != reset_columns(w) || 0 != write_schema(w)) {
+        return NULL;
+    }
+
+    w->rows = fopencookie(w, "w", io);
+    return w->rows;
+}
+
+/**
+ * Write the last batch of rows, and the end of the stream.
+ *
+ * Return Value:
+ *   0 on success, or an exit code if something went wrong with any of the
+ *   rows.
+ */
+int arrow_writer_finish(arrow_writer* w)
+{
+    uint8_t eos[8];
+
+    if (NULL != w->rows) {
+        fclose(w->rows);
+        w->rows = NULL;
+    }
+
+    if (0 == w->error && w->pending->size > 0) {
+        fprintf(stderr, "arrow: incomplete row\n");
+        w->error = EX_SOFTWARE;
+    }
+
+    if (0 == w->error) {
+        w->error = write_batch(w);
+    }
+
+    if (0 != w->error) {
+        return w->error;
+    }
+
+    put_le(eos, CONTINUATION_MARKER, 4);
+    put_le(eos + 4, 0, 4);
+    fwrite(eos, 1, sizeof(eos), w->output);
+
+    return 0;
+}
+
+/**
+ * Encode a value of an int64 column of a row.
+ */
+void arrow_encode_long(long num, FILE* rows)
+{
+    int64_t value = num;
+    fwrite_unlocked(&value, 1, sizeof(value), rows);
+}
+
+/**
+ * Encode a value of a float64 column of a row.
+ */
+void arrow_encode_double(double dbl, FILE* rows)
+{
+    fwrite_unlocked(&dbl, 1, sizeof(dbl), rows);
+}
+
+/**
+ * Encode a value of a utf8 column of a row. One too long for a column is
+ * rejected when the row is written out.
+ */
+void arrow_encode_string(const char* str, size_t len, FILE* rows)
+{
+    uint32_t encoded_len = (len > UINT32_MAX) ? UINT32_MAX : (uint32_t)len;
+    fwrite_unlocked(&encoded_len, 1, sizeof(encoded_len), rows);
+    fwrite_unlocked(str, 1, encoded_len, rows);
+}
@@ -0,0 +1,31 @@
+/*
+ * CSV Selector
+ *
+ * Query results as an Apache Arrow IPC stream.
+ */
+
+#ifndef ARROWIPC_H
+#define ARROWIPC_H
+
+#include <stdio.h>
+
+#include "queryparse.h"
+
+/**
+ * Default for how many rows go in each record batch.
+ */
+#define ARROW_DEFAULT_BATCH_ROWS 65536
+
+typedef struct _arrow_writer arrow_writer;
+
+arrow_writer* arrow_writer_create(FILE* output, size_t batch_rows);
+void arrow_writer_free(arrow_writer* w);
+int arrow_writer_add_column(arrow_writer* w, const char* name, type type);
+FILE* arrow_writer_open(arrow_writer* w);
+int arrow_writer_finish(arrow_writer* w);
+
+void arrow_encode_long(long num, FILE* rows);
+void arrow_encode_double(double dbl, FILE* rows);
+void arrow_encode_string(const char* str, size_t len, FILE* rows);
+
+#endif //ARROWIPC_H
@@ -9,234 +9,915 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "growbuf.h"
 #include "csvformat.h"
+#include "csvscan.h"
 
 //#define DEBUG
 #define DEBUG if (false)
 
 /**
- * same as strchr() except it looks for multiple characters.
- *
- * Arguments:
- *   haystack	- string to be searched
- *   chars	- characters to search for
- *   nchars	- number of characters in chars
- *
- * Return Value:
- *   Pointer to the first one of chars in haystack, or NULL if none found.
+ * Whether a field has a comma or a newline in it, and needs double-quotes.
+ * Long fields are looked through a window at a time, the way input is.
  */
-const char* strchrs(const char* haystack, const char* chars, size_t nchars)
+static bool needs_quotes(const char* field, size_t len)
 {
-    const char* end = haystack + strlen(haystack);
-    while (haystack < end) {
-        for (size_t i = 0; i < nchars; i++) {
-            if (*haystack == chars[i]) {
-                return haystack;
+    if (len < CSV_SCAN_WIDTH) {
+        for (size_t i = 0; i < len; i++) {
+            if (field[i] == ',' || field[i] == '\n') {
+                return true;
             }
         }
-        haystack++;
+        return false;
     }
 
-    return NULL;
+    for (size_t i = 0; i < len; i += CSV_SCAN_WIDTH) {
+        csv_structure bits;
+        csv_scan_classify(field + i, len - i, &bits);
+        if (0 != (bits.comma | bits.newline)) {
+            return true;
+        }
+    }
+    return false;
 }
 
 /**
  * Print a CSV field, with appropriate double-quotes.
  *
  * No double-quotes are used, unless the field contains a comma, or a newline.
+ * The field is written out in as few pieces as it can be: all at once, or
+ * in the runs between its double-quotes, which are doubled.
  *
  * Arguments:
- *   field	- field to print
+ *   field	- field to print (need not be NUL-terminated)
+ *   len	- length of the field
  *   output	- file pointer to print to
  */
-void print_csv_field(const char* field, FILE* output)
+void print_csv_field(const char* field, size_t len, FILE* output)
 {
-    if (NULL != strchrs(field, ",\n", 2)) {
-        fprintf(output, "\"");
-        for (size_t i = 0; i < strlen(field); i++) {
-            if (field[i] == '"') {
-                fprintf(output, "\"\"");
-            }
-            else {
-                fprintf(output, "%c", field[i]);
+    if (needs_quotes(field, len)) {
+        const char* end = field + len;
+
+        putc_unlocked('"', output);
+        while (field < end) {
+            const char* dquot = memchr(field, '"', end - field);
+            if (NULL == dquot) {
+                fwrite_unlocked(field, 1, end - field, output);
+                break;
             }
+
+            fwrite_unlocked(field, 1, dquot + 1 - field, output);
+            putc_unlocked('"', output);
+            field = dquot + 1;
         }
-        fprintf(output, "\"");
+        putc_unlocked('"', output);
     }
     else {
-        fprintf(output, "%s", field);
+        fwrite_unlocked(field, 1, len, output);
     }
 }
 
-static int read_csv_internal(
-        FILE* input,
-        row_evaluator row_evaluator,
-        void* context,
-        bool one_row_only,
-        int start_row_number)
+/**
+ * Print a field of the input the way print_csv_field() would. One that wasn't
+ * double-quoted can't have a comma or a newline in it, so it is written out
+ * without looking.
+ */
+void print_csv_column(const csv_field* field, FILE* output)
 {
-    int retval = 0;
+    if (field->quoted) {
+        print_csv_field(field->data, field->len, output);
+    }
+    else {
+        fwrite_unlocked(field->data, 1, field->len, output);
+    }
+}
 
-    growbuf* fields = NULL;
-    growbuf* field  = NULL;
+/**
+ * Whether printing all of a row's fields, with print_csv_field(), gives back
+ * exactly the bytes it was read from (with a newline on the end): whether
+ * every field that was double-quoted had to be, and was closed. Then those
+ * bytes can be copied out instead.
+ */
+bool csv_row_prints_as_read(const csv_row* row)
+{
+    if (NULL == row->raw || row->open_quote) {
+        return false;
+    }
 
-    size_t rownum = start_row_number;
-    bool in_dquot = false;
-    bool prev_was_dquot = false;
-    uint64_t byte_offset = 0;
-    uint64_t row_byte_offset = 0;
+    for (size_t i = 0; i < row->num_fields; i++) {
+        const csv_field* field = &row->fields[i];
+        if (field->quoted && !needs_quotes(field->data, field->len)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    fields = growbuf_create(1);
-    field = growbuf_create(32);
-    growbuf_append(fields, &field, sizeof(growbuf*));
-    while (true) { // iterate over lines
-        int char_in = fgetc(input);
+/**
+ * Print an integer the way printf("%ld") does.
+ */
+void print_csv_long(long n, FILE* output)
+{
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    unsigned long u = (n < 0) ? -(unsigned long)n : (unsigned long)n;
+
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+
+    if (n < 0) {
+        *--p = '-';
+    }
 
-        if (EOF == char_in) {
-            goto handle_eof;
+    fwrite_unlocked(p, 1, buf + sizeof(buf) - p, output);
+}
+
+__extension__ typedef unsigned __int128 uint128;
+
+/**
+ * Print a floating-point number the way printf("%lf") does: rounded to six
+ * decimal places, with ties going to the even one.
+ *
+ * The number is exactly a 53-bit integer times a power of two, so it times a
+ * million can be worked out exactly in 128 bits, and rounded, whenever the
+ * result fits in 64; printf() is left the rest, and infinities and NaNs.
+ */
+void print_csv_double(double d, FILE* output)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+
+    bool negative = (0 != (bits >> 63));
+    int exponent = (int)((bits >> 52) & 0x7ff);
+    uint64_t mantissa = bits & (((uint64_t)1 << 52) - 1);
+
+    if (0x7ff == exponent) {
+        fprintf(output, "%lf", d);
+        return;
+    }
+
+    if (0 == exponent) {
+        exponent = -1074;   // subnormal
+    }
+    else {
+        mantissa |= (uint64_t)1 << 52;
+        exponent -= 1075;
+    }
+
+    uint128 millionths = (uint128)mantissa * 1000000;
+    if (exponent >= 0) {
+        if (exponent >= 64 || 0 != (millionths >> (64 - exponent))) {
+            fprintf(output, "%lf", d);
+            return;
         }
+        millionths <<= exponent;
+    }
+    else if (-exponent >= 128) {
+        millionths = 0;     // less than half of a millionth
+    }
+    else {
+        unsigned int shift = -exponent;
+        uint128 rest = millionths & ((((uint128)1) << shift) - 1);
+        uint128 half = ((uint128)1) << (shift - 1);
 
-        char c = (char)char_in;
-        switch (c) {
-        case '"':
-            if (in_dquot) {
-                if (prev_was_dquot) {
-                    growbuf_append(field, &c, 1);
-                    prev_was_dquot = false;
-                }
-                else {
-                    prev_was_dquot = true;
-                    // don't append yet, wait for the next char.
-                }
-            }
-            else if (field->size != 0) {
-                growbuf_append(field, &c, 1);
-            }
-            else {
-                in_dquot = true;
-                // don't append.
-           }
-           break;
-
-       case '\n':
-           if (!in_dquot || prev_was_dquot) {
-                // we're done with the line
-                c = '\0';
-                growbuf_append(field, &c, 1);
-
-                DEBUG for (size_t i = 0; i < fields->size / sizeof(void*); i++)
-                {
-                    fprintf(stderr, "field %zu: ", i);
-                    fprintf(stderr, "\"%s\"\n",
-                        (char*)(((growbuf**)fields->buf)[i]->buf)
-                    );
-                }
+        millionths >>= shift;
+        if (rest > half || (rest == half && 0 != (millionths & 1))) {
+            millionths++;
+        }
+        if (0 != (millionths >> 64)) {
+            fprintf(output, "%lf", d);
+            return;
+        }
+    }
+
+    char buf[32];
+    char* p = buf + sizeof(buf);
+    uint64_t u = (uint64_t)millionths;
+
+    for (int i = 0; i < 6; i++) {
+        *--p = '0' + u % 10;
+        u /= 10;
+    }
+    *--p = '.';
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u > 0);
+
+    if (negative) {
+        *--p = '-';
+    }
+
+    fwrite_unlocked(p, 1, buf + sizeof(buf) - p, output);
+}
+
+/**
+ * Size of the blocks read from the input by read_csv().
+ */
+static size_t csv_block_size = CSV_DEFAULT_BLOCK_SIZE;
+
+/**
+ * Set the size of the blocks read from the input by read_csv().
+ *
+ * Arguments:
+ *   block_size	- size in bytes. Zero selects the default.
+ */
+void csv_set_block_size(size_t block_size)
+{
+    csv_block_size = (block_size == 0) ? CSV_DEFAULT_BLOCK_SIZE : block_size;
+}
+
+/**
+ * Cursor over the structural character bitmaps of a block of input.
+ * Windows are classified lazily as the reader advances through the block.
+ */
+typedef struct {
+    const char*   block;
+    size_t        len;
+    size_t        window;   // offset of the classified window
+    csv_structure bits;
+} structural_index;
+
+static void structural_index_init(structural_index* idx, const char* block, size_t len)
+{
+    idx->block = block;
+    idx->len = len;
+    idx->window = SIZE_MAX;
+}
+
+/**
+ * Kinds of structural characters to look for with find_structural().
+ */
+enum {
+    FIND_DQUOT   = 1,
+    FIND_COMMA   = 2,
+    FIND_NEWLINE = 4,
+};
+
+/**
+ * Find the next structural character at or after a position.
+ *
+ * Arguments:
+ *   idx	- structural index of the block
+ *   pos	- position to start from
+ *   what	- FIND_* flags of the characters to look for
+ *
+ * Return Value:
+ *   Position of the character, or the length of the block if none found.
+ */
+static size_t find_structural(structural_index* idx, size_t pos, int what)
+{
+    while (pos < idx->len) {
+        size_t window = pos & ~(size_t)(CSV_SCAN_WIDTH - 1);
+        if (window != idx->window) {
+            csv_scan_classify(idx->block + window, idx->len - window, &idx->bits);
+            idx->window = window;
+        }
+
+        uint64_t mask = 0;
+        if (what & FIND_DQUOT) {
+            mask |= idx->bits.dquot;
+        }
+        if (what & FIND_COMMA) {
+            mask |= idx->bits.comma;
+        }
+        if (what & FIND_NEWLINE) {
+            mask |= idx->bits.newline;
+        }
+        mask &= ~(uint64_t)0 << (pos - window);
+
+        if (0 != mask) {
+            return window + __builtin_ctzll(mask);
+        }
+
+        pos = window + CSV_SCAN_WIDTH;
+    }
+
+    return idx->len;
+}
+
+/**
+ * Location of a field within the row being tokenized.
+ */
+typedef struct {
+    size_t start;       // offset of the field contents from the row start
+    size_t len;
+    bool   quoted;      // field was double-quoted
+    bool   escaped;     // contents have "" pairs that must be unescaped
+    size_t scratch;     // offset of the unescaped contents in the scratch buffer
+} field_span;
+
+/**
+ * State of a CSV reader.
+ *
+ * All of its buffers live as long as the reader and are reused from row to
+ * row and from one read to the next: their sizes are reset, and they only
+ * grow when a row is wider or longer than any seen before. A steady-state
+ * scan does no heap allocation.
+ */
+struct _csv_reader {
+    csv_input input;
+    growbuf*  spans;        // field_span for each field of the current row
+    growbuf*  fields;       // csv_field views handed to the row evaluator
+    growbuf*  scratch;      // unescaped contents of fields with "" in them
+    bool      unterminated; // current row was ended by the end of the input
+    bool      open_quote;   // ...while inside a double-quoted field
+    bool      truncated;    // current row had fields past max_fields
+    bool      quiet;        // don't report format errors
+    size_t    max_fields;   // fields past this many are skipped
+    char*     buf;          // block buffer, for stream input
+    size_t    capacity;     // allocated size of buf
+};
+
+/**
+ * Create a reader.
+ *
+ * Arguments:
+ *   input	- the CSV input: a stream, or a file mapped into memory
+ *
+ * Returns:
+ *   the reader, or NULL if out of memory.
+ */
+csv_reader* csv_reader_create(const csv_input* input)
+{
+    csv_scan_init();
+
+    csv_reader* r = (csv_reader*)malloc(sizeof(csv_reader));
+    if (NULL == r) {
+        return NULL;
+    }
+
+    r->input = *input;
+    r->spans = growbuf_create(16 * sizeof(field_span));
+    r->fields = growbuf_create(16 * sizeof(csv_field));
+    r->scratch = growbuf_create(64);
+    r->unterminated = false;
+    r->open_quote = false;
+    r->truncated = false;
+    r->quiet = false;
+    r->max_fields = SIZE_MAX;
+    r->buf = NULL;
+    r->capacity = 0;
+
+    if (NULL == r->spans || NULL == r->fields || NULL == r->scratch) {
+        csv_reader_free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+void csv_reader_free(csv_reader* r)
+{
+    if (NULL != r) {
+        growbuf_free(r->spans);
+        growbuf_free(r->fields);
+        growbuf_free(r->scratch);
+        free(r->buf);
+        free(r);
+    }
+}
+
+/**
+ * Limit the fields the reader hands to the row evaluator to the first few of
+ * each row. The rest are only scanned for the end of the row.
+ *
+ * At least two fields are always kept: whether a row ended by the end of the
+ * input counts as a row depends on whether it has more than one.
+ *
+ * Arguments:
+ *   reader	- the reader
+ *   max_fields	- number of fields to keep, or SIZE_MAX for all of them
+ */
+void csv_reader_set_max_fields(csv_reader* reader, size_t max_fields)
+{
+    reader->max_fields = (max_fields < 2) ? 2 : max_fields;
+}
+
+/**
+ * Grow the block buffer to at least the given size.
+ *
+ * Returns:
+ *   0 on success, 2 if out of memory.
+ */
+static int reserve_buffer(csv_reader* r, size_t size)
+{
+    if (r->capacity >= size) {
+        return 0;
+    }
+
+    char* newbuf = (char*)realloc(r->buf, size);
+    if (NULL == newbuf) {
+        fprintf(stderr, "malloc failed\n");
+        return 2;
+    }
+
+    r->buf = newbuf;
+    r->capacity = size;
+    return 0;
+}
 
-                if (fields->size / sizeof(void*) > 0
-                        && (fields->size / sizeof(void*) > 1
-                            || ((growbuf**)fields->buf)[0]->size > 0))
-                {
-                    row_evaluator(fields, rownum, row_byte_offset, context);
+/**
+ * Find the extent of one row and of each of its fields.
+ *
+ * Arguments:
+ *   p		- tokenizer state; receives the field spans
+ *   idx	- structural index of the buffer the row is in
+ *   row_start	- offset of the row in the buffer
+ *   at_eof	- whether the buffer extends to the end of the input
+ *   rownum	- row number, for error messages
+ *
+ * Return Value:
+ *   Length of the row, including its newline.
+ *   0 if the buffer ends before the row does (and at_eof is false).
+ *   -1 if the row is malformed.
+ */
+static ssize_t tokenize_row(
+        csv_reader* p,
+        structural_index* idx,
+        size_t row_start,
+        bool at_eof,
+        size_t rownum)
+{
+    const char* data = idx->block;
+    size_t len = idx->len;
+    size_t pos = row_start;
+
+    size_t num_fields = 0;
+
+    p->spans->size = 0;
+    p->unterminated = false;
+    p->open_quote = false;
+    p->truncated = false;
+
+    while (true) { // iterate over fields
+        field_span span = {0};
+        bool skip = (num_fields >= p->max_fields);
+        num_fields++;
+
+        if (pos < len && data[pos] == '"') {
+            //
+            // Double-quoted field: everything up to the closing double-quote
+            // is field data, commas and newlines included. A pair of
+            // double-quotes stands for one.
+            //
+
+            pos++;
+            span.start = pos - row_start;
+            span.quoted = true;
+
+            while (true) {
+                size_t dquot = find_structural(idx, pos, FIND_DQUOT);
+
+                if (dquot + 1 >= len && !at_eof) {
+                    // need to see the char after the double-quote
+                    return 0;
                 }
 
-                for (size_t i = 0; i < fields->size / sizeof(void*); i++) {
-                    growbuf_free(((growbuf**)(fields->buf))[i]);
+                if (dquot >= len) {
+                    // unterminated at the end of the input
+                    span.len = len - (row_start + span.start);
+                    pos = len;
+                    p->open_quote = true;
+                    break;
                 }
-                fields->size = 0;
 
-                if (one_row_only) {
-                    goto cleanup;
+                if (dquot + 1 < len && data[dquot + 1] == '"') {
+                    span.escaped = true;
+                    pos = dquot + 2;
+                    continue;
                 }
 
-                field = growbuf_create(32);
-                growbuf_append(fields, &field, sizeof(void*));
-                in_dquot = false;
-                prev_was_dquot = false;
-                rownum++;
-                row_byte_offset = byte_offset + 1;
+                span.len = dquot - (row_start + span.start);
+                pos = dquot + 1;
+
+                if (pos < len && data[pos] != ',' && data[pos] != '\n') {
+                    if (!p->quiet) fprintf(stderr, "csv format error: double-quoted field has "
+                            "trailing garbage. Line %zu, field %zu\n",
+                            rownum,
+                            num_fields);
+                    return -1;
+                }
                 break;
             }
-            else {
-                // embedded newline
-                growbuf_append(field, &c, 1);
-            }
-            break;
+        }
+        else {
+            //
+            // Unquoted field: everything up to the next comma or newline.
+            // Double-quotes past the first character are literal.
+            //
+
+            size_t delim;
 
-        case ',':
-            if (!in_dquot || prev_was_dquot) {
-                // we're done with the field
-                c = '\0';
-                growbuf_append(field, &c, 1);
+            if (skip) {
+                //
+                // Nobody will look at the rest of the row, so if there is
+                // no double-quote before the newline, there is no quoted
+                // field to honor and the rest of it can be skipped whole.
+                //
 
-                field = growbuf_create(32);
-                growbuf_append(fields, &field, sizeof(void*));
-                in_dquot = false;
-                prev_was_dquot = false;
+                size_t next = find_structural(idx, pos, FIND_DQUOT | FIND_NEWLINE);
+                if (next >= len || data[next] == '\n') {
+                    delim = next;
+                }
+                else {
+                    delim = find_structural(idx, pos, FIND_COMMA | FIND_NEWLINE);
+                }
             }
             else {
-                growbuf_append(field, &c, 1);
+                delim = find_structural(idx, pos, FIND_COMMA | FIND_NEWLINE);
             }
-            break;
 
-        default:
-            if (in_dquot && prev_was_dquot) {
-                fprintf(stderr, "csv format error: double-quoted field has "
-                        "trailing garbage. Line %zu, field %zu\n",
-                        rownum,
-                        fields->size / sizeof(void*));
-                retval = 1;
-                goto cleanup;
+            if (delim >= len && !at_eof) {
+                return 0;
             }
-            else {
-                growbuf_append(field, &c, 1);
+
+            span.start = pos - row_start;
+            span.len = delim - pos;
+            pos = delim;
+        }
+
+        if (!skip) {
+            growbuf_append(p->spans, &span, sizeof(span));
+        }
+        else {
+            p->truncated = true;
+        }
+
+        if (pos >= len) {
+            p->unterminated = true;
+            return len - row_start;
+        }
+
+        pos++;
+        if (data[pos - 1] == '\n') {
+            return pos - row_start;
+        }
+    }
+}
+
+/**
+ * Build the field views of a tokenized row, unescaping the fields that need
+ * it into the scratch buffer.
+ */
+static void build_row(csv_reader* p, const char* row_data, size_t row_len, csv_row* row)
+{
+    field_span* spans = (field_span*)p->spans->buf;
+    size_t num_fields = p->spans->size / sizeof(field_span);
+
+    p->scratch->size = 0;
+    for (size_t i = 0; i < num_fields; i++) {
+        if (!spans[i].escaped) {
+            continue;
+        }
+
+        spans[i].scratch = p->scratch->size;
+
+        const char* in = row_data + spans[i].start;
+        const char* end = in + spans[i].len;
+        while (in < end) {
+            const char* dquot = (const char*)memchr(in, '"', end - in);
+            if (NULL == dquot) {
+                growbuf_append(p->scratch, in, end - in);
+                break;
             }
+
+            // keep the first of the pair
+            growbuf_append(p->scratch, in, dquot + 1 - in);
+            in = dquot + 2;
+        }
+
+        spans[i].len = p->scratch->size - spans[i].scratch;
+    }
+
+    p->fields->size = 0;
+    for (size_t i = 0; i < num_fields; i++) {
+        csv_field field;
+        if (spans[i].escaped) {
+            field.data = (const char*)p->scratch->buf + spans[i].scratch;
+        }
+        else {
+            field.data = row_data + spans[i].start;
+        }
+        field.len = spans[i].len;
+        field.quoted = spans[i].quoted;
+        growbuf_append(p->fields, &field, sizeof(field));
+    }
+
+    row->fields = (const csv_field*)p->fields->buf;
+    row->num_fields = num_fields;
+    row->raw = p->truncated ? NULL : row_data;
+    row->raw_len = row_len;
+    row->open_quote = p->open_quote;
+}
+
+/**
+ * Run the row evaluator on each complete row in a buffer.
+ *
+ * Arguments:
+ *   p		    - tokenizer state
+ *   data	    - buffer, starting at a row boundary
+ *   len	    - length of the buffer
+ *   at_eof	    - whether the buffer extends to the end of the input
+ *   base_offset    - byte offset of the buffer in the input
+ *   rownum	    - number of the first row; advanced past each row read
+ *   end_row	    - stop before the row with this number
+ *   row_limit	    - stop before a row starting at or past this offset
+ *   row_evaluator  - function to run on each row, or NULL to skip them
+ *   context	    - arbitrary data to pass to the row evaluator
+ *   consumed	    - receives the length of the complete rows read
+ *
+ * Return Value:
+ *   0 on success, 1 if the CSV data is malformed.
+ */
+static int read_rows(
+        csv_reader* p,
+        const char* data,
+        size_t len,
+        bool at_eof,
+        uint64_t base_offset,
+        size_t* rownum,
+        size_t end_row,
+        size_t row_limit,
+        row_evaluator row_evaluator,
+        void* context,
+        size_t* consumed)
+{
+    structural_index idx;
+    structural_index_init(&idx, data, len);
+
+    size_t pos = 0;
+    while (pos < len && pos < row_limit && *rownum < end_row) { // iterate over rows
+        ssize_t row_len = tokenize_row(p, &idx, pos, at_eof, *rownum);
+
+        if (row_len < 0) {
+            return 1;
+        }
+        else if (row_len == 0) {
             break;
+        }
 
-        } // switch
+        //
+        // A row ended by the end of the input instead of a newline is only
+        // a row if it has something in it.
+        //
 
-        byte_offset += 1;
+        if (NULL != row_evaluator
+                && (!p->unterminated
+                    || p->spans->size > sizeof(field_span)
+                    || ((field_span*)p->spans->buf)[0].len > 0))
+        {
+            csv_row row;
+            build_row(p, data + pos, row_len, &row);
 
-    } // while (true)
+            DEBUG for (size_t i = 0; i < row.num_fields; i++)
+            {
+                fprintf(stderr, "field %zu: ", i);
+                fprintf(stderr, "\"%.*s\"\n",
+                    (int)row.fields[i].len, row.fields[i].data
+                );
+            }
+
+            row_evaluator(&row, *rownum, base_offset + pos, context);
+        }
 
-handle_eof:
-    if (fields->size / sizeof(void*) > 0
-            && ((fields->size / sizeof(void*) > 1 
-                 || ((growbuf**)fields->buf)[0]->size > 0)))
-    {
-        row_evaluator(fields, rownum, byte_offset, context);
+        pos += row_len;
+        (*rownum)++;
     }
 
-cleanup:
-    if (NULL != fields) {
-        for (size_t i = 0; i < fields->size / sizeof(void*); i++) {
-            growbuf_free(((growbuf**)(fields->buf))[i]);
+    *consumed = pos;
+    return 0;
+}
+
+/**
+ * Read rows from a stream, a block at a time.
+ *
+ * Rows are kept contiguous in the buffer so the fields can be handed out as
+ * views into it: a row that runs off the end of a block is moved to the
+ * start of the buffer before reading the next block, and the buffer grows if
+ * a single row doesn't fit in it.
+ */
+static int read_stream(
+        csv_reader* r,
+        uint64_t base_offset,
+        size_t rownum,
+        size_t end_row,
+        size_t block_size,
+        row_evaluator row_evaluator,
+        void* context)
+{
+    int retval = reserve_buffer(r, block_size);
+    size_t filled = 0;
+    bool at_eof = false;
+
+    while (0 == retval && !at_eof) { // iterate over blocks
+        if (filled == r->capacity) {
+            retval = reserve_buffer(r, r->capacity * 2);
+            if (0 != retval) {
+                break;
+            }
+        }
+
+        size_t want = r->capacity - filled;
+        if (want > block_size) {
+            want = block_size;
+        }
+
+        size_t len = fread(r->buf + filled, 1, want, r->input.stream);
+        if (0 == len) {
+            if (ferror(r->input.stream)) {
+                perror("error reading input");
+                retval = 1;
+                break;
+            }
+            at_eof = true;
+        }
+        filled += len;
+
+        size_t consumed = 0;
+        retval = read_rows(r, r->buf, filled, at_eof, base_offset, &rownum,
+                end_row, SIZE_MAX, row_evaluator, context, &consumed);
+        if (0 != retval || rownum >= end_row) {
+            break;
         }
-        growbuf_free(fields);
+
+        memmove(r->buf, r->buf + consumed, filled - consumed);
+        filled -= consumed;
+        base_offset += consumed;
     }
 
     return retval;
 }
 
+static int read_csv_internal(
+        csv_reader* r,
+        uint64_t byte_offset,
+        size_t rownum,
+        size_t end_row,
+        size_t block_size,
+        row_evaluator row_evaluator,
+        void* context)
+{
+    if (NULL != r->input.data) {
+        size_t consumed;
+        return read_rows(r, r->input.data + byte_offset,
+                r->input.size - byte_offset, true, byte_offset, &rownum,
+                end_row, SIZE_MAX, row_evaluator, context, &consumed);
+    }
+    else {
+        return read_stream(r, byte_offset, rownum, end_row, block_size,
+                row_evaluator, context);
+    }
+}
+
 /**
  * Read a CSV file, running a function on each row.
  *
  * Arguments:
- *   input	   - file pointer to CSV file to read
- *   row_evaluator - pointer to a function which takes 3 arguments:
- *                     - 2-dimensional growbuf with the fields
+ *   reader	   - reader of the CSV input
+ *   row_evaluator - pointer to a function which takes 4 arguments:
+ *                     - the row, as views of its fields
  *                     - the row number
+ *                     - the byte offset of the start of the row
  *                     - the context parameter passed to this function
  *                   and returns void.
  *   context       - arbitrary data to pass to the row evaluator
  */
-int read_csv(FILE* input, row_evaluator row_evaluator, void* context)
+int read_csv(csv_reader* reader, row_evaluator row_evaluator, void* context)
+{
+    return read_csv_internal(reader, 0, 0, SIZE_MAX, csv_block_size,
+            row_evaluator, context);
+}
+
+/**
+ * Read the rows of a CSV input from a given byte offset, up to a given row.
+ *
+ * A stream is seeked to the offset first, unless it is 0: then the stream
+ * must not have been read from yet, and needn't be seekable.
+ *
+ * Arguments:
+ *   reader	   - reader of the CSV input
+ *   byte_offset   - byte offset of the first row to read
+ *   rownum	   - number of the first row to read
+ *   end_row	   - number of the row to stop before, or SIZE_MAX
+ *   row_evaluator - function to run on each row
+ *   context	   - arbitrary data to pass to the row evaluator
+ *
+ * Return Value:
+ *   0 on success, 1 on error.
+ */
+int read_csv_rows(
+        csv_reader* reader,
+        uint64_t byte_offset,
+        size_t rownum,
+        size_t end_row,
+        row_evaluator row_evaluator,
+        void* context)
 {
-    return read_csv_internal(input, row_evaluator, context, false, 0);
+    if (NULL == reader->input.data && 0 != byte_offset
+            && -1 == fseek(reader->input.stream, byte_offset, SEEK_SET)) {
+        perror("error seeking input file");
+        return 1;
+    }
+
+    if (NULL != reader->input.data && byte_offset > reader->input.size) {
+        return 0;
+    }
+
+    return read_csv_internal(reader, byte_offset, rownum, end_row,
+            csv_block_size, row_evaluator, context);
 }
 
-int read_csv_row(FILE* input, int row_number, row_evaluator row_evaluator, void* context)
+/**
+ * Whether the last row read was ended by the end of the input instead of a
+ * newline: when a file is appended to, such a row may carry on.
+ */
+bool csv_reader_unterminated(const csv_reader* reader)
 {
-    return read_csv_internal(input, row_evaluator, context, true, row_number);
+    return reader->unterminated;
+}
+
+/**
+ * Guess where the first row starting at or after an offset of a mapped input
+ * is: just past the next newline. This is wrong if the newline is inside a
+ * double-quoted field, so rows read from the guess must be checked against
+ * the end of the rows before them; see read_csv_range().
+ */
+uint64_t csv_find_row_start(const csv_input* input, uint64_t offset)
+{
+    if (0 == offset || offset >= input->size) {
+        return (offset >= input->size) ? input->size : 0;
+    }
+
+    const char* newline = (const char*)memchr(input->data + offset - 1, '\n',
+            input->size - offset + 1);
+
+    return (NULL == newline) ? input->size : (uint64_t)(newline - input->data) + 1;
+}
+
+/**
+ * Read the rows of a mapped input that start within a byte range.
+ *
+ * This is how a mapped input is split between threads. The starting offset
+ * may be a guess from csv_find_row_start(); it was right if it equals the end
+ * of the range before it, when that was read from a right starting offset.
+ *
+ * A wrong guess can make the rest of the input look like one double-quoted
+ * field, so a speculative read gives up on a row that runs as far past the
+ * limit as the range is long, and stops before it. It is up to the caller to
+ * read on from there.
+ *
+ * Arguments:
+ *   reader	   - reader of a mapped input
+ *   start	   - byte offset of the first row
+ *   limit	   - rows starting at or past this offset are not read
+ *   rownum	   - number of the first row
+ *   speculative   - start is a guess: don't report format errors, and give
+ *		     up on long rows
+ *   row_evaluator - function to run on each row, or NULL to just count them
+ *   context	   - arbitrary data to pass to the row evaluator
+ *   end	   - receives the offset of the first row not read
+ *   num_rows	   - receives the number of rows read
+ *
+ * Return Value:
+ *   0 on success, 1 if the CSV data is malformed.
+ */
+int read_csv_range(
+        csv_reader* reader,
+        uint64_t start,
+        uint64_t limit,
+        size_t rownum,
+        bool speculative,
+        row_evaluator row_evaluator,
+        void* context,
+        uint64_t* end,
+        size_t* num_rows)
+{
+    size_t first_row = rownum;
+    size_t consumed = 0;
+    int retval = 0;
+
+    if (start < limit) {
+        size_t len = reader->input.size - start;
+        bool at_eof = true;
+
+        if (speculative && (limit - start) * 2 < len) {
+            len = (limit - start) * 2;
+            at_eof = false;
+        }
+
+        reader->quiet = speculative;
+        retval = read_rows(reader, reader->input.data + start, len, at_eof,
+                start, &rownum, SIZE_MAX, limit - start, row_evaluator, context,
+                &consumed);
+        reader->quiet = false;
+    }
+
+    *end = start + consumed;
+    *num_rows = rownum - first_row;
+    return retval;
 }
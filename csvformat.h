@@ -3,11 +3,62 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 
-typedef void (*row_evaluator)(growbuf* fields, size_t rownum, uint64_t byte_offset,  void* context);
+/**
+ * Default size of the blocks read from the input by read_csv(): 1 MiB.
+ */
+#define CSV_DEFAULT_BLOCK_SIZE (1024 * 1024)
 
-void print_csv_field(const char* field, FILE* output);
-int read_csv(FILE* input, row_evaluator row_evaluator, void* context);
-int read_csv_row(FILE* input, int row_number, row_evaluator row_evaluator, void* context);
+/**
+ * View of the contents of a field. The data is not NUL-terminated.
+ */
+typedef struct {
+    const char* data;
+    size_t      len;
+    bool        quoted;     // was double-quoted in the input
+} csv_field;
+
+/**
+ * A row, as views of its fields, and of the bytes it was read from. The views
+ * are only valid until the row evaluator returns.
+ */
+typedef struct {
+    const csv_field* fields;
+    size_t           num_fields;
+    const char*      raw;   // the row as it is in the input, with its newline
+                            // if it has one; NULL if fields were skipped
+    size_t           raw_len;
+    bool             open_quote; // the last field's double-quote was never
+                                 // closed before the end of the input
+} csv_row;
+
+/**
+ * Input to the CSV reader: a stream, or a file mapped into memory.
+ */
+typedef struct {
+    FILE*       stream;
+    const char* data;   // contents of the mapped file, or NULL
+    size_t      size;
+} csv_input;
+
+typedef struct _csv_reader csv_reader;
+
+typedef void (*row_evaluator)(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context);
+
+void print_csv_field(const char* field, size_t len, FILE* output);
+void print_csv_column(const csv_field* field, FILE* output);
+bool csv_row_prints_as_read(const csv_row* row);
+void print_csv_long(long n, FILE* output);
+void print_csv_double(double d, FILE* output);
+void csv_set_block_size(size_t block_size);
+csv_reader* csv_reader_create(const csv_input* input);
+void csv_reader_free(csv_reader* reader);
+void csv_reader_set_max_fields(csv_reader* reader, size_t max_fields);
+int read_csv(csv_reader* reader, row_evaluator row_evaluator, void* context);
+int read_csv_rows(csv_reader* reader, uint64_t byte_offset, size_t rownum, size_t end_row, row_evaluator row_evaluator, void* context);
+bool csv_reader_unterminated(const csv_reader* reader);
+uint64_t csv_find_row_start(const csv_input* input, uint64_t offset);
+int read_csv_range(csv_reader* reader, uint64_t start, uint64_t limit, size_t rownum, bool speculative, row_evaluator row_evaluator, void* context, uint64_t* end, size_t* num_rows);
 
 #endif // CSVFORMAT_H
@@ -0,0 +1,298 @@
+/*
+ * CSV Selector
+ *
+ * Sidecar index of the row offsets of a CSV file.
+ *
+ * The index of "file.csv" is kept in "file.csv.csvidx". It holds the byte
+ * offset of every Nth row, so a query that only wants rows from some row
+ * number on can start reading right before it, instead of tokenizing every
+ * row in front of it.
+ *
+ * An index is only used if the file hasn't changed since it was written: its
+ * size and modification time must be the same, and so must a checksum of the
+ * last few KiB of the indexed rows. A file that has only been appended to
+ * keeps the checksum, and the index is still good for the rows it covers;
+ * csvsel --index then only has to index the rows after them.
+ *
+ * The index is written in the byte order of the machine that wrote it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "growbuf.h"
+#include "csvformat.h"
+#include "csvindex.h"
+
+#define DEBUG if (false)
+//#define DEBUG
+
+#define INDEX_SUFFIX ".csvidx"
+#define INDEX_MAGIC "CSVIDX1"
+
+/**
+ * How much of the end of the indexed rows the checksum covers.
+ */
+#define TAIL_CHECK_SIZE 4096
+
+/**
+ * Header of the index file. It is followed by num_entries uint64_t offsets.
+ */
+typedef struct {
+    char     magic[8];
+    uint64_t stride;
+    uint64_t file_size;
+    int64_t  mtime_sec;
+    int64_t  mtime_nsec;
+    uint64_t indexed_end;
+    uint64_t num_rows;
+    uint64_t tail_crc;
+    uint64_t num_entries;
+} index_header;
+
+csv_index* csv_index_create(uint64_t stride)
+{
+    csv_index* index = (csv_index*)calloc(1, sizeof(csv_index));
+    if (NULL == index) {
+        return NULL;
+    }
+
+    index->stride = stride;
+    index->offsets = growbuf_create(0);
+    if (NULL == index->offsets) {
+        free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+void csv_index_free(csv_index* index)
+{
+    if (NULL != index) {
+        growbuf_free(index->offsets);
+        free(index);
+    }
+}
+
+/**
+ * Checksum of the bytes of a mapped input just before an offset.
+ */
+static uint64_t tail_crc(const csv_input* input, uint64_t end)
+{
+    uint64_t start = (end > TAIL_CHECK_SIZE) ? end - TAIL_CHECK_SIZE : 0;
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    return crc32(crc, (const Bytef*)input->data + start, (uInt)(end - start));
+}
+
+/**
+ * Load the index of a CSV file, if it has one that is good for it.
+ *
+ * Arguments:
+ *   csv_path	- path of the CSV file
+ *   input	- the CSV file, mapped into memory
+ *   up_to_date	- receives whether the index covers the whole file, rather
+ *		  than only the rows it had before it was appended to
+ *
+ * Return Value:
+ *   the index, or NULL if there is none, or it is out of date.
+ */
+csv_index* csv_index_load(const char* csv_path, const csv_input* input, bool* up_to_date)
+{
+    csv_index* index = NULL;
+    char* path = NULL;
+    FILE* file = NULL;
+    struct stat st;
+    index_header h;
+
+    *up_to_date = false;
+
+    if (NULL == input->data || 0 != stat(csv_path, &st)) {
+        goto cleanup;
+    }
+
+    if (-1 == asprintf(&path, "%s" INDEX_SUFFIX, csv_path)) {
+        path = NULL;
+        goto cleanup;
+    }
+
+    file = fopen(path, "rb");
+    if (NULL == file) {
+        goto cleanup;
+    }
+
+    if (1 != fread(&h, sizeof(h), 1, file)
+            || 0 != memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic))
+            || 0 == h.stride
+            || h.indexed_end > h.file_size
+            || h.num_rows > h.indexed_end
+            || h.num_entries != (h.num_rows + h.stride - 1) / h.stride) {
+        DEBUG fprintf(stderr, "%s is not a valid index\n", path);
+        goto cleanup;
+    }
+
+    bool same_file = (h.file_size == input->size
+            && h.mtime_sec == (int64_t)st.st_mtim.tv_sec
+            && h.mtime_nsec == (int64_t)st.st_mtim.tv_nsec);
+
+    if ((!same_file && h.file_size >= input->size)
+            || h.tail_crc != tail_crc(input, h.indexed_end)) {
+        DEBUG fprintf(stderr, "%s is out of date\n", path);
+        goto cleanup;
+    }
+
+    index = csv_index_create(h.stride);
+    if (NULL == index) {
+        goto cleanup;
+    }
+
+    size_t len = h.num_entries * sizeof(uint64_t);
+    growbuf_free(index->offsets);
+    index->offsets = growbuf_create(len);
+    if (NULL == index->offsets
+            || (len > 0 && 1 != fread(index->offsets->buf, len, 1, file))) {
+        csv_index_free(index);
+        index = NULL;
+        goto cleanup;
+    }
+    index->offsets->size = len;
+
+    index->file_size = h.file_size;
+    index->mtime_sec = h.mtime_sec;
+    index->mtime_nsec = h.mtime_nsec;
+    index->indexed_end = h.indexed_end;
+    index->num_rows = h.num_rows;
+
+    *up_to_date = same_file;
+
+cleanup:
+    if (NULL != file) {
+        fclose(file);
+    }
+    free(path);
+
+    return index;
+}
+
+/**
+ * Write out the index of a CSV file. It is written to a temporary file
+ * first, so a reader never sees half of it.
+ *
+ * Arguments:
+ *   index	- the index; its file size and modification time are set here
+ *   csv_path	- path of the CSV file
+ *   st		- status of the CSV file, from before it was read
+ *   input	- the CSV file, mapped into memory
+ *
+ * Return Value:
+ *   0 on success, 1 on error.
+ */
+int csv_index_save(csv_index* index, const char* csv_path, const struct stat* st, const csv_input* input)
+{
+    int retval = 1;
+    char* path = NULL;
+    char* temp_path = NULL;
+    FILE* file = NULL;
+
+    index->file_size = input->size;
+    index->mtime_sec = st->st_mtim.tv_sec;
+    index->mtime_nsec = st->st_mtim.tv_nsec;
+
+    index_header h = {0};
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.stride = index->stride;
+    h.file_size = index->file_size;
+    h.mtime_sec = index->mtime_sec;
+    h.mtime_nsec = index->mtime_nsec;
+    h.indexed_end = index->indexed_end;
+    h.num_rows = index->num_rows;
+    h.tail_crc = tail_crc(input, index->indexed_end);
+    h.num_entries = index->offsets->size / sizeof(uint64_t);
+
+    if (-1 == asprintf(&path, "%s" INDEX_SUFFIX, csv_path)) {
+        path = NULL;
+        fprintf(stderr, "malloc failed\n");
+        goto cleanup;
+    }
+
+    if (-1 == asprintf(&temp_path, "%s.XXXXXX", path)) {
+        temp_path = NULL;
+        fprintf(stderr, "malloc failed\n");
+        goto cleanup;
+    }
+
+    int fd = mkstemp(temp_path);
+    if (-1 == fd) {
+        perror("error creating index file");
+        goto cleanup;
+    }
+
+    // mkstemp() makes it private; make it like any other new file
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+
+    file = fdopen(fd, "wb");
+    if (NULL == file) {
+        perror("error creating index file");
+        close(fd);
+        unlink(temp_path);
+        goto cleanup;
+    }
+
+    if (1 != fwrite(&h, sizeof(h), 1, file)
+            || index->offsets->size != fwrite(index->offsets->buf, 1,
+                index->offsets->size, file)
+            || 0 != fflush(file)) {
+        perror("error writing index file");
+        unlink(temp_path);
+        goto cleanup;
+    }
+
+    if (0 != rename(temp_path, path)) {
+        perror("error renaming index file");
+        unlink(temp_path);
+        goto cleanup;
+    }
+
+    retval = 0;
+
+cleanup:
+    if (NULL != file) {
+        fclose(file);
+    }
+    free(temp_path);
+    free(path);
+
+    return retval;
+}
+
+/**
+ * Find where to start reading to get to a row.
+ *
+ * Arguments:
+ *   index	 - the index
+ *   row	 - number of the wanted row
+ *   byte_offset - receives the offset of the nearest indexed row at or
+ *		   before it
+ *   rownum	 - receives the number of that row
+ */
+void csv_index_lookup(const csv_index* index, size_t row, uint64_t* byte_offset, size_t* rownum)
+{
+    if (row >= index->num_rows) {
+        *byte_offset = index->indexed_end;
+        *rownum = index->num_rows;
+        return;
+    }
+
+    size_t entry = row / index->stride;
+    *byte_offset = ((const uint64_t*)index->offsets->buf)[entry];
+    *rownum = entry * index->stride;
+}
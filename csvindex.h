@@ -0,0 +1,38 @@
+/*
+ * CSV Selector
+ *
+ * Sidecar index of the row offsets of a CSV file.
+ */
+
+#ifndef CSVINDEX_H
+#define CSVINDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "growbuf.h"
+#include "csvformat.h"
+
+/**
+ * Rows between index entries, for a new index.
+ */
+#define CSV_INDEX_STRIDE 1024
+
+typedef struct {
+    uint64_t stride;        // rows between entries
+    uint64_t file_size;     // size of the file when it was indexed
+    int64_t  mtime_sec;     // modification time of the file then
+    int64_t  mtime_nsec;
+    uint64_t indexed_end;   // offset of the first row not indexed
+    uint64_t num_rows;      // rows before indexed_end
+    growbuf* offsets;       // uint64_t offset of every stride'th row
+} csv_index;
+
+csv_index* csv_index_create(uint64_t stride);
+void csv_index_free(csv_index* index);
+csv_index* csv_index_load(const char* csv_path, const csv_input* input, bool* up_to_date);
+int csv_index_save(csv_index* index, const char* csv_path, const struct stat* st, const csv_input* input);
+void csv_index_lookup(const csv_index* index, size_t row, uint64_t* byte_offset, size_t* rownum);
+
+#endif //CSVINDEX_H
@@ -0,0 +1,202 @@
+/*
+ * CSV Selector
+ *
+ * Structural character indexing for the CSV reader.
+ *
+ * The reader only needs to stop at double-quotes, commas and newlines;
+ * everything in between is copied as a run. This classifies a window of
+ * input at a time into bitmaps of those characters, using SIMD compares
+ * where the CPU has them.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#include "csvscan.h"
+
+typedef void (*window_classifier)(const char* data, csv_structure* out);
+
+static void classify_scalar(const char* data, csv_structure* out)
+{
+    uint64_t dquot = 0, comma = 0, newline = 0;
+
+    for (size_t i = 0; i < CSV_SCAN_WIDTH; i++) {
+        switch (data[i]) {
+        case '"':
+            dquot |= (uint64_t)1 << i;
+            break;
+        case ',':
+            comma |= (uint64_t)1 << i;
+            break;
+        case '\n':
+            newline |= (uint64_t)1 << i;
+            break;
+        }
+    }
+
+    out->dquot = dquot;
+    out->comma = comma;
+    out->newline = newline;
+}
+
+#ifdef HAVE_X86_SIMD
+
+static void classify_sse2(const char* data, csv_structure* out)
+{
+    const __m128i dquot = _mm_set1_epi8('"');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    out->dquot = out->comma = out->newline = 0;
+
+    for (size_t i = 0; i < CSV_SCAN_WIDTH; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+
+        out->dquot |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(chunk, dquot)) << i;
+        out->comma |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(chunk, comma)) << i;
+        out->newline |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(chunk, newline)) << i;
+    }
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char* data, csv_structure* out)
+{
+    const __m256i dquot = _mm256_set1_epi8('"');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+
+    __m256i lo = _mm256_loadu_si256((const __m256i*)data);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(data + 32));
+
+#define MASK64(c) \
+    ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, c)) \
+     | ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, c)) << 32))
+
+    out->dquot = MASK64(dquot);
+    out->comma = MASK64(comma);
+    out->newline = MASK64(newline);
+
+#undef MASK64
+}
+
+#endif // HAVE_X86_SIMD
+
+static window_classifier classify_window = &classify_scalar;
+static csv_scan_impl active_impl = CSV_SCAN_AUTO;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Select the classifier implementation.
+ *
+ * Returns:
+ *   0 on success, -1 if the CPU doesn't support the requested one.
+ */
+int csv_scan_set_impl(csv_scan_impl impl)
+{
+    switch (impl) {
+    case CSV_SCAN_AUTO:
+#ifdef HAVE_X86_SIMD
+        if (__builtin_cpu_supports("avx2")) {
+            return csv_scan_set_impl(CSV_SCAN_AVX2);
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return csv_scan_set_impl(CSV_SCAN_SSE2);
+        }
+#endif
+        return csv_scan_set_impl(CSV_SCAN_SCALAR);
+
+    case CSV_SCAN_SCALAR:
+        classify_window = &classify_scalar;
+        break;
+
+#ifdef HAVE_X86_SIMD
+    case CSV_SCAN_SSE2:
+        if (!__builtin_cpu_supports("sse2")) {
+            return -1;
+        }
+        classify_window = &classify_sse2;
+        break;
+
+    case CSV_SCAN_AVX2:
+        if (!__builtin_cpu_supports("avx2")) {
+            return -1;
+        }
+        classify_window = &classify_avx2;
+        break;
+#endif
+
+    default:
+        return -1;
+    }
+
+    active_impl = impl;
+    return 0;
+}
+
+static void init_impl(void)
+{
+    if (active_impl == CSV_SCAN_AUTO) {
+        csv_scan_set_impl(CSV_SCAN_AUTO);
+    }
+}
+
+/**
+ * Pick the best implementation the CPU supports, unless one has been
+ * selected already. Only the first call does anything, so readers on several
+ * threads can all call it.
+ */
+void csv_scan_init(void)
+{
+    pthread_once(&init_once, &init_impl);
+}
+
+csv_scan_impl csv_scan_get_impl(void)
+{
+    csv_scan_init();
+    return active_impl;
+}
+
+const char* csv_scan_impl_name(csv_scan_impl impl)
+{
+    switch (impl) {
+    case CSV_SCAN_AUTO:
+        return "auto";
+    case CSV_SCAN_SCALAR:
+        return "scalar";
+    case CSV_SCAN_SSE2:
+        return "sse2";
+    case CSV_SCAN_AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+/**
+ * Classify up to CSV_SCAN_WIDTH bytes of input.
+ *
+ * Arguments:
+ *   data	- start of the window
+ *   len	- number of valid bytes; bits past this are left clear
+ *   out	- bitmaps of the structural characters in the window
+ */
+void csv_scan_classify(const char* data, size_t len, csv_structure* out)
+{
+    if (len >= CSV_SCAN_WIDTH) {
+        classify_window(data, out);
+    }
+    else {
+        char padded[CSV_SCAN_WIDTH] = {0};
+        memcpy(padded, data, len);
+        classify_window(padded, out);
+    }
+}
@@ -0,0 +1,42 @@
+/*
+ * CSV Selector
+ *
+ * Structural character indexing for the CSV reader.
+ */
+
+#ifndef CSVSCAN_H
+#define CSVSCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Number of bytes classified at a time.
+ */
+#define CSV_SCAN_WIDTH 64
+
+/**
+ * Bitmaps of the structural characters in a CSV_SCAN_WIDTH-byte window.
+ * Bit i is set if byte i of the window is that character.
+ */
+typedef struct {
+    uint64_t dquot;
+    uint64_t comma;
+    uint64_t newline;
+} csv_structure;
+
+typedef enum {
+    CSV_SCAN_AUTO,      // pick the best one the CPU supports
+    CSV_SCAN_SCALAR,
+    CSV_SCAN_SSE2,
+    CSV_SCAN_AVX2,
+} csv_scan_impl;
+
+void csv_scan_init(void);
+int  csv_scan_set_impl(csv_scan_impl impl);
+csv_scan_impl csv_scan_get_impl(void);
+const char* csv_scan_impl_name(csv_scan_impl impl);
+
+void csv_scan_classify(const char* data, size_t len, csv_structure* out);
+
+#endif //CSVSCAN_H
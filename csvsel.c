@@ -12,16 +12,25 @@
 #include <sysexits.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "growbuf.h"
 #include "csvformat.h"
 #include "queryeval.h"
+#include "queryvm.h"
 #include "util.h"
+#include "csvindex.h"
+#include "extsort.h"
+#include "arrowipc.h"
+#include "functions.h"
 #include "csvsel.h"
 
 #define DEBUG if (false)
 //#define DEBUG
 
+extern functionspec FUNCTIONS[];
+
 int query_debug = 0;
 
 typedef void (*field_evaluator)(
@@ -31,29 +40,49 @@ typedef void (*field_evaluator)(
         size_t total_fields,
         void* context);
 
+static void print_separator(size_t field_num, size_t total_fields, FILE* output)
+{
+    if (field_num + 1 != total_fields) {
+        putc_unlocked(',', output);
+    } else {
+        putc_unlocked('\n', output);
+    }
+}
+
 static void print_field(val v, uint64_t byte_offset, size_t field_num, size_t total_fields, void* context)
 {
     FILE* output = (FILE*)context;
     if (v.is_num) {
-        fprintf(output, "%ld", v.num);
+        print_csv_long(v.num, output);
     } else if (v.is_dbl) {
-        fprintf(output, "%lf", v.dbl);
+        print_csv_double(v.dbl, output);
     } else if (v.is_str) {
-        print_csv_field(v.str, output);
+        print_csv_field(v.str, v.len, output);
     } else {
         fprintf(stderr, "Error: invalid value type!");
     }
 
-    if (field_num + 1 != total_fields) {
-        fprintf(output, ",");
+    print_separator(field_num, total_fields, output);
+}
+
+static void encode_field(val v, uint64_t byte_offset, size_t field_num, size_t total_fields, void* context)
+{
+    FILE* output = (FILE*)context;
+    if (v.is_num) {
+        arrow_encode_long(v.num, output);
+    } else if (v.is_dbl) {
+        arrow_encode_double(v.dbl, output);
+    } else if (v.is_str) {
+        arrow_encode_string(v.str, v.len, output);
     } else {
-        fprintf(output, "\n");
+        fprintf(stderr, "Error: invalid value type!");
     }
 }
 
 static void evaluate_selector(
         selector* c,
-        growbuf* fields,
+        query_vm* vm,
+        const csv_row* row,
         size_t rownum,
         size_t byte_offset,
         size_t selector_num,
@@ -64,16 +93,17 @@ static void evaluate_selector(
     switch (c->type) {
     case SELECTOR_COLUMN:
         if (c->column == SIZE_MAX) {
-            size_t num_fields = fields->size / sizeof(void*);
+            size_t num_fields = row->num_fields;
             for (size_t j = 0; j < num_fields; j++) {
-                growbuf* field = ((growbuf**)(fields->buf))[j];
+                const csv_field* field = &row->fields[j];
                 val v = {0};
-                v.str = (char*)field->buf;
+                v.str = (char*)field->data;
+                v.len = field->len;
                 v.is_str = true;
-                eval(v, byte_offset, selector_num + j, num_selectors + num_fields, context);
+                eval(v, byte_offset, selector_num + j, num_selectors - 1 + num_fields, context);
             }
         }
-        else if (c->column >= (fields->size / sizeof(void*))) {
+        else if (c->column >= row->num_fields) {
             //
             // An out-of-bounds column is defined as empty string.
             //
@@ -84,9 +114,10 @@ static void evaluate_selector(
             eval(v, byte_offset, selector_num, num_selectors, context);
         }
         else {
-            growbuf* field = ((growbuf**)(fields->buf))[c->column];
+            const csv_field* field = &row->fields[c->column];
             val v = {0};
-            v.str = (char*)field->buf;
+            v.str = (char*)field->data;
+            v.len = field->len;
             v.is_str = true;
             eval(v, byte_offset, selector_num, num_selectors, context);
         }
@@ -94,120 +125,783 @@ static void evaluate_selector(
 
     case SELECTOR_VALUE:
         {
-            val v = value_evaluate(&(c->value), fields, rownum);
+            val v = query_vm_selector(vm, selector_num, row, rownum);
             eval(v, byte_offset, selector_num, num_selectors, context);
-            val_free(&v);
         }
         break;
     }
 }
 
-static void eval_and_print(growbuf* fields, size_t rownum, uint64_t byte_offset, void* context)
+static void print_selected(
+        const csv_row* row,
+        size_t rownum,
+        uint64_t byte_offset,
+        query_vm* vm,
+        growbuf* selectors,
+        FILE* output,
+        output_format format)
 {
-    row_evaluator_args* args = (row_evaluator_args*)context;
-    FILE* output = args->output;
-    compound* root_condition = args->root_condition;
-    growbuf* selectors = args->selectors;
     size_t num_selectors = selectors->size / sizeof(void*);
+    selector** sels = (selector**)selectors->buf;
 
-    if (query_evaluate(fields, rownum, root_condition)) {
+    if (OUTPUT_ARROW == format) {
         for (size_t sel_num = 0; sel_num < num_selectors; sel_num++) {
-            selector* c = ((selector**)(selectors->buf))[sel_num];
-            evaluate_selector(c, fields, rownum, byte_offset, sel_num, num_selectors,
+            evaluate_selector(sels[sel_num], vm, row, rownum, byte_offset, sel_num,
+                    num_selectors, &encode_field, output);
+        }
+        return;
+    }
+
+    //
+    // A whole row that would print the same as it was read is copied out as
+    // it is, instead of field by field.
+    //
+
+    if (1 == num_selectors && SELECTOR_COLUMN == sels[0]->type
+            && SIZE_MAX == sels[0]->column && csv_row_prints_as_read(row)) {
+        fwrite_unlocked(row->raw, 1, row->raw_len, output);
+        if (0 == row->raw_len || '\n' != row->raw[row->raw_len - 1]) {
+            putc_unlocked('\n', output);
+        }
+        return;
+    }
+
+    for (size_t sel_num = 0; sel_num < num_selectors; sel_num++) {
+        selector* c = sels[sel_num];
+        if (SELECTOR_COLUMN == c->type && c->column < row->num_fields) {
+            print_csv_column(&row->fields[c->column], output);
+            print_separator(sel_num, num_selectors, output);
+        }
+        else {
+            evaluate_selector(c, vm, row, rownum, byte_offset, sel_num, num_selectors,
                     &print_field, output);
         }
     }
 }
 
-typedef struct {
-    int row_number;
-    uint64_t byte_offset;
-    val value;
-} row_sort_data;
+static void eval_and_print(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context)
+{
+    row_evaluator_args* args = (row_evaluator_args*)context;
+
+    if (query_vm_matches(args->vm, row, rownum)) {
+        print_selected(row, rownum, byte_offset, args->vm, args->selectors, args->output,
+                args->format);
+    }
+}
+
+/**
+ * Whether an ORDER BY puts the rows in the order they're read in anyway: if
+ * it's by row number first.
+ */
+static bool order_is_input_order(const order* order)
+{
+    const order_key* first = (const order_key*)order->keys->buf;
+
+    return order->keys->size > 0
+        && ORDER_ASCENDING == first->direction
+        && first->value.is_special
+        && SPECIAL_ROWNUM == first->value.special
+        && TYPE_STRING != first->value.conversion_type;
+}
 
 typedef struct {
-    compound* root_condition;
-    selector* order_selector;
-    growbuf* sort_data;
+    query_vm* vm;
+    order*    order;
+    growbuf*  selectors;
+    sorter*   sorter;
+    growbuf*  key;          // room to build each row's sort key in
+    output_format format;
 } sort_args;
 
+static void populate_sort_data(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context)
+{
+    sort_args* args = (sort_args*)context;
+
+    if (query_vm_matches(args->vm, row, rownum)) {
+        //
+        // Print the row's output now, while the row is at hand, so it
+        // doesn't have to be found and parsed again once the rows are
+        // sorted.
+        //
+
+        order_key* keys = (order_key*)args->order->keys->buf;
+        args->key->size = 0;
+        for (size_t i = 0; i < args->order->keys->size / sizeof(order_key); i++) {
+            val value = query_vm_order_key(args->vm, i, row, rownum);
+            sort_key_append(args->key, &value, keys[i].direction == ORDER_DESCENDING);
+        }
+
+        if (!sorter_wants(args->sorter, args->key)) {
+            // it wouldn't make the limit
+            return;
+        }
+
+        FILE* output = sorter_begin_row(args->sorter);
+        print_selected(row, rownum, byte_offset, args->vm, args->selectors, output,
+                args->format);
+        sorter_end_row(args->sorter, args->key);
+    }
+}
+
 typedef struct {
-    growbuf* sort_data;
-    int row_number;
-} row_sort_args;
+    growbuf* offsets;
+    size_t stride;
+} index_args;
 
-static void populate_sort_data_field(
-        val value,
-        uint64_t byte_offset,
-        size_t field_num,
-        size_t total_fields,
-        void* context)
+static void record_row_offset(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context)
 {
-    row_sort_args* args = (row_sort_args*)context;
-    row_sort_data d = {
-        args->row_number,
-        byte_offset,
-        value,
-    };
-    if (value.is_str) {
-        d.value.str = strdup(value.str);
-    }
-    growbuf_append(args->sort_data, &d, sizeof(d));
+    index_args* args = (index_args*)context;
+
+    if (0 == rownum % args->stride) {
+        growbuf_append(args->offsets, &byte_offset, sizeof(byte_offset));
+    }
 }
 
-static void populate_sort_data(growbuf* fields, size_t rownum, uint64_t byte_offset, void* context)
+/**
+ * Bounds on the size of the pieces a mapped input is split into for -j.
+ */
+#define MIN_CHUNK_SIZE (1024*1024)
+#define MAX_CHUNK_SIZE (64*1024*1024)
+
+/**
+ * Default for how much memory the rows of an ORDER BY query may take before
+ * they are spilled to temporary files: 256 MiB.
+ */
+#define DEFAULT_MEMORY_LIMIT (256 * 1024 * 1024)
+
+typedef enum {
+    SCAN_COUNT,     // count the rows, so row numbers are known for %#
+    SCAN_PRINT,     // evaluate and print the rows
+    SCAN_SORT,      // evaluate the rows and gather their sort data
+    SCAN_INDEX,     // gather the offsets of rows for the index
+} scan_mode;
+
+typedef struct {
+    uint64_t start;       // guessed offset of the first row
+    uint64_t limit;       // guessed offset of the next chunk's first row
+    uint64_t end;         // offset of the first row not read
+    size_t   first_row;   // number of the first row, when counted
+    size_t   num_rows;
+    int      status;
+    bool     done;
+    char*    output;      // formatted rows, for SCAN_PRINT
+    size_t   output_len;
+    sorter*  sorter;      // rows, for SCAN_SORT
+    growbuf* offsets;     // row offsets, for SCAN_INDEX
+    query_vm* vm;         // what was learned about the condition, for --debug
+} scan_chunk;
+
+/**
+ * Where the rows read by a scan go.
+ */
+typedef struct {
+    FILE*    output;      // where to print rows, for SCAN_PRINT
+    sorter*  sorter;      // where to add rows, for SCAN_SORT
+    growbuf* offsets;     // where to gather row offsets, for SCAN_INDEX
+} scan_target;
+
+typedef struct {
+    csv_input*      input;
+    scan_mode       mode;
+    const query_program* program;
+    query_vm*       vm;           // gathers the chunks' VMs, for --debug
+    growbuf*        selectors;
+    output_format   format;
+    order*          order;
+    size_t          memory_limit; // for the sorters of the chunks read ahead
+    size_t          chunk_memory_limit; // for each one of them
+    size_t          max_fields;
+    size_t          index_stride; // rows between index entries, for SCAN_INDEX
+    uint64_t        start;        // offset of the first row to read
+    size_t          first_row;    // number of that row
+    scan_chunk*     chunks;
+    size_t          num_chunks;
+    size_t          num_threads;
+    size_t          next_chunk;   // next chunk for a worker to take
+    size_t          window_end;   // workers wait before taking this chunk
+    bool            stop;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} parallel_scan;
+
+/**
+ * Read the rows of one chunk, starting from a given offset.
+ *
+ * Arguments:
+ *   scan	- the scan the chunk belongs to
+ *   reader	- reader to use; each thread has its own
+ *   chunk	- chunk to read; receives the end and number of rows
+ *   start	- offset to start reading from
+ *   first_row	- number of the first row
+ *   speculative - start is a guess; see read_csv_range()
+ *   target	- where the rows go
+ *
+ * Return Value:
+ *   0 on success, 1 if the CSV data is malformed.
+ */
+static int read_chunk(
+        parallel_scan* scan,
+        csv_reader* reader,
+        scan_chunk* chunk,
+        uint64_t start,
+        size_t first_row,
+        bool speculative,
+        const scan_target* target)
 {
-    sort_args* args = (sort_args*)context;
-    compound* root_condition = args->root_condition;
-    selector* order_selector = args->order_selector;
+    query_vm* vm = NULL;
+    row_evaluator_args print_args = { NULL, scan->selectors, target->output, scan->format };
+    sort_args sort_args = { NULL, scan->order, scan->selectors, target->sorter, NULL,
+            scan->format };
+    index_args index_args = { target->offsets, scan->index_stride };
+    row_evaluator evaluator = NULL;
+    void* context = NULL;
+    int retval;
 
-    if (query_evaluate(fields, rownum, root_condition)) {
-        row_sort_args row_args = {
-            args->sort_data,
-            rownum,
-        };
-        evaluate_selector(order_selector, fields, rownum, byte_offset, 0, 1,
-                &populate_sort_data_field, &row_args);
+    if (scan->mode == SCAN_PRINT || scan->mode == SCAN_SORT) {
+        // each thread has registers of its own to run the query with
+        vm = print_args.vm = sort_args.vm = query_vm_create(scan->program);
+        if (NULL == vm) {
+            return 1;
+        }
+    }
+
+    switch (scan->mode) {
+    case SCAN_COUNT:
+        break;
+    case SCAN_PRINT:
+        evaluator = &eval_and_print;
+        context = &print_args;
+        break;
+    case SCAN_SORT:
+        sort_args.key = growbuf_create(64);
+        if (NULL == sort_args.key) {
+            query_vm_free(vm);
+            return 1;
+        }
+        evaluator = &populate_sort_data;
+        context = &sort_args;
+        break;
+    case SCAN_INDEX:
+        evaluator = &record_row_offset;
+        context = &index_args;
+        break;
     }
+
+    retval = read_csv_range(reader, start, chunk->limit, first_row, speculative,
+            evaluator, context, &chunk->end, &chunk->num_rows);
+
+    if (NULL != scan->vm && NULL != vm) {
+        // keep it for the main thread to gather, if the chunk is used
+        chunk->vm = vm;
+        vm = NULL;
+    }
+
+    growbuf_free(sort_args.key);
+    query_vm_free(vm);
+    return retval;
 }
 
-static int row_comparator(const void* avoid, const void* bvoid)
+/**
+ * Throw away what a worker made of a chunk.
+ */
+static void discard_chunk(scan_chunk* chunk)
 {
-    // The values are expected to be of the same type.
-    row_sort_data* a = (row_sort_data*)avoid;
-    row_sort_data* b = (row_sort_data*)bvoid;
-    if (a->value.is_str) {
-        return strcmp(a->value.str, b->value.str);
-    } else if (a->value.is_num) {
-        return a->value.num - b->value.num;
-    } else if (a->value.is_dbl) {
-        return a->value.dbl - b->value.dbl;
-    } else {
-        fprintf(stderr, "error: invalid value type in row comparator: ");
+    free(chunk->output);
+    chunk->output = NULL;
+    chunk->output_len = 0;
 
-        if (a->value.is_col) {
-            fprintf(stderr, "column\n");
-        } else if (a->value.is_special) {
-            fprintf(stderr, "special\n");
-        } else if (a->value.is_func) {
-            fprintf(stderr, "func\n");
-        } else {
-            fprintf(stderr, "none\n");
+    sorter_free(chunk->sorter);
+    chunk->sorter = NULL;
+
+    growbuf_free(chunk->offsets);
+    chunk->offsets = NULL;
+
+    query_vm_free(chunk->vm);
+    chunk->vm = NULL;
+}
+
+/**
+ * Worker thread: reads chunks in order of their offsets, guessing that each
+ * one starts on a row boundary, until there are none left.
+ */
+static void* scan_worker(void* context)
+{
+    parallel_scan* scan = (parallel_scan*)context;
+    csv_reader* reader = csv_reader_create(scan->input);
+
+    if (NULL != reader) {
+        csv_reader_set_max_fields(reader, scan->max_fields);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&scan->lock);
+        while (!scan->stop
+                && scan->next_chunk < scan->num_chunks
+                && scan->next_chunk >= scan->window_end) {
+            pthread_cond_wait(&scan->cond, &scan->lock);
+        }
+        if (scan->stop || scan->next_chunk >= scan->num_chunks) {
+            pthread_mutex_unlock(&scan->lock);
+            break;
+        }
+        scan_chunk* chunk = &scan->chunks[scan->next_chunk++];
+        pthread_mutex_unlock(&scan->lock);
+
+        //
+        // Anything that goes wrong here just leaves the chunk to be read
+        // again by the main thread.
+        //
+
+        chunk->status = -1;
+        if (NULL != reader) {
+            scan_target target = { NULL, NULL, NULL };
+
+            if (scan->mode == SCAN_PRINT) {
+                target.output = open_memstream(&chunk->output, &chunk->output_len);
+            }
+            else if (scan->mode == SCAN_SORT) {
+                // the main thread does the sorting, and spilling
+                target.sorter = chunk->sorter = sorter_create(
+                        scan->chunk_memory_limit, scan->order->limit);
+                if (NULL != target.sorter) {
+                    sorter_hold(target.sorter);
+                }
+            }
+            else if (scan->mode == SCAN_INDEX) {
+                target.offsets = chunk->offsets = growbuf_create(0);
+            }
+
+            if ((scan->mode != SCAN_PRINT || NULL != target.output)
+                    && (scan->mode != SCAN_SORT || NULL != target.sorter)
+                    && (scan->mode != SCAN_INDEX || NULL != target.offsets)) {
+                chunk->status = read_chunk(scan, reader, chunk, chunk->start,
+                        chunk->first_row, true, &target);
+            }
+
+            if (NULL != target.output) {
+                fclose(target.output);
+            }
+        }
+
+        pthread_mutex_lock(&scan->lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&scan->cond);
+        pthread_mutex_unlock(&scan->lock);
+    }
+
+    csv_reader_free(reader);
+    return NULL;
+}
+
+/**
+ * Run one pass over all the chunks: worker threads read them speculatively,
+ * and this thread takes their results in order.
+ *
+ * A chunk's result is only used if it started where the previous chunk
+ * really ended. Otherwise its guessed start was inside a double-quoted field,
+ * or the previous chunk gave up on a long row, and it is read again here from
+ * the right place. This is also how format errors are reported, with the
+ * right line number.
+ *
+ * Arguments:
+ *   scan	- the chunks, and what to do with them
+ *   reader	- reader for this thread
+ *   target	- where the rows go
+ *
+ * Return Value:
+ *   0 on success, EX_DATAERR if the CSV data is malformed, EX_OSERR if
+ *   the threads could not be started, or an exit code from sorting.
+ */
+static int run_parallel_scan(
+        parallel_scan* scan,
+        csv_reader* reader,
+        const scan_target* target)
+{
+    int retval = 0;
+    pthread_t* threads = malloc(scan->num_threads * sizeof(pthread_t));
+    size_t num_started = 0;
+    uint64_t prev_end = scan->start;
+    size_t rownum = scan->first_row;
+
+    if (NULL == threads) {
+        return EX_OSERR;
+    }
+
+    scan->next_chunk = 0;
+    scan->window_end = 2 * scan->num_threads;
+
+    // one more share for the chunk being taken, which is copied while it's held
+    scan->chunk_memory_limit = scan->memory_limit / (scan->window_end + 1);
+    scan->stop = false;
+    for (size_t i = 0; i < scan->num_chunks; i++) {
+        scan->chunks[i].done = false;
+    }
+
+    for (; num_started < scan->num_threads; num_started++) {
+        if (0 != pthread_create(&threads[num_started], NULL, &scan_worker, scan)) {
+            break;
+        }
+    }
+
+    if (0 == num_started) {
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < scan->num_chunks; i++) {
+        scan_chunk* chunk = &scan->chunks[i];
+
+        pthread_mutex_lock(&scan->lock);
+        while (!chunk->done) {
+            pthread_cond_wait(&scan->cond, &scan->lock);
+        }
+        pthread_mutex_unlock(&scan->lock);
+
+        if (chunk->start != prev_end || chunk->status != 0) {
+            DEBUG fprintf(stderr, "chunk %zu: guessed start %lu, really %lu\n",
+                    i, chunk->start, prev_end);
+
+            discard_chunk(chunk);
+            chunk->status = read_chunk(scan, reader, chunk, prev_end, rownum,
+                    false, target);
+            if (0 != chunk->status) {
+                retval = EX_DATAERR;
+                break;
+            }
+        }
+        else if (scan->mode == SCAN_PRINT) {
+            fwrite(chunk->output, 1, chunk->output_len, target->output);
+        }
+        else if (scan->mode == SCAN_SORT) {
+            retval = sorter_take(target->sorter, chunk->sorter);
+            if (0 != retval) {
+                break;
+            }
+        }
+        else if (scan->mode == SCAN_INDEX) {
+            growbuf_append(target->offsets, chunk->offsets->buf, chunk->offsets->size);
+        }
+        if (NULL != chunk->vm) {
+            query_vm_merge_order(scan->vm, chunk->vm);
+        }
+        discard_chunk(chunk);
+
+        chunk->first_row = rownum;
+        rownum += chunk->num_rows;
+        prev_end = chunk->end;
+
+        pthread_mutex_lock(&scan->lock);
+        scan->window_end++;
+        pthread_cond_broadcast(&scan->cond);
+        pthread_mutex_unlock(&scan->lock);
+    }
+
+cleanup:
+    pthread_mutex_lock(&scan->lock);
+    scan->stop = true;
+    pthread_cond_broadcast(&scan->cond);
+    pthread_mutex_unlock(&scan->lock);
+
+    for (size_t i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    for (size_t i = 0; i < scan->num_chunks; i++) {
+        discard_chunk(&scan->chunks[i]);
+    }
+
+    return retval;
+}
+
+/**
+ * Read a mapped input with several threads, each taking a chunk of it at a
+ * time. The output is the same as reading it with one thread.
+ *
+ * Chunks are split at the first newline past an even division of the input,
+ * which is a guess: the newline could be inside a double-quoted field. See
+ * run_parallel_scan() for how wrong guesses are caught.
+ *
+ * If row numbers are needed, a first pass just counts the rows in each
+ * chunk.
+ *
+ * Arguments:
+ *   scan	- what to read: the input, the query, the mode, and the row to
+ *		  start from
+ *   options	- number of threads and chunk size
+ *   reader	- reader for this thread
+ *   need_rownums - whether the rows need numbering
+ *   target	- where the rows go
+ *
+ * Return Value:
+ *   0 on success, or an exit code.
+ */
+static int read_csv_parallel(
+        parallel_scan* scan,
+        const csvsel_options* options,
+        csv_reader* reader,
+        bool need_rownums,
+        const scan_target* target)
+{
+    int retval = 0;
+    size_t chunk_size = options->chunk_size;
+    size_t size = scan->input->size - scan->start;
+    scan_mode mode = scan->mode;
+
+    if (0 == chunk_size) {
+        chunk_size = size / (options->num_threads * 4);
+        if (chunk_size < MIN_CHUNK_SIZE) {
+            chunk_size = MIN_CHUNK_SIZE;
+        }
+        else if (chunk_size > MAX_CHUNK_SIZE) {
+            chunk_size = MAX_CHUNK_SIZE;
         }
+    }
+
+    scan->num_threads = options->num_threads;
+    scan->num_chunks = (size + chunk_size - 1) / chunk_size;
+    if (0 == scan->num_chunks) {
         return 0;
     }
+
+    scan->chunks = calloc(scan->num_chunks, sizeof(scan_chunk));
+    if (NULL == scan->chunks) {
+        fprintf(stderr, "malloc failed\n");
+        return EX_OSERR;
+    }
+
+    uint64_t start = scan->start;
+    for (size_t i = 0; i < scan->num_chunks; i++) {
+        uint64_t offset = scan->start + (i + 1) * chunk_size;
+        if (offset < start) {
+            // a long line already took us past this one
+            offset = start;
+        }
+        scan->chunks[i].start = start;
+        scan->chunks[i].limit = csv_find_row_start(scan->input, offset);
+        start = scan->chunks[i].limit;
+    }
+
+    pthread_mutex_init(&scan->lock, NULL);
+    pthread_cond_init(&scan->cond, NULL);
+
+    if (need_rownums) {
+        scan->mode = SCAN_COUNT;
+        scan_target counting = { NULL, NULL, NULL };
+        retval = run_parallel_scan(scan, reader, &counting);
+    }
+
+    if (0 == retval) {
+        scan->mode = mode;
+        retval = run_parallel_scan(scan, reader, target);
+    }
+
+    pthread_cond_destroy(&scan->cond);
+    pthread_mutex_destroy(&scan->lock);
+    free(scan->chunks);
+    scan->chunks = NULL;
+
+    return retval;
 }
 
-int csv_select(FILE* input, FILE* output, const char* query, size_t query_len)
+/**
+ * Checks whether any part of a query uses the row number (%#).
+ */
+static bool query_uses_rownum(compound* root_condition, growbuf* selectors, order* order)
+{
+    if (compound_uses_rownum(root_condition)) {
+        return true;
+    }
+
+    if (NULL != order) {
+        order_key* keys = (order_key*)order->keys->buf;
+        for (size_t i = 0; i < order->keys->size / sizeof(order_key); i++) {
+            if (val_uses_rownum(&keys[i].value)) {
+                return true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < selectors->size / sizeof(void*); i++) {
+        selector* s = ((selector**)selectors->buf)[i];
+        if (s->type == SELECTOR_VALUE && val_uses_rownum(&s->value)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * How many of the leading fields of a row a query looks at; the rest don't
+ * need to be split up. SIZE_MAX if it prints or counts all of them.
+ */
+static size_t query_columns_needed(compound* root_condition, growbuf* selectors, order* order)
+{
+    size_t needed = compound_columns_needed(root_condition);
+
+    if (NULL != order) {
+        order_key* keys = (order_key*)order->keys->buf;
+        for (size_t i = 0; i < order->keys->size / sizeof(order_key); i++) {
+            size_t order_needed = val_columns_needed(&keys[i].value);
+            if (order_needed > needed) {
+                needed = order_needed;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < selectors->size / sizeof(void*); i++) {
+        selector* s = ((selector**)selectors->buf)[i];
+        size_t selector_needed;
+
+        if (s->type == SELECTOR_VALUE) {
+            selector_needed = val_columns_needed(&s->value);
+        }
+        else if (s->column == SIZE_MAX) {
+            // select with no columns: the whole row
+            selector_needed = SIZE_MAX;
+        }
+        else {
+            selector_needed = s->column + 1;
+        }
+
+        if (selector_needed > needed) {
+            needed = selector_needed;
+        }
+    }
+
+    return needed;
+}
+
+/**
+ * Write a value the way it would be written in a query.
+ */
+static void print_value_name(const val* v, FILE* output)
+{
+    static const char* const conversions[] = { ".int", ".float", ".string" };
+    type natural_type = TYPE_STRING;
+
+    if (v->is_col) {
+        fprintf(output, "%%%zu", v->col + 1);
+    }
+    else if (v->is_num) {
+        fprintf(output, "%ld", v->num);
+        natural_type = TYPE_LONG;
+    }
+    else if (v->is_dbl) {
+        fprintf(output, "%g", v->dbl);
+        natural_type = TYPE_DOUBLE;
+    }
+    else if (v->is_str) {
+        fprintf(output, "\"%s\"", v->str);
+    }
+    else if (v->is_special) {
+        fputs((SPECIAL_ROWNUM == v->special) ? "%#" : "%%", output);
+        natural_type = TYPE_LONG;
+    }
+    else if (v->is_func) {
+        fprintf(output, "%s(", FUNCTIONS[v->func->func].name);
+        for (size_t i = 0; i < v->func->num_args; i++) {
+            if (i > 0) {
+                fputs(", ", output);
+            }
+            print_value_name(&v->func->args[i], output);
+        }
+        putc(')', output);
+        natural_type = FUNCTIONS[v->func->func].return_type;
+    }
+
+    if (v->conversion_type != natural_type) {
+        fputs(conversions[v->conversion_type], output);
+    }
+}
+
+/**
+ * Set up an Arrow stream with a column for each selector, named for what it
+ * selects, and typed by its conversion type.
+ *
+ * Arguments:
+ *   selectors	- the query's selectors
+ *   output	- where to write the stream
+ *   batch_rows	- rows in each record batch; 0 for the default
+ *   writer	- receives the writer, which the caller frees
+ *
+ * Return Value:
+ *   0 on success, 1 if the query selects whole rows, which don't have a set
+ *   number of columns, or EX_OSERR if out of memory.
+ */
+static int create_arrow_writer(
+        growbuf* selectors,
+        FILE* output,
+        size_t batch_rows,
+        arrow_writer** writer)
+{
+    *writer = arrow_writer_create(output, batch_rows);
+    if (NULL == *writer) {
+        fprintf(stderr, "malloc failed\n");
+        return EX_OSERR;
+    }
+
+    for (size_t i = 0; i < selectors->size / sizeof(void*); i++) {
+        selector* s = ((selector**)selectors->buf)[i];
+        type type = TYPE_STRING;
+        char* name = NULL;
+        size_t name_len;
+        int retval;
+
+        if (SELECTOR_COLUMN == s->type && SIZE_MAX == s->column) {
+            fprintf(stderr, "Arrow output can't select whole rows; list the columns\n");
+            return 1;
+        }
+
+        FILE* name_stream = open_memstream(&name, &name_len);
+        if (NULL == name_stream) {
+            fprintf(stderr, "malloc failed\n");
+            return EX_OSERR;
+        }
+        if (SELECTOR_COLUMN == s->type) {
+            fprintf(name_stream, "%%%zu", s->column + 1);
+        }
+        else {
+            print_value_name(&s->value, name_stream);
+            type = s->value.conversion_type;
+        }
+        fclose(name_stream);
+
+        retval = arrow_writer_add_column(*writer, name, type);
+        free(name);
+        if (0 != retval) {
+            fprintf(stderr, "malloc failed\n");
+            return retval;
+        }
+    }
+
+    return 0;
+}
+
+int csv_select(
+        csv_input* input,
+        FILE* output,
+        const char* query,
+        size_t query_len,
+        const csvsel_options* options)
 {
     int retval = 0;
 
     growbuf* selectors = NULL;
     compound* root_condition = NULL;
     order* order = NULL;
+    csv_reader* reader = NULL;
+    sorter* sorter = NULL;
+    growbuf* sort_key = NULL;
+    arrow_writer* writer = NULL;
+    query_program* program = NULL;
+    query_vm* vm = NULL;
+    output_format format = (NULL != options) ? options->output_format : OUTPUT_CSV;
 
     selectors = growbuf_create(1);
-    if (NULL == selectors) {
+    reader = csv_reader_create(input);
+    if (NULL == selectors || NULL == reader) {
         fprintf(stderr, "malloc failed\n");
         retval = 2;
         goto cleanup;
@@ -219,69 +913,193 @@ int csv_select(FILE* input, FILE* output, const char* query, size_t query_len)
         goto cleanup;
     }
 
+    //
+    // What's evaluated for each row is compiled to a program, which each
+    // thread reading rows runs with a VM of its own.
+    //
+
+    program = query_compile(root_condition, selectors, order);
+    vm = (NULL != program) ? query_vm_create(program) : NULL;
+    if (NULL == vm) {
+        fprintf(stderr, "malloc failed\n");
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+
     if (query_debug)
     {
         fprintf(stderr, "condition:\n");
         print_condition(root_condition, 0);
+        fprintf(stderr, "program:\n");
+        query_program_print(program, stderr);
     }
 
-    row_evaluator_args print_args = { root_condition, selectors, output };
+    //
+    // Arrow output goes through a stream that takes each row's values, and
+    // builds them up into record batches.
+    //
 
-    if (order != NULL) {
-        // Read the file, accumulating the sort fields and row byte offsets.
+    if (OUTPUT_ARROW == format) {
+        retval = create_arrow_writer(selectors, output, options->batch_rows, &writer);
+        if (0 != retval) {
+            goto cleanup;
+        }
 
-        selector s = {0};
-        s.type = SELECTOR_VALUE;
-        s.value = order->value;
+        output = arrow_writer_open(writer);
+        if (NULL == output) {
+            fprintf(stderr, "unable to start Arrow output\n");
+            retval = EX_OSERR;
+            goto cleanup;
+        }
+    }
 
-        growbuf* sort_data = growbuf_create(0);
+    row_evaluator_args print_args = { vm, selectors, output, format };
 
-        sort_args sort_args = {
-            root_condition,
-            &s,
-            sort_data,
-        };
+    //
+    // Only a mapped input can be split up between threads.
+    //
 
-        if (0 != read_csv(input, &populate_sort_data, &sort_args)) {
-            retval = EX_DATAERR;
+    bool parallel = (NULL != options && options->num_threads > 1
+            && NULL != input->data);
+    bool need_rownums = parallel && query_uses_rownum(root_condition, selectors, order);
+    size_t max_fields = query_columns_needed(root_condition, selectors, order);
+
+    csv_reader_set_max_fields(reader, max_fields);
+
+    //
+    // If the condition only holds for a range of row numbers, only read
+    // those rows: stop after the last one, and if the file has an index,
+    // start at the indexed row nearest before the first one. A bounded range
+    // is read by one thread.
+    //
+
+    size_t first_row, last_row;
+    compound_rownum_range(root_condition, &first_row, &last_row);
+
+    uint64_t start = 0;
+    size_t start_row = 0;
+    size_t end_row = (SIZE_MAX == last_row) ? SIZE_MAX : last_row + 1;
+
+    if (first_row > last_row) {
+        end_row = 0;
+    }
+    else if (first_row > 0 && NULL != options && NULL != options->input_path
+            && NULL != input->data) {
+        bool up_to_date;
+        csv_index* index = csv_index_load(options->input_path, input, &up_to_date);
+        if (NULL != index) {
+            csv_index_lookup(index, first_row, &start, &start_row);
+            csv_index_free(index);
+        }
+    }
+
+    DEBUG fprintf(stderr, "reading rows %zu to %zu from row %zu at offset %lu\n",
+            first_row, last_row, start_row, start);
+
+    parallel = parallel && (SIZE_MAX == end_row);
+
+    parallel_scan scan = {0};
+    scan.input = input;
+    scan.program = program;
+    scan.vm = query_debug ? vm : NULL;
+    scan.selectors = selectors;
+    scan.format = format;
+    scan.max_fields = max_fields;
+    scan.start = start;
+    scan.first_row = start_row;
+
+    if (order != NULL) {
+        //
+        // Read the file, printing the output of the matching rows into the
+        // sorter along with their sort values; then print it out in order.
+        //
+
+        size_t memory_limit = (NULL != options && 0 != options->memory_limit)
+            ? options->memory_limit : DEFAULT_MEMORY_LIMIT;
+
+        if (parallel) {
+            // the chunks read ahead get half of it; see run_parallel_scan()
+            scan.memory_limit = memory_limit / 2;
+            memory_limit -= scan.memory_limit;
+        }
+
+        sorter = sorter_create(memory_limit, order->limit);
+        sort_key = growbuf_create(64);
+        if (NULL == sorter || NULL == sort_key) {
+            fprintf(stderr, "malloc failed\n");
+            retval = EX_OSERR;
             goto cleanup;
         }
 
-        size_t num_rows = sort_data->size / sizeof(row_sort_data);
-        qsort(sort_data->buf, num_rows, sizeof(row_sort_data), &row_comparator);
+        if (NULL != options) {
+            sorter_set_threads(sorter, options->num_threads);
+        }
 
-        bool reverse = (order->direction == ORDER_DESCENDING);
-        for (size_t i = reverse ? num_rows - 1 : i;
-                reverse ? i < num_rows : i < num_rows;
-                reverse ? i-- : i++)
-        {
-            row_sort_data* row = &(((row_sort_data*)sort_data->buf)[i]);
+        //
+        // Rows that are read in order can be printed as they're read.
+        //
 
-            if (-1 == fseek(input, row->byte_offset, SEEK_SET)) {
-                perror("error seeking input file");
-                retval = EX_DATAERR;
+        if ((NULL != options && options->presorted) || order_is_input_order(order)) {
+            retval = sorter_stream(sorter, output);
+            if (0 != retval) {
                 goto cleanup;
             }
+        }
 
-            if (0 != read_csv_row(input, row->row_number, &eval_and_print, &print_args)) {
-                retval = EX_DATAERR;
-                goto cleanup;
-            }
+        sort_args sort_args = {
+            vm,
+            order,
+            selectors,
+            sorter,
+            sort_key,
+            format,
+        };
 
-            if (row->value.is_str) {
-                free(row->value.str);
-                row->value.str = NULL;
+        if (parallel) {
+            scan_target target = { NULL, sorter, NULL };
+            scan.order = order;
+            scan.mode = SCAN_SORT;
+            retval = read_csv_parallel(&scan, options, reader, need_rownums,
+                    &target);
+            if (0 != retval) {
+                goto cleanup;
             }
         }
+        else if (0 != read_csv_rows(reader, start, start_row, end_row,
+                    &populate_sort_data, &sort_args)) {
+            retval = EX_DATAERR;
+            goto cleanup;
+        }
+
+        retval = sorter_finish(sorter, output);
 
     } else {
         // No sort; just read the file and print in one pass.
-        if (0 != read_csv(input, &eval_and_print, &print_args)) {
+        if (parallel) {
+            scan_target target = { output, NULL, NULL };
+            scan.mode = SCAN_PRINT;
+            retval = read_csv_parallel(&scan, options, reader, need_rownums,
+                    &target);
+        }
+        else if (0 != read_csv_rows(reader, start, start_row, end_row,
+                    &eval_and_print, &print_args)) {
             retval = EX_DATAERR;
         }
     }
 
+    if (NULL != writer && 0 == retval) {
+        retval = arrow_writer_finish(writer);
+    }
+
+    if (query_debug) {
+        query_vm_print_order(vm, stderr);
+    }
+
 cleanup:
+    // the program refers to the parse tree, so goes first
+    query_vm_free(vm);
+    query_program_free(program);
+
     if (NULL != selectors) {
         for (size_t i = 0; i < selectors->size / sizeof(void*); i++) {
             selector* s = ((selector**)selectors->buf)[i];
@@ -297,6 +1115,147 @@ cleanup:
         free_compound(root_condition);
     }
 
+    free_order(order);
+    sorter_free(sorter);
+    growbuf_free(sort_key);
+    arrow_writer_free(writer);
+    csv_reader_free(reader);
+
     return retval;
 }
 
+typedef struct {
+    uint64_t offset;
+    size_t   rownum;
+    size_t   end_row;
+} last_row_args;
+
+static void track_last_row(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context)
+{
+    last_row_args* args = (last_row_args*)context;
+
+    args->offset = byte_offset;
+    args->rownum = rownum;
+    args->end_row = rownum + 1;
+}
+
+/**
+ * Build the index of a CSV file, or bring it up to date; see csvindex.c.
+ *
+ * If the file has an index from before it was appended to, only the rows
+ * after the ones it covers are read. With more than one thread, they are
+ * read in parallel.
+ *
+ * A last row without a newline isn't indexed, because appending to the file
+ * could carry it on.
+ *
+ * Arguments:
+ *   input	- the file, mapped into memory
+ *   options	- path of the file, and number of threads
+ *
+ * Return Value:
+ *   0 on success, or an exit code.
+ */
+int csv_build_index(csv_input* input, const csvsel_options* options)
+{
+    int retval = 0;
+    csv_index* index = NULL;
+    csv_reader* reader = NULL;
+    struct stat st;
+    bool up_to_date = false;
+
+    if (0 != stat(options->input_path, &st)) {
+        perror("unable to access input file");
+        return EX_NOINPUT;
+    }
+
+    index = csv_index_load(options->input_path, input, &up_to_date);
+    if (up_to_date) {
+        DEBUG fprintf(stderr, "index is up to date\n");
+        goto cleanup;
+    }
+
+    if (NULL == index) {
+        index = csv_index_create(CSV_INDEX_STRIDE);
+    }
+    reader = csv_reader_create(input);
+    if (NULL == index || NULL == reader) {
+        fprintf(stderr, "malloc failed\n");
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+
+    // only the row boundaries are wanted
+    csv_reader_set_max_fields(reader, 1);
+
+    DEBUG fprintf(stderr, "indexing from row %lu at offset %lu\n",
+            index->num_rows, index->indexed_end);
+
+    if (options->num_threads > 1) {
+        parallel_scan scan = {0};
+        scan.input = input;
+        scan.mode = SCAN_INDEX;
+        scan.max_fields = 1;
+        scan.index_stride = index->stride;
+        scan.start = index->indexed_end;
+        scan.first_row = index->num_rows;
+
+        scan_target target = { NULL, NULL, index->offsets };
+        retval = read_csv_parallel(&scan, options, reader, true, &target);
+    }
+    else {
+        index_args args = { index->offsets, index->stride };
+        if (0 != read_csv_rows(reader, index->indexed_end, index->num_rows,
+                    SIZE_MAX, &record_row_offset, &args)) {
+            retval = EX_DATAERR;
+        }
+    }
+
+    if (0 != retval) {
+        goto cleanup;
+    }
+
+    //
+    // Read the rows after the last index entry again, to find out where the
+    // last one starts and whether it has a newline.
+    //
+
+    size_t num_entries = index->offsets->size / sizeof(uint64_t);
+    last_row_args last = { 0, 0, 0 };
+    if (num_entries > 0) {
+        last.offset = ((uint64_t*)index->offsets->buf)[num_entries - 1];
+        last.rownum = (num_entries - 1) * index->stride;
+        last.end_row = last.rownum;
+    }
+
+    if (0 != read_csv_rows(reader, last.offset, last.rownum, SIZE_MAX,
+                &track_last_row, &last)) {
+        retval = EX_DATAERR;
+        goto cleanup;
+    }
+
+    if (csv_reader_unterminated(reader)) {
+        index->indexed_end = last.offset;
+        index->num_rows = last.rownum;
+    }
+    else {
+        index->indexed_end = input->size;
+        index->num_rows = last.end_row;
+    }
+
+    num_entries = (index->num_rows + index->stride - 1) / index->stride;
+    index->offsets->size = num_entries * sizeof(uint64_t);
+
+    DEBUG fprintf(stderr, "indexed %lu rows, %zu entries\n",
+            index->num_rows, num_entries);
+
+    if (0 != csv_index_save(index, options->input_path, &st, input)) {
+        retval = EX_CANTCREAT;
+    }
+
+cleanup:
+    csv_index_free(index);
+    csv_reader_free(reader);
+
+    return retval;
+}
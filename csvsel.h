@@ -3,15 +3,34 @@
 
 #include <stdio.h>
 #include "growbuf.h"
+#include "csvformat.h"
 #include "queryeval.h"
+#include "queryvm.h"
+
+typedef enum {
+    OUTPUT_CSV,
+    OUTPUT_ARROW,   // an Apache Arrow IPC stream; see arrowipc.c
+} output_format;
 
 typedef struct {
-    compound* root_condition;
-    growbuf*  selectors;
-    FILE*     output;
+    query_vm*     vm;
+    growbuf*      selectors;
+    FILE*         output;
+    output_format format;
 } row_evaluator_args;
 
-int csv_select(FILE* input, FILE* output, const char* query, size_t query_len);
+typedef struct {
+    size_t num_threads;     // threads to read a mapped input and sort with; 0 or 1 for one
+    size_t chunk_size;      // bytes of input per piece of work; 0 for automatic
+    const char* input_path; // path of the input file, to find its index; or NULL
+    size_t memory_limit;    // bytes ORDER BY may use before spilling; 0 for default
+    bool presorted;         // the input is already in ORDER BY order
+    output_format output_format;
+    size_t batch_rows;      // rows in each Arrow record batch; 0 for default
+} csvsel_options;
+
+int csv_select(csv_input* input, FILE* output, const char* query, size_t query_len, const csvsel_options* options);
+int csv_build_index(csv_input* input, const csvsel_options* options);
 
 #endif //CSVSEL_H
 
@@ -0,0 +1,444 @@
+/*
+ * CSV Selector
+ *
+ * Reading gzip- and zstd-compressed input.
+ *
+ * A compressed file is decompressed on its own thread, which fills a ring
+ * buffer that the reader drains through a stdio stream, so decompression and
+ * parsing overlap. The stream can only be read through from the start.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "decompress.h"
+
+#define DEBUG if (false)
+//#define DEBUG
+
+#define RING_SIZE       (4*1024*1024)   // decompressed data waiting to be read
+#define CHUNK_SIZE      (256*1024)      // decompressed by the decoder at a time
+#define INPUT_SIZE      (64*1024)       // compressed data read at a time
+
+typedef enum {
+    FORMAT_GZIP,
+    FORMAT_ZSTD,
+} compression_format;
+
+typedef struct {
+    FILE*              file;
+    compression_format format;
+
+    //
+    // Decoder state. Only the decoder thread touches this while it runs.
+    //
+
+    z_stream      zs;
+    bool          member_done;  // between gzip members (or frames)
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx*    zstd;
+    ZSTD_inBuffer zin;
+#endif
+    unsigned char input[INPUT_SIZE];
+    char          pending[CHUNK_SIZE];  // decompressed, not yet in the ring
+    size_t        pending_len;
+    size_t        pending_off;
+    int           pending_status;   // of the decompression that made it
+
+    //
+    // Shared with the reader, under the lock.
+    //
+
+    char*           ring;
+    uint64_t        head;       // bytes ever written to the ring
+    uint64_t        tail;       // bytes ever read from it
+    bool            eof;
+    bool            error;
+    bool            stop;
+    bool            running;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} decompressor;
+
+enum { DECODE_OK, DECODE_EOF, DECODE_ERROR };
+
+/**
+ * Read more compressed data into the input buffer.
+ *
+ * Returns:
+ *   the number of bytes read; 0 at the end of the file or on error.
+ */
+static size_t fill_input(decompressor* d)
+{
+    return fread(d->input, 1, INPUT_SIZE, d->file);
+}
+
+/**
+ * Decompress gzip data into a buffer. Any number of gzip members are read one after the other.
+ *
+ * Returns:
+ *   DECODE_OK if the buffer was filled, DECODE_EOF at the end of the data,
+ *   DECODE_ERROR if it is corrupt or truncated.
+ */
+static int decode_gzip(decompressor* d, unsigned char* out, size_t out_size, size_t* produced)
+{
+    z_stream* zs = &d->zs;
+
+    zs->next_out = out;
+    zs->avail_out = out_size;
+    *produced = 0;
+
+    while (zs->avail_out > 0) {
+        if (zs->avail_in == 0) {
+            zs->next_in = d->input;
+            zs->avail_in = fill_input(d);
+            if (zs->avail_in == 0) {
+                if (ferror(d->file)) {
+                    perror("error reading compressed input");
+                    return DECODE_ERROR;
+                }
+                if (!d->member_done) {
+                    fprintf(stderr, "gzip error: unexpected end of input\n");
+                    return DECODE_ERROR;
+                }
+                return DECODE_EOF;
+            }
+        }
+
+        if (d->member_done) {
+            inflateReset2(zs, 15 + 16);
+            d->member_done = false;
+        }
+
+        unsigned char* start = zs->next_out;
+        int ret = inflate(zs, Z_NO_FLUSH);
+        *produced += zs->next_out - start;
+
+        if (ret == Z_STREAM_END) {
+            d->member_done = true;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            fprintf(stderr, "gzip error: %s\n", (NULL != zs->msg) ? zs->msg : "corrupt data");
+            return DECODE_ERROR;
+        }
+    }
+
+    return DECODE_OK;
+}
+
+#ifdef HAVE_ZSTD
+/**
+ * Decompress zstd data into a buffer. Any number of frames are read one
+ * after the other.
+ *
+ * Returns:
+ *   DECODE_OK if the buffer was filled, DECODE_EOF at the end of the data,
+ *   DECODE_ERROR if it is corrupt or truncated.
+ */
+static int decode_zstd(decompressor* d, unsigned char* out, size_t out_size, size_t* produced)
+{
+    ZSTD_outBuffer zout = { out, out_size, 0 };
+
+    while (zout.pos < zout.size) {
+        if (d->zin.pos == d->zin.size) {
+            d->zin.src = d->input;
+            d->zin.pos = 0;
+            d->zin.size = fill_input(d);
+            if (d->zin.size == 0) {
+                if (ferror(d->file)) {
+                    perror("error reading compressed input");
+                    *produced = zout.pos;
+                    return DECODE_ERROR;
+                }
+                if (!d->member_done) {
+                    fprintf(stderr, "zstd error: unexpected end of input\n");
+                    *produced = zout.pos;
+                    return DECODE_ERROR;
+                }
+                *produced = zout.pos;
+                return DECODE_EOF;
+            }
+        }
+
+        size_t ret = ZSTD_decompressStream(d->zstd, &zout, &d->zin);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "zstd error: %s\n", ZSTD_getErrorName(ret));
+            *produced = zout.pos;
+            return DECODE_ERROR;
+        }
+
+        d->member_done = (ret == 0);
+    }
+
+    *produced = zout.pos;
+    return DECODE_OK;
+}
+
+#endif // HAVE_ZSTD
+
+static int decode(decompressor* d, unsigned char* out, size_t out_size, size_t* produced)
+{
+    switch (d->format) {
+    case FORMAT_GZIP:
+        return decode_gzip(d, out, out_size, produced);
+#ifdef HAVE_ZSTD
+    case FORMAT_ZSTD:
+        return decode_zstd(d, out, out_size, produced);
+#endif
+    default:
+        return DECODE_ERROR;
+    }
+}
+
+/**
+ * Decoder thread: decompresses into the ring buffer until the end of the
+ * data, an error, or it is told to stop.
+ */
+static void* decoder_thread(void* context)
+{
+    decompressor* d = (decompressor*)context;
+
+    for (;;) {
+        if (d->pending_len == 0) {
+            d->pending_off = 0;
+            d->pending_status = decode(d, (unsigned char*)d->pending, CHUNK_SIZE,
+                    &d->pending_len);
+        }
+
+        pthread_mutex_lock(&d->lock);
+        while (d->pending_off < d->pending_len && !d->stop) {
+            size_t space = RING_SIZE - (d->head - d->tail);
+            if (space == 0) {
+                pthread_cond_wait(&d->cond, &d->lock);
+                continue;
+            }
+
+            size_t n = d->pending_len - d->pending_off;
+            size_t at = d->head % RING_SIZE;
+            if (n > space) {
+                n = space;
+            }
+            if (n > RING_SIZE - at) {
+                n = RING_SIZE - at;
+            }
+
+            memcpy(d->ring + at, d->pending + d->pending_off, n);
+            d->pending_off += n;
+            d->head += n;
+            pthread_cond_broadcast(&d->cond);
+        }
+
+        bool done = d->stop;
+        if (!done && d->pending_status != DECODE_OK) {
+            d->eof = (d->pending_status == DECODE_EOF);
+            d->error = (d->pending_status == DECODE_ERROR);
+            pthread_cond_broadcast(&d->cond);
+            done = true;
+        }
+        pthread_mutex_unlock(&d->lock);
+
+        if (done) {
+            break;
+        }
+        d->pending_len = 0;
+    }
+
+    return NULL;
+}
+
+static int start_decoder(decompressor* d)
+{
+    d->stop = false;
+    d->eof = false;
+    d->error = false;
+    if (0 != pthread_create(&d->thread, NULL, &decoder_thread, d)) {
+        return -1;
+    }
+    d->running = true;
+    return 0;
+}
+
+static void stop_decoder(decompressor* d)
+{
+    if (!d->running) {
+        return;
+    }
+
+    pthread_mutex_lock(&d->lock);
+    d->stop = true;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+
+    pthread_join(d->thread, NULL);
+    d->running = false;
+}
+
+static ssize_t decompress_read(void* cookie, char* buf, size_t size)
+{
+    decompressor* d = (decompressor*)cookie;
+    size_t n = 0;
+
+    pthread_mutex_lock(&d->lock);
+    while (d->head == d->tail && !d->eof && !d->error && d->running) {
+        pthread_cond_wait(&d->cond, &d->lock);
+    }
+
+    if (d->head == d->tail) {
+        bool error = !d->eof;
+        pthread_mutex_unlock(&d->lock);
+        if (error) {
+            errno = EIO;
+            return -1;
+        }
+        return 0;
+    }
+
+    while (n < size && d->head != d->tail) {
+        size_t at = d->tail % RING_SIZE;
+        size_t chunk = d->head - d->tail;
+        if (chunk > RING_SIZE - at) {
+            chunk = RING_SIZE - at;
+        }
+        if (chunk > size - n) {
+            chunk = size - n;
+        }
+        memcpy(buf + n, d->ring + at, chunk);
+        n += chunk;
+        d->tail += chunk;
+    }
+
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+    return n;
+}
+
+/**
+ * Free a (stopped) decompressor, but not the file it reads.
+ */
+static void free_decompressor(decompressor* d)
+{
+    if (d->format == FORMAT_GZIP) {
+        inflateEnd(&d->zs);
+    }
+#ifdef HAVE_ZSTD
+    if (NULL != d->zstd) {
+        ZSTD_freeDCtx(d->zstd);
+    }
+#endif
+
+    pthread_cond_destroy(&d->cond);
+    pthread_mutex_destroy(&d->lock);
+
+    free(d->ring);
+    free(d);
+}
+
+static int decompress_close(void* cookie)
+{
+    decompressor* d = (decompressor*)cookie;
+    FILE* file = d->file;
+
+    stop_decoder(d);
+    free_decompressor(d);
+    return fclose(file);
+}
+
+/**
+ * Open a decompressing stream over a file, if it is compressed.
+ *
+ * The format is detected from the first bytes of the file, which must be
+ * seekable (pipes are returned as they are).
+ *
+ * Arguments:
+ *   file	- the opened input, at its start
+ *
+ * Return Value:
+ *   A stream of the decompressed data, which owns the file and closes it;
+ *   the file itself if it isn't compressed; or NULL on error, in which case
+ *   the file is left open.
+ */
+FILE* decompress_open(FILE* file)
+{
+    unsigned char magic[4] = {0};
+    compression_format format;
+
+    if (0 != fseek(file, 0, SEEK_SET)) {
+        return file;
+    }
+
+    size_t n = fread(magic, 1, sizeof(magic), file);
+    clearerr(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        format = FORMAT_GZIP;
+    }
+    else if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5
+            && magic[2] == 0x2f && magic[3] == 0xfd) {
+#ifdef HAVE_ZSTD
+        format = FORMAT_ZSTD;
+#else
+        fprintf(stderr, "zstd-compressed input needs csvsel built with zstd "
+                "(make WITH_ZSTD=1)\n");
+        return NULL;
+#endif
+    }
+    else {
+        return file;
+    }
+
+    decompressor* d = calloc(1, sizeof(decompressor));
+    if (NULL == d) {
+        fprintf(stderr, "malloc failed\n");
+        return NULL;
+    }
+
+    d->file = file;
+    d->format = format;
+    d->member_done = true;
+    d->ring = malloc(RING_SIZE);
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+
+    bool ok = (NULL != d->ring);
+
+    if (ok && format == FORMAT_GZIP) {
+        ok = (Z_OK == inflateInit2(&d->zs, 15 + 16));
+    }
+#ifdef HAVE_ZSTD
+    if (ok && format == FORMAT_ZSTD) {
+        d->zstd = ZSTD_createDCtx();
+        ok = (NULL != d->zstd);
+    }
+#endif
+
+    cookie_io_functions_t io = {
+        .read = &decompress_read,
+        .write = NULL,
+        .seek = NULL,
+        .close = &decompress_close,
+    };
+
+    FILE* stream = NULL;
+    if (ok && 0 == start_decoder(d)) {
+        stream = fopencookie(d, "r", io);
+    }
+
+    if (NULL == stream) {
+        fprintf(stderr, "unable to set up decompression\n");
+        stop_decoder(d);
+        free_decompressor(d);
+    }
+
+    return stream;
+}
@@ -0,0 +1,14 @@
+/*
+ * CSV Selector
+ *
+ * Reading gzip- and zstd-compressed input.
+ */
+
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include <stdio.h>
+
+FILE* decompress_open(FILE* file);
+
+#endif //DECOMPRESS_H
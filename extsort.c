@@ -0,0 +1,1950 @@
+/*
+ * CSV Selector
+ *
+ * Sorting the rows of an ORDER BY query: in memory, or past a memory limit,
+ * in sorted runs spilled to temporary files and merged.
+ *
+ * Each row is a sort key and the row's output, printed when the row was read.
+ * The key is all of the row's ORDER BY values, encoded by sort_key_append()
+ * into one string of bytes that compares with memcmp() the way the rows
+ * should sort, so sorting doesn't need to know the values' types, how many
+ * there are, or which way each of them sorts.
+ * Rows are kept in memory until they take up more than the memory limit;
+ * then they are sorted and written out to a temporary file as a run, and
+ * memory starts over. At the end, the runs are merged with a loser tree,
+ * at most MAX_MERGE_WAYS of them at a time; so that they don't all hold a
+ * file open until then, the first of them are merged as they pile up.
+ *
+ * Rows with equal keys stay in the order they were read in, so the output
+ * doesn't depend on how the rows were split into runs, or between threads
+ * to sort them with.
+ *
+ * With a limit of N rows, the rows in memory are kept in a heap with the
+ * last of them on top, and a row only gets in if it comes before that one,
+ * so memory is bounded by the N rows that are first so far. Each run then
+ * holds at most N rows, and merging stops after N.
+ *
+ * Rows that come in order don't need sorting at all: if they turn out to be,
+ * or nearly so, sorting them is skipped or is a merge of the runs that are in
+ * order; and if they are known to be beforehand, they can be printed as they
+ * are added, without keeping them.
+ *
+ * Rows read by other threads are gathered in sorters of their own, which
+ * only hold them until the main sorter takes them; past their memory limit,
+ * they write them out in the order they were added instead of sorting them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <sysexits.h>
+#include <pthread.h>
+
+#include "growbuf.h"
+#include "queryparse.h"
+#include "extsort.h"
+
+#define DEBUG if (false)
+//#define DEBUG
+
+/**
+ * Most runs merged at once. With more than this, groups of them are merged
+ * into longer runs first.
+ */
+#define MAX_MERGE_WAYS 64
+
+/**
+ * Most runs kept before the first MAX_MERGE_WAYS of them are merged, while
+ * rows are still being added: each of them has a temporary file open.
+ */
+#define MAX_OPEN_RUNS (2 * MAX_MERGE_WAYS)
+
+/**
+ * Bounds on the stdio buffer of each temporary file.
+ */
+#define MIN_SPILL_BUFFER_SIZE (16 * 1024)
+#define MAX_SPILL_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Fewer rows than this are sorted with qsort() rather than a radix sort.
+ */
+#define RADIX_MIN_ROWS 64
+
+/**
+ * Groups of fewer rows than this are left by the MSD radix sort to be
+ * sorted by insertion.
+ */
+#define MSD_INSERTION_ROWS 32
+
+/**
+ * Most threads the rows in memory are sorted with, and fewest rows each one
+ * is given.
+ */
+#define MAX_SORT_THREADS 64
+#define PARALLEL_SORT_MIN_ROWS (64 * 1024)
+
+/**
+ * Rows that are already in order except for at most this many places are
+ * sorted by merging the runs between those places.
+ */
+#define NATURAL_MERGE_MAX_RUNS 64
+
+/**
+ * Output of rows pushed out of a limited sort is only reclaimed once there is
+ * at least this much of it, and more of it than of output still in use.
+ */
+#define MIN_ARENA_GARBAGE (64 * 1024)
+
+typedef struct {
+    size_t seq;             // order the row was added in
+    size_t key_offset;      // where the row's key is in keys
+    size_t key_len;
+    size_t output_offset;   // where the row's output is in the arena
+    size_t output_len;
+} sort_row;
+
+typedef struct {
+    FILE*  file;
+    size_t num_rows;
+} sort_run;
+
+struct _sorter {
+    size_t   memory_limit;
+    size_t   limit;         // most rows to print; SIZE_MAX for all of them
+    growbuf* rows;          // sort_row for the rows in memory; a heap, if
+                            // there is a limit
+    FILE*    arena;         // the rows' output
+    char*    arena_buf;
+    size_t   arena_len;
+    growbuf* keys;          // the rows' keys
+    size_t   garbage;       // bytes of output and keys no row uses
+    size_t   num_added;     // rows added so far
+    sort_method method;     // how to sort rows in memory
+    size_t   num_threads;   // how many threads to sort them with
+    long     row_start;     // where the output of the row being added starts
+    growbuf* runs;          // sort_run for each run spilled
+    FILE*    stream;        // where rows are printed as they're added, when
+                            // they come in order; or NULL to sort them
+    growbuf* last_key;      // key of the last row printed there
+    bool     holding;       // rows are only held for another sorter to take
+    FILE*    overflow;      // rows held past the memory limit, in the order
+                            // they were added
+    size_t   accounted;     // memory counted for this sorter in memory_in_use
+    int      error;
+};
+
+/**
+ * Memory taken by the rows of all sorters, and the most it has been; see
+ * sorter_peak_memory().
+ */
+static size_t memory_in_use = 0;
+static size_t memory_peak = 0;
+
+/**
+ * A run being merged, and the row at its head.
+ */
+typedef struct {
+    FILE*    file;
+    bool     done;
+    size_t   seq;
+    growbuf* key;           // the row's key
+    growbuf* output;        // the row's output
+} merge_source;
+
+/**
+ * Append a value to a row's sort key, encoded so that memcmp() of two keys
+ * orders them by this value after the ones before it:
+ *   an int is 8 bytes, big-endian, with the sign bit flipped;
+ *   a float is 8 bytes, big-endian, with the sign bit flipped if it is
+ *     positive, and all of the bits flipped if it is negative;
+ *   a string is its bytes and a terminating NUL (it can't have others).
+ * For a descending sort, all of the bytes are flipped.
+ *
+ * Arguments:
+ *   key	- the key so far
+ *   value	- the value, evaluated for the row
+ *   descending	- whether the value sorts from the biggest down
+ */
+void sort_key_append(growbuf* key, const val* value, bool descending)
+{
+    size_t start = key->size;
+    uint64_t bits = 0;
+    bool fixed = true;
+
+    if (value->is_num) {
+        bits = (uint64_t)value->num ^ ((uint64_t)1 << 63);
+    }
+    else if (value->is_dbl) {
+        double d = value->dbl;
+        if (0.0 == d) {
+            d = 0.0;    // -0.0 sorts the same as 0.0
+        }
+        else if (isnan(d)) {
+            d = NAN;
+        }
+        memcpy(&bits, &d, sizeof(bits));
+        bits = (bits >> 63) ? ~bits : (bits | ((uint64_t)1 << 63));
+    }
+    else if (value->is_str) {
+        growbuf_append(key, value->str, strnlen(value->str, value->len));
+        growbuf_append(key, "", 1);
+        fixed = false;
+    }
+
+    if (fixed) {
+        unsigned char be[8];
+        for (size_t i = 0; i < 8; i++) {
+            be[i] = (unsigned char)(bits >> (56 - 8 * i));
+        }
+        growbuf_append(key, be, sizeof(be));
+    }
+
+    if (descending) {
+        unsigned char* p = (unsigned char*)key->buf;
+        for (size_t i = start; i < key->size; i++) {
+            p[i] = ~p[i];
+        }
+    }
+}
+
+/**
+ * Order of two rows: by key, then by the order they were added in.
+ */
+static int compare_keys(
+        const void* a_key,
+        size_t a_len,
+        size_t a_seq,
+        const void* b_key,
+        size_t b_len,
+        size_t b_seq)
+{
+    int c = memcmp(a_key, b_key, (a_len < b_len) ? a_len : b_len);
+    if (0 == c) {
+        c = (a_len > b_len) - (a_len < b_len);
+    }
+    if (0 == c) {
+        c = (a_seq > b_seq) - (a_seq < b_seq);
+    }
+    return c;
+}
+
+static int compare_rows(const sorter* s, const sort_row* a, const sort_row* b)
+{
+    const char* keys = (const char*)s->keys->buf;
+    return compare_keys(keys + a->key_offset, a->key_len, a->seq,
+            keys + b->key_offset, b->key_len, b->seq);
+}
+
+static int row_comparator(const void* avoid, const void* bvoid, void* context)
+{
+    return compare_rows((const sorter*)context,
+            *(const sort_row**)avoid, *(const sort_row**)bvoid);
+}
+
+/**
+ * Create a sorter.
+ *
+ * Arguments:
+ *   memory_limit	- how much memory the rows may take before they are
+ *			  spilled to a temporary file; SIZE_MAX for no limit
+ *   limit		- how many of the first rows to print; SIZE_MAX for
+ *			  all of them
+ *
+ * Return Value:
+ *   the sorter, or NULL if out of memory.
+ */
+sorter* sorter_create(size_t memory_limit, size_t limit)
+{
+    sorter* s = (sorter*)calloc(1, sizeof(sorter));
+    if (NULL == s) {
+        return NULL;
+    }
+
+    s->memory_limit = memory_limit;
+    s->limit = limit;
+    s->rows = growbuf_create(0);
+    s->keys = growbuf_create(0);
+    s->runs = growbuf_create(0);
+    s->arena = open_memstream(&s->arena_buf, &s->arena_len);
+
+    if (NULL == s->rows || NULL == s->keys || NULL == s->runs || NULL == s->arena) {
+        sorter_free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+/**
+ * Throw away the rows in memory, and start a new arena.
+ */
+static int clear_rows(sorter* s)
+{
+    s->rows->size = 0;
+    s->keys->size = 0;
+    s->garbage = 0;
+
+    if (NULL != s->arena) {
+        fclose(s->arena);
+    }
+    free(s->arena_buf);
+    s->arena_buf = NULL;
+    s->arena_len = 0;
+    s->arena = open_memstream(&s->arena_buf, &s->arena_len);
+
+    return (NULL == s->arena) ? EX_OSERR : 0;
+}
+
+void sorter_free(sorter* s)
+{
+    if (NULL == s) {
+        return;
+    }
+
+    growbuf_free(s->rows);
+    growbuf_free(s->keys);
+    growbuf_free(s->last_key);
+
+    if (NULL != s->runs) {
+        sort_run* runs = (sort_run*)s->runs->buf;
+        for (size_t i = 0; i < s->runs->size / sizeof(sort_run); i++) {
+            fclose(runs[i].file);
+        }
+        growbuf_free(s->runs);
+    }
+
+    if (NULL != s->overflow) {
+        fclose(s->overflow);
+    }
+
+    if (NULL != s->arena) {
+        fclose(s->arena);
+    }
+    free(s->arena_buf);
+    __atomic_sub_fetch(&memory_in_use, s->accounted, __ATOMIC_RELAXED);
+    free(s);
+}
+
+/**
+ * Open a temporary file for a run. It is unlinked right away, so it goes
+ * away when it is closed, or if the program dies.
+ */
+static FILE* open_spill_file(sorter* s)
+{
+    const char* dir = getenv("TMPDIR");
+    char* path = NULL;
+
+    if (NULL == dir || '\0' == *dir) {
+        dir = "/tmp";
+    }
+
+    if (-1 == asprintf(&path, "%s/csvsel-sort-XXXXXX", dir)) {
+        fprintf(stderr, "malloc failed\n");
+        return NULL;
+    }
+
+    int fd = mkstemp(path);
+    if (-1 == fd) {
+        perror("error creating temporary file");
+        free(path);
+        return NULL;
+    }
+    unlink(path);
+    free(path);
+
+    FILE* file = fdopen(fd, "w+b");
+    if (NULL == file) {
+        perror("error creating temporary file");
+        close(fd);
+        return NULL;
+    }
+
+    size_t buffer_size = s->memory_limit / (MAX_MERGE_WAYS + 1);
+    if (buffer_size < MIN_SPILL_BUFFER_SIZE) {
+        buffer_size = MIN_SPILL_BUFFER_SIZE;
+    }
+    else if (buffer_size > MAX_SPILL_BUFFER_SIZE) {
+        buffer_size = MAX_SPILL_BUFFER_SIZE;
+    }
+    setvbuf(file, NULL, _IOFBF, buffer_size);
+
+    return file;
+}
+
+//
+// Rows in a run are written as:
+//   sequence number     varint
+//   key length          varint
+//   key
+//   output length       varint
+//   output
+// Varints are 7 bits a byte, low bits first, with the high bit set on all
+// but the last byte.
+//
+
+static void write_varint(FILE* file, uint64_t n)
+{
+    while (n >= 0x80) {
+        putc((int)(n & 0x7f) | 0x80, file);
+        n >>= 7;
+    }
+    putc((int)n, file);
+}
+
+/**
+ * Returns 1 if a varint was read, 0 at the end of the file, -1 if the file
+ * ends in the middle of one.
+ */
+static int read_varint(FILE* file, uint64_t* n)
+{
+    *n = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(file);
+        if (EOF == c) {
+            return (0 == shift) ? 0 : -1;
+        }
+        *n |= (uint64_t)(c & 0x7f) << shift;
+        if (0 == (c & 0x80)) {
+            return 1;
+        }
+    }
+    return -1;
+}
+
+static void write_row(
+        FILE* file,
+        size_t seq,
+        const char* key,
+        size_t key_len,
+        const char* output,
+        size_t output_len)
+{
+    write_varint(file, seq);
+    write_varint(file, key_len);
+    fwrite(key, 1, key_len, file);
+    write_varint(file, output_len);
+    fwrite(output, 1, output_len, file);
+}
+
+/**
+ * Read len bytes of a file into a growbuf, replacing what was in it.
+ */
+static bool read_bytes(FILE* file, growbuf* g, size_t len)
+{
+    if (g->allocated_size < len + 1) {
+        void* buf = realloc(g->buf, len + 1);
+        if (NULL == buf) {
+            return false;
+        }
+        g->buf = buf;
+        g->allocated_size = len + 1;
+    }
+
+    g->size = len;
+    ((char*)g->buf)[len] = '\0';
+    return (len == fread(g->buf, 1, len, file));
+}
+
+/**
+ * Read the next row of a run into a merge source.
+ *
+ * Return Value:
+ *   0 on success or at the end of the run, EX_IOERR if it can't be read.
+ */
+static int read_row(merge_source* src)
+{
+    uint64_t seq, len;
+
+    int got = read_varint(src->file, &seq);
+    if (0 == got) {
+        src->done = true;
+        return 0;
+    }
+    else if (got < 0) {
+        goto error;
+    }
+
+    src->seq = seq;
+
+    if (1 != read_varint(src->file, &len)
+            || !read_bytes(src->file, src->key, len)) {
+        goto error;
+    }
+
+    if (1 != read_varint(src->file, &len)
+            || !read_bytes(src->file, src->output, len)) {
+        goto error;
+    }
+
+    return 0;
+
+error:
+    fprintf(stderr, "error reading temporary file\n");
+    return EX_IOERR;
+}
+
+/**
+ * Whether merge source a loses to b, i.e. comes after it. k stands for a
+ * source that beats every other, and a finished source loses to any that
+ * isn't.
+ */
+static bool loses(merge_source* sources, size_t k, size_t a, size_t b)
+{
+    if (a == k) {
+        return false;
+    }
+    if (b == k) {
+        return true;
+    }
+    if (sources[a].done || sources[b].done) {
+        return sources[a].done && !sources[b].done;
+    }
+
+    return compare_keys(sources[a].key->buf, sources[a].key->size, sources[a].seq,
+            sources[b].key->buf, sources[b].key->size, sources[b].seq) > 0;
+}
+
+/**
+ * Play source s's new head row up the loser tree, from its leaf to the top.
+ */
+static void adjust(size_t* tree, merge_source* sources, size_t k, size_t s)
+{
+    for (size_t t = (s + k) / 2; t > 0; t /= 2) {
+        if (loses(sources, k, s, tree[t])) {
+            size_t winner = tree[t];
+            tree[t] = s;
+            s = winner;
+        }
+    }
+    tree[0] = s;
+}
+
+/**
+ * Merge runs into one stream of rows, with a loser tree: tree[0] is the
+ * source with the first row, and every other node holds the source that lost
+ * the match played there, so taking a row only means replaying the matches
+ * on its source's path to the top.
+ *
+ * Arguments:
+ *   s		- the sorter
+ *   runs	- runs to merge
+ *   k		- number of runs
+ *   output	- where to print the rows' output, or NULL
+ *   spill	- where to write the rows as one run, if output is NULL
+ *   num_rows	- receives the number of rows merged, which stops at the
+ *		  sorter's limit
+ *
+ * Return Value:
+ *   0 on success, or an exit code.
+ */
+static int merge_runs(
+        sorter* s,
+        sort_run* runs,
+        size_t k,
+        FILE* output,
+        FILE* spill,
+        size_t* num_rows)
+{
+    int retval = 0;
+    merge_source* sources = calloc(k, sizeof(merge_source));
+    size_t* tree = calloc(k, sizeof(size_t));
+
+    if (NULL == sources || NULL == tree) {
+        fprintf(stderr, "malloc failed\n");
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        sources[i].file = runs[i].file;
+        sources[i].key = growbuf_create(64);
+        sources[i].output = growbuf_create(256);
+        if (NULL == sources[i].key || NULL == sources[i].output) {
+            fprintf(stderr, "malloc failed\n");
+            retval = EX_OSERR;
+            goto cleanup;
+        }
+
+        retval = read_row(&sources[i]);
+        if (0 != retval) {
+            goto cleanup;
+        }
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        tree[i] = k;
+    }
+    for (size_t i = k; i > 0; i--) {
+        adjust(tree, sources, k, i - 1);
+    }
+
+    *num_rows = 0;
+    while (!sources[tree[0]].done && *num_rows < s->limit) {
+        merge_source* src = &sources[tree[0]];
+        (*num_rows)++;
+
+        if (NULL != output) {
+            fwrite(src->output->buf, 1, src->output->size, output);
+        }
+        else {
+            write_row(spill, src->seq, src->key->buf, src->key->size,
+                    src->output->buf, src->output->size);
+        }
+
+        retval = read_row(src);
+        if (0 != retval) {
+            goto cleanup;
+        }
+        adjust(tree, sources, k, tree[0]);
+    }
+
+cleanup:
+    if (NULL != sources) {
+        for (size_t i = 0; i < k; i++) {
+            growbuf_free(sources[i].key);
+            growbuf_free(sources[i].output);
+        }
+    }
+    free(sources);
+    free(tree);
+
+    return retval;
+}
+
+/**
+ * A row's key, or the first 8 bytes of it, as a number, with the row: what
+ * the LSD radix sort moves around.
+ */
+typedef struct {
+    uint64_t  key;
+    sort_row* row;
+} radix_item;
+
+/**
+ * Sort rows whose keys are all the same length, and no longer than 8 bytes
+ * (one int or float ORDER BY value), with an LSD radix sort: a stable
+ * counting sort on each byte of the key, from the last one to the first.
+ * Bytes that are the same in every key are skipped.
+ *
+ * Arguments:
+ *   s		- the sorter
+ *   sorted	- the rows, in the order they were added; sorted in place
+ *   num_rows	- number of rows
+ *   key_len	- length of every key
+ *
+ * Return Value:
+ *   true on success, false if out of memory.
+ */
+static bool lsd_radix_sort(sorter* s, sort_row** sorted, size_t num_rows, size_t key_len)
+{
+    radix_item* a = malloc(num_rows * sizeof(radix_item));
+    radix_item* b = malloc(num_rows * sizeof(radix_item));
+    size_t counts[8][256];
+
+    if (NULL == a || NULL == b) {
+        free(a);
+        free(b);
+        return false;
+    }
+
+    memset(counts, 0, sizeof(counts));
+
+    const unsigned char* keys = (const unsigned char*)s->keys->buf;
+    for (size_t i = 0; i < num_rows; i++) {
+        const unsigned char* k = keys + sorted[i]->key_offset;
+        uint64_t key = 0;
+        for (size_t j = 0; j < key_len; j++) {
+            key = (key << 8) | k[j];
+        }
+        a[i].key = key;
+        a[i].row = sorted[i];
+
+        for (size_t pass = 0; pass < key_len; pass++) {
+            counts[pass][(key >> (8 * pass)) & 0xff]++;
+        }
+    }
+
+    for (size_t pass = 0; pass < key_len; pass++) {
+        size_t* count = counts[pass];
+        unsigned int shift = 8 * pass;
+
+        if (count[(a[0].key >> shift) & 0xff] == num_rows) {
+            continue;
+        }
+
+        size_t pos = 0;
+        for (size_t d = 0; d < 256; d++) {
+            size_t c = count[d];
+            count[d] = pos;
+            pos += c;
+        }
+
+        for (size_t i = 0; i < num_rows; i++) {
+            b[count[(a[i].key >> shift) & 0xff]++] = a[i];
+        }
+
+        radix_item* t = a;
+        a = b;
+        b = t;
+    }
+
+    for (size_t i = 0; i < num_rows; i++) {
+        sorted[i] = a[i].row;
+    }
+
+    free(a);
+    free(b);
+    return true;
+}
+
+/**
+ * Sort a few rows by insertion, comparing their keys from some byte on.
+ */
+static void insertion_sort(const char* keys, sort_row** rows, size_t n, size_t depth)
+{
+    for (size_t i = 1; i < n; i++) {
+        sort_row* r = rows[i];
+        size_t j = i;
+        while (j > 0 && compare_keys(keys + r->key_offset + depth, r->key_len - depth, r->seq,
+                    keys + rows[j - 1]->key_offset + depth, rows[j - 1]->key_len - depth,
+                    rows[j - 1]->seq) < 0) {
+            rows[j] = rows[j - 1];
+            j--;
+        }
+        rows[j] = r;
+    }
+}
+
+/**
+ * A range of rows left for the MSD radix sort to sort, whose keys are the
+ * same up to depth.
+ */
+typedef struct {
+    size_t start;
+    size_t n;
+    size_t depth;
+} msd_range;
+
+/**
+ * Sort rows with an MSD radix sort: a stable counting sort on the first byte
+ * of the keys (or the end of the key), then the same on the next byte within
+ * each group of rows that had the same one, until the groups are small
+ * enough to sort by insertion. The ranges left to sort are kept on a stack
+ * of their own, since long keys could take the recursion very deep.
+ *
+ * Arguments:
+ *   s		- the sorter
+ *   sorted	- the rows, in the order they were added; sorted in place
+ *   num_rows	- number of rows
+ *
+ * Return Value:
+ *   true on success, false if out of memory.
+ */
+static bool msd_radix_sort(sorter* s, sort_row** sorted, size_t num_rows)
+{
+    const char* keys = (const char*)s->keys->buf;
+    sort_row** tmp = malloc(num_rows * sizeof(sort_row*));
+    uint16_t* digits = malloc(num_rows * sizeof(uint16_t));
+    growbuf* stack = growbuf_create(64 * sizeof(msd_range));
+    size_t counts[257];
+
+    if (NULL == tmp || NULL == digits || NULL == stack) {
+        free(tmp);
+        free(digits);
+        growbuf_free(stack);
+        return false;
+    }
+
+    msd_range all = { 0, num_rows, 0 };
+    growbuf_append(stack, &all, sizeof(all));
+
+    while (stack->size > 0) {
+        stack->size -= sizeof(msd_range);
+        msd_range r = *(msd_range*)((char*)stack->buf + stack->size);
+        sort_row** rows = sorted + r.start;
+
+        if (r.n < MSD_INSERTION_ROWS) {
+            insertion_sort(keys, rows, r.n, r.depth);
+            continue;
+        }
+
+        //
+        // Digit 0 is for keys that end here; they are the same as each
+        // other, and come first.
+        //
+
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < r.n; i++) {
+            uint16_t d = 0;
+            if (rows[i]->key_len > r.depth) {
+                d = 1 + (unsigned char)keys[rows[i]->key_offset + r.depth];
+            }
+            digits[i] = d;
+            counts[d]++;
+        }
+
+        if (counts[digits[0]] == r.n) {
+            // all the same here; go on to the next byte, unless they all ended
+            if (0 != digits[0]) {
+                r.depth++;
+                growbuf_append(stack, &r, sizeof(r));
+            }
+            continue;
+        }
+
+        size_t pos = 0;
+        for (size_t d = 0; d < 257; d++) {
+            size_t c = counts[d];
+            counts[d] = pos;
+            pos += c;
+        }
+
+        for (size_t i = 0; i < r.n; i++) {
+            tmp[counts[digits[i]]++] = rows[i];
+        }
+        memcpy(rows, tmp, r.n * sizeof(sort_row*));
+
+        // counts[d] is now where group d ends
+        for (size_t d = 1; d < 257; d++) {
+            size_t start = counts[d - 1];
+            size_t n = counts[d] - start;
+            if (n > 1) {
+                msd_range next = { r.start + start, n, r.depth + 1 };
+                growbuf_append(stack, &next, sizeof(next));
+            }
+        }
+    }
+
+    free(tmp);
+    free(digits);
+    growbuf_free(stack);
+    return true;
+}
+
+/**
+ * Sort rows that are in the order they were added: with a radix sort, unless
+ * it is a comparison sort that's wanted, or there isn't memory for one.
+ *
+ * Arguments:
+ *   s		- the sorter
+ *   sorted	- the rows; sorted in place
+ *   num_rows	- number of rows
+ *   key_len	- length of every key, or SIZE_MAX if they aren't all the same
+ *   method	- SORT_RADIX or SORT_COMPARISON
+ */
+static void sort_range(
+        sorter* s,
+        sort_row** sorted,
+        size_t num_rows,
+        size_t key_len,
+        sort_method method)
+{
+    bool done = false;
+    if (SORT_RADIX == method) {
+        done = (key_len <= 8)
+            ? lsd_radix_sort(s, sorted, num_rows, key_len)
+            : msd_radix_sort(s, sorted, num_rows);
+    }
+
+    if (!done) {
+        qsort_r(sorted, num_rows, sizeof(sort_row*), &row_comparator, s);
+    }
+}
+
+/**
+ * One thread's part of a parallel sort: first a range of the rows to sort,
+ * then a range of the output to merge into.
+ */
+typedef struct {
+    sorter*     s;
+    sort_row**  rows;       // the rows to sort
+    size_t      num_rows;
+    size_t      key_len;
+    sort_method method;
+    size_t      num_parts;
+    sort_row*** heads;      // where each sorted part's rows for this thread
+    sort_row*** ends;       //  start and end
+    sort_row**  merged;     // where to merge them to
+} sort_task;
+
+static void* sort_worker(void* arg)
+{
+    sort_task* task = arg;
+    sort_range(task->s, task->rows, task->num_rows, task->key_len, task->method);
+    return NULL;
+}
+
+/**
+ * Merge this thread's rows from each sorted part, keeping the parts in a
+ * heap by their next row.
+ */
+static void* merge_worker(void* arg)
+{
+    sort_task* task = arg;
+    sort_row*** heads = task->heads;
+    sort_row*** ends = task->ends;
+    sort_row** out = task->merged;
+    size_t heap[MAX_SORT_THREADS];
+    size_t n = 0;
+
+    for (size_t p = 0; p < task->num_parts; p++) {
+        if (heads[p] == ends[p]) {
+            continue;
+        }
+
+        size_t i = n++;
+        while (i > 0 && compare_rows(task->s, *heads[p], *heads[heap[(i - 1) / 2]]) < 0) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = p;
+    }
+
+    while (n > 0) {
+        size_t p = heap[0];
+        *out++ = *heads[p]++;
+
+        if (heads[p] == ends[p]) {
+            p = heap[--n];
+        }
+
+        size_t i = 0;
+        for (;;) {
+            size_t child = 2 * i + 1;
+            if (child >= n) {
+                break;
+            }
+            if (child + 1 < n
+                    && compare_rows(task->s, *heads[heap[child + 1]], *heads[heap[child]]) < 0) {
+                child++;
+            }
+            if (compare_rows(task->s, *heads[p], *heads[heap[child]]) <= 0) {
+                break;
+            }
+            heap[i] = heap[child];
+            i = child;
+        }
+        if (n > 0) {
+            heap[i] = p;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Where the first row not before a given one is, in sorted rows.
+ */
+static sort_row** lower_bound(const sorter* s, sort_row** rows, size_t n, const sort_row* row)
+{
+    while (n > 0) {
+        size_t half = n / 2;
+        if (compare_rows(s, rows[half], row) < 0) {
+            rows += half + 1;
+            n -= half + 1;
+        }
+        else {
+            n = half;
+        }
+    }
+    return rows;
+}
+
+/**
+ * Run a function for each task on a thread of its own. Tasks that a thread
+ * couldn't be started for are run on this one.
+ */
+static void run_tasks(void* (*func)(void*), sort_task* tasks, size_t num_tasks)
+{
+    pthread_t threads[MAX_SORT_THREADS];
+    bool started[MAX_SORT_THREADS];
+
+    for (size_t i = 1; i < num_tasks; i++) {
+        started[i] = (0 == pthread_create(&threads[i], NULL, func, &tasks[i]));
+    }
+
+    (*func)(&tasks[0]);
+
+    for (size_t i = 1; i < num_tasks; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        else {
+            (*func)(&tasks[i]);
+        }
+    }
+}
+
+/**
+ * Sort rows on several threads: each sorts an equal part of them, and then
+ * each merges the rows from all the parts that fall between two splitters,
+ * chosen from evenly spaced rows of each sorted part, to its own part of the
+ * output.
+ * Rows never compare equal, since the order they were added in breaks ties,
+ * so the result is the same as sorting them on one thread.
+ *
+ * Arguments:
+ *   s		- the sorter
+ *   sorted	- the rows, in the order they were added
+ *   num_rows	- number of rows
+ *   key_len	- length of every key, or SIZE_MAX if they aren't all the same
+ *   method	- SORT_RADIX or SORT_COMPARISON
+ *   num_threads - threads to sort them with, at most MAX_SORT_THREADS
+ *
+ * Return Value:
+ *   the sorted rows: a new array, with sorted freed; or if there isn't memory
+ *   for one, sorted, sorted on one thread.
+ */
+static sort_row** parallel_sort(
+        sorter* s,
+        sort_row** sorted,
+        size_t num_rows,
+        size_t key_len,
+        sort_method method,
+        size_t num_threads)
+{
+    size_t t = num_threads;
+    sort_task tasks[MAX_SORT_THREADS];
+    size_t starts[MAX_SORT_THREADS + 1];
+    sort_row** merged = malloc((num_rows + 1) * sizeof(sort_row*));
+    sort_row** samples = malloc(t * t * sizeof(sort_row*));
+    sort_row*** cuts = malloc(t * (t + 1) * sizeof(sort_row**));
+    sort_row*** heads = malloc(2 * t * t * sizeof(sort_row**));
+
+    if (NULL == merged || NULL == samples || NULL == cuts || NULL == heads) {
+        free(merged);
+        free(samples);
+        free(cuts);
+        free(heads);
+        sort_range(s, sorted, num_rows, key_len, method);
+        return sorted;
+    }
+
+    for (size_t i = 0; i <= t; i++) {
+        starts[i] = num_rows * i / t;
+    }
+
+    for (size_t i = 0; i < t; i++) {
+        sort_task task = { s, sorted + starts[i], starts[i + 1] - starts[i], key_len, method };
+        tasks[i] = task;
+    }
+    run_tasks(&sort_worker, tasks, t);
+
+    //
+    // Splitter j is the j * t'th of the samples, in order: a part of the
+    // output each has fewer than twice its share of the rows.
+    // cuts[p * (t + 1) + j] is where in part p the rows for thread j start.
+    //
+
+    for (size_t p = 0; p < t; p++) {
+        size_t n = starts[p + 1] - starts[p];
+        for (size_t i = 0; i < t; i++) {
+            samples[p * t + i] = sorted[starts[p] + n * i / t];
+        }
+    }
+    qsort_r(samples, t * t, sizeof(sort_row*), &row_comparator, s);
+
+    for (size_t p = 0; p < t; p++) {
+        sort_row** part = sorted + starts[p];
+        size_t n = starts[p + 1] - starts[p];
+        cuts[p * (t + 1)] = part;
+        cuts[p * (t + 1) + t] = part + n;
+        for (size_t j = 1; j < t; j++) {
+            cuts[p * (t + 1) + j] = lower_bound(s, part, n, samples[j * t]);
+        }
+    }
+
+    size_t out = 0;
+    for (size_t j = 0; j < t; j++) {
+        tasks[j].num_parts = t;
+        tasks[j].heads = heads + 2 * t * j;
+        tasks[j].ends = tasks[j].heads + t;
+        tasks[j].merged = merged + out;
+        for (size_t p = 0; p < t; p++) {
+            tasks[j].heads[p] = cuts[p * (t + 1) + j];
+            tasks[j].ends[p] = cuts[p * (t + 1) + j + 1];
+            out += tasks[j].ends[p] - tasks[j].heads[p];
+        }
+    }
+    run_tasks(&merge_worker, tasks, t);
+
+    free(samples);
+    free(cuts);
+    free(heads);
+    free(sorted);
+    return merged;
+}
+
+/**
+ * Sort rows that are in order but for a few places, by merging the runs in
+ * between, two at a time: ties go to the earlier run, so this is stable.
+ *
+ * Arguments:
+ *   s		- the sorter
+ *   sorted	- the rows, in the order they were added
+ *   num_rows	- number of rows
+ *
+ * Return Value:
+ *   the sorted rows: sorted, or a new array with sorted freed; or NULL if out
+ *   of memory, leaving sorted as it was.
+ */
+static sort_row** natural_merge_sort(sorter* s, sort_row** sorted, size_t num_rows)
+{
+    sort_row** tmp = malloc((num_rows + 1) * sizeof(sort_row*));
+    growbuf* starts = growbuf_create(NATURAL_MERGE_MAX_RUNS * sizeof(size_t));
+
+    if (NULL == tmp || NULL == starts) {
+        free(tmp);
+        growbuf_free(starts);
+        return NULL;
+    }
+
+    //
+    // starts holds where each run starts, and then the end of the rows.
+    //
+
+    size_t start = 0;
+    growbuf_append(starts, &start, sizeof(start));
+    for (size_t i = 1; i < num_rows; i++) {
+        if (compare_rows(s, sorted[i - 1], sorted[i]) > 0) {
+            growbuf_append(starts, &i, sizeof(i));
+        }
+    }
+    growbuf_append(starts, &num_rows, sizeof(num_rows));
+
+    while (starts->size / sizeof(size_t) > 2) {
+        size_t* bounds = (size_t*)starts->buf;
+        size_t num_runs = starts->size / sizeof(size_t) - 1;
+        size_t num_merged = 0;
+
+        for (size_t r = 0; r < num_runs; r += 2) {
+            size_t a = bounds[r];
+            size_t mid = bounds[r + 1];
+            size_t end = bounds[(r + 2 < num_runs) ? r + 2 : num_runs];
+            size_t b = mid;
+            size_t out = a;
+
+            while (a < mid && b < end) {
+                tmp[out++] = (compare_rows(s, sorted[b], sorted[a]) < 0)
+                    ? sorted[b++] : sorted[a++];
+            }
+            memcpy(tmp + out, sorted + a, (mid - a) * sizeof(sort_row*));
+            out += mid - a;
+            memcpy(tmp + out, sorted + b, (end - b) * sizeof(sort_row*));
+
+            bounds[num_merged++] = bounds[r];
+        }
+        bounds[num_merged] = num_rows;
+        starts->size = (num_merged + 1) * sizeof(size_t);
+
+        sort_row** t = sorted;
+        sorted = tmp;
+        tmp = t;
+    }
+
+    free(tmp);
+    growbuf_free(starts);
+    return sorted;
+}
+
+/**
+ * Sort the rows in memory, by pointer.
+ *
+ * Rows are radix sorted, unless there are only a few of them, or they are
+ * the heap of a limited sort: the radix sorts are stable, and need the rows
+ * in the order they were added. With only fixed-size keys of up to 8 bytes,
+ * that is an LSD radix sort on them as numbers, and otherwise an MSD radix
+ * sort on their bytes.
+ * With more than one thread, and enough rows to keep them busy, parts of the
+ * rows are sorted this way on each thread and then merged.
+ * Rows that were added in order are left that way, and rows that are in order
+ * but for a few places are merged from the runs that are.
+ *
+ * Return Value:
+ *   the sorted pointers, or NULL if out of memory.
+ */
+static sort_row** sort_rows(sorter* s, size_t* num_rows)
+{
+    *num_rows = s->rows->size / sizeof(sort_row);
+
+    sort_row** sorted = malloc((*num_rows + 1) * sizeof(sort_row*));
+    if (NULL == sorted) {
+        fprintf(stderr, "malloc failed\n");
+        return NULL;
+    }
+
+    size_t key_len = SIZE_MAX;  // length of every key, if they're all the same
+    size_t num_descents = 0;    // places a row comes before the one ahead of it
+    for (size_t i = 0; i < *num_rows; i++) {
+        sorted[i] = &((sort_row*)s->rows->buf)[i];
+        if (0 == i) {
+            key_len = sorted[i]->key_len;
+        }
+        else {
+            if (sorted[i]->key_len != key_len) {
+                key_len = SIZE_MAX;
+            }
+            if (compare_rows(s, sorted[i - 1], sorted[i]) > 0) {
+                num_descents++;
+            }
+        }
+    }
+
+    // A limited sort's rows are in a heap, not the order they were added in.
+    if (SIZE_MAX == s->limit && SORT_AUTO == s->method) {
+        if (0 == num_descents) {
+            DEBUG fprintf(stderr, "%zu rows already in order\n", *num_rows);
+            return sorted;
+        }
+
+        if (num_descents < NATURAL_MERGE_MAX_RUNS) {
+            DEBUG fprintf(stderr, "merging %zu runs of rows in order\n", num_descents + 1);
+            sort_row** merged = natural_merge_sort(s, sorted, *num_rows);
+            if (NULL != merged) {
+                return merged;
+            }
+        }
+    }
+
+    sort_method method = s->method;
+    if (SORT_AUTO == method) {
+        method = (*num_rows < RADIX_MIN_ROWS) ? SORT_COMPARISON : SORT_RADIX;
+    }
+    if (SIZE_MAX != s->limit) {
+        method = SORT_COMPARISON;
+    }
+
+    size_t num_threads = *num_rows / PARALLEL_SORT_MIN_ROWS;
+    if (num_threads > s->num_threads) {
+        num_threads = s->num_threads;
+    }
+
+    if (num_threads > 1) {
+        return parallel_sort(s, sorted, *num_rows, key_len, method, num_threads);
+    }
+
+    sort_range(s, sorted, *num_rows, key_len, method);
+    return sorted;
+}
+
+/**
+ * Merge the first MAX_MERGE_WAYS runs into one, put after the others. Rows
+ * with equal keys still come out in the order they were added, since the
+ * merge goes by sequence number after the key.
+ */
+static int merge_first_runs(sorter* s)
+{
+    sort_run* runs = (sort_run*)s->runs->buf;
+    sort_run merged = { open_spill_file(s), 0 };
+    if (NULL == merged.file) {
+        return EX_CANTCREAT;
+    }
+
+    int retval = merge_runs(s, runs, MAX_MERGE_WAYS, NULL, merged.file,
+            &merged.num_rows);
+    if (0 == retval && (0 != fflush(merged.file) || ferror(merged.file))) {
+        perror("error writing temporary file");
+        retval = EX_IOERR;
+    }
+    if (0 != retval) {
+        fclose(merged.file);
+        return retval;
+    }
+    rewind(merged.file);
+
+    DEBUG fprintf(stderr, "merged %d runs into one of %zu rows\n", MAX_MERGE_WAYS,
+            merged.num_rows);
+
+    for (size_t i = 0; i < MAX_MERGE_WAYS; i++) {
+        fclose(runs[i].file);
+    }
+    s->runs->size -= MAX_MERGE_WAYS * sizeof(sort_run);
+    memmove(runs, runs + MAX_MERGE_WAYS, s->runs->size);
+    growbuf_append(s->runs, &merged, sizeof(merged));
+    return 0;
+}
+
+/**
+ * Sort the rows in memory and write them out as a run.
+ */
+static int spill_run(sorter* s)
+{
+    size_t num_rows;
+    sort_run run = { NULL, 0 };
+
+    if (0 != fflush(s->arena)) {
+        perror("error buffering output");
+        return EX_OSERR;
+    }
+
+    sort_row** sorted = sort_rows(s, &num_rows);
+    if (NULL == sorted) {
+        return EX_OSERR;
+    }
+
+    run.file = open_spill_file(s);
+    if (NULL == run.file) {
+        free(sorted);
+        return EX_CANTCREAT;
+    }
+
+    for (size_t i = 0; i < num_rows; i++) {
+        write_row(run.file, sorted[i]->seq,
+                (const char*)s->keys->buf + sorted[i]->key_offset, sorted[i]->key_len,
+                s->arena_buf + sorted[i]->output_offset, sorted[i]->output_len);
+    }
+    free(sorted);
+    run.num_rows = num_rows;
+
+    if (0 != fflush(run.file) || ferror(run.file)) {
+        perror("error writing temporary file");
+        fclose(run.file);
+        return EX_IOERR;
+    }
+    rewind(run.file);
+
+    DEBUG fprintf(stderr, "spilled a run of %zu rows\n", num_rows);
+
+    growbuf_append(s->runs, &run, sizeof(run));
+
+    // each run holds a file open, so don't let them pile up
+    if (s->runs->size / sizeof(sort_run) >= MAX_OPEN_RUNS) {
+        int retval = merge_first_runs(s);
+        if (0 != retval) {
+            return retval;
+        }
+    }
+
+    return clear_rows(s);
+}
+
+static int seq_comparator(const void* avoid, const void* bvoid);
+
+/**
+ * Write the rows in memory of a sorter that's only holding them out to its
+ * overflow file, in the order they were added, for sorter_take().
+ */
+static int overflow_rows(sorter* s)
+{
+    sort_row* rows = (sort_row*)s->rows->buf;
+    size_t num_rows = s->rows->size / sizeof(sort_row);
+
+    if (0 != fflush(s->arena)) {
+        perror("error buffering output");
+        return EX_OSERR;
+    }
+
+    if (NULL == s->overflow) {
+        s->overflow = open_spill_file(s);
+        if (NULL == s->overflow) {
+            return EX_CANTCREAT;
+        }
+    }
+
+    if (SIZE_MAX != s->limit) {
+        // put the heap back in the order the rows were added in
+        qsort(rows, num_rows, sizeof(sort_row), &seq_comparator);
+    }
+
+    for (size_t i = 0; i < num_rows; i++) {
+        write_row(s->overflow, rows[i].seq,
+                (const char*)s->keys->buf + rows[i].key_offset, rows[i].key_len,
+                s->arena_buf + rows[i].output_offset, rows[i].output_len);
+    }
+
+    if (ferror(s->overflow)) {
+        perror("error writing temporary file");
+        return EX_IOERR;
+    }
+
+    DEBUG fprintf(stderr, "held %zu rows in a temporary file\n", num_rows);
+
+    return clear_rows(s);
+}
+
+/**
+ * Whether a row belongs in a limited sort's heap: it isn't full yet, or the
+ * row comes before the last of the rows in it.
+ */
+static bool heap_wants(const sorter* s, const char* key, size_t key_len, size_t seq)
+{
+    const sort_row* top = (const sort_row*)s->rows->buf;
+
+    if (s->rows->size / sizeof(sort_row) < s->limit) {
+        return true;
+    }
+    return s->limit > 0
+        && compare_keys(key, key_len, seq, (const char*)s->keys->buf + top->key_offset,
+                top->key_len, top->seq) < 0;
+}
+
+static void swap_rows(sort_row* rows, size_t a, size_t b)
+{
+    sort_row t = rows[a];
+    rows[a] = rows[b];
+    rows[b] = t;
+}
+
+/**
+ * Whether row a of the heap should be above row b, i.e. comes after it.
+ */
+static bool heap_above(const sorter* s, const sort_row* rows, size_t a, size_t b)
+{
+    return compare_rows(s, &rows[a], &rows[b]) > 0;
+}
+
+static void sift_up(sorter* s, size_t i)
+{
+    sort_row* rows = (sort_row*)s->rows->buf;
+    while (i > 0 && heap_above(s, rows, i, (i - 1) / 2)) {
+        swap_rows(rows, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(sorter* s, size_t i)
+{
+    sort_row* rows = (sort_row*)s->rows->buf;
+    size_t n = s->rows->size / sizeof(sort_row);
+
+    for (;;) {
+        size_t top = i;
+        size_t l = 2 * i + 1;
+        size_t r = l + 1;
+
+        if (l < n && heap_above(s, rows, l, top)) {
+            top = l;
+        }
+        if (r < n && heap_above(s, rows, r, top)) {
+            top = r;
+        }
+        if (top == i) {
+            break;
+        }
+        swap_rows(rows, i, top);
+        i = top;
+    }
+}
+
+/**
+ * Copy the output and keys still in use to a new arena and key buffer,
+ * leaving out those of rows pushed out of the heap.
+ */
+static int compact_arena(sorter* s)
+{
+    // closing the arena leaves its buffer in arena_buf
+    if (0 != fclose(s->arena)) {
+        s->arena = NULL;
+        perror("error buffering output");
+        return EX_OSERR;
+    }
+
+    char* old_buf = s->arena_buf;
+
+    s->arena_buf = NULL;
+    s->arena_len = 0;
+    s->arena = open_memstream(&s->arena_buf, &s->arena_len);
+    if (NULL == s->arena) {
+        fprintf(stderr, "malloc failed\n");
+        free(old_buf);
+        return EX_OSERR;
+    }
+
+    growbuf* old_keys = s->keys;
+    s->keys = growbuf_create(old_keys->size);
+    if (NULL == s->keys) {
+        fprintf(stderr, "malloc failed\n");
+        s->keys = old_keys;
+        free(old_buf);
+        return EX_OSERR;
+    }
+
+    sort_row* rows = (sort_row*)s->rows->buf;
+    for (size_t i = 0; i < s->rows->size / sizeof(sort_row); i++) {
+        long offset = ftell(s->arena);
+        fwrite(old_buf + rows[i].output_offset, 1, rows[i].output_len, s->arena);
+        rows[i].output_offset = offset;
+
+        offset = s->keys->size;
+        growbuf_append(s->keys, (const char*)old_keys->buf + rows[i].key_offset,
+                rows[i].key_len);
+        rows[i].key_offset = offset;
+    }
+
+    growbuf_free(old_keys);
+    free(old_buf);
+    s->garbage = 0;
+
+    return 0;
+}
+
+/**
+ * Put a row in a limited sort's heap, pushing out the last row if it is
+ * full, or throw it away if it doesn't get in.
+ */
+static int heap_add(sorter* s, sort_row* row)
+{
+    size_t n = s->rows->size / sizeof(sort_row);
+
+    if (n < s->limit) {
+        growbuf_append(s->rows, row, sizeof(*row));
+        sift_up(s, n);
+    }
+    else {
+        sort_row out = *row;    // the row that doesn't make it
+        if (heap_wants(s, (const char*)s->keys->buf + row->key_offset,
+                    row->key_len, row->seq)) {
+            sort_row* rows = (sort_row*)s->rows->buf;
+            out = rows[0];
+            rows[0] = *row;
+            sift_down(s, 0);
+        }
+        s->garbage += out.key_len + out.output_len;
+    }
+
+    size_t used = (size_t)ftell(s->arena) + s->keys->size - s->garbage;
+    if (s->garbage >= MIN_ARENA_GARBAGE && s->garbage > used) {
+        return compact_arena(s);
+    }
+
+    return 0;
+}
+
+/**
+ * Memory taken by the rows in memory, counting what it takes to sort them:
+ * the sorted pointers (twice, to merge them, with more than one thread), and
+ * an LSD radix sort's two arrays.
+ */
+static size_t memory_used(sorter* s)
+{
+    size_t num_rows = s->rows->size / sizeof(sort_row);
+    size_t pointers = (s->num_threads > 1) ? 2 : 1;
+    return s->rows->size + num_rows * (pointers * sizeof(sort_row*) + 2 * sizeof(radix_item))
+        + (size_t)ftell(s->arena) + s->keys->size;
+}
+
+/**
+ * Count a change in the memory a sorter's rows take toward memory_in_use.
+ */
+static void account_memory(sorter* s, size_t used)
+{
+    size_t total;
+
+    if (used >= s->accounted) {
+        total = __atomic_add_fetch(&memory_in_use, used - s->accounted, __ATOMIC_RELAXED);
+    }
+    else {
+        total = __atomic_sub_fetch(&memory_in_use, s->accounted - used, __ATOMIC_RELAXED);
+    }
+    s->accounted = used;
+
+    size_t peak = __atomic_load_n(&memory_peak, __ATOMIC_RELAXED);
+    while (total > peak && !__atomic_compare_exchange_n(&memory_peak, &peak, total,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static int check_memory(sorter* s)
+{
+    if (0 != s->error) {
+        return s->error;
+    }
+
+    size_t used = memory_used(s);
+    account_memory(s, used);
+
+    if (used > s->memory_limit) {
+        s->error = s->holding ? overflow_rows(s) : spill_run(s);
+        account_memory(s, memory_used(s));
+    }
+    return s->error;
+}
+
+/**
+ * Memory taken by the rows of all sorters at once, at its most since the
+ * last call: for testing that memory limits hold, with threads.
+ */
+size_t sorter_peak_memory(void)
+{
+    return __atomic_exchange_n(&memory_peak, __atomic_load_n(&memory_in_use, __ATOMIC_RELAXED),
+            __ATOMIC_RELAXED);
+}
+
+/**
+ * Choose how the rows in memory are sorted, instead of by how many there are
+ * and what their keys are like: for testing and benchmarks.
+ */
+void sorter_set_method(sorter* s, sort_method method)
+{
+    s->method = method;
+}
+
+/**
+ * Sort the rows in memory with up to this many threads, when there are
+ * enough of them.
+ */
+void sorter_set_threads(sorter* s, size_t num_threads)
+{
+    s->num_threads = (num_threads > MAX_SORT_THREADS) ? MAX_SORT_THREADS : num_threads;
+}
+
+/**
+ * Only hold the rows added, for another sorter to take with sorter_take():
+ * past the memory limit, write them out to a temporary file in the order they
+ * were added, instead of sorting them into a run.
+ */
+void sorter_hold(sorter* s)
+{
+    s->holding = true;
+}
+
+/**
+ * Print rows to a stream as they are added, instead of sorting them: for
+ * when they are known to come in order. A row that comes before the one
+ * ahead of it is an error.
+ */
+int sorter_stream(sorter* s, FILE* output)
+{
+    s->last_key = growbuf_create(64);
+    if (NULL == s->last_key) {
+        return EX_OSERR;
+    }
+
+    s->stream = output;
+    return 0;
+}
+
+/**
+ * Print a row being streamed, unless it's out of order.
+ */
+static int stream_row(
+        sorter* s,
+        const char* key,
+        size_t key_len,
+        const char* output,
+        size_t output_len)
+{
+    if (0 != s->error || s->num_added >= s->limit) {
+        return s->error;
+    }
+
+    if (s->num_added > 0
+            && compare_keys(key, key_len, 1, s->last_key->buf, s->last_key->size, 0) < 0) {
+        fprintf(stderr, "input is not in ORDER BY order\n");
+        s->error = EX_DATAERR;
+        return s->error;
+    }
+
+    s->last_key->size = 0;
+    growbuf_append(s->last_key, key, key_len);
+    fwrite(output, 1, output_len, s->stream);
+    s->num_added++;
+
+    return 0;
+}
+
+/**
+ * Whether a row with this key would be kept: with a limit, there's no need
+ * to print the output of a row that comes after the rows already kept.
+ */
+bool sorter_wants(const sorter* s, const growbuf* key)
+{
+    if (NULL != s->stream) {
+        return 0 == s->error && s->num_added < s->limit;
+    }
+    return SIZE_MAX == s->limit || heap_wants(s, key->buf, key->size, s->num_added);
+}
+
+/**
+ * Start adding a row: its output is to be printed to the stream returned,
+ * and then sorter_end_row() called.
+ */
+FILE* sorter_begin_row(sorter* s)
+{
+    s->row_start = ftell(s->arena);
+    return s->arena;
+}
+
+/**
+ * Finish adding a row.
+ *
+ * Arguments:
+ *   s		- the sorter
+ *   key	- the row's sort key, from sort_key_append()
+ *
+ * Return Value:
+ *   0 on success, or an exit code if the rows couldn't be spilled.
+ */
+int sorter_end_row(sorter* s, const growbuf* key)
+{
+    if (NULL != s->stream) {
+        if (0 != fflush(s->arena)) {
+            perror("error buffering output");
+            return EX_OSERR;
+        }
+
+        int retval = stream_row(s, key->buf, key->size, s->arena_buf + s->row_start,
+                ftell(s->arena) - s->row_start);
+        rewind(s->arena);
+        return retval;
+    }
+
+    sort_row row = {
+        s->num_added++,
+        s->keys->size,
+        key->size,
+        s->row_start,
+        ftell(s->arena) - s->row_start,
+    };
+
+    growbuf_append(s->keys, key->buf, key->size);
+
+    if (SIZE_MAX != s->limit) {
+        int retval = heap_add(s, &row);
+        if (0 != retval) {
+            s->error = retval;
+        }
+    }
+    else {
+        growbuf_append(s->rows, &row, sizeof(row));
+    }
+
+    return check_memory(s);
+}
+
+static int seq_comparator(const void* avoid, const void* bvoid)
+{
+    const sort_row* a = avoid;
+    const sort_row* b = bvoid;
+    return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+/**
+ * Add a row taken from another sorter: print it, if rows are being streamed;
+ * otherwise keep it, unless it doesn't get into a limited sort's heap.
+ *
+ * Arguments:
+ *   s		- the sorter taking the row
+ *   seq	- its sequence number in s
+ *   key	- its key
+ *   key_len	- length of the key
+ *   output	- its output
+ *   output_len	- length of the output
+ *
+ * Return Value:
+ *   0 on success, or an exit code.
+ */
+static int take_row(
+        sorter* s,
+        size_t seq,
+        const char* key,
+        size_t key_len,
+        const char* output,
+        size_t output_len)
+{
+    if (NULL != s->stream) {
+        return stream_row(s, key, key_len, output, output_len);
+    }
+
+    if (SIZE_MAX != s->limit && !heap_wants(s, key, key_len, seq)) {
+        return 0;
+    }
+
+    sort_row row = { seq, s->keys->size, key_len, ftell(s->arena), output_len };
+    growbuf_append(s->keys, key, key_len);
+    fwrite(output, 1, output_len, s->arena);
+
+    if (SIZE_MAX != s->limit) {
+        int retval = heap_add(s, &row);
+        if (0 != retval) {
+            s->error = retval;
+        }
+    }
+    else {
+        growbuf_append(s->rows, &row, sizeof(row));
+    }
+
+    return check_memory(s);
+}
+
+/**
+ * Take the rows a sorter holding them wrote out to its overflow file.
+ */
+static int take_overflow(sorter* s, sorter* from)
+{
+    merge_source src = { from->overflow, false, 0, growbuf_create(64), growbuf_create(256) };
+    int retval = 0;
+
+    if (NULL == src.key || NULL == src.output) {
+        fprintf(stderr, "malloc failed\n");
+        retval = EX_OSERR;
+        goto cleanup;
+    }
+
+    if (0 != fflush(from->overflow) || ferror(from->overflow)) {
+        perror("error writing temporary file");
+        retval = EX_IOERR;
+        goto cleanup;
+    }
+    rewind(from->overflow);
+
+    for (;;) {
+        retval = read_row(&src);
+        if (0 != retval || src.done) {
+            break;
+        }
+
+        retval = take_row(s, s->num_added + src.seq, src.key->buf, src.key->size,
+                src.output->buf, src.output->size);
+        if (0 != retval) {
+            break;
+        }
+    }
+
+cleanup:
+    growbuf_free(src.key);
+    growbuf_free(src.output);
+    fclose(from->overflow);
+    from->overflow = NULL;
+    return retval;
+}
+
+/**
+ * Move all the rows of one sorter into another, after the ones it has. The
+ * sorter taken from must not have spilled any runs, though it may have held
+ * rows in a temporary file (see sorter_hold()).
+ */
+int sorter_take(sorter* s, sorter* from)
+{
+    if (0 != fflush(from->arena)) {
+        perror("error buffering output");
+        return EX_OSERR;
+    }
+
+    if (NULL != from->overflow) {
+        int retval = take_overflow(s, from);
+        if (0 != retval) {
+            return retval;
+        }
+    }
+
+    sort_row* rows = (sort_row*)from->rows->buf;
+    size_t num_rows = from->rows->size / sizeof(sort_row);
+    const char* keys = (const char*)from->keys->buf;
+
+    if (NULL != s->stream) {
+        if (SIZE_MAX != from->limit) {
+            // put the heap back in the order the rows were added in
+            qsort(rows, num_rows, sizeof(sort_row), &seq_comparator);
+        }
+
+        for (size_t i = 0; i < num_rows && 0 == s->error; i++) {
+            stream_row(s, keys + rows[i].key_offset, rows[i].key_len,
+                    from->arena_buf + rows[i].output_offset, rows[i].output_len);
+        }
+
+        from->rows->size = 0;
+        from->keys->size = 0;
+        from->num_added = 0;
+        return s->error;
+    }
+
+    if (SIZE_MAX != s->limit) {
+        //
+        // Only the rows that get into the heap need copying.
+        //
+
+        for (size_t i = 0; i < num_rows; i++) {
+            if (0 != take_row(s, s->num_added + rows[i].seq, keys + rows[i].key_offset,
+                        rows[i].key_len, from->arena_buf + rows[i].output_offset,
+                        rows[i].output_len)) {
+                break;
+            }
+        }
+    }
+    else {
+        long base = ftell(s->arena);
+        size_t key_base = s->keys->size;
+        fwrite(from->arena_buf, 1, from->arena_len, s->arena);
+        growbuf_append(s->keys, from->keys->buf, from->keys->size);
+
+        for (size_t i = 0; i < from->rows->size / sizeof(sort_row); i++) {
+            rows[i].output_offset += base;
+            rows[i].key_offset += key_base;
+            rows[i].seq += s->num_added;
+        }
+        growbuf_append(s->rows, from->rows->buf, from->rows->size);
+    }
+
+    s->num_added += from->num_added;
+    from->rows->size = 0;
+    from->keys->size = 0;
+    from->num_added = 0;
+
+    return check_memory(s);
+}
+
+/**
+ * Print the output of all the rows, in sorted order.
+ *
+ * Return Value:
+ *   0 on success, or an exit code.
+ */
+int sorter_finish(sorter* s, FILE* output)
+{
+    if (0 != s->error) {
+        return s->error;
+    }
+
+    if (0 == s->runs->size) {
+        size_t num_rows;
+
+        if (0 != fflush(s->arena)) {
+            perror("error buffering output");
+            return EX_OSERR;
+        }
+
+        sort_row** sorted = sort_rows(s, &num_rows);
+        if (NULL == sorted) {
+            return EX_OSERR;
+        }
+
+        for (size_t i = 0; i < num_rows; i++) {
+            fwrite(s->arena_buf + sorted[i]->output_offset, 1,
+                    sorted[i]->output_len, output);
+        }
+        free(sorted);
+
+        return 0;
+    }
+
+    int retval = 0;
+    if (s->rows->size > 0) {
+        retval = spill_run(s);
+        if (0 != retval) {
+            return retval;
+        }
+    }
+
+    //
+    // Merge the first runs into one until there are few enough to merge
+    // all at once.
+    //
+
+    while (s->runs->size / sizeof(sort_run) > MAX_MERGE_WAYS) {
+        retval = merge_first_runs(s);
+        if (0 != retval) {
+            return retval;
+        }
+    }
+
+    DEBUG fprintf(stderr, "merging %zu runs\n", s->runs->size / sizeof(sort_run));
+
+    size_t num_rows;
+    return merge_runs(s, (sort_run*)s->runs->buf, s->runs->size / sizeof(sort_run),
+            output, NULL, &num_rows);
+}
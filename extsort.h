@@ -0,0 +1,40 @@
+/*
+ * CSV Selector
+ *
+ * Sorting the rows of an ORDER BY query: in memory, or past a memory limit,
+ * in sorted runs spilled to temporary files and merged.
+ */
+
+#ifndef EXTSORT_H
+#define EXTSORT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "growbuf.h"
+#include "queryparse.h"
+
+typedef struct _sorter sorter;
+
+typedef enum {
+    SORT_AUTO,          // by how many rows there are
+    SORT_COMPARISON,    // qsort()
+    SORT_RADIX,         // LSD for keys of up to 8 bytes, MSD otherwise
+} sort_method;
+
+void sort_key_append(growbuf* key, const val* value, bool descending);
+
+sorter* sorter_create(size_t memory_limit, size_t limit);
+void sorter_free(sorter* s);
+void sorter_set_method(sorter* s, sort_method method);
+void sorter_set_threads(sorter* s, size_t num_threads);
+void sorter_hold(sorter* s);
+int sorter_stream(sorter* s, FILE* output);
+bool sorter_wants(const sorter* s, const growbuf* key);
+FILE* sorter_begin_row(sorter* s);
+int sorter_end_row(sorter* s, const growbuf* key);
+int sorter_take(sorter* s, sorter* from);
+int sorter_finish(sorter* s, FILE* output);
+size_t sorter_peak_memory(void);
+
+#endif //EXTSORT_H
@@ -106,7 +106,8 @@ int growbuf_append(growbuf* gb, const void* buf, size_t len)
 
         if (gb->size + len < GROWBUF_ALLOC_GRANULARITY) {
 
-            newsize = gb->allocated_size;
+            // (allocated_size is 0 if the first append was empty)
+            newsize = (gb->allocated_size > 0) ? gb->allocated_size : 1;
             while (newsize < gb->size + len) {
                 newsize *= 2;
             }
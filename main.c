@@ -12,23 +12,103 @@
 #include <sysexits.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "growbuf.h"
 #include "csvformat.h"
 #include "queryeval.h"
 #include "util.h"
 #include "csvsel.h"
+#include "decompress.h"
 
 #define DEBUG if (false)
 //#define DEBUG
 
 extern int query_debug;
 
+/**
+ * Size of the buffer on standard output, when it isn't a terminal: output is
+ * written in pieces this big.
+ */
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Parse a size argument, which may have a k, m, or g suffix (powers of 1024).
+ *
+ * Returns:
+ *   the size in bytes, or 0 if the argument is not a valid size.
+ */
+static size_t parse_size(const char* arg)
+{
+    char* end = NULL;
+    unsigned long long size = strtoull(arg, &end, 10);
+
+    if (end == arg) {
+        return 0;
+    }
+
+    switch (*end) {
+    case 'g': case 'G':
+        size *= 1024;
+        // fall through
+    case 'm': case 'M':
+        size *= 1024;
+        // fall through
+    case 'k': case 'K':
+        size *= 1024;
+        end++;
+        break;
+    }
+
+    if (*end != '\0') {
+        return 0;
+    }
+
+    return (size_t)size;
+}
+
+/**
+ * Set up the reader's input. A regular file is mapped into memory, so the
+ * reader can hand out views of it instead of copying; anything else (pipes,
+ * terminals) is read as a stream.
+ *
+ * Arguments:
+ *   file	- the opened input
+ *   input	- receives the reader's input
+ */
+static void map_input(FILE* file, csv_input* input)
+{
+    struct stat st;
+
+    input->stream = file;
+    input->data = NULL;
+    input->size = 0;
+
+    if (0 != fstat(fileno(file), &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (MAP_FAILED == data) {
+        // fall back to reading it as a stream
+        return;
+    }
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    input->data = (const char*)data;
+    input->size = st.st_size;
+}
+
 int main(int argc, char** argv)
 {
     int    retval          = EX_OK;
     FILE*  input           = stdin;
     size_t query_arg_start = 1;
+    csv_input csv          = {0};
+    csvsel_options options = {0};
+    bool   build_index     = false;
 
     growbuf* query = growbuf_create(32);
     if (NULL == query) {
@@ -38,7 +118,8 @@ int main(int argc, char** argv)
     }
 
     if (argc == 1 || (argc == 2 && strcmp(argv[1], "--help") == 0)) {
-        fprintf(stderr, "usage: %s [-f inputfile] [--debug] <query string>\n", argv[0]);
+        fprintf(stderr, "usage: %s [-f inputfile] [-b blocksize] [-j threads] [-m memory] [--sorted] [--output-format csv|arrow] [--batch-size rows] [--debug] <query string>\n", argv[0]);
+        fprintf(stderr, "       %s -f inputfile [-j threads] --index\n", argv[0]);
         retval = EX_USAGE;
         goto cleanup;
     }
@@ -49,6 +130,15 @@ int main(int argc, char** argv)
             query_debug = 1;
             query_arg_start = i + 1;
         }
+        else if (strcmp(argv[i], "--index") == 0) {
+            build_index = true;
+            query_arg_start = i + 1;
+        }
+        else if (strcmp(argv[i], "-s") == 0
+                || strcmp(argv[i], "--sorted") == 0) {
+            options.presorted = true;
+            query_arg_start = i + 1;
+        }
         else if (strcmp(argv[i], "-f") == 0
                 || strcmp(argv[i], "--file") == 0) {
 
@@ -75,6 +165,116 @@ int main(int argc, char** argv)
                 goto cleanup;
             }
 
+            options.input_path = argv[i + 1];
+
+            query_arg_start = i + 2;
+            i++;
+        }
+        else if (strcmp(argv[i], "-b") == 0
+                || strcmp(argv[i], "--block-size") == 0) {
+
+            if (i + 1 >= argc) {
+                fprintf(stderr, "%s flag needs an argument\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            size_t block_size = parse_size(argv[i + 1]);
+            if (0 == block_size) {
+                fprintf(stderr, "invalid block size: %s\n", argv[i + 1]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            csv_set_block_size(block_size);
+
+            query_arg_start = i + 2;
+            i++;
+        }
+        else if (strcmp(argv[i], "-j") == 0
+                || strcmp(argv[i], "--threads") == 0) {
+
+            if (i + 1 >= argc) {
+                fprintf(stderr, "%s flag needs an argument\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            char* end = NULL;
+            unsigned long threads = strtoul(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || *end != '\0' || 0 == threads) {
+                fprintf(stderr, "invalid number of threads: %s\n", argv[i + 1]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            options.num_threads = threads;
+
+            query_arg_start = i + 2;
+            i++;
+        }
+        else if (strcmp(argv[i], "-m") == 0
+                || strcmp(argv[i], "--memory-limit") == 0) {
+
+            if (i + 1 >= argc) {
+                fprintf(stderr, "%s flag needs an argument\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            size_t memory_limit = parse_size(argv[i + 1]);
+            if (0 == memory_limit) {
+                fprintf(stderr, "invalid memory limit: %s\n", argv[i + 1]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            options.memory_limit = memory_limit;
+
+            query_arg_start = i + 2;
+            i++;
+        }
+        else if (strcmp(argv[i], "--output-format") == 0) {
+
+            if (i + 1 >= argc) {
+                fprintf(stderr, "%s flag needs an argument\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            if (strcmp(argv[i + 1], "csv") == 0) {
+                options.output_format = OUTPUT_CSV;
+            }
+            else if (strcmp(argv[i + 1], "arrow") == 0) {
+                options.output_format = OUTPUT_ARROW;
+            }
+            else {
+                fprintf(stderr, "invalid output format: %s\n", argv[i + 1]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            query_arg_start = i + 2;
+            i++;
+        }
+        else if (strcmp(argv[i], "--batch-size") == 0) {
+
+            if (i + 1 >= argc) {
+                fprintf(stderr, "%s flag needs an argument\n", argv[i]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            char* end = NULL;
+            unsigned long batch_rows = strtoul(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || *end != '\0' || 0 == batch_rows) {
+                fprintf(stderr, "invalid batch size: %s\n", argv[i + 1]);
+                retval = EX_USAGE;
+                goto cleanup;
+            }
+
+            options.batch_rows = batch_rows;
+
             query_arg_start = i + 2;
             i++;
         }
@@ -88,17 +288,57 @@ int main(int argc, char** argv)
     // space-separated string
     //
 
+    if (build_index && query_arg_start < argc) {
+        fprintf(stderr, "--index doesn't take a query\n");
+        retval = EX_USAGE;
+        goto cleanup;
+    }
+
     const char* space = " ";
     for (size_t i = query_arg_start; i < argc; i++) {
         size_t len = strlen(argv[i]);
         growbuf_append(query, argv[i], len);
         growbuf_append(query, space, 1);
     }
-    ((char*)query->buf)[ query->size - 1 ] = '\0';
+    if (query->size > 0) {
+        ((char*)query->buf)[ query->size - 1 ] = '\0';
+    }
+    else {
+        growbuf_append_byte(query, '\0');
+    }
 
     DEBUG printf("%s\n", (char*)query->buf);
 
-    switch (csv_select(input, stdout, query->buf, query->size)) {
+    //
+    // gzip and zstd input is decompressed as it is read.
+    //
+
+    FILE* decompressed = decompress_open(input);
+    if (NULL == decompressed) {
+        retval = EX_DATAERR;
+        goto cleanup;
+    }
+    input = decompressed;
+
+    map_input(input, &csv);
+
+    if (!isatty(STDOUT_FILENO)) {
+        setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+    }
+
+    if (build_index) {
+        if (NULL == csv.data || NULL == options.input_path) {
+            // stdin can be a mapped file, but there's no name to index it by
+            fprintf(stderr, "--index needs an uncompressed, non-empty file given with -f\n");
+            retval = EX_USAGE;
+        }
+        else {
+            retval = csv_build_index(&csv, &options);
+        }
+        goto cleanup;
+    }
+
+    switch (csv_select(&csv, stdout, query->buf, query->size, &options)) {
         case 0:
             retval = EX_OK;
             break;
@@ -117,6 +357,10 @@ cleanup:
         growbuf_free(query);
     }
 
+    if (NULL != csv.data) {
+        munmap((void*)csv.data, csv.size);
+    }
+
     if (NULL != input) {
         fclose(input);
     }
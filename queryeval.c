@@ -7,23 +7,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <string.h>
-#include <math.h>
+#include <float.h>
 
 #include "growbuf.h"
+#include "csvformat.h"
 #include "queryparse.h"
 #include "queryparse.tab.h"
 #include "util.h"
-#include "functions.h"
 
 //#define DEBUG
 #define DEBUG if (false)
 
 extern int query_debug;
 
-extern functionspec FUNCTIONS[];
-
 void val_free(val* val)
 {
     if (val->is_str) {
@@ -38,494 +38,593 @@ void selector_free(selector* s)
     }
 }
 
-double csvsel_strtod(const char *str, char **unused)
+/**
+ * Copy a number out of a string, without any '$' or ',' in it, to be parsed.
+ *
+ * Arguments:
+ *   str	- the string; it ends at its length or a NUL, whichever is first
+ *   len	- its length
+ *   small	- room for the copy, if it fits
+ *   small_len	- size of small
+ *
+ * Return Value:
+ *   The copy, NUL-terminated: small, or an allocation if it didn't fit.
+ */
+static char* number_copy(const char* str, size_t len, char* small, size_t small_len)
 {
-    (void)unused;
+    char* buf = small;
 
-    char *buf = (char*)malloc(strlen(str)+1);
-    if (buf == NULL) {
-        fprintf(stderr, "malloc failed!\n");
-        abort();
+    if (len >= small_len) {
+        buf = (char*)malloc(len + 1);
+        if (NULL == buf) {
+            fprintf(stderr, "malloc failed!\n");
+            abort();
+        }
     }
 
-    for (size_t i = 0, j = 0; ; i++) {
+    size_t j = 0;
+    for (size_t i = 0; i < len && str[i] != '\0'; i++) {
         if (str[i] != '$' && str[i] != ',') {
             buf[j++] = str[i];
-            if (str[i] == '\0') {
-                break;
-            }
         }
     }
+    buf[j] = '\0';
+
+    return buf;
+}
+
+//
+// Numbers are parsed in one pass, skipping '$' and ',' wherever they are, as
+// if they'd been taken out first and the rest given to strtod() or atol().
+// Runs of eight digits are taken at once where the byte order allows. A
+// double is exact without strtod() when its digits fit in 53 bits and it's
+// scaled by at most 10^22, since then both are exact doubles and one multiply
+// or divide rounds correctly; that's most numbers in a CSV file. Anything
+// else (more digits, big exponents, hex, inf and nan) goes to strtod() on a
+// copy with the '$' and ',' taken out.
+//
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HAVE_SWAR_DIGITS
+#endif
+
+typedef struct {
+    const char* p;
+    const char* end;
+} number_reader;
+
+/**
+ * The next character of a number, after any '$' and ',', without taking it.
+ *
+ * Return Value:
+ *   The character, or -1 at the end of the string or a NUL.
+ */
+static inline int number_peek(number_reader* r)
+{
+    while (r->p < r->end && (*r->p == '$' || *r->p == ',')) {
+        r->p++;
+    }
+    return (r->p < r->end && *r->p != '\0') ? (unsigned char)*r->p : -1;
+}
+
+static inline bool number_is_space(int c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/**
+ * Take the next eight characters as digits, if they all are.
+ */
+static inline bool number_eight_digits(number_reader* r, uint32_t* digits)
+{
+#ifdef HAVE_SWAR_DIGITS
+    uint64_t v;
+
+    if (r->end - r->p < 8) {
+        return false;
+    }
+    memcpy(&v, r->p, sizeof(v));
+    if (((v & 0xF0F0F0F0F0F0F0F0) | (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4))
+            != 0x3333333333333333) {
+        return false;
+    }
+
+    // pairs of digits, then fours, then all eight
+    v -= 0x3030303030303030;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FF) * 0x000F424000000064)
+            + (((v >> 16) & 0x000000FF000000FF) * 0x0000271000000001)) >> 32;
+
+    *digits = (uint32_t)v;
+    r->p += 8;
+    return true;
+#else
+    (void)r;
+    (void)digits;
+    return false;
+#endif
+}
+
+/**
+ * Take a run of digits into a mantissa, up to 19 of them in all.
+ *
+ * Arguments:
+ *   r		- the number
+ *   mantissa	- the digits so far, and then with these
+ *   digits	- how many there are, and then with these
+ *   too_many	- set if there were more than fit
+ *
+ * Return Value:
+ *   How many digits were taken, including ones that didn't fit.
+ */
+static long number_digits(number_reader* r, uint64_t* mantissa, int* digits, bool* too_many)
+{
+    long n = 0;
+
+    for (;;) {
+        uint32_t eight;
+        if (*digits <= 19 - 8 && number_eight_digits(r, &eight)) {
+            *mantissa = *mantissa * 100000000 + eight;
+            *digits += 8;
+            n += 8;
+            continue;
+        }
+
+        int c = number_peek(r);
+        if (c < '0' || c > '9') {
+            return n;
+        }
+        if (*digits < 19) {
+            *mantissa = *mantissa * 10 + (uint64_t)(c - '0');
+            (*digits)++;
+        }
+        else {
+            *too_many = true;
+        }
+        r->p++;
+        n++;
+    }
+}
+
+/**
+ * Parse a double the slow way: strtod() on a copy without any '$' or ','.
+ */
+static double slow_strtod(const char *str, size_t len)
+{
+    char small[64];
+    char* buf = number_copy(str, len, small, sizeof(small));
 
     double d = strtod(buf, NULL);
 
-    free(buf);
+    if (buf != small) {
+        free(buf);
+    }
     return d;
 }
 
-long csvsel_atol(const char *str)
+/**
+ * Parse a double out of a string of a given length, which needn't be
+ * NUL-terminated. '$' and ',' are ignored.
+ */
+double csvsel_strntod(const char *str, size_t len)
 {
-    char *buf = (char*)malloc(strlen(str)+1);
-    if (NULL == buf) {
-        fprintf(stderr, "malloc failed!\n");
-        abort();
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    number_reader r = { str, str + len };
+    uint64_t mantissa = 0;
+    int digits = 0;
+    long exponent = 0;
+    bool negative = false;
+    bool any_digits = false;
+    bool too_many = false;
+    int c;
+
+    c = number_peek(&r);
+    while (number_is_space(c)) {
+        r.p++;
+        c = number_peek(&r);
+    }
+    if ('-' == c || '+' == c) {
+        negative = ('-' == c);
+        r.p++;
+        c = number_peek(&r);
     }
 
-    for (size_t i = 0, j = 0; ; i++) {
-        if (str[i] != '$' && str[i] != ',') {
-            buf[j++] = str[i];
-            if (str[i] == '\0') {
-                break;
+    while ('0' == c) {
+        any_digits = true;
+        r.p++;
+        c = number_peek(&r);
+    }
+    long whole = number_digits(&r, &mantissa, &digits, &too_many);
+    any_digits = any_digits || (whole > 0);
+    // the digits that didn't fit still count
+    exponent = whole - digits;
+    c = number_peek(&r);
+
+    if ('.' == c) {
+        r.p++;
+        c = number_peek(&r);
+        if (0 == mantissa) {
+            while ('0' == c) {
+                any_digits = true;
+                exponent--;
+                r.p++;
+                c = number_peek(&r);
             }
         }
+        int before = digits;
+        long fraction = number_digits(&r, &mantissa, &digits, &too_many);
+        any_digits = any_digits || (fraction > 0);
+        exponent -= digits - before;
+        c = number_peek(&r);
     }
 
-    long l = atol(buf);
+    if (!any_digits || too_many || 'x' == c || 'X' == c) {
+        return slow_strtod(str, len);
+    }
+
+    if ('e' == c || 'E' == c) {
+        bool negative_exponent = false;
+        long e = 0;
 
-    free(buf);
-    return l;
+        r.p++;
+        c = number_peek(&r);
+        if ('-' == c || '+' == c) {
+            negative_exponent = ('-' == c);
+            r.p++;
+            c = number_peek(&r);
+        }
+        // with no digits, the 'e' isn't part of the number
+        while (c >= '0' && c <= '9') {
+            if (e < 100000) {
+                e = e * 10 + (c - '0');
+            }
+            r.p++;
+            c = number_peek(&r);
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+
+    if (0 == mantissa) {
+        return negative ? -0.0 : 0.0;
+    }
+
+#if FLT_EVAL_METHOD == 0
+    if (mantissa <= ((uint64_t)1 << 53)) {
+        double d = (double)mantissa;
+
+        // a bigger exponent may still do, with some of it in the mantissa
+        while (exponent > 22 && mantissa <= ((uint64_t)1 << 53) / 10) {
+            mantissa *= 10;
+            exponent--;
+            d = (double)mantissa;
+        }
+
+        if (exponent >= -22 && exponent <= 22) {
+            d = (exponent < 0) ? d / powers_of_ten[-exponent] : d * powers_of_ten[exponent];
+            return negative ? -d : d;
+        }
+    }
+#else
+    (void)powers_of_ten;
+#endif
+
+    return slow_strtod(str, len);
 }
 
 /**
- * Evaluates a val to a constant.
- * Returns a new val with all strings copied.
+ * Parse a long out of a string of a given length, like csvsel_strntod(). Too
+ * big a number gives LONG_MAX or LONG_MIN, as atol() does.
  */
-val value_evaluate(const val* val, growbuf* fields, size_t rownum)
+long csvsel_strntol(const char *str, size_t len)
 {
-    struct _val ret;
-    memset(&ret, 0, sizeof(struct _val));
-
-    if (val->is_num) {
-        ret.num = val->num;
-        ret.is_num = true;
-        ret.conversion_type = TYPE_LONG;
-    }
-    else if (val->is_dbl) {
-        ret.dbl = val->dbl;
-        ret.is_dbl = true;
-        ret.conversion_type = TYPE_DOUBLE;
-    }
-    else if (val->is_str) {
-        size_t n = strlen(val->str) + 1;
-        ret.str = (char*)malloc(n);
-        strncpy(ret.str, val->str, n);
-        ret.is_str = true;
-        ret.conversion_type = TYPE_STRING;
-    }
-    else if (val->is_col) {
-        size_t colnum = val->col;
-
-        if (colnum >= fields->size / sizeof(void*)) {
-            //
-            // Selected an out-of-bounds column
-            // This is defined as empty string.
-            //
-
-            ret.str = strdup("");
+    number_reader r = { str, str + len };
+    uint64_t value = 0;
+    bool negative = false;
+    bool overflow = false;
+    int c;
+
+    c = number_peek(&r);
+    while (number_is_space(c)) {
+        r.p++;
+        c = number_peek(&r);
+    }
+    if ('-' == c || '+' == c) {
+        negative = ('-' == c);
+        r.p++;
+    }
+
+    for (;;) {
+        uint32_t eight;
+        if (value <= (UINT64_MAX - 99999999) / 100000000 && number_eight_digits(&r, &eight)) {
+            value = value * 100000000 + eight;
+            continue;
+        }
+
+        c = number_peek(&r);
+        if (c < '0' || c > '9') {
+            break;
+        }
+        if (value > (UINT64_MAX - 9) / 10) {
+            overflow = true;
         }
         else {
-            growbuf* field = ((growbuf**)fields->buf)[colnum];
-            ret.str = strdup(field->buf);
+            value = value * 10 + (uint64_t)(c - '0');
         }
-
-        ret.is_str = true;
-        ret.conversion_type = TYPE_STRING;
+        r.p++;
     }
-    else if (val->is_special) {
-        switch (val->special) {
-        case SPECIAL_NUMCOLS:
-            ret.num = fields->size / sizeof(void*);
-            ret.is_num = true;
-            ret.conversion_type = TYPE_LONG;
-            break;
-        case SPECIAL_ROWNUM:
-            ret.num = rownum;
-            ret.is_num = true;
-            ret.conversion_type = TYPE_LONG;
-            break;
+
+    if (negative) {
+        if (overflow || value > (uint64_t)LONG_MAX + 1) {
+            return LONG_MIN;
         }
+        return (long)(0 - value);
+    }
+    if (overflow || value > LONG_MAX) {
+        return LONG_MAX;
+    }
+    return (long)value;
+}
+
+double csvsel_strtod(const char *str, char **unused)
+{
+    (void)unused;
+    return csvsel_strntod(str, strlen(str));
+}
+
+long csvsel_atol(const char *str)
+{
+    return csvsel_strntol(str, strlen(str));
+}
+
+/**
+ * Checks whether evaluating a val needs the row number (%#).
+ */
+bool val_uses_rownum(const val* val)
+{
+    if (val->is_special) {
+        return val->special == SPECIAL_ROWNUM;
     }
     else if (val->is_func) {
-        struct _val args[MAX_ARGS];
         for (size_t i = 0; i < val->func->num_args; i++) {
-            args[i] = value_evaluate(&(val->func->args[i]), fields, rownum);
+            if (val_uses_rownum(&(val->func->args[i]))) {
+                return true;
+            }
         }
+    }
+    return false;
+}
 
-        switch (val->func->func) {
-        case FUNC_SUBSTR:
-            {
-                ssize_t start  = args[1].num;
-                ssize_t len    = args[2].num;
-                size_t  in_len = strlen(args[0].str);
-
-                if (start < 0) {
-                    if (-1*start >= in_len) {
-                        start = 0;
-                    }
-                    else {
-                        start += in_len;
-                    }
-                }
-                else if (start >= in_len) {
-                    start = in_len;
-                    len = 0;
-                }
-
-                if (val->func->num_args == 2) {
-                    len = -1;
-                }
-
-                if (len < 0) {
-                    if (-1*len >= in_len) {
-                        len = in_len - start;
-                    }
-                    else {
-                        len += in_len - start + 1;
-                    }
-                }
-                else if (start + len > in_len) {
-                    len = in_len - start;
-                }
-                
-                DEBUG printf("start(%zu) len(%zu) in_len(%zu)\n",
-                        start, len, in_len);
-
-                char* result = (char*)malloc(len + 1);
-                
-                if (len > 0) {
-                    memcpy(result, args[0].str + start, len);
-                }
-
-                result[len] = '\0';
-
-                ret.str = result;
-                ret.is_str = true;
-                ret.conversion_type = TYPE_STRING;
+/**
+ * Checks whether a val is the same for every row: it doesn't look at the row
+ * or its number, only at literals.
+ */
+bool val_is_constant(const val* val)
+{
+    if (val->is_col || val->is_special) {
+        return false;
+    }
+    else if (val->is_func) {
+        for (size_t i = 0; i < val->func->num_args; i++) {
+            if (!val_is_constant(&(val->func->args[i]))) {
+                return false;
             }
-            break;
+        }
+    }
+    return true;
+}
 
-        case FUNC_STRLEN:
-            {
-                ret.num = strlen(args[0].str);
-                ret.is_num = true;
-                ret.conversion_type = TYPE_LONG;
-            }
-            break;
+/**
+ * Checks whether evaluating a condition needs the row number (%#).
+ */
+bool compound_uses_rownum(const compound* condition)
+{
+    if (NULL == condition) {
+        return false;
+    }
 
-        case FUNC_MAX:
-        case FUNC_MIN:
-            {
-                double arg0 = 0.0;
-                double arg1 = 0.0;
-
-                if (args[0].is_dbl) {
-                    arg0 = args[0].dbl;
-                }
-                else if (args[0].is_num) {
-                    arg0 = (double)(args[0].num);
-                }
-
-                if (args[1].is_dbl) {
-                    arg1 = args[1].dbl;
-                }
-                else if (args[1].is_num) {
-                    arg1 = (double)(args[1].num);
-                }
-
-                if (val->func->func == FUNC_MAX) {
-                    ret.dbl = (arg0 > arg1) ? arg0 : arg1;
-                }
-                else {
-                    ret.dbl = (arg0 < arg1) ? arg0 : arg1;
-                }
-
-                ret.is_dbl = true;
-                ret.conversion_type = TYPE_DOUBLE;
-            }
-            break;
+    switch (condition->oper) {
+    case OPER_SIMPLE:
+        return val_uses_rownum(&(condition->simple.left))
+            || val_uses_rownum(&(condition->simple.right));
 
-        case FUNC_ABS:
-            {
-                double arg0 = 0.0;
+    default:
+        return compound_uses_rownum(condition->left)
+            || compound_uses_rownum(condition->right);
+    }
+}
 
-                if (args[0].is_dbl) {
-                    arg0 = args[0].dbl;
-                }
-                else if (args[0].is_num) {
-                    arg0 = (double)args[0].num;
-                }
+/**
+ * How many of the leading columns of a row evaluating a val looks at.
+ * SIZE_MAX if it needs the whole row (%%).
+ */
+size_t val_columns_needed(const val* val)
+{
+    size_t needed = 0;
 
-                ret.dbl = fabs(arg0);
-                ret.is_dbl = true;
-                ret.conversion_type = TYPE_DOUBLE;
+    if (val->is_col) {
+        needed = val->col + 1;
+    }
+    else if (val->is_special) {
+        if (val->special == SPECIAL_NUMCOLS) {
+            needed = SIZE_MAX;
+        }
+    }
+    else if (val->is_func) {
+        for (size_t i = 0; i < val->func->num_args; i++) {
+            size_t arg_needed = val_columns_needed(&(val->func->args[i]));
+            if (arg_needed > needed) {
+                needed = arg_needed;
             }
-            break;
+        }
+    }
 
-        case FUNC_LOWER:
-        case FUNC_UPPER:
-            {
-                size_t len = strlen(args[0].str);
-                ret.str = (char*)malloc(len + 1);
-
-                for (size_t i = 0; i <= len; i++) {
-                    if (val->func->func == FUNC_LOWER
-                            && args[0].str[i] >= 'A' && args[0].str[i] <= 'Z') {
-                        ret.str[i] = args[0].str[i] + ('a' - 'A');
-                    }
-                    else if (val->func->func == FUNC_UPPER
-                            && args[0].str[i] >= 'a' && args[0].str[i] <= 'z') {
-                        ret.str[i] = args[0].str[i] - ('a' - 'A');
-                    }
-                    else {
-                        ret.str[i] = args[0].str[i];
-                    }
-                }
-
-                ret.is_str = true;
-                ret.conversion_type = TYPE_STRING;
-            }
-            break;
+    return needed;
+}
 
-        case FUNC_TRIM:
-            {
-                size_t len = strlen(args[0].str);
-                size_t start, end;
-
-                #define IS_WHITESPACE(c) \
-                    ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
-                
-                for (start = 0; start < len; start++) {
-                    if (!IS_WHITESPACE(args[0].str[start])) {
-                        break;
-                    }
-                }
-
-                for (end = len - 1; end > start; end--) {
-                    if (!IS_WHITESPACE(args[0].str[end])) {
-                        break;
-                    }
-                }
-
-                len = end - start + 1;
-                ret.str = (char*)malloc(len + 1);
-                memcpy(ret.str, args[0].str + start, len);
-                ret.str[len] = '\0';
-
-                ret.is_str = true;
-                ret.conversion_type = TYPE_STRING;
-            }
-            break;
+/**
+ * How many of the leading columns of a row evaluating a condition looks at.
+ * SIZE_MAX if it needs the whole row.
+ */
+size_t compound_columns_needed(const compound* condition)
+{
+    size_t left, right;
 
-        default:
-            fprintf(stderr, "ERROR: no implementation for function %s\n",
-                    FUNCTIONS[val->func->func].name);
-        }
+    if (NULL == condition) {
+        return 0;
+    }
 
-        for (size_t i = 0; i < val->func->num_args; i++) {
-            val_free(&args[i]);
+    switch (condition->oper) {
+    case OPER_SIMPLE:
+        left = val_columns_needed(&(condition->simple.left));
+        right = val_columns_needed(&(condition->simple.right));
+        break;
+
+    default:
+        left = compound_columns_needed(condition->left);
+        right = compound_columns_needed(condition->right);
+        break;
+    }
+
+    return (left > right) ? left : right;
+}
+
+/**
+ * Narrows a range of row numbers to the rows a comparison of the row number
+ * with a constant ("%# >= 100", "5 > %#") can be true for. Other conditions
+ * leave the range as it is.
+ */
+static void simple_rownum_range(const condition* c, size_t* first, size_t* last)
+{
+    const val* constant;
+    int oper = c->oper;
+
+    // both sides must be compared as numbers
+    if (c->left.conversion_type != TYPE_LONG
+            || c->right.conversion_type != TYPE_LONG) {
+        return;
+    }
+
+    if (c->left.is_special && c->left.special == SPECIAL_ROWNUM
+            && c->right.is_num) {
+        constant = &(c->right);
+    }
+    else if (c->right.is_special && c->right.special == SPECIAL_ROWNUM
+            && c->left.is_num) {
+        constant = &(c->left);
+
+        // flip it around so the row number is on the left
+        switch (oper) {
+        case TOK_GT:  oper = TOK_LT;  break;
+        case TOK_LT:  oper = TOK_GT;  break;
+        case TOK_GTE: oper = TOK_LTE; break;
+        case TOK_LTE: oper = TOK_GTE; break;
         }
     }
+    else {
+        return;
+    }
 
-    //
-    // Evaluation to a constant is now complete.
-    // Now, do any explicit type conversion that was specified.
-    //
+    long n = constant->num;
 
-    if (val->conversion_type == TYPE_LONG) {
-        if (ret.is_str) {
-            char* str = ret.str;
-            ret.num = csvsel_atol(str);
-            ret.is_str = false;
-            free(str);
+    switch (oper) {
+    case TOK_EQ:
+        if (n < 0) {
+            *first = 1;
+            *last = 0;
         }
-        else if (ret.is_dbl) {
-            ret.num = (long)ret.dbl;
-            ret.is_dbl = false;
+        else {
+            *first = (size_t)n;
+            *last = (size_t)n;
         }
-        ret.is_num = true;
-    }
-    else if (val->conversion_type == TYPE_DOUBLE) {
-        if (ret.is_str) {
-            char* str = ret.str;
-            ret.dbl = csvsel_strtod(str, NULL);
-            ret.is_str = false;
-            free(str);
+        break;
+
+    case TOK_LT:
+        n--;
+        // fall through
+    case TOK_LTE:
+        if (n < 0) {
+            *first = 1;
+            *last = 0;
         }
-        else if (ret.is_num) {
-            ret.dbl = (double)ret.num;
-            ret.is_num = false;
+        else {
+            *last = (size_t)n;
         }
-        ret.is_dbl = true;
-    }
-    else if (val->conversion_type == TYPE_STRING) {
-        if (ret.is_num) {
-            asprintf(&(ret.str), "%ld", ret.num);
-            ret.is_num = false;
+        break;
+
+    case TOK_GT:
+        if (n == LONG_MAX) {
+            *first = 1;
+            *last = 0;
+            break;
         }
-        else if (ret.is_dbl) {
-            asprintf(&(ret.str), "%lf", val->dbl);
-            ret.is_dbl = false;
+        n++;
+        // fall through
+    case TOK_GTE:
+        if (n > 0) {
+            *first = (size_t)n;
         }
-        ret.is_str = true;
+        break;
     }
-
-    return ret;
 }
 
-bool query_evaluate(growbuf* fields, size_t rownum, compound* condition)
+/**
+ * Works out a range of row numbers outside of which a condition can't be
+ * true, from the comparisons of the row number with constants in it. This
+ * lets a reader start at the first row that may match and stop after the
+ * last one.
+ *
+ * Arguments:
+ *   condition  - the condition, or NULL
+ *   first      - receives the first row number that may match
+ *   last       - receives the last row number that may match, or SIZE_MAX
+ *
+ * If no row can match, *first ends up greater than *last.
+ */
+void compound_rownum_range(const compound* condition, size_t* first, size_t* last)
 {
-    bool retval = true;
+    size_t left_first, left_last, right_first, right_last;
+
+    *first = 0;
+    *last = SIZE_MAX;
 
     if (NULL == condition) {
-        // return true
-        goto cleanup;
+        return;
     }
 
     switch (condition->oper) {
     case OPER_SIMPLE:
-        {
-            val left = value_evaluate(
-                                &(condition->simple.left),  fields, rownum);
-            val right = value_evaluate(
-                                &(condition->simple.right), fields, rownum);
-
-            if (condition->simple.oper == TOK_CONTAINS) {
-                //
-                // 'contains' is a special case.
-                //
-
-                if (left.is_num) {
-                    asprintf(&(left.str), "%ld", left.num);
-                }
-                else if (left.is_dbl) {
-                    asprintf(&(left.str), "%lf", left.dbl);
-                }
-
-                if (right.is_num) {
-                    asprintf(&(right.str), "%ld", right.num);
-                }
-                else if (right.is_dbl) {
-                    asprintf(&(right.str), "%lf", right.dbl);
-                }
-
-                retval = (NULL != strstr(left.str, right.str));
-
-                free(left.str);
-                free(right.str);
-
-                goto cleanup;
-            }
-
-            //
-            // Next we do automatic type conversion if needed.
-            //
-            // conversion | num dbl str
-            // -----------+----------------
-            //        num | num dbl  *
-            //        dbl | dbl dbl dbl
-            //        str |  *  dbl str
-            //
-            // *: If the string has a dot in it, both are converted to dbl.
-            //    Otherwise, the string is converted to num.
-            //
-
-#define CONVERSION(a, b) \
-            if (b.is_dbl) { \
-                if (a.is_str) { \
-                    char* temp = a.str; \
-                    a.dbl = csvsel_strtod(temp, NULL); \
-                    a.is_dbl = true; \
-                    a.is_str = false; \
-                    free(temp); \
-                } \
-                else if (a.is_num) { \
-                    a.dbl = (double)a.num; \
-                    a.is_dbl = true; \
-                    a.is_num = false; \
-                } \
-            } \
-            else if (b.is_num && a.is_str) { \
-                if (strchr(a.str, '.') != NULL) { \
-                    char* temp = a.str; \
-                    a.dbl = csvsel_strtod(temp, NULL); \
-                    a.is_dbl = true; \
-                    a.is_str = false; \
-                    free(temp); \
-                    b.dbl = (double)b.num; \
-                    b.is_dbl = true; \
-                    b.is_num = false; \
-                } \
-                else { \
-                    char* temp = a.str; \
-                    a.num = csvsel_atol(temp); \
-                    a.is_num = true; \
-                    a.is_str = false; \
-                    free(temp); \
-                } \
-            }
-           
-            //
-            // The macro only modifies one side (except the special case).
-            // Need to apply it both ways.
-            //
-            CONVERSION(left, right);
-            CONVERSION(right, left);
-
-#define COMPARE(operator) \
-            if (left.is_dbl) { \
-                retval = (left.dbl operator right.dbl); \
-            } else if (left.is_num) { \
-                retval = (left.num operator right.num); \
-            } \
-            else { \
-                retval = (strcmp(left.str, right.str) operator 0); \
-                /* these strings are intermediate results, so free them */ \
-                free(left.str); \
-                free(right.str); \
-            } \
-
-            switch (condition->simple.oper) {
-            case TOK_EQ:
-                COMPARE(==)
-                break;
-
-            case TOK_NEQ:
-                COMPARE(!=)
-                break;
-
-            case TOK_GT:
-                COMPARE(>)
-                break;
-
-            case TOK_LT:
-                COMPARE(<)
-                break;
-
-            case TOK_GTE:
-                COMPARE(>=)
-                break;
-
-            case TOK_LTE:
-                COMPARE(<=)
-                break;
-            }
-        }
-        break;
-
-    case OPER_NOT:
-        retval = ! query_evaluate(fields, rownum, condition->left);
+        simple_rownum_range(&(condition->simple), first, last);
         break;
 
     case OPER_AND:
-        retval = (query_evaluate(fields, rownum, condition->left) && query_evaluate(fields, rownum, condition->right));
+        compound_rownum_range(condition->left, &left_first, &left_last);
+        compound_rownum_range(condition->right, &right_first, &right_last);
+        *first = (left_first > right_first) ? left_first : right_first;
+        *last = (left_last < right_last) ? left_last : right_last;
         break;
 
     case OPER_OR:
-        retval = (query_evaluate(fields, rownum, condition->left) || query_evaluate(fields, rownum, condition->right));
+        compound_rownum_range(condition->left, &left_first, &left_last);
+        compound_rownum_range(condition->right, &right_first, &right_last);
+        if (left_first > left_last) {
+            *first = right_first;
+            *last = right_last;
+        }
+        else if (right_first > right_last) {
+            *first = left_first;
+            *last = left_last;
+        }
+        else {
+            *first = (left_first < right_first) ? left_first : right_first;
+            *last = (left_last > right_last) ? left_last : right_last;
+        }
         break;
-    }
 
-cleanup:
-    return retval;
+    case OPER_NOT:
+        // could be anything
+        break;
+    }
 }
-
@@ -10,13 +10,22 @@
 #include <stdbool.h>
 
 #include "growbuf.h"
+#include "csvformat.h"
 #include "queryparse.h"
 
 void val_free(val* val);
 void selector_free(selector* s);
 
-val value_evaluate(const val* val, growbuf* fields, size_t rownum);
+double csvsel_strtod(const char *str, char **unused);
+long csvsel_atol(const char *str);
+double csvsel_strntod(const char *str, size_t len);
+long csvsel_strntol(const char *str, size_t len);
 
-bool query_evaluate(growbuf* fields, size_t rownum, compound* condition);
+bool val_is_constant(const val* val);
+bool val_uses_rownum(const val* val);
+bool compound_uses_rownum(const compound* condition);
+size_t val_columns_needed(const val* val);
+size_t compound_columns_needed(const compound* condition);
+void compound_rownum_range(const compound* condition, size_t* first, size_t* last);
 
 #endif //QUERYEVAL_H
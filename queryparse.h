@@ -37,6 +37,7 @@ typedef struct _val {
         special_value special;
         struct _func* func;
     };
+    size_t len;     // length of str
     bool is_num;
     bool is_dbl;
     bool is_str;
@@ -78,9 +79,14 @@ typedef struct _selector {
     } type;
 } selector;
 
-typedef struct _order {
+typedef struct _order_key {
     enum { ORDER_ASCENDING, ORDER_DESCENDING} direction;
     val value;
+} order_key;
+
+typedef struct _order {
+    growbuf* keys;  // order_key, first the one that counts most
+    size_t limit;   // most rows to print; SIZE_MAX for all of them
 } order;
 
 int queryparse(
@@ -94,4 +100,6 @@ void free_compound(compound* c);
 
 void free_selectors(growbuf* g);
 
+void free_order(order* o);
+
 #endif // QUERY_H
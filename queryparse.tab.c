@@ -0,0 +1,2325 @@
+/* A Bison parser, made by GNU Bison 3.8.2.  */
+
+/* Bison implementation for Yacc-like parsers in C
+
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* As a special exception, you may create a larger work that contains
+   part or all of the Bison parser skeleton and distribute that work
+   under terms of your choice, so long as that work isn't itself a
+   parser generator using the skeleton or a modified version thereof
+   as a parser skeleton.  Alternatively, if you modify or redistribute
+   the parser skeleton itself, you may (at your option) remove this
+   special exception, which will cause the skeleton and the resulting
+   Bison output files to be licensed under the GNU General Public
+   License without this special exception.
+
+   This special exception was added by the Free Software Foundation in
+   version 2.2 of Bison.  */
+
+/* C LALR(1) parser skeleton written by Richard Stallman, by
+   simplifying the original so-called "semantic" parser.  */
+
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
+/* All symbols defined below should begin with yy or YY, to avoid
+   infringing on user name space.  This should be done even for local
+   variables, as they might otherwise be expanded by user macros.
+   There are some unavoidable exceptions within include files to
+   define necessary library symbols; they are noted "INFRINGES ON
+   USER NAME SPACE" below.  */
+
+/* Identify Bison output, and Bison version.  */
+#define YYBISON 30802
+
+/* Bison version string.  */
+#define YYBISON_VERSION "3.8.2"
+
+/* Skeleton name.  */
+#define YYSKELETON_NAME "yacc.c"
+
+/* Pure parsers.  */
+#define YYPURE 0
+
+/* Push parsers.  */
+#define YYPUSH 0
+
+/* Pull parsers.  */
+#define YYPULL 1
+
+
+/* Substitute the variable and function names.  */
+#define yyparse         query_parse
+#define yylex           query_lex
+#define yyerror         query_error
+#define yydebug         query_debug
+#define yynerrs         query_nerrs
+#define yylval          query_lval
+#define yychar          query_char
+
+/* First part of user prologue.  */
+#line 1 "queryparse.y"
+
+
+/**
+ * CSVSEL Query Parser
+ *
+ * by William R. Fraser, 10/22/2011
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include "growbuf.h"
+#include "util.h"
+#include "functions.h"
+
+#include "queryparse.h"
+
+static growbuf* SELECTORS;
+static compound** ROOT_CONDITION;
+static order** ORDER;
+
+extern int   query_debug;
+extern FILE* query_in;
+
+static int query_parse(void);
+extern int query_lex();
+extern int query_lex_destroy();
+static void query_error();
+
+extern functionspec FUNCTIONS[];
+
+int queryparse(
+    const char* query,
+    size_t query_length,
+    growbuf* selectors,
+    compound** root_condition,
+    order** order)
+{
+    int fd[2];
+
+    SELECTORS = selectors;
+    ROOT_CONDITION = root_condition;
+    ORDER = order;
+
+    //
+    // The tokenizer needs its input via a FILE* (thanks Flex...)
+    // Silly hack solution is to open a pipe and feed it through that.
+    //
+
+    if (0 != pipe(fd)) {
+        perror("error creating pipe for parsing");
+        return -1;
+    }
+
+    query_in = fdopen(fd[0], "r");
+    if (NULL == query_in) {
+        perror("error on pipe fdopen for parsing");
+        return -1;
+    }
+
+    if (query_length != write(fd[1], query, query_length)) {
+        perror("error on pipe write for parsing");
+        return -1;
+    }
+
+    close(fd[1]);
+
+    int retval = query_parse();
+
+    fclose(query_in);
+    query_lex_destroy();
+
+    return retval;
+}
+
+compound* new_compound()
+{
+    compound* c = (compound*)malloc(sizeof(compound));
+    if (NULL == c) {
+        fprintf(stderr, "malloc failed in query parser!\n");
+        exit(EX_OSERR);
+    }
+    memset(c, 0, sizeof(compound));
+    return c;
+}
+
+void free_compound(compound* c)
+{
+    if (NULL != c) {
+        if (c->simple.right.is_str && NULL != c->simple.right.str) {
+            free(c->simple.right.str);
+        }
+        if (c->simple.left.is_str && NULL != c->simple.left.str) {
+            free(c->simple.left.str);
+        }
+        compound* l = c->left;
+        compound* r = c->right;
+
+        free(c);
+
+        free_compound(l);
+        free_compound(r);
+    }
+}
+
+void free_selectors(growbuf* g)
+{
+    if (g != NULL) {
+        for (size_t i = 0; i < g->size / sizeof(void*); i++) {
+            free(((selector**)g->buf)[i]);
+        }
+        growbuf_free(g);
+    }
+}
+
+void free_order(order* o)
+{
+    if (NULL != o) {
+        order_key* keys = (order_key*)o->keys->buf;
+        for (size_t i = 0; i < o->keys->size / sizeof(order_key); i++) {
+            if (keys[i].value.is_str && NULL != keys[i].value.str) {
+                free(keys[i].value.str);
+            }
+        }
+        growbuf_free(o->keys);
+        free(o);
+    }
+}
+
+/**
+ * Add a key to sort on to the query's ORDER BY, after the ones before it.
+ */
+void add_order_key(val value, int direction)
+{
+    if (NULL == *ORDER) {
+        order* o = (order*)malloc(sizeof(order));
+        if (NULL == o) {
+            fprintf(stderr, "malloc failed in query parser!\n");
+            exit(EX_OSERR);
+        }
+        o->keys = growbuf_create(sizeof(order_key));
+        o->limit = SIZE_MAX;
+        *ORDER = o;
+    }
+
+    order_key k;
+    k.direction = direction;
+    k.value = value;
+    growbuf_append((*ORDER)->keys, &k, sizeof(k));
+}
+
+void value_clear(val* v)
+{
+    memset(v, 0, sizeof(val));
+}
+
+bool check_function(func* f)
+{
+    functionspec spec = FUNCTIONS[f->func];
+
+    if (f->num_args > spec.num_args || f->num_args < spec.min_args) {
+        if (spec.num_args == spec.min_args) {
+            fprintf(stderr, "Error: %s() needs %zu arguments (%zu given).\n",
+                    spec.name,
+                    spec.num_args,
+                    f->num_args);
+        }
+        else {
+            fprintf(stderr, "Error: %s() needs between %zu and %zu arguments (%zu given).\n",
+                    spec.name,
+                    spec.min_args,
+                    spec.num_args,
+                    f->num_args);
+        }
+        return false;
+    }
+
+    for (size_t i = 0; i < f->num_args; i++) {
+        bool ok = false;
+        for (size_t j = 0; j < spec.arguments[i].num_types; j++) {
+            if (f->args[i].conversion_type == spec.arguments[i].types[j]) {
+                ok = true;
+                break;
+            }
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Error: argument %zu of %s() must be of type ",
+                    i,
+                    spec.name);
+            for (size_t j = 0; j < spec.arguments[i].num_types; j++) {
+                switch (spec.arguments[i].types[j]) {
+                case TYPE_STRING:
+                    fprintf(stderr, "string");
+                    break;
+                case TYPE_DOUBLE:
+                    fprintf(stderr, "float");
+                    break;
+                case TYPE_LONG:
+                    fprintf(stderr, "integer");
+                    break;
+                }
+                
+                if (j > 0 && j + 1 == spec.arguments[i].num_types) {
+                    fprintf(stderr, ", or ");
+                }
+                else {
+                    fprintf(stderr, ", ");
+                }
+            }
+
+            fprintf(stderr, "not ");
+            switch (f->args[i].conversion_type) {
+            case TYPE_STRING:
+                fprintf(stderr, "string");
+                break;
+            case TYPE_DOUBLE:
+                fprintf(stderr, "float");
+                break;
+            case TYPE_LONG:
+                fprintf(stderr, "integer");
+                break;
+            }
+            fprintf(stderr, "\n");
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool column_selected(growbuf* selectors, size_t column)
+{
+    for (size_t i = 0; i < selectors->size / sizeof(void*); i++) {
+        selector* s = ((selector**)(selectors->buf))[i];
+        if (s->type == SELECTOR_COLUMN
+                && s->column == column) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+#line 327 "queryparse.tab.c"
+
+# ifndef YY_CAST
+#  ifdef __cplusplus
+#   define YY_CAST(Type, Val) static_cast<Type> (Val)
+#   define YY_REINTERPRET_CAST(Type, Val) reinterpret_cast<Type> (Val)
+#  else
+#   define YY_CAST(Type, Val) ((Type) (Val))
+#   define YY_REINTERPRET_CAST(Type, Val) ((Type) (Val))
+#  endif
+# endif
+# ifndef YY_NULLPTR
+#  if defined __cplusplus
+#   if 201103L <= __cplusplus
+#    define YY_NULLPTR nullptr
+#   else
+#    define YY_NULLPTR 0
+#   endif
+#  else
+#   define YY_NULLPTR ((void*)0)
+#  endif
+# endif
+
+#include "queryparse.tab.h"
+/* Symbol kind.  */
+enum yysymbol_kind_t
+{
+  YYSYMBOL_YYEMPTY = -2,
+  YYSYMBOL_YYEOF = 0,                      /* "end of file"  */
+  YYSYMBOL_YYerror = 1,                    /* error  */
+  YYSYMBOL_YYUNDEF = 2,                    /* "invalid token"  */
+  YYSYMBOL_TOK_SELECT = 3,                 /* TOK_SELECT  */
+  YYSYMBOL_TOK_WHERE = 4,                  /* TOK_WHERE  */
+  YYSYMBOL_TOK_CONTAINS = 5,               /* TOK_CONTAINS  */
+  YYSYMBOL_TOK_EQ = 6,                     /* TOK_EQ  */
+  YYSYMBOL_TOK_NEQ = 7,                    /* TOK_NEQ  */
+  YYSYMBOL_TOK_GT = 8,                     /* TOK_GT  */
+  YYSYMBOL_TOK_LT = 9,                     /* TOK_LT  */
+  YYSYMBOL_TOK_GTE = 10,                   /* TOK_GTE  */
+  YYSYMBOL_TOK_LTE = 11,                   /* TOK_LTE  */
+  YYSYMBOL_TOK_AND = 12,                   /* TOK_AND  */
+  YYSYMBOL_TOK_OR = 13,                    /* TOK_OR  */
+  YYSYMBOL_TOK_NOT = 14,                   /* TOK_NOT  */
+  YYSYMBOL_TOK_LPAREN = 15,                /* TOK_LPAREN  */
+  YYSYMBOL_TOK_RPAREN = 16,                /* TOK_RPAREN  */
+  YYSYMBOL_TOK_COMMA = 17,                 /* TOK_COMMA  */
+  YYSYMBOL_TOK_DASH = 18,                  /* TOK_DASH  */
+  YYSYMBOL_TOK_CONV_NUM = 19,              /* TOK_CONV_NUM  */
+  YYSYMBOL_TOK_CONV_DBL = 20,              /* TOK_CONV_DBL  */
+  YYSYMBOL_TOK_CONV_STR = 21,              /* TOK_CONV_STR  */
+  YYSYMBOL_TOK_ERROR = 22,                 /* TOK_ERROR  */
+  YYSYMBOL_TOK_ORDER = 23,                 /* TOK_ORDER  */
+  YYSYMBOL_TOK_BY = 24,                    /* TOK_BY  */
+  YYSYMBOL_TOK_ASCENDING = 25,             /* TOK_ASCENDING  */
+  YYSYMBOL_TOK_DESCENDING = 26,            /* TOK_DESCENDING  */
+  YYSYMBOL_TOK_LIMIT = 27,                 /* TOK_LIMIT  */
+  YYSYMBOL_TOK_INTEGER = 28,               /* TOK_INTEGER  */
+  YYSYMBOL_TOK_FLOAT = 29,                 /* TOK_FLOAT  */
+  YYSYMBOL_TOK_COLUMN = 30,                /* TOK_COLUMN  */
+  YYSYMBOL_TOK_STRING = 31,                /* TOK_STRING  */
+  YYSYMBOL_TOK_IDENTIFIER = 32,            /* TOK_IDENTIFIER  */
+  YYSYMBOL_TOK_SPECIAL = 33,               /* TOK_SPECIAL  */
+  YYSYMBOL_YYACCEPT = 34,                  /* $accept  */
+  YYSYMBOL_Start = 35,                     /* Start  */
+  YYSYMBOL_Selectors = 36,                 /* Selectors  */
+  YYSYMBOL_Selector = 37,                  /* Selector  */
+  YYSYMBOL_Columnspec = 38,                /* Columnspec  */
+  YYSYMBOL_NoColumns = 39,                 /* NoColumns  */
+  YYSYMBOL_Conditions = 40,                /* Conditions  */
+  YYSYMBOL_Simple = 41,                    /* Simple  */
+  YYSYMBOL_Compound = 42,                  /* Compound  */
+  YYSYMBOL_Function_Identifier = 43,       /* Function_Identifier  */
+  YYSYMBOL_Function = 44,                  /* Function  */
+  YYSYMBOL_Operator = 45,                  /* Operator  */
+  YYSYMBOL_Conversion = 46,                /* Conversion  */
+  YYSYMBOL_Value = 47,                     /* Value  */
+  YYSYMBOL_Value_Base = 48,                /* Value_Base  */
+  YYSYMBOL_OrderSpec = 49,                 /* OrderSpec  */
+  YYSYMBOL_OrderKey = 50,                  /* OrderKey  */
+  YYSYMBOL_Limit = 51,                     /* Limit  */
+  YYSYMBOL_Order = 52                      /* Order  */
+};
+typedef enum yysymbol_kind_t yysymbol_kind_t;
+
+
+
+
+#ifdef short
+# undef short
+#endif
+
+/* On compilers that do not define __PTRDIFF_MAX__ etc., make sure
+   <limits.h> and (if available) <stdint.h> are included
+   so that the code can choose integer types of a good width.  */
+
+#ifndef __PTRDIFF_MAX__
+# include <limits.h> /* INFRINGES ON USER NAME SPACE */
+# if defined __STDC_VERSION__ && 199901 <= __STDC_VERSION__
+#  include <stdint.h> /* INFRINGES ON USER NAME SPACE */
+#  define YY_STDINT_H
+# endif
+#endif
+
+/* Narrow types that promote to a signed type and that can represent a
+   signed or unsigned integer of at least N bits.  In tables they can
+   save space and decrease cache pressure.  Promoting to a signed type
+   helps avoid bugs in integer arithmetic.  */
+
+#ifdef __INT_LEAST8_MAX__
+typedef __INT_LEAST8_TYPE__ yytype_int8;
+#elif defined YY_STDINT_H
+typedef int_least8_t yytype_int8;
+#else
+typedef signed char yytype_int8;
+#endif
+
+#ifdef __INT_LEAST16_MAX__
+typedef __INT_LEAST16_TYPE__ yytype_int16;
+#elif defined YY_STDINT_H
+typedef int_least16_t yytype_int16;
+#else
+typedef short yytype_int16;
+#endif
+
+/* Work around bug in HP-UX 11.23, which defines these macros
+   incorrectly for preprocessor constants.  This workaround can likely
+   be removed in 2023, as HPE has promised support for HP-UX 11.23
+   (aka HP-UX 11i v2) only through the end of 2022; see Table 2 of
+   <https://h20195.www2.hpe.com/V2/getpdf.aspx/4AA4-7673ENW.pdf>.  */
+#ifdef __hpux
+# undef UINT_LEAST8_MAX
+# undef UINT_LEAST16_MAX
+# define UINT_LEAST8_MAX 255
+# define UINT_LEAST16_MAX 65535
+#endif
+
+#if defined __UINT_LEAST8_MAX__ && __UINT_LEAST8_MAX__ <= __INT_MAX__
+typedef __UINT_LEAST8_TYPE__ yytype_uint8;
+#elif (!defined __UINT_LEAST8_MAX__ && defined YY_STDINT_H \
+       && UINT_LEAST8_MAX <= INT_MAX)
+typedef uint_least8_t yytype_uint8;
+#elif !defined __UINT_LEAST8_MAX__ && UCHAR_MAX <= INT_MAX
+typedef unsigned char yytype_uint8;
+#else
+typedef short yytype_uint8;
+#endif
+
+#if defined __UINT_LEAST16_MAX__ && __UINT_LEAST16_MAX__ <= __INT_MAX__
+typedef __UINT_LEAST16_TYPE__ yytype_uint16;
+#elif (!defined __UINT_LEAST16_MAX__ && defined YY_STDINT_H \
+       && UINT_LEAST16_MAX <= INT_MAX)
+typedef uint_least16_t yytype_uint16;
+#elif !defined __UINT_LEAST16_MAX__ && USHRT_MAX <= INT_MAX
+typedef unsigned short yytype_uint16;
+#else
+typedef int yytype_uint16;
+#endif
+
+#ifndef YYPTRDIFF_T
+# if defined __PTRDIFF_TYPE__ && defined __PTRDIFF_MAX__
+#  define YYPTRDIFF_T __PTRDIFF_TYPE__
+#  define YYPTRDIFF_MAXIMUM __PTRDIFF_MAX__
+# elif defined PTRDIFF_MAX
+#  ifndef ptrdiff_t
+#   include <stddef.h> /* INFRINGES ON USER NAME SPACE */
+#  endif
+#  define YYPTRDIFF_T ptrdiff_t
+#  define YYPTRDIFF_MAXIMUM PTRDIFF_MAX
+# else
+#  define YYPTRDIFF_T long
+#  define YYPTRDIFF_MAXIMUM LONG_MAX
+# endif
+#endif
+
+#ifndef YYSIZE_T
+# ifdef __SIZE_TYPE__
+#  define YYSIZE_T __SIZE_TYPE__
+# elif defined size_t
+#  define YYSIZE_T size_t
+# elif defined __STDC_VERSION__ && 199901 <= __STDC_VERSION__
+#  include <stddef.h> /* INFRINGES ON USER NAME SPACE */
+#  define YYSIZE_T size_t
+# else
+#  define YYSIZE_T unsigned
+# endif
+#endif
+
+#define YYSIZE_MAXIMUM                                  \
+  YY_CAST (YYPTRDIFF_T,                                 \
+           (YYPTRDIFF_MAXIMUM < YY_CAST (YYSIZE_T, -1)  \
+            ? YYPTRDIFF_MAXIMUM                         \
+            : YY_CAST (YYSIZE_T, -1)))
+
+#define YYSIZEOF(X) YY_CAST (YYPTRDIFF_T, sizeof (X))
+
+
+/* Stored state numbers (used for stacks). */
+typedef yytype_int8 yy_state_t;
+
+/* State numbers in computations.  */
+typedef int yy_state_fast_t;
+
+#ifndef YY_
+# if defined YYENABLE_NLS && YYENABLE_NLS
+#  if ENABLE_NLS
+#   include <libintl.h> /* INFRINGES ON USER NAME SPACE */
+#   define YY_(Msgid) dgettext ("bison-runtime", Msgid)
+#  endif
+# endif
+# ifndef YY_
+#  define YY_(Msgid) Msgid
+# endif
+#endif
+
+
+#ifndef YY_ATTRIBUTE_PURE
+# if defined __GNUC__ && 2 < __GNUC__ + (96 <= __GNUC_MINOR__)
+#  define YY_ATTRIBUTE_PURE __attribute__ ((__pure__))
+# else
+#  define YY_ATTRIBUTE_PURE
+# endif
+#endif
+
+#ifndef YY_ATTRIBUTE_UNUSED
+# if defined __GNUC__ && 2 < __GNUC__ + (7 <= __GNUC_MINOR__)
+#  define YY_ATTRIBUTE_UNUSED __attribute__ ((__unused__))
+# else
+#  define YY_ATTRIBUTE_UNUSED
+# endif
+#endif
+
+/* Suppress unused-variable warnings by "using" E.  */
+#if ! defined lint || defined __GNUC__
+# define YY_USE(E) ((void) (E))
+#else
+# define YY_USE(E) /* empty */
+#endif
+
+/* Suppress an incorrect diagnostic about yylval being uninitialized.  */
+#if defined __GNUC__ && ! defined __ICC && 406 <= __GNUC__ * 100 + __GNUC_MINOR__
+# if __GNUC__ * 100 + __GNUC_MINOR__ < 407
+#  define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN                           \
+    _Pragma ("GCC diagnostic push")                                     \
+    _Pragma ("GCC diagnostic ignored \"-Wuninitialized\"")
+# else
+#  define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN                           \
+    _Pragma ("GCC diagnostic push")                                     \
+    _Pragma ("GCC diagnostic ignored \"-Wuninitialized\"")              \
+    _Pragma ("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+# endif
+# define YY_IGNORE_MAYBE_UNINITIALIZED_END      \
+    _Pragma ("GCC diagnostic pop")
+#else
+# define YY_INITIAL_VALUE(Value) Value
+#endif
+#ifndef YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+# define YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+# define YY_IGNORE_MAYBE_UNINITIALIZED_END
+#endif
+#ifndef YY_INITIAL_VALUE
+# define YY_INITIAL_VALUE(Value) /* Nothing. */
+#endif
+
+#if defined __cplusplus && defined __GNUC__ && ! defined __ICC && 6 <= __GNUC__
+# define YY_IGNORE_USELESS_CAST_BEGIN                          \
+    _Pragma ("GCC diagnostic push")                            \
+    _Pragma ("GCC diagnostic ignored \"-Wuseless-cast\"")
+# define YY_IGNORE_USELESS_CAST_END            \
+    _Pragma ("GCC diagnostic pop")
+#endif
+#ifndef YY_IGNORE_USELESS_CAST_BEGIN
+# define YY_IGNORE_USELESS_CAST_BEGIN
+# define YY_IGNORE_USELESS_CAST_END
+#endif
+
+
+#define YY_ASSERT(E) ((void) (0 && (E)))
+
+#if 1
+
+/* The parser invokes alloca or malloc; define the necessary symbols.  */
+
+# ifdef YYSTACK_USE_ALLOCA
+#  if YYSTACK_USE_ALLOCA
+#   ifdef __GNUC__
+#    define YYSTACK_ALLOC __builtin_alloca
+#   elif defined __BUILTIN_VA_ARG_INCR
+#    include <alloca.h> /* INFRINGES ON USER NAME SPACE */
+#   elif defined _AIX
+#    define YYSTACK_ALLOC __alloca
+#   elif defined _MSC_VER
+#    include <malloc.h> /* INFRINGES ON USER NAME SPACE */
+#    define alloca _alloca
+#   else
+#    define YYSTACK_ALLOC alloca
+#    if ! defined _ALLOCA_H && ! defined EXIT_SUCCESS
+#     include <stdlib.h> /* INFRINGES ON USER NAME SPACE */
+      /* Use EXIT_SUCCESS as a witness for stdlib.h.  */
+#     ifndef EXIT_SUCCESS
+#      define EXIT_SUCCESS 0
+#     endif
+#    endif
+#   endif
+#  endif
+# endif
+
+# ifdef YYSTACK_ALLOC
+   /* Pacify GCC's 'empty if-body' warning.  */
+#  define YYSTACK_FREE(Ptr) do { /* empty */; } while (0)
+#  ifndef YYSTACK_ALLOC_MAXIMUM
+    /* The OS might guarantee only one guard page at the bottom of the stack,
+       and a page size can be as small as 4096 bytes.  So we cannot safely
+       invoke alloca (N) if N exceeds 4096.  Use a slightly smaller number
+       to allow for a few compiler-allocated temporary stack slots.  */
+#   define YYSTACK_ALLOC_MAXIMUM 4032 /* reasonable circa 2006 */
+#  endif
+# else
+#  define YYSTACK_ALLOC YYMALLOC
+#  define YYSTACK_FREE YYFREE
+#  ifndef YYSTACK_ALLOC_MAXIMUM
+#   define YYSTACK_ALLOC_MAXIMUM YYSIZE_MAXIMUM
+#  endif
+#  if (defined __cplusplus && ! defined EXIT_SUCCESS \
+       && ! ((defined YYMALLOC || defined malloc) \
+             && (defined YYFREE || defined free)))
+#   include <stdlib.h> /* INFRINGES ON USER NAME SPACE */
+#   ifndef EXIT_SUCCESS
+#    define EXIT_SUCCESS 0
+#   endif
+#  endif
+#  ifndef YYMALLOC
+#   define YYMALLOC malloc
+#   if ! defined malloc && ! defined EXIT_SUCCESS
+void *malloc (YYSIZE_T); /* INFRINGES ON USER NAME SPACE */
+#   endif
+#  endif
+#  ifndef YYFREE
+#   define YYFREE free
+#   if ! defined free && ! defined EXIT_SUCCESS
+void free (void *); /* INFRINGES ON USER NAME SPACE */
+#   endif
+#  endif
+# endif
+#endif /* 1 */
+
+#if (! defined yyoverflow \
+     && (! defined __cplusplus \
+         || (defined YYSTYPE_IS_TRIVIAL && YYSTYPE_IS_TRIVIAL)))
+
+/* A type that is properly aligned for any stack member.  */
+union yyalloc
+{
+  yy_state_t yyss_alloc;
+  YYSTYPE yyvs_alloc;
+};
+
+/* The size of the maximum gap between one aligned stack and the next.  */
+# define YYSTACK_GAP_MAXIMUM (YYSIZEOF (union yyalloc) - 1)
+
+/* The size of an array large to enough to hold all stacks, each with
+   N elements.  */
+# define YYSTACK_BYTES(N) \
+     ((N) * (YYSIZEOF (yy_state_t) + YYSIZEOF (YYSTYPE)) \
+      + YYSTACK_GAP_MAXIMUM)
+
+# define YYCOPY_NEEDED 1
+
+/* Relocate STACK from its old location to the new one.  The
+   local variables YYSIZE and YYSTACKSIZE give the old and new number of
+   elements in the stack, and YYPTR gives the new location of the
+   stack.  Advance YYPTR to a properly aligned location for the next
+   stack.  */
+# define YYSTACK_RELOCATE(Stack_alloc, Stack)                           \
+    do                                                                  \
+      {                                                                 \
+        YYPTRDIFF_T yynewbytes;                                         \
+        YYCOPY (&yyptr->Stack_alloc, Stack, yysize);                    \
+        Stack = &yyptr->Stack_alloc;                                    \
+        yynewbytes = yystacksize * YYSIZEOF (*Stack) + YYSTACK_GAP_MAXIMUM; \
+        yyptr += yynewbytes / YYSIZEOF (*yyptr);                        \
+      }                                                                 \
+    while (0)
+
+#endif
+
+#if defined YYCOPY_NEEDED && YYCOPY_NEEDED
+/* Copy COUNT objects from SRC to DST.  The source and destination do
+   not overlap.  */
+# ifndef YYCOPY
+#  if defined __GNUC__ && 1 < __GNUC__
+#   define YYCOPY(Dst, Src, Count) \
+      __builtin_memcpy (Dst, Src, YY_CAST (YYSIZE_T, (Count)) * sizeof (*(Src)))
+#  else
+#   define YYCOPY(Dst, Src, Count)              \
+      do                                        \
+        {                                       \
+          YYPTRDIFF_T yyi;                      \
+          for (yyi = 0; yyi < (Count); yyi++)   \
+            (Dst)[yyi] = (Src)[yyi];            \
+        }                                       \
+      while (0)
+#  endif
+# endif
+#endif /* !YYCOPY_NEEDED */
+
+/* YYFINAL -- State number of the termination state.  */
+#define YYFINAL  17
+/* YYLAST -- Last index in YYTABLE.  */
+#define YYLAST   79
+
+/* YYNTOKENS -- Number of terminals.  */
+#define YYNTOKENS  34
+/* YYNNTS -- Number of nonterminals.  */
+#define YYNNTS  19
+/* YYNRULES -- Number of rules.  */
+#define YYNRULES  50
+/* YYNSTATES -- Number of states.  */
+#define YYNSTATES  74
+
+/* YYMAXUTOK -- Last valid token kind.  */
+#define YYMAXUTOK   288
+
+
+/* YYTRANSLATE(TOKEN-NUM) -- Symbol number corresponding to TOKEN-NUM
+   as returned by yylex, with out-of-bounds checking.  */
+#define YYTRANSLATE(YYX)                                \
+  (0 <= (YYX) && (YYX) <= YYMAXUTOK                     \
+   ? YY_CAST (yysymbol_kind_t, yytranslate[YYX])        \
+   : YYSYMBOL_YYUNDEF)
+
+/* YYTRANSLATE[TOKEN-NUM] -- Symbol number corresponding to TOKEN-NUM
+   as returned by yylex.  */
+static const yytype_int8 yytranslate[] =
+{
+       0,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     2,     2,     2,     2,
+       2,     2,     2,     2,     2,     2,     1,     2,     3,     4,
+       5,     6,     7,     8,     9,    10,    11,    12,    13,    14,
+      15,    16,    17,    18,    19,    20,    21,    22,    23,    24,
+      25,    26,    27,    28,    29,    30,    31,    32,    33
+};
+
+#if YYDEBUG
+/* YYRLINE[YYN] -- Source line where rule number YYN was defined.  */
+static const yytype_int16 yyrline[] =
+{
+       0,   288,   288,   289,   293,   294,   295,   299,   300,   309,
+     319,   330,   343,   349,   357,   363,   369,   374,   377,   385,
+     407,   416,   426,   437,   452,   455,   458,   461,   464,   467,
+     470,   476,   479,   482,   488,   492,   498,   504,   511,   517,
+     523,   529,   540,   541,   545,   548,   551,   557,   564,   568,
+     569
+};
+#endif
+
+/** Accessing symbol of state STATE.  */
+#define YY_ACCESSING_SYMBOL(State) YY_CAST (yysymbol_kind_t, yystos[State])
+
+#if 1
+/* The user-facing name of the symbol whose (internal) number is
+   YYSYMBOL.  No bounds checking.  */
+static const char *yysymbol_name (yysymbol_kind_t yysymbol) YY_ATTRIBUTE_UNUSED;
+
+/* YYTNAME[SYMBOL-NUM] -- String name of the symbol SYMBOL-NUM.
+   First, the terminals, then, starting at YYNTOKENS, nonterminals.  */
+static const char *const yytname[] =
+{
+  "\"end of file\"", "error", "\"invalid token\"", "TOK_SELECT",
+  "TOK_WHERE", "TOK_CONTAINS", "TOK_EQ", "TOK_NEQ", "TOK_GT", "TOK_LT",
+  "TOK_GTE", "TOK_LTE", "TOK_AND", "TOK_OR", "TOK_NOT", "TOK_LPAREN",
+  "TOK_RPAREN", "TOK_COMMA", "TOK_DASH", "TOK_CONV_NUM", "TOK_CONV_DBL",
+  "TOK_CONV_STR", "TOK_ERROR", "TOK_ORDER", "TOK_BY", "TOK_ASCENDING",
+  "TOK_DESCENDING", "TOK_LIMIT", "TOK_INTEGER", "TOK_FLOAT", "TOK_COLUMN",
+  "TOK_STRING", "TOK_IDENTIFIER", "TOK_SPECIAL", "$accept", "Start",
+  "Selectors", "Selector", "Columnspec", "NoColumns", "Conditions",
+  "Simple", "Compound", "Function_Identifier", "Function", "Operator",
+  "Conversion", "Value", "Value_Base", "OrderSpec", "OrderKey", "Limit",
+  "Order", YY_NULLPTR
+};
+
+static const char *
+yysymbol_name (yysymbol_kind_t yysymbol)
+{
+  return yytname[yysymbol];
+}
+#endif
+
+#define YYPACT_NINF (-26)
+
+#define yypact_value_is_default(Yyn) \
+  ((Yyn) == YYPACT_NINF)
+
+#define YYTABLE_NINF (-37)
+
+#define yytable_value_is_error(Yyn) \
+  0
+
+/* YYPACT[STATE-NUM] -- Index in YYTABLE of the portion describing
+   STATE-NUM.  */
+static const yytype_int8 yypact[] =
+{
+       8,   -25,    13,   -26,   -26,    53,   -26,   -26,   -26,    -3,
+     -26,   -26,   -26,     6,   -26,   -26,    28,   -26,   -12,    -5,
+     -25,    11,   -26,     1,   -26,   -26,   -26,   -26,   -26,    -5,
+      -5,   -26,    14,   -26,     3,    35,   -26,    29,   -26,    38,
+       3,    52,   -26,    -5,    -5,   -26,   -26,   -26,   -26,   -26,
+     -26,   -26,    29,    41,   -15,   -26,   -26,    29,   -26,     3,
+       3,   -26,   -26,   -26,    29,    22,   -26,    59,   -26,   -26,
+     -26,    29,    61,   -26
+};
+
+/* YYDEFACT[STATE-NUM] -- Default reduction number in state STATE-NUM.
+   Performed when YYTABLE does not specify something else to do.  Zero
+   means the default is an error.  */
+static const yytype_int8 yydefact[] =
+{
+       0,    11,     0,    38,    39,    10,    37,    19,    40,    50,
+       5,     7,     6,     0,    41,     8,    35,     1,     0,     0,
+       0,     0,     3,     0,    31,    32,    33,    34,     9,     0,
+       0,    36,    50,    18,    12,     0,     4,     0,    20,     0,
+      16,     0,     2,     0,     0,    30,    24,    25,    26,    27,
+      28,    29,     0,    44,    48,    43,    21,     0,    17,    14,
+      15,    13,    45,    46,     0,     0,    49,     0,    42,    47,
+      22,     0,     0,    23
+};
+
+/* YYPGOTO[NTERM-NUM].  */
+static const yytype_int8 yypgoto[] =
+{
+     -26,   -26,   -26,    49,   -26,   -26,   -26,   -26,     9,   -26,
+     -26,   -26,   -26,    -1,   -26,   -26,    15,   -26,    46
+};
+
+/* YYDEFGOTO[NTERM-NUM].  */
+static const yytype_int8 yydefgoto[] =
+{
+       0,     2,     9,    10,    11,    12,    32,    33,    34,    13,
+      14,    52,    27,    35,    16,    54,    55,    66,    22
+};
+
+/* YYTABLE[YYPACT[STATE-NUM]] -- What to do in state STATE-NUM.  If
+   positive, shift that token.  If negative, reduce the rule whose
+   number is the opposite.  If YYTABLE_NINF, syntax error.  */
+static const yytype_int8 yytable[] =
+{
+      15,    19,    64,     3,     4,     5,     6,     7,     8,    29,
+      30,     1,    65,    17,    20,    43,    44,    38,    28,    15,
+      21,    23,    39,     3,     4,    31,     6,     7,     8,     3,
+       4,    31,     6,     7,     8,    37,    53,    21,    40,    41,
+      45,    46,    47,    48,    49,    50,    51,    24,    25,    26,
+      69,    61,    59,    60,    56,    57,    67,     3,     4,    31,
+       6,     7,     8,    53,    43,    44,    62,    63,    58,    36,
+      72,    18,   -36,   -36,   -36,    70,    71,    73,    42,    68
+};
+
+static const yytype_int8 yycheck[] =
+{
+       1,     4,    17,    28,    29,    30,    31,    32,    33,    14,
+      15,     3,    27,     0,    17,    12,    13,    16,    30,    20,
+      23,    15,    23,    28,    29,    30,    31,    32,    33,    28,
+      29,    30,    31,    32,    33,    24,    37,    23,    29,    30,
+       5,     6,     7,     8,     9,    10,    11,    19,    20,    21,
+      28,    52,    43,    44,    16,    17,    57,    28,    29,    30,
+      31,    32,    33,    64,    12,    13,    25,    26,    16,    20,
+      71,    18,    19,    20,    21,    16,    17,    16,    32,    64
+};
+
+/* YYSTOS[STATE-NUM] -- The symbol kind of the accessing symbol of
+   state STATE-NUM.  */
+static const yytype_int8 yystos[] =
+{
+       0,     3,    35,    28,    29,    30,    31,    32,    33,    36,
+      37,    38,    39,    43,    44,    47,    48,     0,    18,     4,
+      17,    23,    52,    15,    19,    20,    21,    46,    30,    14,
+      15,    30,    40,    41,    42,    47,    37,    24,    16,    47,
+      42,    42,    52,    12,    13,     5,     6,     7,     8,     9,
+      10,    11,    45,    47,    49,    50,    16,    17,    16,    42,
+      42,    47,    25,    26,    17,    27,    51,    47,    50,    28,
+      16,    17,    47,    16
+};
+
+/* YYR1[RULE-NUM] -- Symbol kind of the left-hand side of rule RULE-NUM.  */
+static const yytype_int8 yyr1[] =
+{
+       0,    34,    35,    35,    36,    36,    36,    37,    37,    38,
+      38,    39,    40,    41,    42,    42,    42,    42,    42,    43,
+      44,    44,    44,    44,    45,    45,    45,    45,    45,    45,
+      45,    46,    46,    46,    47,    47,    48,    48,    48,    48,
+      48,    48,    49,    49,    50,    50,    50,    51,    51,    52,
+      52
+};
+
+/* YYR2[RULE-NUM] -- Number of symbols on the right-hand side of rule RULE-NUM.  */
+static const yytype_int8 yyr2[] =
+{
+       0,     2,     5,     3,     3,     1,     1,     1,     1,     3,
+       1,     0,     1,     3,     3,     3,     2,     3,     1,     1,
+       3,     4,     6,     8,     1,     1,     1,     1,     1,     1,
+       1,     1,     1,     1,     2,     1,     1,     1,     1,     1,
+       1,     1,     3,     1,     1,     2,     2,     2,     0,     4,
+       0
+};
+
+
+enum { YYENOMEM = -2 };
+
+#define yyerrok         (yyerrstatus = 0)
+#define yyclearin       (yychar = YYEMPTY)
+
+#define YYACCEPT        goto yyacceptlab
+#define YYABORT         goto yyabortlab
+#define YYERROR         goto yyerrorlab
+#define YYNOMEM         goto yyexhaustedlab
+
+
+#define YYRECOVERING()  (!!yyerrstatus)
+
+#define YYBACKUP(Token, Value)                                    \
+  do                                                              \
+    if (yychar == YYEMPTY)                                        \
+      {                                                           \
+        yychar = (Token);                                         \
+        yylval = (Value);                                         \
+        YYPOPSTACK (yylen);                                       \
+        yystate = *yyssp;                                         \
+        goto yybackup;                                            \
+      }                                                           \
+    else                                                          \
+      {                                                           \
+        yyerror (YY_("syntax error: cannot back up")); \
+        YYERROR;                                                  \
+      }                                                           \
+  while (0)
+
+/* Backward compatibility with an undocumented macro.
+   Use YYerror or YYUNDEF. */
+#define YYERRCODE YYUNDEF
+
+
+/* Enable debugging if requested.  */
+#if YYDEBUG
+
+# ifndef YYFPRINTF
+#  include <stdio.h> /* INFRINGES ON USER NAME SPACE */
+#  define YYFPRINTF fprintf
+# endif
+
+# define YYDPRINTF(Args)                        \
+do {                                            \
+  if (yydebug)                                  \
+    YYFPRINTF Args;                             \
+} while (0)
+
+
+
+
+# define YY_SYMBOL_PRINT(Title, Kind, Value, Location)                    \
+do {                                                                      \
+  if (yydebug)                                                            \
+    {                                                                     \
+      YYFPRINTF (stderr, "%s ", Title);                                   \
+      yy_symbol_print (stderr,                                            \
+                  Kind, Value); \
+      YYFPRINTF (stderr, "\n");                                           \
+    }                                                                     \
+} while (0)
+
+
+/*-----------------------------------.
+| Print this symbol's value on YYO.  |
+`-----------------------------------*/
+
+static void
+yy_symbol_value_print (FILE *yyo,
+                       yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep)
+{
+  FILE *yyoutput = yyo;
+  YY_USE (yyoutput);
+  if (!yyvaluep)
+    return;
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  YY_USE (yykind);
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+}
+
+
+/*---------------------------.
+| Print this symbol on YYO.  |
+`---------------------------*/
+
+static void
+yy_symbol_print (FILE *yyo,
+                 yysymbol_kind_t yykind, YYSTYPE const * const yyvaluep)
+{
+  YYFPRINTF (yyo, "%s %s (",
+             yykind < YYNTOKENS ? "token" : "nterm", yysymbol_name (yykind));
+
+  yy_symbol_value_print (yyo, yykind, yyvaluep);
+  YYFPRINTF (yyo, ")");
+}
+
+/*------------------------------------------------------------------.
+| yy_stack_print -- Print the state stack from its BOTTOM up to its |
+| TOP (included).                                                   |
+`------------------------------------------------------------------*/
+
+static void
+yy_stack_print (yy_state_t *yybottom, yy_state_t *yytop)
+{
+  YYFPRINTF (stderr, "Stack now");
+  for (; yybottom <= yytop; yybottom++)
+    {
+      int yybot = *yybottom;
+      YYFPRINTF (stderr, " %d", yybot);
+    }
+  YYFPRINTF (stderr, "\n");
+}
+
+# define YY_STACK_PRINT(Bottom, Top)                            \
+do {                                                            \
+  if (yydebug)                                                  \
+    yy_stack_print ((Bottom), (Top));                           \
+} while (0)
+
+
+/*------------------------------------------------.
+| Report that the YYRULE is going to be reduced.  |
+`------------------------------------------------*/
+
+static void
+yy_reduce_print (yy_state_t *yyssp, YYSTYPE *yyvsp,
+                 int yyrule)
+{
+  int yylno = yyrline[yyrule];
+  int yynrhs = yyr2[yyrule];
+  int yyi;
+  YYFPRINTF (stderr, "Reducing stack by rule %d (line %d):\n",
+             yyrule - 1, yylno);
+  /* The symbols being reduced.  */
+  for (yyi = 0; yyi < yynrhs; yyi++)
+    {
+      YYFPRINTF (stderr, "   $%d = ", yyi + 1);
+      yy_symbol_print (stderr,
+                       YY_ACCESSING_SYMBOL (+yyssp[yyi + 1 - yynrhs]),
+                       &yyvsp[(yyi + 1) - (yynrhs)]);
+      YYFPRINTF (stderr, "\n");
+    }
+}
+
+# define YY_REDUCE_PRINT(Rule)          \
+do {                                    \
+  if (yydebug)                          \
+    yy_reduce_print (yyssp, yyvsp, Rule); \
+} while (0)
+
+/* Nonzero means print parse trace.  It is left uninitialized so that
+   multiple parsers can coexist.  */
+int yydebug;
+#else /* !YYDEBUG */
+# define YYDPRINTF(Args) ((void) 0)
+# define YY_SYMBOL_PRINT(Title, Kind, Value, Location)
+# define YY_STACK_PRINT(Bottom, Top)
+# define YY_REDUCE_PRINT(Rule)
+#endif /* !YYDEBUG */
+
+
+/* YYINITDEPTH -- initial size of the parser's stacks.  */
+#ifndef YYINITDEPTH
+# define YYINITDEPTH 200
+#endif
+
+/* YYMAXDEPTH -- maximum size the stacks can grow to (effective only
+   if the built-in stack extension method is used).
+
+   Do not make this value too large; the results are undefined if
+   YYSTACK_ALLOC_MAXIMUM < YYSTACK_BYTES (YYMAXDEPTH)
+   evaluated with infinite-precision integer arithmetic.  */
+
+#ifndef YYMAXDEPTH
+# define YYMAXDEPTH 10000
+#endif
+
+
+/* Context of a parse error.  */
+typedef struct
+{
+  yy_state_t *yyssp;
+  yysymbol_kind_t yytoken;
+} yypcontext_t;
+
+/* Put in YYARG at most YYARGN of the expected tokens given the
+   current YYCTX, and return the number of tokens stored in YYARG.  If
+   YYARG is null, return the number of expected tokens (guaranteed to
+   be less than YYNTOKENS).  Return YYENOMEM on memory exhaustion.
+   Return 0 if there are more than YYARGN expected tokens, yet fill
+   YYARG up to YYARGN. */
+static int
+yypcontext_expected_tokens (const yypcontext_t *yyctx,
+                            yysymbol_kind_t yyarg[], int yyargn)
+{
+  /* Actual size of YYARG. */
+  int yycount = 0;
+  int yyn = yypact[+*yyctx->yyssp];
+  if (!yypact_value_is_default (yyn))
+    {
+      /* Start YYX at -YYN if negative to avoid negative indexes in
+         YYCHECK.  In other words, skip the first -YYN actions for
+         this state because they are default actions.  */
+      int yyxbegin = yyn < 0 ? -yyn : 0;
+      /* Stay within bounds of both yycheck and yytname.  */
+      int yychecklim = YYLAST - yyn + 1;
+      int yyxend = yychecklim < YYNTOKENS ? yychecklim : YYNTOKENS;
+      int yyx;
+      for (yyx = yyxbegin; yyx < yyxend; ++yyx)
+        if (yycheck[yyx + yyn] == yyx && yyx != YYSYMBOL_YYerror
+            && !yytable_value_is_error (yytable[yyx + yyn]))
+          {
+            if (!yyarg)
+              ++yycount;
+            else if (yycount == yyargn)
+              return 0;
+            else
+              yyarg[yycount++] = YY_CAST (yysymbol_kind_t, yyx);
+          }
+    }
+  if (yyarg && yycount == 0 && 0 < yyargn)
+    yyarg[0] = YYSYMBOL_YYEMPTY;
+  return yycount;
+}
+
+
+
+
+#ifndef yystrlen
+# if defined __GLIBC__ && defined _STRING_H
+#  define yystrlen(S) (YY_CAST (YYPTRDIFF_T, strlen (S)))
+# else
+/* Return the length of YYSTR.  */
+static YYPTRDIFF_T
+yystrlen (const char *yystr)
+{
+  YYPTRDIFF_T yylen;
+  for (yylen = 0; yystr[yylen]; yylen++)
+    continue;
+  return yylen;
+}
+# endif
+#endif
+
+#ifndef yystpcpy
+# if defined __GLIBC__ && defined _STRING_H && defined _GNU_SOURCE
+#  define yystpcpy stpcpy
+# else
+/* Copy YYSRC to YYDEST, returning the address of the terminating '\0' in
+   YYDEST.  */
+static char *
+yystpcpy (char *yydest, const char *yysrc)
+{
+  char *yyd = yydest;
+  const char *yys = yysrc;
+
+  while ((*yyd++ = *yys++) != '\0')
+    continue;
+
+  return yyd - 1;
+}
+# endif
+#endif
+
+#ifndef yytnamerr
+/* Copy to YYRES the contents of YYSTR after stripping away unnecessary
+   quotes and backslashes, so that it's suitable for yyerror.  The
+   heuristic is that double-quoting is unnecessary unless the string
+   contains an apostrophe, a comma, or backslash (other than
+   backslash-backslash).  YYSTR is taken from yytname.  If YYRES is
+   null, do not copy; instead, return the length of what the result
+   would have been.  */
+static YYPTRDIFF_T
+yytnamerr (char *yyres, const char *yystr)
+{
+  if (*yystr == '"')
+    {
+      YYPTRDIFF_T yyn = 0;
+      char const *yyp = yystr;
+      for (;;)
+        switch (*++yyp)
+          {
+          case '\'':
+          case ',':
+            goto do_not_strip_quotes;
+
+          case '\\':
+            if (*++yyp != '\\')
+              goto do_not_strip_quotes;
+            else
+              goto append;
+
+          append:
+          default:
+            if (yyres)
+              yyres[yyn] = *yyp;
+            yyn++;
+            break;
+
+          case '"':
+            if (yyres)
+              yyres[yyn] = '\0';
+            return yyn;
+          }
+    do_not_strip_quotes: ;
+    }
+
+  if (yyres)
+    return yystpcpy (yyres, yystr) - yyres;
+  else
+    return yystrlen (yystr);
+}
+#endif
+
+
+static int
+yy_syntax_error_arguments (const yypcontext_t *yyctx,
+                           yysymbol_kind_t yyarg[], int yyargn)
+{
+  /* Actual size of YYARG. */
+  int yycount = 0;
+  /* There are many possibilities here to consider:
+     - If this state is a consistent state with a default action, then
+       the only way this function was invoked is if the default action
+       is an error action.  In that case, don't check for expected
+       tokens because there are none.
+     - The only way there can be no lookahead present (in yychar) is if
+       this state is a consistent state with a default action.  Thus,
+       detecting the absence of a lookahead is sufficient to determine
+       that there is no unexpected or expected token to report.  In that
+       case, just report a simple "syntax error".
+     - Don't assume there isn't a lookahead just because this state is a
+       consistent state with a default action.  There might have been a
+       previous inconsistent state, consistent state with a non-default
+       action, or user semantic action that manipulated yychar.
+     - Of course, the expected token list depends on states to have
+       correct lookahead information, and it depends on the parser not
+       to perform extra reductions after fetching a lookahead from the
+       scanner and before detecting a syntax error.  Thus, state merging
+       (from LALR or IELR) and default reductions corrupt the expected
+       token list.  However, the list is correct for canonical LR with
+       one exception: it will still contain any token that will not be
+       accepted due to an error action in a later state.
+  */
+  if (yyctx->yytoken != YYSYMBOL_YYEMPTY)
+    {
+      int yyn;
+      if (yyarg)
+        yyarg[yycount] = yyctx->yytoken;
+      ++yycount;
+      yyn = yypcontext_expected_tokens (yyctx,
+                                        yyarg ? yyarg + 1 : yyarg, yyargn - 1);
+      if (yyn == YYENOMEM)
+        return YYENOMEM;
+      else
+        yycount += yyn;
+    }
+  return yycount;
+}
+
+/* Copy into *YYMSG, which is of size *YYMSG_ALLOC, an error message
+   about the unexpected token YYTOKEN for the state stack whose top is
+   YYSSP.
+
+   Return 0 if *YYMSG was successfully written.  Return -1 if *YYMSG is
+   not large enough to hold the message.  In that case, also set
+   *YYMSG_ALLOC to the required number of bytes.  Return YYENOMEM if the
+   required number of bytes is too large to store.  */
+static int
+yysyntax_error (YYPTRDIFF_T *yymsg_alloc, char **yymsg,
+                const yypcontext_t *yyctx)
+{
+  enum { YYARGS_MAX = 5 };
+  /* Internationalized format string. */
+  const char *yyformat = YY_NULLPTR;
+  /* Arguments of yyformat: reported tokens (one for the "unexpected",
+     one per "expected"). */
+  yysymbol_kind_t yyarg[YYARGS_MAX];
+  /* Cumulated lengths of YYARG.  */
+  YYPTRDIFF_T yysize = 0;
+
+  /* Actual size of YYARG. */
+  int yycount = yy_syntax_error_arguments (yyctx, yyarg, YYARGS_MAX);
+  if (yycount == YYENOMEM)
+    return YYENOMEM;
+
+  switch (yycount)
+    {
+#define YYCASE_(N, S)                       \
+      case N:                               \
+        yyformat = S;                       \
+        break
+    default: /* Avoid compiler warnings. */
+      YYCASE_(0, YY_("syntax error"));
+      YYCASE_(1, YY_("syntax error, unexpected %s"));
+      YYCASE_(2, YY_("syntax error, unexpected %s, expecting %s"));
+      YYCASE_(3, YY_("syntax error, unexpected %s, expecting %s or %s"));
+      YYCASE_(4, YY_("syntax error, unexpected %s, expecting %s or %s or %s"));
+      YYCASE_(5, YY_("syntax error, unexpected %s, expecting %s or %s or %s or %s"));
+#undef YYCASE_
+    }
+
+  /* Compute error message size.  Don't count the "%s"s, but reserve
+     room for the terminator.  */
+  yysize = yystrlen (yyformat) - 2 * yycount + 1;
+  {
+    int yyi;
+    for (yyi = 0; yyi < yycount; ++yyi)
+      {
+        YYPTRDIFF_T yysize1
+          = yysize + yytnamerr (YY_NULLPTR, yytname[yyarg[yyi]]);
+        if (yysize <= yysize1 && yysize1 <= YYSTACK_ALLOC_MAXIMUM)
+          yysize = yysize1;
+        else
+          return YYENOMEM;
+      }
+  }
+
+  if (*yymsg_alloc < yysize)
+    {
+      *yymsg_alloc = 2 * yysize;
+      if (! (yysize <= *yymsg_alloc
+             && *yymsg_alloc <= YYSTACK_ALLOC_MAXIMUM))
+        *yymsg_alloc = YYSTACK_ALLOC_MAXIMUM;
+      return -1;
+    }
+
+  /* Avoid sprintf, as that infringes on the user's name space.
+     Don't have undefined behavior even if the translation
+     produced a string with the wrong number of "%s"s.  */
+  {
+    char *yyp = *yymsg;
+    int yyi = 0;
+    while ((*yyp = *yyformat) != '\0')
+      if (*yyp == '%' && yyformat[1] == 's' && yyi < yycount)
+        {
+          yyp += yytnamerr (yyp, yytname[yyarg[yyi++]]);
+          yyformat += 2;
+        }
+      else
+        {
+          ++yyp;
+          ++yyformat;
+        }
+  }
+  return 0;
+}
+
+
+/*-----------------------------------------------.
+| Release the memory associated to this symbol.  |
+`-----------------------------------------------*/
+
+static void
+yydestruct (const char *yymsg,
+            yysymbol_kind_t yykind, YYSTYPE *yyvaluep)
+{
+  YY_USE (yyvaluep);
+  if (!yymsg)
+    yymsg = "Deleting";
+  YY_SYMBOL_PRINT (yymsg, yykind, yyvaluep, yylocationp);
+
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  YY_USE (yykind);
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+}
+
+
+/* Lookahead token kind.  */
+int yychar;
+
+/* The semantic value of the lookahead symbol.  */
+YYSTYPE yylval;
+/* Number of syntax errors so far.  */
+int yynerrs;
+
+
+
+
+/*----------.
+| yyparse.  |
+`----------*/
+
+int
+yyparse (void)
+{
+    yy_state_fast_t yystate = 0;
+    /* Number of tokens to shift before error messages enabled.  */
+    int yyerrstatus = 0;
+
+    /* Refer to the stacks through separate pointers, to allow yyoverflow
+       to reallocate them elsewhere.  */
+
+    /* Their size.  */
+    YYPTRDIFF_T yystacksize = YYINITDEPTH;
+
+    /* The state stack: array, bottom, top.  */
+    yy_state_t yyssa[YYINITDEPTH];
+    yy_state_t *yyss = yyssa;
+    yy_state_t *yyssp = yyss;
+
+    /* The semantic value stack: array, bottom, top.  */
+    YYSTYPE yyvsa[YYINITDEPTH];
+    YYSTYPE *yyvs = yyvsa;
+    YYSTYPE *yyvsp = yyvs;
+
+  int yyn;
+  /* The return value of yyparse.  */
+  int yyresult;
+  /* Lookahead symbol kind.  */
+  yysymbol_kind_t yytoken = YYSYMBOL_YYEMPTY;
+  /* The variables used to return semantic value and location from the
+     action routines.  */
+  YYSTYPE yyval;
+
+  /* Buffer for error messages, and its allocated size.  */
+  char yymsgbuf[128];
+  char *yymsg = yymsgbuf;
+  YYPTRDIFF_T yymsg_alloc = sizeof yymsgbuf;
+
+#define YYPOPSTACK(N)   (yyvsp -= (N), yyssp -= (N))
+
+  /* The number of symbols on the RHS of the reduced rule.
+     Keep to zero when no symbol should be popped.  */
+  int yylen = 0;
+
+  YYDPRINTF ((stderr, "Starting parse\n"));
+
+  yychar = YYEMPTY; /* Cause a token to be read.  */
+
+  goto yysetstate;
+
+
+/*------------------------------------------------------------.
+| yynewstate -- push a new state, which is found in yystate.  |
+`------------------------------------------------------------*/
+yynewstate:
+  /* In all cases, when you get here, the value and location stacks
+     have just been pushed.  So pushing a state here evens the stacks.  */
+  yyssp++;
+
+
+/*--------------------------------------------------------------------.
+| yysetstate -- set current state (the top of the stack) to yystate.  |
+`--------------------------------------------------------------------*/
+yysetstate:
+  YYDPRINTF ((stderr, "Entering state %d\n", yystate));
+  YY_ASSERT (0 <= yystate && yystate < YYNSTATES);
+  YY_IGNORE_USELESS_CAST_BEGIN
+  *yyssp = YY_CAST (yy_state_t, yystate);
+  YY_IGNORE_USELESS_CAST_END
+  YY_STACK_PRINT (yyss, yyssp);
+
+  if (yyss + yystacksize - 1 <= yyssp)
+#if !defined yyoverflow && !defined YYSTACK_RELOCATE
+    YYNOMEM;
+#else
+    {
+      /* Get the current used size of the three stacks, in elements.  */
+      YYPTRDIFF_T yysize = yyssp - yyss + 1;
+
+# if defined yyoverflow
+      {
+        /* Give user a chance to reallocate the stack.  Use copies of
+           these so that the &'s don't force the real ones into
+           memory.  */
+        yy_state_t *yyss1 = yyss;
+        YYSTYPE *yyvs1 = yyvs;
+
+        /* Each stack pointer address is followed by the size of the
+           data in use in that stack, in bytes.  This used to be a
+           conditional around just the two extra args, but that might
+           be undefined if yyoverflow is a macro.  */
+        yyoverflow (YY_("memory exhausted"),
+                    &yyss1, yysize * YYSIZEOF (*yyssp),
+                    &yyvs1, yysize * YYSIZEOF (*yyvsp),
+                    &yystacksize);
+        yyss = yyss1;
+        yyvs = yyvs1;
+      }
+# else /* defined YYSTACK_RELOCATE */
+      /* Extend the stack our own way.  */
+      if (YYMAXDEPTH <= yystacksize)
+        YYNOMEM;
+      yystacksize *= 2;
+      if (YYMAXDEPTH < yystacksize)
+        yystacksize = YYMAXDEPTH;
+
+      {
+        yy_state_t *yyss1 = yyss;
+        union yyalloc *yyptr =
+          YY_CAST (union yyalloc *,
+                   YYSTACK_ALLOC (YY_CAST (YYSIZE_T, YYSTACK_BYTES (yystacksize))));
+        if (! yyptr)
+          YYNOMEM;
+        YYSTACK_RELOCATE (yyss_alloc, yyss);
+        YYSTACK_RELOCATE (yyvs_alloc, yyvs);
+#  undef YYSTACK_RELOCATE
+        if (yyss1 != yyssa)
+          YYSTACK_FREE (yyss1);
+      }
+# endif
+
+      yyssp = yyss + yysize - 1;
+      yyvsp = yyvs + yysize - 1;
+
+      YY_IGNORE_USELESS_CAST_BEGIN
+      YYDPRINTF ((stderr, "Stack size increased to %ld\n",
+                  YY_CAST (long, yystacksize)));
+      YY_IGNORE_USELESS_CAST_END
+
+      if (yyss + yystacksize - 1 <= yyssp)
+        YYABORT;
+    }
+#endif /* !defined yyoverflow && !defined YYSTACK_RELOCATE */
+
+
+  if (yystate == YYFINAL)
+    YYACCEPT;
+
+  goto yybackup;
+
+
+/*-----------.
+| yybackup.  |
+`-----------*/
+yybackup:
+  /* Do appropriate processing given the current state.  Read a
+     lookahead token if we need one and don't already have one.  */
+
+  /* First try to decide what to do without reference to lookahead token.  */
+  yyn = yypact[yystate];
+  if (yypact_value_is_default (yyn))
+    goto yydefault;
+
+  /* Not known => get a lookahead token if don't already have one.  */
+
+  /* YYCHAR is either empty, or end-of-input, or a valid lookahead.  */
+  if (yychar == YYEMPTY)
+    {
+      YYDPRINTF ((stderr, "Reading a token\n"));
+      yychar = yylex ();
+    }
+
+  if (yychar <= YYEOF)
+    {
+      yychar = YYEOF;
+      yytoken = YYSYMBOL_YYEOF;
+      YYDPRINTF ((stderr, "Now at end of input.\n"));
+    }
+  else if (yychar == YYerror)
+    {
+      /* The scanner already issued an error message, process directly
+         to error recovery.  But do not keep the error token as
+         lookahead, it is too special and may lead us to an endless
+         loop in error recovery. */
+      yychar = YYUNDEF;
+      yytoken = YYSYMBOL_YYerror;
+      goto yyerrlab1;
+    }
+  else
+    {
+      yytoken = YYTRANSLATE (yychar);
+      YY_SYMBOL_PRINT ("Next token is", yytoken, &yylval, &yylloc);
+    }
+
+  /* If the proper action on seeing token YYTOKEN is to reduce or to
+     detect an error, take that action.  */
+  yyn += yytoken;
+  if (yyn < 0 || YYLAST < yyn || yycheck[yyn] != yytoken)
+    goto yydefault;
+  yyn = yytable[yyn];
+  if (yyn <= 0)
+    {
+      if (yytable_value_is_error (yyn))
+        goto yyerrlab;
+      yyn = -yyn;
+      goto yyreduce;
+    }
+
+  /* Count tokens shifted since error; after three, turn off error
+     status.  */
+  if (yyerrstatus)
+    yyerrstatus--;
+
+  /* Shift the lookahead token.  */
+  YY_SYMBOL_PRINT ("Shifting", yytoken, &yylval, &yylloc);
+  yystate = yyn;
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  *++yyvsp = yylval;
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+
+  /* Discard the shifted token.  */
+  yychar = YYEMPTY;
+  goto yynewstate;
+
+
+/*-----------------------------------------------------------.
+| yydefault -- do the default action for the current state.  |
+`-----------------------------------------------------------*/
+yydefault:
+  yyn = yydefact[yystate];
+  if (yyn == 0)
+    goto yyerrlab;
+  goto yyreduce;
+
+
+/*-----------------------------.
+| yyreduce -- do a reduction.  |
+`-----------------------------*/
+yyreduce:
+  /* yyn is the number of a rule to reduce with.  */
+  yylen = yyr2[yyn];
+
+  /* If YYLEN is nonzero, implement the default value of the action:
+     '$$ = $1'.
+
+     Otherwise, the following line sets YYVAL to garbage.
+     This behavior is undocumented and Bison
+     users should not rely upon it.  Assigning to YYVAL
+     unconditionally makes the parser a bit smaller, and it avoids a
+     GCC warning that YYVAL may be used uninitialized.  */
+  yyval = yyvsp[1-yylen];
+
+
+  YY_REDUCE_PRINT (yyn);
+  switch (yyn)
+    {
+  case 8: /* Selector: Value  */
+#line 300 "queryparse.y"
+            {
+        selector* s = (selector*)malloc(sizeof(selector));
+        s->type = SELECTOR_VALUE;
+        s->value = (yyvsp[0].val);
+        growbuf_append(SELECTORS, &s, sizeof(void*));
+    }
+#line 1691 "queryparse.tab.c"
+    break;
+
+  case 9: /* Columnspec: TOK_COLUMN TOK_DASH TOK_COLUMN  */
+#line 309 "queryparse.y"
+                                     {
+        for (size_t i = (yyvsp[-2].col); i <= (yyvsp[0].col); i++) {
+            if (!column_selected(SELECTORS, i)) {
+                selector* s = (selector*)malloc(sizeof(selector));
+                s->type = SELECTOR_COLUMN;
+                s->column = i;
+                growbuf_append(SELECTORS, &s, sizeof(void*));
+            }
+        }
+    }
+#line 1706 "queryparse.tab.c"
+    break;
+
+  case 10: /* Columnspec: TOK_COLUMN  */
+#line 319 "queryparse.y"
+                 {
+        if (!column_selected(SELECTORS, (yyvsp[0].col))) {
+            selector* s = (selector*)malloc(sizeof(selector));
+            s->type = SELECTOR_COLUMN;
+            s->column = (yyvsp[0].col);
+            growbuf_append(SELECTORS, &s, sizeof(void*));
+        }
+    }
+#line 1719 "queryparse.tab.c"
+    break;
+
+  case 11: /* NoColumns: %empty  */
+#line 330 "queryparse.y"
+      {
+        //
+        // select "column -1".
+        //
+
+        selector* s = (selector*)malloc(sizeof(selector));
+        s->type = SELECTOR_COLUMN;
+        s->column = SIZE_MAX;
+        growbuf_append(SELECTORS, &s, sizeof(void*));
+    }
+#line 1734 "queryparse.tab.c"
+    break;
+
+  case 12: /* Conditions: Compound  */
+#line 343 "queryparse.y"
+               {
+        *ROOT_CONDITION = (yyvsp[0].compound);
+    }
+#line 1742 "queryparse.tab.c"
+    break;
+
+  case 13: /* Simple: Value Operator Value  */
+#line 349 "queryparse.y"
+                           {
+        (yyval.simple).left = (yyvsp[-2].val);
+        (yyval.simple).oper = (yyvsp[-1].num);
+        (yyval.simple).right = (yyvsp[0].val);
+    }
+#line 1752 "queryparse.tab.c"
+    break;
+
+  case 14: /* Compound: Compound TOK_AND Compound  */
+#line 357 "queryparse.y"
+                                {
+        (yyval.compound) = new_compound();
+        (yyval.compound)->left = (yyvsp[-2].compound);
+        (yyval.compound)->right = (yyvsp[0].compound);
+        (yyval.compound)->oper = OPER_AND;
+    }
+#line 1763 "queryparse.tab.c"
+    break;
+
+  case 15: /* Compound: Compound TOK_OR Compound  */
+#line 363 "queryparse.y"
+                               {
+        (yyval.compound) = new_compound();
+        (yyval.compound)->left = (yyvsp[-2].compound);
+        (yyval.compound)->right = (yyvsp[0].compound);
+        (yyval.compound)->oper = OPER_OR;
+    }
+#line 1774 "queryparse.tab.c"
+    break;
+
+  case 16: /* Compound: TOK_NOT Compound  */
+#line 369 "queryparse.y"
+                       {
+        (yyval.compound) = new_compound();
+        (yyval.compound)->left = (yyvsp[0].compound);
+        (yyval.compound)->oper = OPER_NOT;
+    }
+#line 1784 "queryparse.tab.c"
+    break;
+
+  case 17: /* Compound: TOK_LPAREN Compound TOK_RPAREN  */
+#line 374 "queryparse.y"
+                                     {
+        (yyval.compound) = (yyvsp[-1].compound);
+    }
+#line 1792 "queryparse.tab.c"
+    break;
+
+  case 18: /* Compound: Simple  */
+#line 377 "queryparse.y"
+             {
+        (yyval.compound) = new_compound();
+        (yyval.compound)->simple = (yyvsp[0].simple);
+        (yyval.compound)->oper = OPER_SIMPLE;
+    }
+#line 1802 "queryparse.tab.c"
+    break;
+
+  case 19: /* Function_Identifier: TOK_IDENTIFIER  */
+#line 385 "queryparse.y"
+                     {
+        memset(&(yyval.func), 0, sizeof(func));
+
+        bool found = false;
+        for (size_t i = 0; i < MAX_FUNC; i++) {
+            if (strcmp((yyvsp[0].str), FUNCTIONS[i].name) == 0) {
+                (yyval.func).func = i;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found) {
+            fprintf(stderr, "Parse error: unknown function \"%s\"\n", (yyvsp[0].str));
+            YYERROR;
+        }
+
+        (yyval.func).func_str = (yyvsp[0].str);
+    }
+#line 1826 "queryparse.tab.c"
+    break;
+
+  case 20: /* Function: Function_Identifier TOK_LPAREN TOK_RPAREN  */
+#line 407 "queryparse.y"
+                                                {
+        (yyval.func) = (yyvsp[-2].func);
+        (yyval.func).num_args = 0;
+
+        if (!check_function(&(yyval.func))) {
+            YYERROR;
+        }
+        free((yyval.func).func_str);
+    }
+#line 1840 "queryparse.tab.c"
+    break;
+
+  case 21: /* Function: Function_Identifier TOK_LPAREN Value TOK_RPAREN  */
+#line 416 "queryparse.y"
+                                                      {
+        (yyval.func) = (yyvsp[-3].func);
+        (yyval.func).args[0] = (yyvsp[-1].val);
+        (yyval.func).num_args = 1;
+
+        if (!check_function(&(yyval.func))) {
+            YYERROR;
+        }
+        free((yyval.func).func_str);
+    }
+#line 1855 "queryparse.tab.c"
+    break;
+
+  case 22: /* Function: Function_Identifier TOK_LPAREN Value TOK_COMMA Value TOK_RPAREN  */
+#line 426 "queryparse.y"
+                                                                      {
+        (yyval.func) = (yyvsp[-5].func);
+        (yyval.func).args[0] = (yyvsp[-3].val);
+        (yyval.func).args[1] = (yyvsp[-1].val);
+        (yyval.func).num_args = 2;
+
+        if (!check_function(&(yyval.func))) {
+            YYERROR;
+        }
+        free((yyval.func).func_str);
+    }
+#line 1871 "queryparse.tab.c"
+    break;
+
+  case 23: /* Function: Function_Identifier TOK_LPAREN Value TOK_COMMA Value TOK_COMMA Value TOK_RPAREN  */
+#line 437 "queryparse.y"
+                                                                                      {
+        (yyval.func) = (yyvsp[-7].func);
+        (yyval.func).args[0] = (yyvsp[-5].val);
+        (yyval.func).args[1] = (yyvsp[-3].val);
+        (yyval.func).args[2] = (yyvsp[-1].val);
+        (yyval.func).num_args = 3;
+
+        if (!check_function(&(yyval.func))) {
+            YYERROR;
+        }
+        free((yyval.func).func_str);
+    }
+#line 1888 "queryparse.tab.c"
+    break;
+
+  case 24: /* Operator: TOK_EQ  */
+#line 452 "queryparse.y"
+             {
+        (yyval.num) = TOK_EQ;
+    }
+#line 1896 "queryparse.tab.c"
+    break;
+
+  case 25: /* Operator: TOK_NEQ  */
+#line 455 "queryparse.y"
+              {
+        (yyval.num) = TOK_NEQ;
+    }
+#line 1904 "queryparse.tab.c"
+    break;
+
+  case 26: /* Operator: TOK_GT  */
+#line 458 "queryparse.y"
+             {
+        (yyval.num) = TOK_GT;
+    }
+#line 1912 "queryparse.tab.c"
+    break;
+
+  case 27: /* Operator: TOK_LT  */
+#line 461 "queryparse.y"
+             {
+        (yyval.num) = TOK_LT;
+    }
+#line 1920 "queryparse.tab.c"
+    break;
+
+  case 28: /* Operator: TOK_GTE  */
+#line 464 "queryparse.y"
+              {
+        (yyval.num) = TOK_GTE;
+    }
+#line 1928 "queryparse.tab.c"
+    break;
+
+  case 29: /* Operator: TOK_LTE  */
+#line 467 "queryparse.y"
+              {
+        (yyval.num) = TOK_LTE;
+    }
+#line 1936 "queryparse.tab.c"
+    break;
+
+  case 30: /* Operator: TOK_CONTAINS  */
+#line 470 "queryparse.y"
+                   {
+        (yyval.num) = TOK_CONTAINS;
+    }
+#line 1944 "queryparse.tab.c"
+    break;
+
+  case 31: /* Conversion: TOK_CONV_NUM  */
+#line 476 "queryparse.y"
+                   {
+        (yyval.type) = TYPE_LONG;
+    }
+#line 1952 "queryparse.tab.c"
+    break;
+
+  case 32: /* Conversion: TOK_CONV_DBL  */
+#line 479 "queryparse.y"
+                   {
+        (yyval.type) = TYPE_DOUBLE;
+    }
+#line 1960 "queryparse.tab.c"
+    break;
+
+  case 33: /* Conversion: TOK_CONV_STR  */
+#line 482 "queryparse.y"
+                   {
+        (yyval.type) = TYPE_STRING;
+    }
+#line 1968 "queryparse.tab.c"
+    break;
+
+  case 34: /* Value: Value_Base Conversion  */
+#line 488 "queryparse.y"
+                            {
+        (yyval.val) = (yyvsp[-1].val);
+        (yyval.val).conversion_type = (yyvsp[0].type);
+    }
+#line 1977 "queryparse.tab.c"
+    break;
+
+  case 35: /* Value: Value_Base  */
+#line 492 "queryparse.y"
+                 {
+        (yyval.val) = (yyvsp[0].val);
+    }
+#line 1985 "queryparse.tab.c"
+    break;
+
+  case 36: /* Value_Base: TOK_COLUMN  */
+#line 498 "queryparse.y"
+                 {
+        value_clear(&(yyval.val));
+        (yyval.val).col = (yyvsp[0].col);
+        (yyval.val).is_col = true;
+        (yyval.val).conversion_type = TYPE_STRING;
+    }
+#line 1996 "queryparse.tab.c"
+    break;
+
+  case 37: /* Value_Base: TOK_STRING  */
+#line 504 "queryparse.y"
+                 {
+        value_clear(&(yyval.val));
+        (yyval.val).str = (yyvsp[0].str);
+        (yyval.val).len = strlen((yyvsp[0].str));
+        (yyval.val).is_str = true;
+        (yyval.val).conversion_type = TYPE_STRING;
+    }
+#line 2008 "queryparse.tab.c"
+    break;
+
+  case 38: /* Value_Base: TOK_INTEGER  */
+#line 511 "queryparse.y"
+                  {  
+        value_clear(&(yyval.val));
+        (yyval.val).num = (yyvsp[0].num);
+        (yyval.val).is_num = true;
+        (yyval.val).conversion_type = TYPE_LONG;
+    }
+#line 2019 "queryparse.tab.c"
+    break;
+
+  case 39: /* Value_Base: TOK_FLOAT  */
+#line 517 "queryparse.y"
+                {
+        value_clear(&(yyval.val));
+        (yyval.val).dbl = (yyvsp[0].dbl);
+        (yyval.val).is_dbl = true;
+        (yyval.val).conversion_type = TYPE_DOUBLE;
+    }
+#line 2030 "queryparse.tab.c"
+    break;
+
+  case 40: /* Value_Base: TOK_SPECIAL  */
+#line 523 "queryparse.y"
+                  {
+        value_clear(&(yyval.val));
+        (yyval.val).special = (yyvsp[0].special);
+        (yyval.val).is_special = true;
+        (yyval.val).conversion_type = TYPE_LONG;
+    }
+#line 2041 "queryparse.tab.c"
+    break;
+
+  case 41: /* Value_Base: Function  */
+#line 529 "queryparse.y"
+               {
+        value_clear(&(yyval.val));
+        (yyval.val).func = (func*)malloc(sizeof(func));
+        memcpy((yyval.val).func, &(yyvsp[0].func), sizeof(func));
+        (yyval.val).is_func = true;
+
+        (yyval.val).conversion_type = FUNCTIONS[(yyval.val).func->func].return_type;
+    }
+#line 2054 "queryparse.tab.c"
+    break;
+
+  case 44: /* OrderKey: Value  */
+#line 545 "queryparse.y"
+            {
+        add_order_key((yyvsp[0].val), ORDER_ASCENDING);
+    }
+#line 2062 "queryparse.tab.c"
+    break;
+
+  case 45: /* OrderKey: Value TOK_ASCENDING  */
+#line 548 "queryparse.y"
+                          {
+        add_order_key((yyvsp[-1].val), ORDER_ASCENDING);
+    }
+#line 2070 "queryparse.tab.c"
+    break;
+
+  case 46: /* OrderKey: Value TOK_DESCENDING  */
+#line 551 "queryparse.y"
+                           {
+        add_order_key((yyvsp[-1].val), ORDER_DESCENDING);
+    }
+#line 2078 "queryparse.tab.c"
+    break;
+
+  case 47: /* Limit: TOK_LIMIT TOK_INTEGER  */
+#line 557 "queryparse.y"
+                            {
+        if ((yyvsp[0].num) < 0) {
+            fprintf(stderr, "Parse error: limit can't be negative\n");
+            YYERROR;
+        }
+        (*ORDER)->limit = (yyvsp[0].num);
+    }
+#line 2090 "queryparse.tab.c"
+    break;
+
+
+#line 2094 "queryparse.tab.c"
+
+      default: break;
+    }
+  /* User semantic actions sometimes alter yychar, and that requires
+     that yytoken be updated with the new translation.  We take the
+     approach of translating immediately before every use of yytoken.
+     One alternative is translating here after every semantic action,
+     but that translation would be missed if the semantic action invokes
+     YYABORT, YYACCEPT, or YYERROR immediately after altering yychar or
+     if it invokes YYBACKUP.  In the case of YYABORT or YYACCEPT, an
+     incorrect destructor might then be invoked immediately.  In the
+     case of YYERROR or YYBACKUP, subsequent parser actions might lead
+     to an incorrect destructor call or verbose syntax error message
+     before the lookahead is translated.  */
+  YY_SYMBOL_PRINT ("-> $$ =", YY_CAST (yysymbol_kind_t, yyr1[yyn]), &yyval, &yyloc);
+
+  YYPOPSTACK (yylen);
+  yylen = 0;
+
+  *++yyvsp = yyval;
+
+  /* Now 'shift' the result of the reduction.  Determine what state
+     that goes to, based on the state we popped back to and the rule
+     number reduced by.  */
+  {
+    const int yylhs = yyr1[yyn] - YYNTOKENS;
+    const int yyi = yypgoto[yylhs] + *yyssp;
+    yystate = (0 <= yyi && yyi <= YYLAST && yycheck[yyi] == *yyssp
+               ? yytable[yyi]
+               : yydefgoto[yylhs]);
+  }
+
+  goto yynewstate;
+
+
+/*--------------------------------------.
+| yyerrlab -- here on detecting error.  |
+`--------------------------------------*/
+yyerrlab:
+  /* Make sure we have latest lookahead translation.  See comments at
+     user semantic actions for why this is necessary.  */
+  yytoken = yychar == YYEMPTY ? YYSYMBOL_YYEMPTY : YYTRANSLATE (yychar);
+  /* If not already recovering from an error, report this error.  */
+  if (!yyerrstatus)
+    {
+      ++yynerrs;
+      {
+        yypcontext_t yyctx
+          = {yyssp, yytoken};
+        char const *yymsgp = YY_("syntax error");
+        int yysyntax_error_status;
+        yysyntax_error_status = yysyntax_error (&yymsg_alloc, &yymsg, &yyctx);
+        if (yysyntax_error_status == 0)
+          yymsgp = yymsg;
+        else if (yysyntax_error_status == -1)
+          {
+            if (yymsg != yymsgbuf)
+              YYSTACK_FREE (yymsg);
+            yymsg = YY_CAST (char *,
+                             YYSTACK_ALLOC (YY_CAST (YYSIZE_T, yymsg_alloc)));
+            if (yymsg)
+              {
+                yysyntax_error_status
+                  = yysyntax_error (&yymsg_alloc, &yymsg, &yyctx);
+                yymsgp = yymsg;
+              }
+            else
+              {
+                yymsg = yymsgbuf;
+                yymsg_alloc = sizeof yymsgbuf;
+                yysyntax_error_status = YYENOMEM;
+              }
+          }
+        yyerror (yymsgp);
+        if (yysyntax_error_status == YYENOMEM)
+          YYNOMEM;
+      }
+    }
+
+  if (yyerrstatus == 3)
+    {
+      /* If just tried and failed to reuse lookahead token after an
+         error, discard it.  */
+
+      if (yychar <= YYEOF)
+        {
+          /* Return failure if at end of input.  */
+          if (yychar == YYEOF)
+            YYABORT;
+        }
+      else
+        {
+          yydestruct ("Error: discarding",
+                      yytoken, &yylval);
+          yychar = YYEMPTY;
+        }
+    }
+
+  /* Else will try to reuse lookahead token after shifting the error
+     token.  */
+  goto yyerrlab1;
+
+
+/*---------------------------------------------------.
+| yyerrorlab -- error raised explicitly by YYERROR.  |
+`---------------------------------------------------*/
+yyerrorlab:
+  /* Pacify compilers when the user code never invokes YYERROR and the
+     label yyerrorlab therefore never appears in user code.  */
+  if (0)
+    YYERROR;
+  ++yynerrs;
+
+  /* Do not reclaim the symbols of the rule whose action triggered
+     this YYERROR.  */
+  YYPOPSTACK (yylen);
+  yylen = 0;
+  YY_STACK_PRINT (yyss, yyssp);
+  yystate = *yyssp;
+  goto yyerrlab1;
+
+
+/*-------------------------------------------------------------.
+| yyerrlab1 -- common code for both syntax error and YYERROR.  |
+`-------------------------------------------------------------*/
+yyerrlab1:
+  yyerrstatus = 3;      /* Each real token shifted decrements this.  */
+
+  /* Pop stack until we find a state that shifts the error token.  */
+  for (;;)
+    {
+      yyn = yypact[yystate];
+      if (!yypact_value_is_default (yyn))
+        {
+          yyn += YYSYMBOL_YYerror;
+          if (0 <= yyn && yyn <= YYLAST && yycheck[yyn] == YYSYMBOL_YYerror)
+            {
+              yyn = yytable[yyn];
+              if (0 < yyn)
+                break;
+            }
+        }
+
+      /* Pop the current state because it cannot handle the error token.  */
+      if (yyssp == yyss)
+        YYABORT;
+
+
+      yydestruct ("Error: popping",
+                  YY_ACCESSING_SYMBOL (yystate), yyvsp);
+      YYPOPSTACK (1);
+      yystate = *yyssp;
+      YY_STACK_PRINT (yyss, yyssp);
+    }
+
+  YY_IGNORE_MAYBE_UNINITIALIZED_BEGIN
+  *++yyvsp = yylval;
+  YY_IGNORE_MAYBE_UNINITIALIZED_END
+
+
+  /* Shift the error token.  */
+  YY_SYMBOL_PRINT ("Shifting", YY_ACCESSING_SYMBOL (yyn), yyvsp, yylsp);
+
+  yystate = yyn;
+  goto yynewstate;
+
+
+/*-------------------------------------.
+| yyacceptlab -- YYACCEPT comes here.  |
+`-------------------------------------*/
+yyacceptlab:
+  yyresult = 0;
+  goto yyreturnlab;
+
+
+/*-----------------------------------.
+| yyabortlab -- YYABORT comes here.  |
+`-----------------------------------*/
+yyabortlab:
+  yyresult = 1;
+  goto yyreturnlab;
+
+
+/*-----------------------------------------------------------.
+| yyexhaustedlab -- YYNOMEM (memory exhaustion) comes here.  |
+`-----------------------------------------------------------*/
+yyexhaustedlab:
+  yyerror (YY_("memory exhausted"));
+  yyresult = 2;
+  goto yyreturnlab;
+
+
+/*----------------------------------------------------------.
+| yyreturnlab -- parsing is finished, clean up and return.  |
+`----------------------------------------------------------*/
+yyreturnlab:
+  if (yychar != YYEMPTY)
+    {
+      /* Make sure we have latest lookahead translation.  See comments at
+         user semantic actions for why this is necessary.  */
+      yytoken = YYTRANSLATE (yychar);
+      yydestruct ("Cleanup: discarding lookahead",
+                  yytoken, &yylval);
+    }
+  /* Do not reclaim the symbols of the rule whose action triggered
+     this YYABORT or YYACCEPT.  */
+  YYPOPSTACK (yylen);
+  YY_STACK_PRINT (yyss, yyssp);
+  while (yyssp != yyss)
+    {
+      yydestruct ("Cleanup: popping",
+                  YY_ACCESSING_SYMBOL (+*yyssp), yyvsp);
+      YYPOPSTACK (1);
+    }
+#ifndef yyoverflow
+  if (yyss != yyssa)
+    YYSTACK_FREE (yyss);
+#endif
+  if (yymsg != yymsgbuf)
+    YYSTACK_FREE (yymsg);
+  return yyresult;
+}
+
+#line 572 "queryparse.y"
+
+
+void query_error(const char* s)
+{
+    fprintf(stderr, "%s\n", s);
+}
+
+
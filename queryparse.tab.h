@@ -0,0 +1,124 @@
+/* A Bison parser, made by GNU Bison 3.8.2.  */
+
+/* Bison interface for Yacc-like parsers in C
+
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* As a special exception, you may create a larger work that contains
+   part or all of the Bison parser skeleton and distribute that work
+   under terms of your choice, so long as that work isn't itself a
+   parser generator using the skeleton or a modified version thereof
+   as a parser skeleton.  Alternatively, if you modify or redistribute
+   the parser skeleton itself, you may (at your option) remove this
+   special exception, which will cause the skeleton and the resulting
+   Bison output files to be licensed under the GNU General Public
+   License without this special exception.
+
+   This special exception was added by the Free Software Foundation in
+   version 2.2 of Bison.  */
+
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
+#ifndef YY_QUERY_QUERYPARSE_TAB_H_INCLUDED
+# define YY_QUERY_QUERYPARSE_TAB_H_INCLUDED
+/* Debug traces.  */
+#ifndef YYDEBUG
+# define YYDEBUG 1
+#endif
+#if YYDEBUG
+extern int query_debug;
+#endif
+
+/* Token kinds.  */
+#ifndef YYTOKENTYPE
+# define YYTOKENTYPE
+  enum yytokentype
+  {
+    YYEMPTY = -2,
+    YYEOF = 0,                     /* "end of file"  */
+    YYerror = 256,                 /* error  */
+    YYUNDEF = 257,                 /* "invalid token"  */
+    TOK_SELECT = 258,              /* TOK_SELECT  */
+    TOK_WHERE = 259,               /* TOK_WHERE  */
+    TOK_CONTAINS = 260,            /* TOK_CONTAINS  */
+    TOK_EQ = 261,                  /* TOK_EQ  */
+    TOK_NEQ = 262,                 /* TOK_NEQ  */
+    TOK_GT = 263,                  /* TOK_GT  */
+    TOK_LT = 264,                  /* TOK_LT  */
+    TOK_GTE = 265,                 /* TOK_GTE  */
+    TOK_LTE = 266,                 /* TOK_LTE  */
+    TOK_AND = 267,                 /* TOK_AND  */
+    TOK_OR = 268,                  /* TOK_OR  */
+    TOK_NOT = 269,                 /* TOK_NOT  */
+    TOK_LPAREN = 270,              /* TOK_LPAREN  */
+    TOK_RPAREN = 271,              /* TOK_RPAREN  */
+    TOK_COMMA = 272,               /* TOK_COMMA  */
+    TOK_DASH = 273,                /* TOK_DASH  */
+    TOK_CONV_NUM = 274,            /* TOK_CONV_NUM  */
+    TOK_CONV_DBL = 275,            /* TOK_CONV_DBL  */
+    TOK_CONV_STR = 276,            /* TOK_CONV_STR  */
+    TOK_ERROR = 277,               /* TOK_ERROR  */
+    TOK_ORDER = 278,               /* TOK_ORDER  */
+    TOK_BY = 279,                  /* TOK_BY  */
+    TOK_ASCENDING = 280,           /* TOK_ASCENDING  */
+    TOK_DESCENDING = 281,          /* TOK_DESCENDING  */
+    TOK_LIMIT = 282,               /* TOK_LIMIT  */
+    TOK_INTEGER = 283,             /* TOK_INTEGER  */
+    TOK_FLOAT = 284,               /* TOK_FLOAT  */
+    TOK_COLUMN = 285,              /* TOK_COLUMN  */
+    TOK_STRING = 286,              /* TOK_STRING  */
+    TOK_IDENTIFIER = 287,          /* TOK_IDENTIFIER  */
+    TOK_SPECIAL = 288              /* TOK_SPECIAL  */
+  };
+  typedef enum yytokentype yytoken_kind_t;
+#endif
+
+/* Value type.  */
+#if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
+union YYSTYPE
+{
+#line 250 "queryparse.y"
+
+    long          num;
+    double        dbl;
+    char*         str;
+    size_t        col;
+    special_value special;
+    val           val;
+    func          func;
+    type          type;
+    compound*     compound;
+    condition     simple;
+
+#line 110 "queryparse.tab.h"
+
+};
+typedef union YYSTYPE YYSTYPE;
+# define YYSTYPE_IS_TRIVIAL 1
+# define YYSTYPE_IS_DECLARED 1
+#endif
+
+
+extern YYSTYPE query_lval;
+
+
+int query_parse (void);
+
+
+#endif /* !YY_QUERY_QUERYPARSE_TAB_H_INCLUDED  */
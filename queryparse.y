@@ -115,6 +115,42 @@ void free_selectors(growbuf* g)
     }
 }
 
+void free_order(order* o)
+{
+    if (NULL != o) {
+        order_key* keys = (order_key*)o->keys->buf;
+        for (size_t i = 0; i < o->keys->size / sizeof(order_key); i++) {
+            if (keys[i].value.is_str && NULL != keys[i].value.str) {
+                free(keys[i].value.str);
+            }
+        }
+        growbuf_free(o->keys);
+        free(o);
+    }
+}
+
+/**
+ * Add a key to sort on to the query's ORDER BY, after the ones before it.
+ */
+void add_order_key(val value, int direction)
+{
+    if (NULL == *ORDER) {
+        order* o = (order*)malloc(sizeof(order));
+        if (NULL == o) {
+            fprintf(stderr, "malloc failed in query parser!\n");
+            exit(EX_OSERR);
+        }
+        o->keys = growbuf_create(sizeof(order_key));
+        o->limit = SIZE_MAX;
+        *ORDER = o;
+    }
+
+    order_key k;
+    k.direction = direction;
+    k.value = value;
+    growbuf_append((*ORDER)->keys, &k, sizeof(k));
+}
+
 void value_clear(val* v)
 {
     memset(v, 0, sizeof(val));
@@ -226,7 +262,7 @@ bool column_selected(growbuf* selectors, size_t column)
 
 %token TOK_SELECT TOK_WHERE TOK_CONTAINS TOK_EQ TOK_NEQ TOK_GT TOK_LT TOK_GTE TOK_LTE TOK_AND
     TOK_OR TOK_NOT TOK_LPAREN TOK_RPAREN TOK_COMMA TOK_DASH TOK_CONV_NUM TOK_CONV_DBL
-    TOK_CONV_STR TOK_ERROR TOK_ORDER TOK_BY TOK_ASCENDING TOK_DESCENDING
+    TOK_CONV_STR TOK_ERROR TOK_ORDER TOK_BY TOK_ASCENDING TOK_DESCENDING TOK_LIMIT
 
 %token <num> TOK_INTEGER
 %token <dbl> TOK_FLOAT
@@ -468,6 +504,7 @@ Value_Base
     | TOK_STRING {
         value_clear(&$$);
         $$.str = $1;
+        $$.len = strlen($1);
         $$.is_str = true;
         $$.conversion_type = TYPE_STRING;
     }
@@ -500,28 +537,35 @@ Value_Base
 ;
 
 OrderSpec
+    : OrderSpec TOK_COMMA OrderKey
+    | OrderKey
+;
+
+OrderKey
     : Value {
-        order* o = (order*)malloc(sizeof(order));
-        o->direction = ORDER_ASCENDING;
-        o->value = $1;
-        *ORDER = o;
+        add_order_key($1, ORDER_ASCENDING);
     }
     | Value TOK_ASCENDING {
-        order* o = (order*)malloc(sizeof(order));
-        o->direction = ORDER_ASCENDING;
-        o->value = $1;
-        *ORDER = o;
+        add_order_key($1, ORDER_ASCENDING);
     }
     | Value TOK_DESCENDING {
-        order* o = (order*)malloc(sizeof(order));
-        o->direction = ORDER_DESCENDING;
-        o->value = $1;
-        *ORDER = o;
+        add_order_key($1, ORDER_DESCENDING);
     }
 ;
 
+Limit
+    : TOK_LIMIT TOK_INTEGER {
+        if ($2 < 0) {
+            fprintf(stderr, "Parse error: limit can't be negative\n");
+            YYERROR;
+        }
+        (*ORDER)->limit = $2;
+    }
+    |
+    ;
+
 Order
-    : TOK_ORDER TOK_BY OrderSpec
+    : TOK_ORDER TOK_BY OrderSpec Limit
     |
     ;
 
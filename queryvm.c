@@ -0,0 +1,1674 @@
+/*
+ * CSV Selector
+ *
+ * Queries compiled to a flat program over typed registers, so the work of
+ * evaluating a row is picked once, when the query is compiled, instead of for
+ * every row. A program can be shared by threads, each running it on a
+ * query_vm of its own. The results are the same as evaluating the parse tree,
+ * which is what unittests.c checks the programs against.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "growbuf.h"
+#include "arena.h"
+#include "csvformat.h"
+#include "queryparse.h"
+#include "queryparse.tab.h"
+#include "queryeval.h"
+#include "functions.h"
+#include "queryvm.h"
+
+#define DEBUG if (false)
+//#define DEBUG
+
+extern functionspec FUNCTIONS[];
+
+typedef enum {
+    OP_COLUMN,          // dst = column imm.col, borrowed, or "" if the row is short
+    OP_NUMCOLS,         // dst = number of fields in the row
+    OP_ROWNUM,          // dst = row number
+    OP_LONG_TO_DOUBLE,  // dst = src0, converted
+    OP_LONG_TO_STRING,
+    OP_DOUBLE_TO_LONG,
+    OP_DOUBLE_TO_STRING,
+    OP_STRING_TO_LONG,
+    OP_STRING_TO_DOUBLE,
+    OP_SUBSTR,          // dst = function of src0..., mode arguments
+    OP_STRLEN,
+    OP_MAX,
+    OP_MIN,
+    OP_ABS,
+    OP_LOWER,
+    OP_UPPER,
+    OP_TRIM,
+    OP_CMP_LONG,        // flag = src0 <mode> src1
+    OP_CMP_DOUBLE,
+    OP_CMP_STRING,
+    OP_CMP_STRING_LONG, // as doubles if the string has a '.', else as longs
+    OP_CONTAINS,        // flag = src1 is in src0
+    OP_TRUE,            // flag = true
+    OP_FALSE,           // flag = false
+    OP_NOT,             // flag = !flag
+    OP_JUMP_IF_FALSE,   // go to imm.target if !flag
+    OP_JUMP_IF_TRUE,    // go to imm.target if flag
+    OP_RETURN,          // stop; the value is in src0
+    NUM_OPS
+} opcode;
+
+static const char* OP_NAMES[NUM_OPS] = {
+    "column", "numcols", "rownum",
+    "long_to_double", "long_to_string", "double_to_long", "double_to_string",
+    "string_to_long", "string_to_double",
+    "substr", "strlen", "max", "min", "abs", "lower", "upper", "trim",
+    "cmp_long", "cmp_double", "cmp_string", "cmp_string_long", "contains",
+    "true", "false", "not", "jump_if_false", "jump_if_true", "return",
+};
+
+typedef struct {
+    opcode op;
+    bool   shared;              // dst is also written elsewhere; run once per row
+    int    mode;                // comparison operator, or number of arguments
+    size_t dst;                 // register written
+    size_t src[MAX_ARGS];       // registers read
+    union {
+        size_t col;
+        size_t target;          // instruction to jump to
+    } imm;
+} instruction;
+
+typedef struct {
+    union {
+        long   num;
+        double dbl;
+        struct {
+            const char* str;    // not necessarily NUL-terminated
+            size_t      len;
+        };
+    };
+} reg;
+
+typedef struct {
+    size_t reg;
+    reg    value;               // a string is in the program's arena
+} constant;
+
+typedef struct {
+    int    oper;                // OPER_AND or OPER_OR for a chain, OPER_SIMPLE for a term
+    size_t entry;               // a term's code
+    size_t term;                // a term's number, from 1
+    size_t first;               // a chain's nodes: where they are in chains
+    size_t count;
+} condition_node;
+
+typedef struct {
+    size_t runs;                // sampled rows the node was run on
+    size_t passes;              // how many of those it was true on
+    size_t cost;                // and the work it took on them
+} node_stats;
+
+/**
+ * How often to run every term of the condition, for their statistics.
+ */
+#define SAMPLE_EVERY 32
+
+/**
+ * How often to put the condition's chains in order by their statistics.
+ */
+#define REORDER_EVERY 4096
+
+struct _query_program {
+    growbuf* code;              // instruction
+    growbuf* types;             // type of each register
+    growbuf* constants;         // constant: registers set before running
+    arena*   strings;           // string constants
+    growbuf* nodes;             // condition_node of the condition's tree
+    growbuf* chains;            // size_t nodes in each chain
+    size_t   root;              // the condition's node
+    size_t   num_terms;
+    growbuf* selectors;         // size_t entry point of each selector; SIZE_MAX for columns
+    growbuf* order_keys;        // size_t entry point of each ORDER BY key
+    bool     fold;              // work out constant values while compiling
+    bool     failed;            // out of memory while compiling
+};
+
+struct _query_vm {
+    const query_program* program;
+    reg*                 registers;
+    size_t               num_registers;
+    size_t*              written;   // row each register was last written for
+    size_t               row;       // count of rows started
+    arena*               scratch;   // strings worked out for the row
+    size_t*              order;     // for each place in chains, which of its
+                                    // chain's nodes runs there
+    node_stats*          stats;     // for each place in chains
+};
+
+static size_t run(query_vm* vm, size_t pc, const csv_row* row, size_t rownum, bool* flag,
+        size_t* cost);
+static val register_value(const query_vm* vm, size_t r);
+
+//
+// Compiling
+//
+
+static size_t new_register(query_program* p, type type)
+{
+    size_t reg = p->types->size / sizeof(type);
+    if (0 != growbuf_append(p->types, &type, sizeof(type))) {
+        p->failed = true;
+    }
+    return reg;
+}
+
+static type register_type(const query_program* p, size_t reg)
+{
+    return ((const type*)p->types->buf)[reg];
+}
+
+static size_t next_instruction(const query_program* p)
+{
+    return p->code->size / sizeof(instruction);
+}
+
+/**
+ * Append an instruction.
+ *
+ * Return Value:
+ *   Its position, for jumps to be pointed at it, or fixed up later.
+ */
+static size_t emit(query_program* p, const instruction* ins)
+{
+    size_t at = next_instruction(p);
+    if (0 != growbuf_append(p->code, ins, sizeof(instruction))) {
+        p->failed = true;
+    }
+    return at;
+}
+
+/**
+ * Find an instruction that works out the same value as one about to be
+ * emitted: the same operation on the same registers.
+ *
+ * Return Value:
+ *   Its position, or SIZE_MAX if there isn't one.
+ */
+static size_t find_value(const query_program* p, const instruction* ins)
+{
+    const instruction* code = (const instruction*)p->code->buf;
+
+    for (size_t i = 0; i < next_instruction(p); i++) {
+        if (code[i].op == ins->op
+                && code[i].mode == ins->mode
+                && code[i].imm.col == ins->imm.col
+                && 0 == memcmp(code[i].src, ins->src, sizeof(ins->src))) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+/**
+ * Append an instruction that writes a register of a type: a new one, or the
+ * one an earlier instruction doing the same thing writes, in which case both
+ * are marked shared.
+ *
+ * Return Value:
+ *   The register.
+ */
+static size_t emit_value(query_program* p, instruction ins, type type)
+{
+    size_t same = find_value(p, &ins);
+
+    if (SIZE_MAX == same) {
+        ins.dst = new_register(p, type);
+    }
+    else {
+        instruction* earlier = &((instruction*)p->code->buf)[same];
+        earlier->shared = true;
+        ins.dst = earlier->dst;
+        ins.shared = true;
+    }
+
+    emit(p, &ins);
+    return ins.dst;
+}
+
+/**
+ * Find a constant register holding a value already.
+ *
+ * Return Value:
+ *   The register, or SIZE_MAX if there isn't one.
+ */
+static size_t find_constant(const query_program* p, type type, const reg* value)
+{
+    const constant* constants = (const constant*)p->constants->buf;
+
+    for (size_t i = 0; i < p->constants->size / sizeof(constant); i++) {
+        const constant* c = &constants[i];
+        if (register_type(p, c->reg) != type) {
+            continue;
+        }
+        switch (type) {
+        case TYPE_LONG:
+            if (c->value.num == value->num) {
+                return c->reg;
+            }
+            break;
+        case TYPE_DOUBLE:
+            if (0 == memcmp(&c->value.dbl, &value->dbl, sizeof(double))) {
+                return c->reg;
+            }
+            break;
+        case TYPE_STRING:
+            if (c->value.len == value->len
+                    && 0 == memcmp(c->value.str, value->str, value->len)) {
+                return c->reg;
+            }
+            break;
+        }
+    }
+    return SIZE_MAX;
+}
+
+/**
+ * Add a register that holds a value for every row, which is set when a VM is
+ * created rather than by an instruction. Constants that are equal share one.
+ *
+ * Arguments:
+ *   v		- a literal, or a value worked out while compiling; a string
+ *		  is copied
+ *
+ * Return Value:
+ *   The register.
+ */
+static size_t add_constant(query_program* p, const val* v)
+{
+    constant c = {0};
+    type type = TYPE_STRING;
+
+    if (v->is_num) {
+        type = TYPE_LONG;
+        c.value.num = v->num;
+    }
+    else if (v->is_dbl) {
+        type = TYPE_DOUBLE;
+        c.value.dbl = v->dbl;
+    }
+    else {
+        c.value.str = v->str;
+        c.value.len = v->len;
+    }
+
+    c.reg = find_constant(p, type, &c.value);
+    if (SIZE_MAX != c.reg) {
+        return c.reg;
+    }
+
+    if (TYPE_STRING == type) {
+        char* str = arena_alloc(p->strings, v->len + 1);
+        if (NULL == str) {
+            p->failed = true;
+            return 0;
+        }
+        memcpy(str, v->str, v->len);
+        str[v->len] = '\0';
+        c.value.str = str;
+    }
+
+    c.reg = new_register(p, type);
+    if (0 != growbuf_append(p->constants, &c, sizeof(c))) {
+        p->failed = true;
+    }
+    return c.reg;
+}
+
+/**
+ * Point a jump compiled earlier at the next instruction.
+ */
+static void patch_jump(query_program* p, size_t jump)
+{
+    if (!p->failed) {
+        ((instruction*)p->code->buf)[jump].imm.target = next_instruction(p);
+    }
+}
+
+/**
+ * Compile a conversion of a register from one type to another.
+ *
+ * Return Value:
+ *   The register holding the converted value; the same one if the types are
+ *   the same.
+ */
+static size_t compile_conversion(query_program* p, size_t reg, type from, type to)
+{
+    static const opcode conversions[3][3] = {
+        // to long, double, string
+        { NUM_OPS, OP_LONG_TO_DOUBLE, OP_LONG_TO_STRING },          // from long
+        { OP_DOUBLE_TO_LONG, NUM_OPS, OP_DOUBLE_TO_STRING },        // from double
+        { OP_STRING_TO_LONG, OP_STRING_TO_DOUBLE, NUM_OPS },        // from string
+    };
+
+    if (from == to) {
+        return reg;
+    }
+
+    instruction ins = { .op = conversions[from][to], .src = { reg } };
+    return emit_value(p, ins, to);
+}
+
+static query_program* program_create(bool fold)
+{
+    query_program* p = calloc(1, sizeof(query_program));
+    if (NULL == p) {
+        return NULL;
+    }
+
+    p->fold = fold;
+    p->code = growbuf_create(64 * sizeof(instruction));
+    p->types = growbuf_create(64 * sizeof(type));
+    p->constants = growbuf_create(16 * sizeof(constant));
+    p->strings = arena_create(1024);
+    p->selectors = growbuf_create(16 * sizeof(size_t));
+    p->order_keys = growbuf_create(16 * sizeof(size_t));
+    p->nodes = growbuf_create(8 * sizeof(condition_node));
+    p->chains = growbuf_create(8 * sizeof(size_t));
+    if (NULL == p->nodes || NULL == p->chains || NULL == p->code || NULL == p->types || NULL == p->constants
+            || NULL == p->strings || NULL == p->selectors || NULL == p->order_keys) {
+        query_program_free(p);
+        return NULL;
+    }
+
+    // register 0 is returned by the condition
+    new_register(p, TYPE_LONG);
+
+    return p;
+}
+
+/**
+ * Run a program that was compiled on the side, to work out a constant, once.
+ * It has no row to look at.
+ *
+ * Arguments:
+ *   p		- the program being compiled, which is marked failed if this
+ *		  runs out of memory
+ *   scratch	- the program to run, from its first instruction
+ *   result	- receives the register it returns
+ *   flag	- receives the flag it returns
+ *
+ * Return Value:
+ *   The VM, holding the result until it's freed, or NULL.
+ */
+static query_vm* run_scratch(query_program* p, const query_program* scratch,
+        size_t* result, bool* flag)
+{
+    csv_row no_row = {0};
+    query_vm* vm = NULL;
+
+    if (!scratch->failed) {
+        vm = query_vm_create(scratch);
+    }
+    if (NULL == vm) {
+        p->failed = true;
+        return NULL;
+    }
+
+    *result = run(vm, 0, &no_row, 0, flag, NULL);
+    return vm;
+}
+
+static size_t compile_value(query_program* p, const val* v);
+static void compile_comparison(query_program* p, const condition* c);
+
+/**
+ * Evaluate a value that's the same for every row.
+ *
+ * Arguments:
+ *   v		- the value; see val_is_constant()
+ *   to		- type to convert it to
+ *   result	- receives the value; a string is allocated, for the caller
+ *		  to free
+ *
+ * Return Value:
+ *   false if out of memory, and the program is marked failed.
+ */
+static bool fold_value(query_program* p, const val* v, type to, val* result)
+{
+    query_program* scratch = program_create(false);
+    query_vm* vm = NULL;
+    instruction ret = { .op = OP_RETURN };
+    size_t reg;
+    bool flag;
+
+    if (NULL == scratch) {
+        p->failed = true;
+        return false;
+    }
+
+    ret.src[0] = compile_conversion(scratch,
+            compile_value(scratch, v), v->conversion_type, to);
+    emit(scratch, &ret);
+
+    vm = run_scratch(p, scratch, &reg, &flag);
+    if (NULL != vm) {
+        *result = register_value(vm, reg);
+        if (result->is_str) {
+            result->str = strndup(result->str, result->len);
+            if (NULL == result->str) {
+                p->failed = true;
+            }
+        }
+    }
+
+    query_vm_free(vm);
+    query_program_free(scratch);
+    return !p->failed;
+}
+
+/**
+ * Compile a value that's the same for every row, by working it out now.
+ *
+ * Return Value:
+ *   The constant register holding it, of the type asked for.
+ */
+static size_t compile_folded(query_program* p, const val* v, type to)
+{
+    val result = {0};
+    size_t reg = 0;
+
+    if (fold_value(p, v, to, &result)) {
+        reg = add_constant(p, &result);
+    }
+    if (result.is_str) {
+        free(result.str);
+    }
+    return reg;
+}
+
+/**
+ * Compile a value, converted to a type.
+ *
+ * Return Value:
+ *   The register holding it.
+ */
+static size_t compile_value_as(query_program* p, const val* v, type to)
+{
+    if (p->fold && val_is_constant(v)) {
+        return compile_folded(p, v, to);
+    }
+    return compile_conversion(p, compile_value(p, v), v->conversion_type, to);
+}
+
+/**
+ * Compile a comparison of two values that are the same for every row, by
+ * deciding it now.
+ */
+static void fold_comparison(query_program* p, const condition* c)
+{
+    query_program* scratch = program_create(false);
+    query_vm* vm = NULL;
+    instruction ins = { .op = OP_RETURN };
+    size_t reg;
+    bool flag = false;
+
+    if (NULL == scratch) {
+        p->failed = true;
+        return;
+    }
+
+    compile_comparison(scratch, c);
+    emit(scratch, &ins);
+
+    vm = run_scratch(p, scratch, &reg, &flag);
+    ins.op = flag ? OP_TRUE : OP_FALSE;
+    emit(p, &ins);
+
+    query_vm_free(vm);
+    query_program_free(scratch);
+}
+
+/**
+ * Compile the evaluation of a value.
+ *
+ * Return Value:
+ *   The register the value ends up in, of the value's conversion type.
+ */
+static size_t compile_value(query_program* p, const val* v)
+{
+    instruction ins = {0};
+    type natural_type = TYPE_STRING;
+    size_t reg;
+
+    if (p->fold && val_is_constant(v)) {
+        return compile_folded(p, v, v->conversion_type);
+    }
+
+    if (v->is_num || v->is_dbl || v->is_str) {
+        reg = add_constant(p, v);
+        return compile_conversion(p, reg, register_type(p, reg), v->conversion_type);
+    }
+    else if (v->is_col) {
+        ins.op = OP_COLUMN;
+        ins.imm.col = v->col;
+    }
+    else if (v->is_special) {
+        ins.op = (SPECIAL_ROWNUM == v->special) ? OP_ROWNUM : OP_NUMCOLS;
+        natural_type = TYPE_LONG;
+    }
+    else if (v->is_func) {
+        const func* f = v->func;
+
+        ins.mode = (int)f->num_args;
+        natural_type = FUNCTIONS[f->func].return_type;
+        // the numeric functions work on doubles
+        bool numeric = (FUNC_MAX == f->func || FUNC_MIN == f->func || FUNC_ABS == f->func);
+        for (size_t i = 0; i < f->num_args; i++) {
+            ins.src[i] = numeric
+                ? compile_value_as(p, &f->args[i], TYPE_DOUBLE)
+                : compile_value(p, &f->args[i]);
+        }
+
+        switch (f->func) {
+        case FUNC_SUBSTR:   ins.op = OP_SUBSTR;     break;
+        case FUNC_STRLEN:   ins.op = OP_STRLEN;     break;
+        case FUNC_MAX:      ins.op = OP_MAX;        break;
+        case FUNC_MIN:      ins.op = OP_MIN;        break;
+        case FUNC_ABS:      ins.op = OP_ABS;        break;
+        case FUNC_LOWER:    ins.op = OP_LOWER;      break;
+        case FUNC_UPPER:    ins.op = OP_UPPER;      break;
+        case FUNC_TRIM:     ins.op = OP_TRIM;       break;
+        default:
+            fprintf(stderr, "ERROR: no implementation for function %s\n",
+                    FUNCTIONS[f->func].name);
+            p->failed = true;
+            return 0;
+        }
+    }
+
+    reg = emit_value(p, ins, natural_type);
+    return compile_conversion(p, reg, natural_type, v->conversion_type);
+}
+
+/**
+ * The comparison operator that gives the same answer with its operands
+ * swapped.
+ */
+static int swap_operator(int oper)
+{
+    switch (oper) {
+    case TOK_GT:  return TOK_LT;
+    case TOK_LT:  return TOK_GT;
+    case TOK_GTE: return TOK_LTE;
+    case TOK_LTE: return TOK_GTE;
+    default:      return oper;
+    }
+}
+
+/**
+ * Compile a comparison of two values, which sets the flag.
+ *
+ * Values of different types are compared as the evaluator always has: a
+ * double with anything as doubles; a long with a string as doubles if the
+ * string has a '.' in it, and as longs if not. 'contains' compares them as
+ * strings.
+ */
+static void compile_comparison(query_program* p, const condition* c)
+{
+    type left_type = c->left.conversion_type;
+    type right_type = c->right.conversion_type;
+    instruction ins = { .mode = c->oper };
+
+    if (p->fold && val_is_constant(&c->left) && val_is_constant(&c->right)) {
+        fold_comparison(p, c);
+        return;
+    }
+
+    if (TOK_CONTAINS == c->oper) {
+        ins.op = OP_CONTAINS;
+        ins.src[0] = compile_value_as(p, &c->left, TYPE_STRING);
+        ins.src[1] = compile_value_as(p, &c->right, TYPE_STRING);
+    }
+    else if (TYPE_DOUBLE == left_type || TYPE_DOUBLE == right_type) {
+        ins.op = OP_CMP_DOUBLE;
+        ins.src[0] = compile_value_as(p, &c->left, TYPE_DOUBLE);
+        ins.src[1] = compile_value_as(p, &c->right, TYPE_DOUBLE);
+    }
+    else if (left_type == right_type) {
+        ins.op = (TYPE_LONG == left_type) ? OP_CMP_LONG : OP_CMP_STRING;
+        ins.src[0] = compile_value(p, &c->left);
+        ins.src[1] = compile_value(p, &c->right);
+    }
+    else {
+        // the string goes on the left
+        const val* string = &c->left;
+        const val* number = &c->right;
+        val folded = {0};
+
+        if (TYPE_LONG == left_type) {
+            string = &c->right;
+            number = &c->left;
+            ins.mode = swap_operator(c->oper);
+        }
+
+        if (!p->fold || !val_is_constant(string)) {
+            ins.op = OP_CMP_STRING_LONG;
+            ins.src[0] = compile_value(p, string);
+            ins.src[1] = compile_value(p, number);
+        }
+        else if (fold_value(p, string, TYPE_STRING, &folded)) {
+            // which way to compare them is known now
+            val converted = {0};
+            if (NULL != strchr(folded.str, '.')) {
+                ins.op = OP_CMP_DOUBLE;
+                converted.dbl = csvsel_strtod(folded.str, NULL);
+                converted.is_dbl = true;
+                ins.src[1] = compile_value_as(p, number, TYPE_DOUBLE);
+            }
+            else {
+                ins.op = OP_CMP_LONG;
+                converted.num = csvsel_atol(folded.str);
+                converted.is_num = true;
+                ins.src[1] = compile_value(p, number);
+            }
+            ins.src[0] = add_constant(p, &converted);
+            free(folded.str);
+        }
+    }
+
+    emit(p, &ins);
+}
+
+static void compile_condition(query_program* p, const compound* c)
+{
+    instruction ins = {0};
+    size_t jump;
+
+    if (NULL == c) {
+        ins.op = OP_TRUE;
+        emit(p, &ins);
+        return;
+    }
+
+    switch (c->oper) {
+    case OPER_SIMPLE:
+        compile_comparison(p, &c->simple);
+        break;
+
+    case OPER_NOT:
+        compile_condition(p, c->left);
+        ins.op = OP_NOT;
+        emit(p, &ins);
+        break;
+
+    case OPER_AND:
+    case OPER_OR:
+        compile_condition(p, c->left);
+        ins.op = (OPER_AND == c->oper) ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE;
+        jump = emit(p, &ins);
+        compile_condition(p, c->right);
+        patch_jump(p, jump);
+        break;
+    }
+}
+
+/**
+ * Gather the conditions in a run of ANDs or ORs.
+ */
+static void gather_chain(const compound* c, int oper, growbuf* terms, query_program* p)
+{
+    if (oper == c->oper) {
+        gather_chain(c->left, oper, terms, p);
+        gather_chain(c->right, oper, terms, p);
+    }
+    else if (0 != growbuf_append(terms, &c, sizeof(c))) {
+        p->failed = true;
+    }
+}
+
+/**
+ * Compile a condition into the condition's tree: a chain of the terms in a
+ * run of ANDs or ORs, or a term, whose code returns with the flag set.
+ *
+ * The terms of a chain are entry points of their own, rather than code with
+ * jumps past the rest of the chain, so that a VM can run them in an order of
+ * its own: starting with the ones cheapest for how often they decide the
+ * chain, which it learns from the rows it sees. Terms have no side effects,
+ * so any order gives the same answer.
+ *
+ * Return Value:
+ *   The node, which goes after any under it.
+ */
+static size_t compile_node(query_program* p, const compound* c)
+{
+    condition_node node = { .oper = OPER_SIMPLE };
+
+    if (NULL != c && (OPER_AND == c->oper || OPER_OR == c->oper)) {
+        growbuf* terms = growbuf_create(4 * sizeof(c));
+        growbuf* nodes = growbuf_create(4 * sizeof(size_t));
+
+        if (NULL == terms || NULL == nodes) {
+            p->failed = true;
+        }
+        else {
+            gather_chain(c, c->oper, terms, p);
+            for (size_t i = 0; i < terms->size / sizeof(c); i++) {
+                size_t n = compile_node(p, ((const compound**)terms->buf)[i]);
+                if (0 != growbuf_append(nodes, &n, sizeof(n))) {
+                    p->failed = true;
+                }
+            }
+
+            node.oper = c->oper;
+            node.first = p->chains->size / sizeof(size_t);
+            node.count = nodes->size / sizeof(size_t);
+            if (0 != growbuf_append(p->chains, nodes->buf, nodes->size)) {
+                p->failed = true;
+            }
+        }
+
+        growbuf_free(terms);
+        growbuf_free(nodes);
+    }
+    else {
+        instruction ret = { .op = OP_RETURN };
+
+        node.entry = next_instruction(p);
+        node.term = ++p->num_terms;
+        compile_condition(p, c);
+        emit(p, &ret);
+    }
+
+    if (0 != growbuf_append(p->nodes, &node, sizeof(node))) {
+        p->failed = true;
+    }
+    return p->nodes->size / sizeof(node) - 1;
+}
+
+/**
+ * Compile a value as an entry point of its own, and record where it starts.
+ */
+static void compile_entry(query_program* p, const val* v, growbuf* entries)
+{
+    size_t entry = next_instruction(p);
+    instruction ret = { .op = OP_RETURN };
+
+    ret.src[0] = compile_value(p, v);
+    emit(p, &ret);
+
+    if (0 != growbuf_append(entries, &entry, sizeof(entry))) {
+        p->failed = true;
+    }
+}
+
+/**
+ * Compile the parts of a query that are evaluated for each row.
+ *
+ * Every value in the parse tree gets a register, whose type is known from the
+ * tree, so the conversions and comparisons to do are picked here. The
+ * condition becomes a tree of chains (see compile_node()), and each selected
+ * value and ORDER BY key an entry point that returns its register.
+ *
+ * Anything the same for every row is worked out here too: a value that only
+ * involves literals is run once and kept as a constant, in a register that is
+ * set when a VM is created and never written, and a comparison of two
+ * constants is decided outright. An instruction that would do exactly what an
+ * earlier one does writes the same register and is marked shared, so a value
+ * used in several places is worked out at most once per row.
+ *
+ * Arguments:
+ *   condition	- the WHERE condition, or NULL
+ *   selectors	- the selectors
+ *   order	- the ORDER BY, or NULL
+ *
+ * Return Value:
+ *   The program, or NULL if out of memory.
+ */
+query_program* query_compile(const compound* condition, const growbuf* selectors, const order* order)
+{
+    query_program* p = program_create(true);
+    if (NULL == p) {
+        return NULL;
+    }
+
+    p->root = compile_node(p, condition);
+
+    for (size_t i = 0; i < selectors->size / sizeof(void*); i++) {
+        const selector* s = ((selector**)selectors->buf)[i];
+        if (SELECTOR_VALUE == s->type) {
+            compile_entry(p, &s->value, p->selectors);
+        }
+        else {
+            size_t none = SIZE_MAX;
+            if (0 != growbuf_append(p->selectors, &none, sizeof(none))) {
+                p->failed = true;
+            }
+        }
+    }
+
+    if (NULL != order) {
+        const order_key* keys = (const order_key*)order->keys->buf;
+        for (size_t i = 0; i < order->keys->size / sizeof(order_key); i++) {
+            compile_entry(p, &keys[i].value, p->order_keys);
+        }
+    }
+
+    if (p->failed) {
+        query_program_free(p);
+        return NULL;
+    }
+
+    DEBUG query_program_print(p, stderr);
+
+    return p;
+}
+
+void query_program_free(query_program* program)
+{
+    if (NULL != program) {
+        growbuf_free(program->code);
+        growbuf_free(program->types);
+        growbuf_free(program->constants);
+        arena_free(program->strings);
+        growbuf_free(program->selectors);
+        growbuf_free(program->order_keys);
+        growbuf_free(program->nodes);
+        growbuf_free(program->chains);
+        free(program);
+    }
+}
+
+static const condition_node* node_at(const query_program* program, size_t n)
+{
+    return &((const condition_node*)program->nodes->buf)[n];
+}
+
+static size_t chain_node(const query_program* program, size_t place)
+{
+    return ((const size_t*)program->chains->buf)[place];
+}
+
+/**
+ * Print the condition's tree, like "and(1, or(2, 3))", by term number.
+ */
+static void print_node(const query_program* program, size_t n, FILE* output)
+{
+    const condition_node* node = node_at(program, n);
+
+    if (OPER_SIMPLE == node->oper) {
+        fprintf(output, "%zu", node->term);
+        return;
+    }
+
+    fprintf(output, "%s(", (OPER_AND == node->oper) ? "and" : "or");
+    for (size_t i = 0; i < node->count; i++) {
+        fprintf(output, (0 == i) ? "" : ", ");
+        print_node(program, chain_node(program, node->first + i), output);
+    }
+    fprintf(output, ")");
+}
+
+/**
+ * Print a program's instructions, one to a line, for debugging. Shared ones
+ * are marked with a *.
+ */
+void query_program_print(const query_program* program, FILE* output)
+{
+    static const char type_letters[] = { 'l', 'd', 's' };
+    const instruction* code = (const instruction*)program->code->buf;
+    const constant* constants = (const constant*)program->constants->buf;
+
+    if (program->constants->size > 0) {
+        fprintf(output, "constants:\n");
+    }
+    for (size_t i = 0; i < program->constants->size / sizeof(constant); i++) {
+        const constant* c = &constants[i];
+        fprintf(output, "      r%zu:%c = ", c->reg, type_letters[register_type(program, c->reg)]);
+        switch (register_type(program, c->reg)) {
+        case TYPE_LONG:     fprintf(output, "%ld\n", c->value.num); break;
+        case TYPE_DOUBLE:   fprintf(output, "%g\n", c->value.dbl); break;
+        case TYPE_STRING:   fprintf(output, "\"%s\"\n", c->value.str); break;
+        }
+    }
+
+    fprintf(output, "condition: ");
+    print_node(program, program->root, output);
+    fprintf(output, "\n");
+
+    for (size_t pc = 0; pc < next_instruction(program); pc++) {
+        const instruction* ins = &code[pc];
+        size_t num_src = 0;
+
+        for (size_t i = 0; i < program->nodes->size / sizeof(condition_node); i++) {
+            const condition_node* node = node_at(program, i);
+            if (OPER_SIMPLE == node->oper && pc == node->entry) {
+                fprintf(output, "term %zu:\n", node->term);
+            }
+        }
+        for (size_t i = 0; i < program->selectors->size / sizeof(size_t); i++) {
+            if (pc == ((size_t*)program->selectors->buf)[i]) {
+                fprintf(output, "selector %zu:\n", i + 1);
+            }
+        }
+        for (size_t i = 0; i < program->order_keys->size / sizeof(size_t); i++) {
+            if (pc == ((size_t*)program->order_keys->buf)[i]) {
+                fprintf(output, "order key %zu:\n", i + 1);
+            }
+        }
+
+        fprintf(output, "%4zu %c%-16s", pc, ins->shared ? '*' : ' ', OP_NAMES[ins->op]);
+
+        switch (ins->op) {
+        case OP_COLUMN:     fprintf(output, " %%%zu", ins->imm.col + 1); break;
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            fprintf(output, " -> %zu", ins->imm.target);
+            break;
+        case OP_RETURN:
+        case OP_LONG_TO_DOUBLE: case OP_LONG_TO_STRING:
+        case OP_DOUBLE_TO_LONG: case OP_DOUBLE_TO_STRING:
+        case OP_STRING_TO_LONG: case OP_STRING_TO_DOUBLE:
+            num_src = 1;
+            break;
+        case OP_CMP_LONG: case OP_CMP_DOUBLE: case OP_CMP_STRING:
+        case OP_CMP_STRING_LONG: case OP_CONTAINS:
+            num_src = 2;
+            break;
+        case OP_SUBSTR: case OP_STRLEN: case OP_MAX: case OP_MIN: case OP_ABS:
+        case OP_LOWER: case OP_UPPER: case OP_TRIM:
+            num_src = (size_t)ins->mode;
+            break;
+        default:
+            break;
+        }
+
+        for (size_t i = 0; i < num_src; i++) {
+            fprintf(output, " r%zu", ins->src[i]);
+        }
+
+        if (ins->op < OP_CMP_LONG) {
+            fprintf(output, " => r%zu:%c", ins->dst,
+                    type_letters[register_type(program, ins->dst)]);
+        }
+        fprintf(output, "\n");
+    }
+}
+
+//
+// Running
+//
+
+query_vm* query_vm_create(const query_program* program)
+{
+    query_vm* vm = malloc(sizeof(query_vm));
+    if (NULL == vm) {
+        return NULL;
+    }
+
+    vm->program = program;
+    vm->num_registers = program->types->size / sizeof(type);
+    vm->row = 1;
+    vm->registers = calloc(vm->num_registers, sizeof(reg));
+    vm->written = calloc(vm->num_registers, sizeof(size_t));
+    vm->scratch = arena_create(4096);
+    vm->order = calloc(program->chains->size / sizeof(size_t) + 1, sizeof(size_t));
+    vm->stats = calloc(program->chains->size / sizeof(size_t) + 1, sizeof(node_stats));
+    if (NULL == vm->registers || NULL == vm->written || NULL == vm->scratch
+            || NULL == vm->order || NULL == vm->stats) {
+        query_vm_free(vm);
+        return NULL;
+    }
+
+    // the chains start out in the order they were written in
+    for (size_t i = 0; i < program->nodes->size / sizeof(condition_node); i++) {
+        const condition_node* node = node_at(program, i);
+        for (size_t j = 0; j < node->count; j++) {
+            vm->order[node->first + j] = j;
+        }
+    }
+
+    const constant* constants = (const constant*)program->constants->buf;
+    for (size_t i = 0; i < program->constants->size / sizeof(constant); i++) {
+        vm->registers[constants[i].reg] = constants[i].value;
+    }
+
+    return vm;
+}
+
+void query_vm_free(query_vm* vm)
+{
+    if (NULL != vm) {
+        free(vm->registers);
+        free(vm->written);
+        arena_free(vm->scratch);
+        free(vm->order);
+        free(vm->stats);
+        free(vm);
+    }
+}
+
+/**
+ * Room for a string of a length and its NUL, for the current row.
+ */
+static char* new_string(query_vm* vm, size_t len)
+{
+    char* str = arena_alloc(vm->scratch, len + 1);
+    if (NULL == str) {
+        fprintf(stderr, "malloc failed!\n");
+        abort();
+    }
+    return str;
+}
+
+static void set_string(reg* r, const char* str, size_t len)
+{
+    r->str = str;
+    r->len = len;
+}
+
+static bool compare_longs(int oper, long a, long b)
+{
+    switch (oper) {
+    case TOK_EQ:  return a == b;
+    case TOK_NEQ: return a != b;
+    case TOK_GT:  return a > b;
+    case TOK_LT:  return a < b;
+    case TOK_GTE: return a >= b;
+    case TOK_LTE: return a <= b;
+    }
+    return true;
+}
+
+static bool compare_doubles(int oper, double a, double b)
+{
+    switch (oper) {
+    case TOK_EQ:  return a == b;
+    case TOK_NEQ: return a != b;
+    case TOK_GT:  return a > b;
+    case TOK_LT:  return a < b;
+    case TOK_GTE: return a >= b;
+    case TOK_LTE: return a <= b;
+    }
+    return true;
+}
+
+/**
+ * Compare two strings by their lengths, the way strcmp() would if they were
+ * NUL-terminated.
+ */
+static int compare_strings(const reg* a, const reg* b)
+{
+    int cmp = memcmp(a->str, b->str, (a->len < b->len) ? a->len : b->len);
+    if (0 == cmp && a->len != b->len) {
+        cmp = (a->len < b->len) ? -1 : 1;
+    }
+    return cmp;
+}
+
+static void substr(query_vm* vm, reg* dst, const reg* str, long start_arg, long len_arg, int num_args)
+{
+    ssize_t start  = start_arg;
+    ssize_t len    = len_arg;
+    size_t  in_len = str->len;
+
+    if (start < 0) {
+        if (-1*start >= in_len) {
+            start = 0;
+        }
+        else {
+            start += in_len;
+        }
+    }
+    else if (start >= in_len) {
+        start = in_len;
+        len = 0;
+    }
+
+    if (num_args == 2) {
+        len = -1;
+    }
+
+    if (len < 0) {
+        if (-1*len >= in_len) {
+            len = in_len - start;
+        }
+        else {
+            len += in_len - start + 1;
+        }
+    }
+    else if (start + len > in_len) {
+        len = in_len - start;
+    }
+
+    char* result = new_string(vm, len);
+    if (len > 0) {
+        memcpy(result, str->str + start, len);
+    }
+    result[len] = '\0';
+
+    set_string(dst, result, len);
+}
+
+static void change_case(query_vm* vm, reg* dst, const reg* str, bool upper)
+{
+    size_t len = str->len;
+    char* result = new_string(vm, len);
+
+    for (size_t i = 0; i < len; i++) {
+        char c = str->str[i];
+        if (!upper && c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+        }
+        else if (upper && c >= 'a' && c <= 'z') {
+            c -= 'a' - 'A';
+        }
+        result[i] = c;
+    }
+    result[len] = '\0';
+
+    set_string(dst, result, len);
+}
+
+static void trim(query_vm* vm, reg* dst, const reg* str)
+{
+    size_t start = 0;
+    size_t end = str->len;
+
+#define IS_WHITESPACE(c) \
+    ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+    while (start < end && IS_WHITESPACE(str->str[start])) {
+        start++;
+    }
+    while (end > start && IS_WHITESPACE(str->str[end - 1])) {
+        end--;
+    }
+
+#undef IS_WHITESPACE
+
+    char* result = new_string(vm, end - start);
+    memcpy(result, str->str + start, end - start);
+    result[end - start] = '\0';
+
+    set_string(dst, result, end - start);
+}
+
+/**
+ * A measure of the work an instruction does: one, and one more for every 16
+ * bytes of strings it goes through.
+ */
+static size_t instruction_cost(const instruction* ins, const reg* a, const reg* b)
+{
+    switch (ins->op) {
+    case OP_CMP_STRING:
+    case OP_CONTAINS:
+        return 1 + (a->len + b->len) / 16;
+    case OP_STRING_TO_LONG:
+    case OP_STRING_TO_DOUBLE:
+    case OP_CMP_STRING_LONG:
+    case OP_SUBSTR:
+    case OP_LOWER:
+    case OP_UPPER:
+    case OP_TRIM:
+        return 1 + a->len / 16;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * Run a program from an entry point to its return.
+ *
+ * A shared instruction is skipped if its register has already been written
+ * for this row. A string in a register is borrowed, from the program for a
+ * constant or from the row for a column, or made in the VM's arena, which is
+ * reset for each row; strings are used by their lengths, since columns aren't
+ * NUL-terminated.
+ *
+ * Arguments:
+ *   vm		- registers to run it with
+ *   pc		- the entry point
+ *   row	- the row
+ *   rownum	- its number
+ *   flag	- receives the outcome of the last comparison, for a condition
+ *   cost	- the work done is added to this, if it isn't NULL; see
+ *		  instruction_cost()
+ *
+ * Return Value:
+ *   The register the return names.
+ */
+static size_t run(query_vm* vm, size_t pc, const csv_row* row, size_t rownum, bool* flag,
+        size_t* cost)
+{
+    const instruction* code = (const instruction*)vm->program->code->buf;
+    reg* r = vm->registers;
+    bool f = false;
+
+    for (;;) {
+        const instruction* ins = &code[pc++];
+        reg* dst = &r[ins->dst];
+        const reg* a = &r[ins->src[0]];
+        const reg* b = &r[ins->src[1]];
+
+        if (ins->shared) {
+            if (vm->written[ins->dst] == vm->row) {
+                continue;
+            }
+            vm->written[ins->dst] = vm->row;
+        }
+
+        if (NULL != cost) {
+            *cost += instruction_cost(ins, a, b);
+        }
+
+        switch (ins->op) {
+        case OP_COLUMN:
+            if (ins->imm.col < row->num_fields) {
+                const csv_field* field = &row->fields[ins->imm.col];
+                dst->str = field->data;
+                dst->len = field->len;
+            }
+            else {
+                dst->str = "";
+                dst->len = 0;
+            }
+            break;
+
+        case OP_NUMCOLS:
+            dst->num = row->num_fields;
+            break;
+
+        case OP_ROWNUM:
+            dst->num = rownum;
+            break;
+
+        case OP_LONG_TO_DOUBLE:
+            dst->dbl = (double)a->num;
+            break;
+
+        case OP_LONG_TO_STRING:
+            {
+                char* str = new_string(vm, 24);
+                int len = snprintf(str, 25, "%ld", a->num);
+                set_string(dst, str, len);
+            }
+            break;
+
+        case OP_DOUBLE_TO_LONG:
+            dst->num = (long)a->dbl;
+            break;
+
+        case OP_DOUBLE_TO_STRING:
+            {
+                char* str = new_string(vm, 32);
+                int len = snprintf(str, 33, "%lf", a->dbl);
+                if (len > 32) {
+                    // a big one
+                    str = new_string(vm, len);
+                    snprintf(str, len + 1, "%lf", a->dbl);
+                }
+                set_string(dst, str, len);
+            }
+            break;
+
+        case OP_STRING_TO_LONG:
+            dst->num = csvsel_strntol(a->str, a->len);
+            break;
+
+        case OP_STRING_TO_DOUBLE:
+            dst->dbl = csvsel_strntod(a->str, a->len);
+            break;
+
+        case OP_SUBSTR:
+            substr(vm, dst, a, b->num, r[ins->src[2]].num, ins->mode);
+            break;
+
+        case OP_STRLEN:
+            dst->num = a->len;
+            break;
+
+        case OP_MAX:
+            dst->dbl = (a->dbl > b->dbl) ? a->dbl : b->dbl;
+            break;
+
+        case OP_MIN:
+            dst->dbl = (a->dbl < b->dbl) ? a->dbl : b->dbl;
+            break;
+
+        case OP_ABS:
+            dst->dbl = fabs(a->dbl);
+            break;
+
+        case OP_LOWER:
+        case OP_UPPER:
+            change_case(vm, dst, a, OP_UPPER == ins->op);
+            break;
+
+        case OP_TRIM:
+            trim(vm, dst, a);
+            break;
+
+        case OP_CMP_LONG:
+            f = compare_longs(ins->mode, a->num, b->num);
+            break;
+
+        case OP_CMP_DOUBLE:
+            f = compare_doubles(ins->mode, a->dbl, b->dbl);
+            break;
+
+        case OP_CMP_STRING:
+            f = compare_longs(ins->mode, compare_strings(a, b), 0);
+            break;
+
+        case OP_CMP_STRING_LONG:
+            if (NULL != memchr(a->str, '.', a->len)) {
+                f = compare_doubles(ins->mode, csvsel_strntod(a->str, a->len), (double)b->num);
+            }
+            else {
+                f = compare_longs(ins->mode, csvsel_strntol(a->str, a->len), b->num);
+            }
+            break;
+
+        case OP_CONTAINS:
+            f = (0 == b->len || NULL != memmem(a->str, a->len, b->str, b->len));
+            break;
+
+        case OP_TRUE:
+            f = true;
+            break;
+
+        case OP_FALSE:
+            f = false;
+            break;
+
+        case OP_NOT:
+            f = !f;
+            break;
+
+        case OP_JUMP_IF_FALSE:
+            if (!f) {
+                pc = ins->imm.target;
+            }
+            break;
+
+        case OP_JUMP_IF_TRUE:
+            if (f) {
+                pc = ins->imm.target;
+            }
+            break;
+
+        case OP_RETURN:
+            *flag = f;
+            return ins->src[0];
+
+        case NUM_OPS:
+            break;
+        }
+    }
+}
+
+/**
+ * The value in a register, borrowed until the program is next run.
+ */
+static val register_value(const query_vm* vm, size_t r)
+{
+    const reg* value = &vm->registers[r];
+    val v = {0};
+
+    v.conversion_type = register_type(vm->program, r);
+    switch (v.conversion_type) {
+    case TYPE_LONG:
+        v.num = value->num;
+        v.is_num = true;
+        break;
+    case TYPE_DOUBLE:
+        v.dbl = value->dbl;
+        v.is_dbl = true;
+        break;
+    case TYPE_STRING:
+        v.str = (char*)value->str;
+        v.len = value->len;
+        v.is_str = true;
+        break;
+    }
+
+    return v;
+}
+
+/**
+ * Evaluate a node of the condition's tree for a row.
+ *
+ * Arguments:
+ *   vm		- the VM
+ *   n		- the node
+ *   row	- the row
+ *   rownum	- its number
+ *   cost	- NULL normally; to sample the row, where the work done is added:
+ *		  then every node of every chain is run, and its statistics
+ *		  kept
+ */
+static bool evaluate_node(query_vm* vm, size_t n, const csv_row* row, size_t rownum, size_t* cost)
+{
+    const condition_node* node = node_at(vm->program, n);
+    bool flag;
+
+    if (OPER_SIMPLE == node->oper) {
+        run(vm, node->entry, row, rownum, &flag, cost);
+        return flag;
+    }
+
+    // a node that comes out this way decides the chain
+    bool decides = (OPER_OR == node->oper);
+    bool result = !decides;
+
+    for (size_t i = 0; i < node->count; i++) {
+        size_t place = node->first + vm->order[node->first + i];
+        size_t child = chain_node(vm->program, place);
+
+        if (NULL == cost) {
+            if (decides == evaluate_node(vm, child, row, rownum, NULL)) {
+                return decides;
+            }
+        }
+        else {
+            node_stats* stats = &vm->stats[place];
+            size_t child_cost = 0;
+
+            flag = evaluate_node(vm, child, row, rownum, &child_cost);
+            stats->runs++;
+            stats->passes += flag;
+            stats->cost += child_cost;
+            *cost += child_cost;
+            if (decides == flag) {
+                result = decides;
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * How good a node is to run early in its chain: the work it takes for each
+ * time it decides the chain. Lower is better.
+ */
+static double node_rank(const node_stats* stats, bool decides)
+{
+    size_t deciding = decides ? stats->passes : stats->runs - stats->passes;
+    double rate = (double)deciding / stats->runs;
+    double cost = (double)stats->cost / stats->runs;
+
+    // a node that never decides still goes by its cost
+    return cost / (rate + 0.001);
+}
+
+/**
+ * Put each chain in order by its nodes' statistics.
+ *
+ * Arguments:
+ *   vm		- the VM whose chains to put in order
+ *   halve	- halve the statistics afterward, so that newer rows count for
+ *		  more
+ */
+static void reorder_chains(query_vm* vm, bool halve)
+{
+    const query_program* program = vm->program;
+
+    for (size_t n = 0; n < program->nodes->size / sizeof(condition_node); n++) {
+        const condition_node* node = node_at(program, n);
+        size_t* order = &vm->order[node->first];
+        node_stats* stats = &vm->stats[node->first];
+        bool decides = (OPER_OR == node->oper);
+        bool sampled = true;
+
+        for (size_t i = 0; i < node->count; i++) {
+            sampled = sampled && (stats[i].runs > 0);
+        }
+        if (!sampled) {
+            continue;
+        }
+
+        // insertion sort; chains are short, and it keeps ties where they are
+        for (size_t i = 1; i < node->count; i++) {
+            size_t moving = order[i];
+            double rank = node_rank(&stats[moving], decides);
+            size_t j = i;
+            while (j > 0 && node_rank(&stats[order[j - 1]], decides) > rank) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = moving;
+        }
+
+        for (size_t i = 0; halve && i < node->count; i++) {
+            stats[i].runs = (stats[i].runs + 1) / 2;
+            stats[i].passes = (stats[i].passes + 1) / 2;
+            stats[i].cost = (stats[i].cost + 1) / 2;
+        }
+    }
+}
+
+/**
+ * Whether a row meets the query's condition.
+ *
+ * This starts the VM on the row: values worked out for it are kept for the
+ * selectors and ORDER BY keys evaluated for it afterward, until the next call.
+ */
+bool query_vm_matches(query_vm* vm, const csv_row* row, size_t rownum)
+{
+    size_t cost = 0;
+    bool flag;
+
+    vm->row++;
+    arena_reset(vm->scratch);
+
+    flag = evaluate_node(vm, vm->program->root, row, rownum,
+            (0 == vm->row % SAMPLE_EVERY) ? &cost : NULL);
+
+    if (0 == vm->row % REORDER_EVERY) {
+        reorder_chains(vm, true);
+    }
+
+    return flag;
+}
+
+/**
+ * Add the rows another VM for the same program has seen, and its statistics
+ * on the condition's terms, to a VM's, and put its chains in order by the
+ * total; for printing one order for a query run on several VMs.
+ */
+void query_vm_merge_order(query_vm* vm, const query_vm* other)
+{
+    size_t places = vm->program->chains->size / sizeof(size_t);
+
+    vm->row += other->row - 1;
+    for (size_t i = 0; i < places; i++) {
+        vm->stats[i].runs += other->stats[i].runs;
+        vm->stats[i].passes += other->stats[i].passes;
+        vm->stats[i].cost += other->stats[i].cost;
+    }
+
+    reorder_chains(vm, false);
+}
+
+/**
+ * Print the nodes of a chain in the order a VM runs them, with their
+ * statistics, and those of any chains in it under them.
+ */
+static void print_chain(const query_vm* vm, size_t n, int indent, FILE* output)
+{
+    const condition_node* node = node_at(vm->program, n);
+
+    for (size_t i = 0; i < node->count; i++) {
+        size_t place = node->first + vm->order[node->first + i];
+        size_t child = chain_node(vm->program, place);
+        const condition_node* child_node = node_at(vm->program, child);
+        const node_stats* stats = &vm->stats[place];
+
+        fprintf(output, "%*s", indent, "");
+        if (OPER_SIMPLE == child_node->oper) {
+            fprintf(output, "term %zu", child_node->term);
+        }
+        else {
+            fprintf(output, "%s", (OPER_AND == child_node->oper) ? "and" : "or");
+        }
+        if (stats->runs > 0) {
+            fprintf(output, ": passed %.1f%%, cost %.1f",
+                    100.0 * stats->passes / stats->runs, (double)stats->cost / stats->runs);
+        }
+        fprintf(output, "\n");
+
+        if (OPER_SIMPLE != child_node->oper) {
+            print_chain(vm, child, indent + 4, output);
+        }
+    }
+}
+
+/**
+ * Print the order a VM has come to run the condition's terms in, and how
+ * often each passed and how much work it took on the rows sampled, for
+ * debugging. Terms are numbered as in query_program_print().
+ */
+void query_vm_print_order(const query_vm* vm, FILE* output)
+{
+    const condition_node* root = node_at(vm->program, vm->program->root);
+
+    fprintf(output, "condition order after %zu rows:\n", vm->row - 1);
+    if (OPER_SIMPLE == root->oper) {
+        fprintf(output, "    term %zu\n", root->term);
+    }
+    else {
+        fprintf(output, "    %s\n", (OPER_AND == root->oper) ? "and" : "or");
+        print_chain(vm, vm->program->root, 8, output);
+    }
+}
+
+/**
+ * Evaluate a selector that's a value, for a row: the one last checked with
+ * query_vm_matches(), if any has been.
+ *
+ * Return Value:
+ *   The value, of its conversion type. A string is borrowed, until the VM is
+ *   next run or the row goes away; don't free it. It isn't NUL-terminated if
+ *   it's a column, so go by its length.
+ */
+val query_vm_selector(query_vm* vm, size_t selector_num, const csv_row* row, size_t rownum)
+{
+    bool flag;
+    size_t entry = ((const size_t*)vm->program->selectors->buf)[selector_num];
+    return register_value(vm, run(vm, entry, row, rownum, &flag, NULL));
+}
+
+/**
+ * Evaluate an ORDER BY key for a row; see query_vm_selector().
+ */
+val query_vm_order_key(query_vm* vm, size_t key_num, const csv_row* row, size_t rownum)
+{
+    bool flag;
+    size_t entry = ((const size_t*)vm->program->order_keys->buf)[key_num];
+    return register_value(vm, run(vm, entry, row, rownum, &flag, NULL));
+}
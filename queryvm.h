@@ -0,0 +1,33 @@
+/*
+ * CSV Selector
+ *
+ * Queries compiled to a flat program over typed registers, which is run for
+ * each row instead of walking the parse tree.
+ */
+
+#ifndef QUERYVM_H
+#define QUERYVM_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "growbuf.h"
+#include "csvformat.h"
+#include "queryparse.h"
+
+typedef struct _query_program query_program;
+typedef struct _query_vm query_vm;
+
+query_program* query_compile(const compound* condition, const growbuf* selectors, const order* order);
+void query_program_free(query_program* program);
+void query_program_print(const query_program* program, FILE* output);
+
+query_vm* query_vm_create(const query_program* program);
+void query_vm_free(query_vm* vm);
+bool query_vm_matches(query_vm* vm, const csv_row* row, size_t rownum);
+val query_vm_selector(query_vm* vm, size_t selector_num, const csv_row* row, size_t rownum);
+val query_vm_order_key(query_vm* vm, size_t key_num, const csv_row* row, size_t rownum);
+void query_vm_print_order(const query_vm* vm, FILE* output);
+void query_vm_merge_order(query_vm* vm, const query_vm* other);
+
+#endif //QUERYVM_H
@@ -51,7 +51,7 @@ int main(int argc, char** argv)
     int retval = 0;
 
     if (argc == 1) {
-        fprintf(stderr, "csvsel tester\nusage: %1$s <test number or \"all\" or \"parse\">\n",
+        fprintf(stderr, "csvsel tester\nusage: %1$s <test number or \"all\" or \"parse\" or \"bench\">\n",
                 argv[0]);
         retval = -1;
         goto cleanup;
@@ -66,6 +66,10 @@ int main(int argc, char** argv)
 
         test_parse(argv[2]);
     }
+    else if (strcmp("bench", argv[1]) == 0) {
+        size_t num_rows = (argc > 2) ? (size_t)atol(argv[2]) : 1000000;
+        bench_sort(num_rows);
+    }
     else if (strcmp("all", argv[1]) == 0) {
         for (size_t test_num = 0; 
                 test_num < sizeof(TESTS) / sizeof(TESTS[0]);
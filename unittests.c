@@ -5,14 +5,62 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <zlib.h>
 
 #include "growbuf.h"
 #include "csvformat.h"
+#include "csvscan.h"
 #include "queryparse.h"
 #include "csvsel.h"
+#include "decompress.h"
+#include "extsort.h"
 #include "util.h"
+#include "queryparse.tab.h"
+#include "queryeval.h"
+#include "queryvm.h"
+#include "functions.h"
 
 extern int query_debug;
+extern functionspec FUNCTIONS[];
+
+//
+// Allocation counting: the test program replaces the C library's allocator
+// entry points with ones that count calls while count_allocations is set.
+//
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static bool   count_allocations = false;
+static size_t num_allocations = 0;
+
+void* malloc(size_t size)
+{
+    if (count_allocations) {
+        num_allocations++;
+    }
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+    if (count_allocations) {
+        num_allocations++;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    if (count_allocations) {
+        num_allocations++;
+    }
+    return __libc_realloc(ptr, size);
+}
 
 /**
  * Read the contents of a file descriptor into a growbuf.
@@ -64,7 +112,7 @@ bool test_csv_out(const char* instr, const char* outstr)
     fcntl(fd[READ], F_SETFL, O_NONBLOCK);
 
     print_output = fdopen(fd[WRITE], "a");
-    print_csv_field(instr, print_output);
+    print_csv_field(instr, strlen(instr), print_output);
     fflush(print_output);
 
     buf = growbuf_create(10);
@@ -104,6 +152,202 @@ bool test_csv_out4()
     return test_csv_out("hello\nworld", "\"hello\nworld\"");
 }
 
+bool test_csv_out5()
+{
+    // the comma is in the field's second window
+    return test_csv_out(
+            "say \"hello\" to the whole world, and then say \"hello\" to it again; "
+            "and, once more",
+            "\"say \"\"hello\"\" to the whole world, and then say \"\"hello\"\" to it again; "
+            "and, once more\"");
+}
+
+/**
+ * Check that a number prints the same with print_csv_long() or
+ * print_csv_double() as with printf().
+ */
+static bool check_number_output(bool is_double, long n, double d)
+{
+    char expected[512];
+    char* actual = NULL;
+    size_t actual_len = 0;
+    FILE* output = open_memstream(&actual, &actual_len);
+
+    if (is_double) {
+        snprintf(expected, sizeof(expected), "%lf", d);
+        print_csv_double(d, output);
+    }
+    else {
+        snprintf(expected, sizeof(expected), "%ld", n);
+        print_csv_long(n, output);
+    }
+    fclose(output);
+
+    bool same = (0 == strcmp(expected, actual));
+    if (!same) {
+        printf("printed %s, not %s\n", actual, expected);
+    }
+
+    free(actual);
+    return same;
+}
+
+bool test_number_output()
+{
+    const long longs[] = { 0, 1, -1, 9, 10, -10, 1234567890, LONG_MAX, LONG_MIN };
+    const double doubles[] = {
+        0.0, -0.0, 1.0, -1.0, 0.1, 73.69, -85.61, 1e-7, -1e-7, 5e-7, 4.9999999e-7,
+        0.0078125, 0.0234375, -0.0234375, 1.0000005, 2.5e-6, 123456789.123456789,
+        1e12, 1.8e13, 1.9e13, -1.9e13, 1e15, 9.2e18, 1e300, -1e300, 5e-324,
+        INFINITY, -INFINITY, NAN,
+    };
+
+    for (size_t i = 0; i < sizeof(longs) / sizeof(longs[0]); i++) {
+        if (!check_number_output(false, longs[i], 0)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+        if (!check_number_output(true, 0, doubles[i])) {
+            return false;
+        }
+    }
+
+    //
+    // Numbers with few bits after the point land on exact ties between
+    // millionths, and random bits hit everything else.
+    //
+
+    for (size_t i = 0; i < 100000; i++) {
+        long n = ((long)rand() << 32) ^ rand();
+        double tie = (double)(rand() % 100000000) / (1 << (rand() % 30));
+        uint64_t bits = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand();
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+
+        if (!check_number_output(false, n, 0)
+                || !check_number_output(true, 0, tie)
+                || !check_number_output(true, 0, (rand() % 2) ? -tie : tie / 1e6)
+                || !check_number_output(true, 0, d)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Check that csvsel_strntod() and csvsel_strntol() parse the first len
+ * characters of a string the same as strtod() and atol() do once the '$'s
+ * and ','s are taken out.
+ */
+static bool check_number_input(const char* str, size_t len)
+{
+    char buf[256];
+    size_t j = 0;
+
+    for (size_t i = 0; i < len && str[i] != '\0' && j < sizeof(buf) - 1; i++) {
+        if (str[i] != '$' && str[i] != ',') {
+            buf[j++] = str[i];
+        }
+    }
+    buf[j] = '\0';
+
+    double expected_dbl = strtod(buf, NULL);
+    double actual_dbl = csvsel_strntod(str, len);
+    long expected_long = atol(buf);
+    long actual_long = csvsel_strntol(str, len);
+
+    if (0 != memcmp(&expected_dbl, &actual_dbl, sizeof(double))
+            && !(isnan(expected_dbl) && isnan(actual_dbl))) {
+        printf("\"%.*s\": %.17g, not %.17g\n", (int)len, str, expected_dbl, actual_dbl);
+        return false;
+    }
+    if (expected_long != actual_long) {
+        printf("\"%.*s\": %ld, not %ld\n", (int)len, str, expected_long, actual_long);
+        return false;
+    }
+    return true;
+}
+
+bool test_number_input()
+{
+    const char* numbers[] = {
+        "", "0", "-0", "+0", "-0.0", ".", "-", "5", "-7", "3.25", "$1,234.50", "-$1,234",
+        "$-5", "1e3", "1e", "1e+", "1E-5", "12.", ".5", "  42", "\t-3.5", "$ 5", "0x1A",
+        "0x1p3", "inf", "-Infinity", "nan", "NaN(123)", "1,2e,3", "00012.50", "0.000123",
+        "9223372036854775807", "9223372036854775808", "-9223372036854775808",
+        "-9223372036854775809", "123456789012345678901234567890", "12345678.87654321",
+        "9007199254740992", "9007199254740993", "1e22", "1e23", "123e30", "1e-22",
+        "1e-23", "4.9e-324", "2.2250738585072014e-308", "1.7976931348623157e308", "1e309",
+        "0.1", "0.30000000000000004", "1e999999999", "1e-999999999", "123abc", "12 34",
+    };
+    const char alphabet[] = "0123456789012345678901234567890123456789.eE+-$, xinfa";
+
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+        if (!check_number_input(numbers[i], strlen(numbers[i]))) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < 200000; i++) {
+        char str[128];
+        size_t len = 0;
+
+        switch (i % 4) {
+        case 0:
+            // anything
+            len = (size_t)rand() % 32;
+            for (size_t j = 0; j < len; j++) {
+                str[j] = alphabet[rand() % (sizeof(alphabet) - 1)];
+            }
+            str[len] = '\0';
+            break;
+
+        case 1:
+            // doubles of any bits, printed exactly and not
+            {
+                uint64_t bits = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 11) ^ rand();
+                double d;
+                memcpy(&d, &bits, sizeof(d));
+                if (rand() % 2) {
+                    len = (size_t)snprintf(str, sizeof(str), "%.17g", d);
+                }
+                else {
+                    len = (size_t)snprintf(str, sizeof(str), "%.*g", rand() % 20, d);
+                }
+            }
+            break;
+
+        case 2:
+            // prices and the like, with grouping and some digits
+            len = (size_t)snprintf(str, sizeof(str), "%s%s%d,%03d,%03d.%0*d",
+                    (rand() % 4) ? "" : "-", (rand() % 2) ? "$" : "",
+                    rand() % 1000, rand() % 1000, rand() % 1000,
+                    1 + rand() % 9, rand() % 100000000);
+            break;
+
+        case 3:
+            // integers around where longs and doubles stop being exact
+            len = (size_t)snprintf(str, sizeof(str), "%ld%0*d",
+                    ((long)rand() << 31) ^ rand(), rand() % 10, rand() % 1000);
+            break;
+        }
+
+        // and sometimes not all of it, as a field of a row isn't NUL-terminated
+        if (len > 0 && 0 == rand() % 4) {
+            len = (size_t)rand() % len;
+        }
+
+        if (!check_number_input(str, len)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /**
  * Select columns 1-10 and 77, specifying some overlaps too.
  * Tests that the overlap detection works, as well as basic column selection.
@@ -169,21 +413,498 @@ cleanup:
         free(root_condition);
     }
 
-    if (order != NULL) {
-        free(order);
+    free_order(order);
+
+    return retval;
+}
+
+//
+// The tree evaluator the compiled programs of queryvm.c replaced, kept as a
+// reference for what they should do.
+//
+
+/**
+ * Evaluates a val to a constant, by walking its tree.
+ * Returns a new val with all strings copied.
+ */
+static val tree_value_evaluate(const val* val, const csv_row* row, size_t rownum)
+{
+    struct _val ret;
+    memset(&ret, 0, sizeof(struct _val));
+
+    if (val->is_num) {
+        ret.num = val->num;
+        ret.is_num = true;
+        ret.conversion_type = TYPE_LONG;
+    }
+    else if (val->is_dbl) {
+        ret.dbl = val->dbl;
+        ret.is_dbl = true;
+        ret.conversion_type = TYPE_DOUBLE;
+    }
+    else if (val->is_str) {
+        ret.str = strndup(val->str, val->len);
+        ret.len = val->len;
+        ret.is_str = true;
+        ret.conversion_type = TYPE_STRING;
+    }
+    else if (val->is_col) {
+        size_t colnum = val->col;
+
+        if (colnum >= row->num_fields) {
+            //
+            // Selected an out-of-bounds column
+            // This is defined as empty string.
+            //
+
+            ret.str = strdup("");
+            ret.len = 0;
+        }
+        else {
+            const csv_field* field = &row->fields[colnum];
+            ret.str = strndup(field->data, field->len);
+            ret.len = field->len;
+        }
+
+        ret.is_str = true;
+        ret.conversion_type = TYPE_STRING;
+    }
+    else if (val->is_special) {
+        switch (val->special) {
+        case SPECIAL_NUMCOLS:
+            ret.num = row->num_fields;
+            ret.is_num = true;
+            ret.conversion_type = TYPE_LONG;
+            break;
+        case SPECIAL_ROWNUM:
+            ret.num = rownum;
+            ret.is_num = true;
+            ret.conversion_type = TYPE_LONG;
+            break;
+        }
+    }
+    else if (val->is_func) {
+        struct _val args[MAX_ARGS];
+        for (size_t i = 0; i < val->func->num_args; i++) {
+            args[i] = tree_value_evaluate(&(val->func->args[i]), row, rownum);
+        }
+
+        switch (val->func->func) {
+        case FUNC_SUBSTR:
+            {
+                ssize_t start  = args[1].num;
+                ssize_t len    = args[2].num;
+                size_t  in_len = args[0].len;
+
+                if (start < 0) {
+                    if (-1*start >= in_len) {
+                        start = 0;
+                    }
+                    else {
+                        start += in_len;
+                    }
+                }
+                else if (start >= in_len) {
+                    start = in_len;
+                    len = 0;
+                }
+
+                if (val->func->num_args == 2) {
+                    len = -1;
+                }
+
+                if (len < 0) {
+                    if (-1*len >= in_len) {
+                        len = in_len - start;
+                    }
+                    else {
+                        len += in_len - start + 1;
+                    }
+                }
+                else if (start + len > in_len) {
+                    len = in_len - start;
+                }
+
+                char* result = (char*)malloc(len + 1);
+                
+                if (len > 0) {
+                    memcpy(result, args[0].str + start, len);
+                }
+
+                result[len] = '\0';
+
+                ret.str = result;
+                ret.len = len;
+                ret.is_str = true;
+                ret.conversion_type = TYPE_STRING;
+            }
+            break;
+
+        case FUNC_STRLEN:
+            {
+                ret.num = args[0].len;
+                ret.is_num = true;
+                ret.conversion_type = TYPE_LONG;
+            }
+            break;
+
+        case FUNC_MAX:
+        case FUNC_MIN:
+            {
+                double arg0 = 0.0;
+                double arg1 = 0.0;
+
+                if (args[0].is_dbl) {
+                    arg0 = args[0].dbl;
+                }
+                else if (args[0].is_num) {
+                    arg0 = (double)(args[0].num);
+                }
+
+                if (args[1].is_dbl) {
+                    arg1 = args[1].dbl;
+                }
+                else if (args[1].is_num) {
+                    arg1 = (double)(args[1].num);
+                }
+
+                if (val->func->func == FUNC_MAX) {
+                    ret.dbl = (arg0 > arg1) ? arg0 : arg1;
+                }
+                else {
+                    ret.dbl = (arg0 < arg1) ? arg0 : arg1;
+                }
+
+                ret.is_dbl = true;
+                ret.conversion_type = TYPE_DOUBLE;
+            }
+            break;
+
+        case FUNC_ABS:
+            {
+                double arg0 = 0.0;
+
+                if (args[0].is_dbl) {
+                    arg0 = args[0].dbl;
+                }
+                else if (args[0].is_num) {
+                    arg0 = (double)args[0].num;
+                }
+
+                ret.dbl = fabs(arg0);
+                ret.is_dbl = true;
+                ret.conversion_type = TYPE_DOUBLE;
+            }
+            break;
+
+        case FUNC_LOWER:
+        case FUNC_UPPER:
+            {
+                size_t len = args[0].len;
+                ret.str = (char*)malloc(len + 1);
+                ret.len = len;
+
+                for (size_t i = 0; i <= len; i++) {
+                    if (val->func->func == FUNC_LOWER
+                            && args[0].str[i] >= 'A' && args[0].str[i] <= 'Z') {
+                        ret.str[i] = args[0].str[i] + ('a' - 'A');
+                    }
+                    else if (val->func->func == FUNC_UPPER
+                            && args[0].str[i] >= 'a' && args[0].str[i] <= 'z') {
+                        ret.str[i] = args[0].str[i] - ('a' - 'A');
+                    }
+                    else {
+                        ret.str[i] = args[0].str[i];
+                    }
+                }
+
+                ret.is_str = true;
+                ret.conversion_type = TYPE_STRING;
+            }
+            break;
+
+        case FUNC_TRIM:
+            {
+                size_t len = args[0].len;
+                size_t start, end;
+
+                #define IS_WHITESPACE(c) \
+                    ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+                
+                for (start = 0; start < len; start++) {
+                    if (!IS_WHITESPACE(args[0].str[start])) {
+                        break;
+                    }
+                }
+
+                for (end = (len > 0) ? len - 1 : 0; end > start; end--) {
+                    if (!IS_WHITESPACE(args[0].str[end])) {
+                        break;
+                    }
+                }
+
+                len = (start < len) ? end - start + 1 : 0;
+                ret.str = (char*)malloc(len + 1);
+                memcpy(ret.str, args[0].str + start, len);
+                ret.str[len] = '\0';
+                ret.len = len;
+
+                ret.is_str = true;
+                ret.conversion_type = TYPE_STRING;
+            }
+            break;
+
+        default:
+            fprintf(stderr, "ERROR: no implementation for function %s\n",
+                    FUNCTIONS[val->func->func].name);
+        }
+
+        for (size_t i = 0; i < val->func->num_args; i++) {
+            val_free(&args[i]);
+        }
+    }
+
+    //
+    // Evaluation to a constant is now complete.
+    // Now, do any explicit type conversion that was specified.
+    //
+
+    if (val->conversion_type == TYPE_LONG) {
+        if (ret.is_str) {
+            char* str = ret.str;
+            ret.num = csvsel_atol(str);
+            ret.is_str = false;
+            free(str);
+        }
+        else if (ret.is_dbl) {
+            ret.num = (long)ret.dbl;
+            ret.is_dbl = false;
+        }
+        ret.is_num = true;
+    }
+    else if (val->conversion_type == TYPE_DOUBLE) {
+        if (ret.is_str) {
+            char* str = ret.str;
+            ret.dbl = csvsel_strtod(str, NULL);
+            ret.is_str = false;
+            free(str);
+        }
+        else if (ret.is_num) {
+            ret.dbl = (double)ret.num;
+            ret.is_num = false;
+        }
+        ret.is_dbl = true;
+    }
+    else if (val->conversion_type == TYPE_STRING) {
+        if (ret.is_num) {
+            ret.len = asprintf(&(ret.str), "%ld", ret.num);
+            ret.is_num = false;
+        }
+        else if (ret.is_dbl) {
+            ret.len = asprintf(&(ret.str), "%lf", ret.dbl);
+            ret.is_dbl = false;
+        }
+        ret.is_str = true;
+    }
+
+    return ret;
+}
+
+/**
+ * Evaluates a condition for a row, by walking its tree.
+ */
+static bool tree_query_evaluate(const csv_row* row, size_t rownum, compound* condition)
+{
+    bool retval = true;
+
+    if (NULL == condition) {
+        // return true
+        goto cleanup;
+    }
+
+    switch (condition->oper) {
+    case OPER_SIMPLE:
+        {
+            val left = tree_value_evaluate(
+                                &(condition->simple.left),  row, rownum);
+            val right = tree_value_evaluate(
+                                &(condition->simple.right), row, rownum);
+
+            if (condition->simple.oper == TOK_CONTAINS) {
+                //
+                // 'contains' is a special case.
+                //
+
+                if (left.is_num) {
+                    asprintf(&(left.str), "%ld", left.num);
+                }
+                else if (left.is_dbl) {
+                    asprintf(&(left.str), "%lf", left.dbl);
+                }
+
+                if (right.is_num) {
+                    asprintf(&(right.str), "%ld", right.num);
+                }
+                else if (right.is_dbl) {
+                    asprintf(&(right.str), "%lf", right.dbl);
+                }
+
+                retval = (NULL != strstr(left.str, right.str));
+
+                free(left.str);
+                free(right.str);
+
+                goto cleanup;
+            }
+
+            //
+            // Next we do automatic type conversion if needed.
+            //
+            // conversion | num dbl str
+            // -----------+----------------
+            //        num | num dbl  *
+            //        dbl | dbl dbl dbl
+            //        str |  *  dbl str
+            //
+            // *: If the string has a dot in it, both are converted to dbl.
+            //    Otherwise, the string is converted to num.
+            //
+
+#define CONVERSION(a, b) \
+            if (b.is_dbl) { \
+                if (a.is_str) { \
+                    char* temp = a.str; \
+                    a.dbl = csvsel_strtod(temp, NULL); \
+                    a.is_dbl = true; \
+                    a.is_str = false; \
+                    free(temp); \
+                } \
+                else if (a.is_num) { \
+                    a.dbl = (double)a.num; \
+                    a.is_dbl = true; \
+                    a.is_num = false; \
+                } \
+            } \
+            else if (b.is_num && a.is_str) { \
+                if (strchr(a.str, '.') != NULL) { \
+                    char* temp = a.str; \
+                    a.dbl = csvsel_strtod(temp, NULL); \
+                    a.is_dbl = true; \
+                    a.is_str = false; \
+                    free(temp); \
+                    b.dbl = (double)b.num; \
+                    b.is_dbl = true; \
+                    b.is_num = false; \
+                } \
+                else { \
+                    char* temp = a.str; \
+                    a.num = csvsel_atol(temp); \
+                    a.is_num = true; \
+                    a.is_str = false; \
+                    free(temp); \
+                } \
+            }
+           
+            //
+            // The macro only modifies one side (except the special case).
+            // Need to apply it both ways.
+            //
+            CONVERSION(left, right);
+            CONVERSION(right, left);
+
+#define COMPARE(operator) \
+            if (left.is_dbl) { \
+                retval = (left.dbl operator right.dbl); \
+            } else if (left.is_num) { \
+                retval = (left.num operator right.num); \
+            } \
+            else { \
+                retval = (strcmp(left.str, right.str) operator 0); \
+                /* these strings are intermediate results, so free them */ \
+                free(left.str); \
+                free(right.str); \
+            } \
+
+            switch (condition->simple.oper) {
+            case TOK_EQ:
+                COMPARE(==)
+                break;
+
+            case TOK_NEQ:
+                COMPARE(!=)
+                break;
+
+            case TOK_GT:
+                COMPARE(>)
+                break;
+
+            case TOK_LT:
+                COMPARE(<)
+                break;
+
+            case TOK_GTE:
+                COMPARE(>=)
+                break;
+
+            case TOK_LTE:
+                COMPARE(<=)
+                break;
+            }
+        }
+        break;
+
+    case OPER_NOT:
+        retval = ! tree_query_evaluate(row, rownum, condition->left);
+        break;
+
+    case OPER_AND:
+        retval = (tree_query_evaluate(row, rownum, condition->left) && tree_query_evaluate(row, rownum, condition->right));
+        break;
+
+    case OPER_OR:
+        retval = (tree_query_evaluate(row, rownum, condition->left) || tree_query_evaluate(row, rownum, condition->right));
+        break;
     }
 
+cleanup:
     return retval;
 }
 
+/**
+ * Evaluates a val with a program compiled from it, as a selector. Returns a
+ * new val with its string copied.
+ */
+static val compiled_value_evaluate(const val* value, const csv_row* row, size_t rownum)
+{
+    selector s = {0};
+    selector* sp = &s;
+    growbuf* selectors = growbuf_create(sizeof(sp));
+    val ret = {0};
+
+    s.type = SELECTOR_VALUE;
+    s.value = *value;
+    growbuf_append(selectors, &sp, sizeof(sp));
+
+    query_program* program = query_compile(NULL, selectors, NULL);
+    query_vm* vm = query_vm_create(program);
+
+    ret = query_vm_selector(vm, 0, row, rownum);
+    if (ret.is_str) {
+        ret.str = strndup(ret.str, ret.len);
+    }
+
+    query_vm_free(vm);
+    query_program_free(program);
+    growbuf_free(selectors);
+    return ret;
+}
+
 bool test_substr()
 {
     bool ret = false;
-    growbuf* fields = growbuf_create(1*sizeof(void*));
-    growbuf* field = growbuf_create(0);
-    growbuf_append(fields, &field, sizeof(void*));
-    field->buf = (void*)"graycode";
-    
+    csv_field field = { "graycode", 8 };
+    csv_row row = { &field, 1 };
+
     val value = {0};
     func function = {0};
 
@@ -203,7 +924,7 @@ bool test_substr()
     function.num_args = 2;
 
     function.args[1].num = 20;
-    val final = value_evaluate(&value, fields, 0);
+    val final = compiled_value_evaluate(&value, &row, 0);
 
     // 20 from the start (start out of range => empty string)
     // substr("graycode", 20) = ""
@@ -215,7 +936,7 @@ bool test_substr()
 
     free(final.str);
     function.args[1].num = -3;
-    final = value_evaluate(&value, fields, 0);
+    final = compiled_value_evaluate(&value, &row, 0);
 
     // 3 from the end, to the end
     // substr("graycode", -3) = "ode"
@@ -227,7 +948,7 @@ bool test_substr()
 
     free(final.str);
     function.args[1].num = 4;
-    final = value_evaluate(&value, fields, 0);
+    final = compiled_value_evaluate(&value, &row, 0);
 
     // 4 from the start, to the end
     // substr("graycode", 4) = "code"
@@ -242,7 +963,7 @@ bool test_substr()
     function.args[2].num = 3;
     function.args[2].conversion_type = TYPE_LONG;
     function.num_args = 3;
-    final = value_evaluate(&value, fields, 0);
+    final = compiled_value_evaluate(&value, &row, 0);
 
     // 4 from the start, length of 3
     // substr("graycode", 4, 3) = "cod"
@@ -254,7 +975,7 @@ bool test_substr()
 
     free(final.str);
     function.args[2].num = -3;
-    final = value_evaluate(&value, fields, 0);
+    final = compiled_value_evaluate(&value, &row, 0);
   
     // 4 from the start, up to and including 3 from the end
     // substr("graycode", 4, -3) = "co"
@@ -266,7 +987,7 @@ bool test_substr()
 
     free(final.str);
     function.args[1].num = 20;
-    final = value_evaluate(&value, fields, 0);
+    final = compiled_value_evaluate(&value, &row, 0);
 
     // 20 from the start, up to and including 3 from the end
     // doesn't make sense because start > end, so yields empty string
@@ -280,7 +1001,7 @@ bool test_substr()
     free(final.str);
     function.args[1].num = -20;
     function.args[2].num = 40;
-    final = value_evaluate(&value, fields, 0);
+    final = compiled_value_evaluate(&value, &row, 0);
 
     // 20 from the end, length of 40.
     // out of bounds start gets trimmed to 0
@@ -296,19 +1017,14 @@ bool test_substr()
     ret = true;
 
 cleanup:
-    field->buf = NULL;
-    growbuf_free(field);
-    growbuf_free(fields);
-
     return ret;
 }
 
 bool test_upper_lower()
 {
     bool ret = false;
-    growbuf* fields = growbuf_create(1*sizeof(void*));
-    growbuf* field = growbuf_create(0);
-    growbuf_append(fields, &field, sizeof(void*));
+    csv_field field = {0};
+    csv_row row = { &field, 1 };
     val value = {0};
     func function = {0};
 
@@ -322,9 +1038,10 @@ bool test_upper_lower()
     function.args[0].conversion_type = TYPE_STRING;
     function.num_args = 1;
 
-    field->buf = "gRaYcOde12 34_-+";
+    field.data = "gRaYcOde12 34_-+";
+    field.len = strlen(field.data);
     
-    val final = value_evaluate(&value, fields, 0);
+    val final = compiled_value_evaluate(&value, &row, 0);
 
     if (!TYPE_CHECKS(final) || strcmp("GRAYCODE12 34_-+", final.str) != 0) {
         printf("upper failed\n");  
@@ -334,7 +1051,7 @@ bool test_upper_lower()
 
     free(final.str);
     function.func = FUNC_LOWER;
-    final = value_evaluate(&value, fields, 0);
+    final = compiled_value_evaluate(&value, &row, 0);
 
     if (!TYPE_CHECKS(final) || strcmp("graycode12 34_-+", final.str) != 0) {
         printf("lower failed\n");
@@ -346,20 +1063,157 @@ bool test_upper_lower()
     ret = true;
 
 cleanup:
-    field->buf = NULL;
-    growbuf_free(field);
-    growbuf_free(fields);
-
     return ret;
 }
 
+/**
+ * Whether a compiled program gave the same value as the tree evaluator. (The
+ * tree evaluator doesn't keep the conversion types of its results up to date;
+ * only their is_ flags count.)
+ */
+static bool same_value(const val* expected, const val* actual)
+{
+    if (expected->is_num != actual->is_num || expected->is_dbl != actual->is_dbl
+            || expected->is_str != actual->is_str) {
+        return false;
+    }
+
+    if (expected->is_num) {
+        return expected->num == actual->num;
+    }
+    else if (expected->is_dbl) {
+        return expected->dbl == actual->dbl
+            || (isnan(expected->dbl) && isnan(actual->dbl));
+    }
+    else {
+        return expected->len == actual->len
+            && 0 == memcmp(expected->str, actual->str, expected->len);
+    }
+}
+
+bool test_compiled_queries()
+{
+    //
+    // Random rows, of fields picked to go through each kind of conversion and
+    // comparison, against queries that use every instruction. The programs
+    // have to agree with the tree evaluator on every one.
+    //
+
+    bool pass = true;
+    const char* queries[] = {
+        "select %1.int, %2.float, %3.string where %1 = %2",
+        "select strlen(%1), upper(%2), lower(%3), trim(%4) where %1.int > 3 and not %2 contains \"a\"",
+        "select substr(%1, 1), substr(%2, -2, 3), abs(%1.float), max(%1.int, %2.float), min(%3.float, 2) "
+            "where %1 < 5 or %2 >= \"b\" order by %3.float desc, %#",
+        "select %#, %%, %5 where (%1 != %2 or %3 <= 2.5) and not (%4 contains 1) "
+            "or 3 > %1 or %# >= %2",
+        "select 1, 2.5, \"x\", 3 .string, \"4\".int, 2.5.int where %# > 2 and %% < 6 or %2.int = %3.float",
+        "select %2 where %1 = 12 or 12 = %1 or %1 > 1.5 or \"-7\" < %2.int or %3 contains %4 "
+            "order by trim(%1), %2.int desc",
+        "select trim(%6), substr(trim(%1), 0, strlen(%2)).float "
+            "where %1 contains 1.5 or %2.float contains %1",
+        "select upper(\"abc\"), substr(\"hello\", 1, 2), max(1, 2.5), \"7\".float where \"x.y\" < %2.int or strlen(\"abc\") > %1 or 1 = 1 and %2 contains lower(\"A\")",
+        "select %1 where 1 > 2 or \"a\" = \"a\" and not 2.5 < 1 and trim(\" a \") = %1 "
+            "or abs(-3) contains 3 and %3 < \"12.\"",
+        "select \"x\" where \"2.5\" > %1.int or not \"-4\" <= %2.int",
+        "select %2.float, upper(%1), abs(%2.float) where %2.float > 0 and upper(%1) != \"A\" "
+            "or %2.float < 3 and upper(%1) contains \"B\" order by %2.float, upper(%1), abs(%2.float)",
+    };
+    const char* fields[] = {
+        "", "0", "12", "-7", "3.25", "$1,234.50", "abc", "ABC", " pad ", "x.y",
+        "1e3", "a", "b", "2.5", "  ", "-0.0", "9999999999", "12.",
+    };
+    const size_t num_fields = sizeof(fields) / sizeof(fields[0]);
+
+    srand(19);
+    for (size_t q = 0; pass && q < sizeof(queries) / sizeof(queries[0]); q++) {
+        growbuf* selectors = growbuf_create(1);
+        compound* root_condition = NULL;
+        order* order = NULL;
+
+        if (0 != queryparse(queries[q], strlen(queries[q]), selectors, &root_condition, &order)) {
+            printf("\"%s\" didn't parse\n", queries[q]);
+            free_selectors(selectors);
+            return false;
+        }
+
+        query_program* program = query_compile(root_condition, selectors, order);
+        query_vm* vm = query_vm_create(program);
+
+        for (size_t rownum = 0; pass && rownum < 2000; rownum++) {
+            csv_field row_fields[6];
+            csv_row row = { row_fields, (size_t)rand() % 7 };
+            char line[128];
+            size_t line_len = 0;
+
+            // the fields are in one line, not NUL-terminated, as they'd be read
+            for (size_t i = 0; i < row.num_fields; i++) {
+                const char* field = fields[rand() % num_fields];
+                row_fields[i].len = strlen(field);
+                memcpy(line + line_len, field, row_fields[i].len);
+                line_len += row_fields[i].len;
+                line[line_len++] = ',';
+            }
+            for (size_t i = 0, start = 0; i < row.num_fields; i++) {
+                row_fields[i].data = line + start;
+                start += row_fields[i].len + 1;
+            }
+
+            if (tree_query_evaluate(&row, rownum, root_condition)
+                    != query_vm_matches(vm, &row, rownum)) {
+                printf("\"%s\": condition differs on row %zu\n", queries[q], rownum);
+                pass = false;
+            }
+
+            for (size_t i = 0; pass && i < selectors->size / sizeof(void*); i++) {
+                selector* sel = ((selector**)selectors->buf)[i];
+                if (SELECTOR_VALUE != sel->type) {
+                    continue;
+                }
+
+                val expected = tree_value_evaluate(&sel->value, &row, rownum);
+                val actual = query_vm_selector(vm, i, &row, rownum);
+                if (!same_value(&expected, &actual)) {
+                    printf("\"%s\": selector %zu differs on row %zu: ", queries[q], i + 1, rownum);
+                    print_val(expected);
+                    printf(" vs. ");
+                    print_val(actual);
+                    printf("\n");
+                    pass = false;
+                }
+                val_free(&expected);
+            }
+
+            for (size_t i = 0; pass && NULL != order
+                    && i < order->keys->size / sizeof(order_key); i++) {
+                order_key* key = &((order_key*)order->keys->buf)[i];
+                val expected = tree_value_evaluate(&key->value, &row, rownum);
+                val actual = query_vm_order_key(vm, i, &row, rownum);
+                if (!same_value(&expected, &actual)) {
+                    printf("\"%s\": order key %zu differs on row %zu\n", queries[q], i + 1, rownum);
+                    pass = false;
+                }
+                val_free(&expected);
+            }
+        }
+
+        query_vm_free(vm);
+        query_program_free(program);
+        free_selectors(selectors);
+        free_compound(root_condition);
+        free_order(order);
+    }
+
+    return pass;
+}
+
 bool test_order()
 {
     bool retval = false;
     growbuf* selected_columns = growbuf_create(1);
     compound* root_condition = NULL;
     order* order = NULL;
-    const char* query = "select %1 order by %2";
+    const char* query = "select %1 order by %2, %3.int desc";
     selector** selectors = NULL;
 
     if (0 != queryparse(query, strlen(query), selected_columns, &root_condition, &order)) {
@@ -374,21 +1228,36 @@ bool test_order()
         goto cleanup;
     }
 
-    if (order->direction != ORDER_ASCENDING) {
+    if (2 != order->keys->size / sizeof(order_key)) {
+        retval = false;
+        printf("wrong number of sort keys: %zu\n", order->keys->size / sizeof(order_key));
+        goto cleanup;
+    }
+
+    order_key* keys = (order_key*)order->keys->buf;
+
+    if (keys[0].direction != ORDER_ASCENDING || keys[1].direction != ORDER_DESCENDING) {
         retval = false;
         printf("wrong sort direction\n");
         goto cleanup;
     }
 
-    if (!order->value.is_col) {
+    if (!keys[0].value.is_col || !keys[1].value.is_col) {
         retval = false;
         printf("wrong sort value: not a column\n");
         goto cleanup;
     }
 
-    if (order->value.col != 1) {
+    if (keys[0].value.col != 1 || keys[1].value.col != 2) {
         retval = false;
-        printf("wrong sort value: not column 2, %zu\n", order->value.col);
+        printf("wrong sort value: not columns 2 and 3, %zu and %zu\n",
+                keys[0].value.col, keys[1].value.col);
+        goto cleanup;
+    }
+
+    if (keys[1].value.conversion_type != TYPE_LONG) {
+        retval = false;
+        printf("wrong sort value: column 3 not converted to int\n");
         goto cleanup;
     }
 
@@ -401,9 +1270,1524 @@ cleanup:
         free(root_condition);
     }
 
-    if (order != NULL) {
-        free(order);
+    free_order(order);
+
+    return retval;
+}
+
+/**
+ * Row evaluator which serializes each row into a growbuf, so the results
+ * of two reads can be compared byte for byte.
+ */
+static void serialize_row(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context)
+{
+    growbuf* out = (growbuf*)context;
+
+    growbuf_append(out, &rownum, sizeof(rownum));
+    growbuf_append(out, &byte_offset, sizeof(byte_offset));
+    growbuf_append(out, &row->num_fields, sizeof(row->num_fields));
+    for (size_t i = 0; i < row->num_fields; i++) {
+        growbuf_append(out, &row->fields[i].len, sizeof(row->fields[i].len));
+        growbuf_append(out, row->fields[i].data, row->fields[i].len);
+    }
+}
+
+/**
+ * Read a CSV buffer with the given scanner implementation, either as a
+ * stream or in place, the way a mapped file is read.
+ *
+ * Returns:
+ *   the serialized rows, or NULL if the implementation isn't supported.
+ */
+static growbuf* read_with_scanner(const char* data, size_t len, csv_scan_impl impl, bool mapped)
+{
+    if (0 != csv_scan_set_impl(impl)) {
+        return NULL;
+    }
+
+    growbuf* out = growbuf_create(64);
+    csv_input input = {0};
+    if (mapped) {
+        input.data = data;
+        input.size = len;
+    }
+    else {
+        input.stream = fmemopen((void*)data, len, "r");
+    }
+
+    csv_reader* reader = csv_reader_create(&input);
+    read_csv(reader, &serialize_row, out);
+    csv_reader_free(reader);
+
+    if (!mapped) {
+        fclose(input.stream);
+    }
+
+    return out;
+}
+
+/**
+ * Check that every supported scanner produces the same rows as the scalar
+ * scanner reading a stream, both for streams and for mapped input.
+ */
+static bool scanners_agree(const char* data, size_t len)
+{
+    bool retval = true;
+    growbuf* expected = read_with_scanner(data, len, CSV_SCAN_SCALAR, false);
+    csv_scan_impl impls[] = { CSV_SCAN_SCALAR, CSV_SCAN_SSE2, CSV_SCAN_AVX2 };
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]) * 2; i++) {
+        bool mapped = (i % 2 == 1);
+        growbuf* actual = read_with_scanner(data, len, impls[i / 2], mapped);
+        if (NULL == actual) {
+            continue;
+        }
+
+        if (actual->size != expected->size
+                || 0 != memcmp(actual->buf, expected->buf, actual->size)) {
+            printf("%s scanner (%s) differs from scalar\n",
+                    csv_scan_impl_name(impls[i / 2]),
+                    mapped ? "mapped" : "stream");
+            retval = false;
+        }
+        growbuf_free(actual);
+    }
+
+    growbuf_free(expected);
+    return retval;
+}
+
+/**
+ * Generate random CSV input: quoted fields with embedded commas, newlines and
+ * escaped double-quotes, and unquoted fields with stray double-quotes.
+ */
+static void random_csv(growbuf* data, size_t max_fields)
+{
+    const char* pieces[] = {
+        ",", "\n", "\"", "\"\"", "abc", "x,y", "$1,234.50", "  ", "a\"b",
+        "0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz",
+    };
+
+    data->size = 0;
+    size_t num_fields = rand() % max_fields;
+    for (size_t i = 0; i < num_fields; i++) {
+        bool quoted = (rand() % 2 == 0);
+        size_t field_start = data->size;
+        if (quoted) {
+            growbuf_append_byte(data, '"');
+        }
+        for (size_t n = rand() % 4; n > 0; n--) {
+            const char* piece = pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+            for (const char* c = piece; *c != '\0'; c++) {
+                if (quoted && *c == '"') {
+                    growbuf_append_byte(data, '"');
+                }
+                else if (!quoted && (*c == ',' || *c == '\n'
+                            || (*c == '"' && data->size == field_start))) {
+                    // keep unquoted fields to a single field
+                    continue;
+                }
+                growbuf_append_byte(data, *c);
+            }
+        }
+        if (quoted) {
+            growbuf_append_byte(data, '"');
+        }
+        growbuf_append_byte(data, (rand() % 4 == 0) ? '\n' : ',');
+    }
+}
+
+bool test_scan_differential()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+
+    //
+    // The sample file.
+    //
+
+    FILE* sample = fopen("test.csv", "r");
+    if (NULL == sample) {
+        printf("can't open test.csv\n");
+        goto cleanup;
+    }
+    read_fd(fileno(sample), data);
+    fclose(sample);
+
+    if (!scanners_agree(data->buf, data->size)) {
+        printf("test.csv\n");
+        goto cleanup;
+    }
+
+    //
+    // Randomly generated input.
+    //
+
+    srand(22);
+    for (size_t round = 0; round < 200; round++) {
+        random_csv(data, 400);
+
+        csv_set_block_size(1 + rand() % 300);
+        if (!scanners_agree(data->buf, data->size)) {
+            printf("random input #%zu\n", round);
+            goto cleanup;
+        }
+    }
+
+    retval = true;
+
+cleanup:
+    csv_set_block_size(0);
+    csv_scan_set_impl(CSV_SCAN_AUTO);
+    growbuf_free(data);
+    return retval;
+}
+
+static void count_row(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context)
+{
+    (*(size_t*)context)++;
+}
+
+/**
+ * Check that once a reader's buffers have grown to fit the input, reading it
+ * again does no heap allocation at all, whether it's mapped or a stream.
+ */
+bool test_reader_allocations()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+    csv_input input = {0};
+    csv_reader* reader = NULL;
+    size_t rows = 0;
+
+    for (size_t i = 0; i < 5000; i++) {
+        const char* row = (i % 100 == 0)
+            ? "\"a \"\"wide\"\" row\",\"x,y\",3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18\n"
+            : "\"quoted\",plain,\"esc\"\"aped\",$1,234\n";
+        growbuf_append(data, row, strlen(row));
+    }
+
+    input.data = data->buf;
+    input.size = data->size;
+    reader = csv_reader_create(&input);
+    read_csv(reader, &count_row, &rows);
+
+    num_allocations = 0;
+    count_allocations = true;
+    read_csv(reader, &count_row, &rows);
+    count_allocations = false;
+
+    csv_reader_free(reader);
+
+    if (num_allocations != 0 || rows != 10000) {
+        printf("mapped: %zu allocations, %zu rows\n", num_allocations, rows);
+        goto cleanup;
+    }
+
+    input.data = NULL;
+    input.size = 0;
+    input.stream = fmemopen(data->buf, data->size, "r");
+    csv_set_block_size(4096);
+    reader = csv_reader_create(&input);
+    read_csv(reader, &count_row, &rows);
+    rewind(input.stream);
+
+    num_allocations = 0;
+    count_allocations = true;
+    read_csv(reader, &count_row, &rows);
+    count_allocations = false;
+
+    csv_reader_free(reader);
+    fclose(input.stream);
+    csv_set_block_size(0);
+
+    if (num_allocations != 0 || rows != 20000) {
+        printf("stream: %zu allocations, %zu rows\n", num_allocations, rows);
+        goto cleanup;
     }
 
+    retval = true;
+
+cleanup:
+    growbuf_free(data);
     return retval;
 }
+
+bool test_query_allocations()
+{
+    //
+    // Once the VM's arena has grown to what a row needs, functions and
+    // conversions shouldn't need the heap.
+    //
+
+    bool retval = false;
+    const char* query = "select upper(%1), substr(trim(%2), 1, 3), max(%3.float, 0).string, "
+        "lower(%1) where %2 contains \"b\" or %3.float > 2 and strlen(%1).string != %2 "
+        "order by %3.float, trim(%1)";
+    const char* lines[][3] = {
+        { "alpha", " bravo ", "3.25" },
+        { "12", "b", "$1,234.50" },
+        { "CHARLIE", "  ", "1e300" },
+    };
+    growbuf* selectors = growbuf_create(1);
+    compound* root_condition = NULL;
+    order* order = NULL;
+    query_program* program = NULL;
+    query_vm* vm = NULL;
+
+    if (0 != queryparse(query, strlen(query), selectors, &root_condition, &order)) {
+        printf("query didn't parse\n");
+        goto cleanup;
+    }
+
+    program = query_compile(root_condition, selectors, order);
+    vm = query_vm_create(program);
+
+    for (int pass = 0; pass < 2; pass++) {
+        num_allocations = 0;
+        count_allocations = (1 == pass);
+
+        for (size_t rownum = 0; rownum < 300; rownum++) {
+            const char** line = lines[rownum % 3];
+            csv_field fields[3];
+            csv_row row = { fields, 3 };
+
+            for (size_t i = 0; i < 3; i++) {
+                fields[i].data = line[i];
+                fields[i].len = strlen(line[i]);
+            }
+
+            query_vm_matches(vm, &row, rownum);
+            for (size_t i = 0; i < 4; i++) {
+                query_vm_selector(vm, i, &row, rownum);
+            }
+            for (size_t i = 0; i < 2; i++) {
+                query_vm_order_key(vm, i, &row, rownum);
+            }
+        }
+
+        count_allocations = false;
+    }
+
+    if (0 != num_allocations) {
+        printf("%zu allocations\n", num_allocations);
+        goto cleanup;
+    }
+
+    retval = true;
+
+cleanup:
+    query_vm_free(vm);
+    query_program_free(program);
+    free_selectors(selectors);
+    free_compound(root_condition);
+    free_order(order);
+    return retval;
+}
+
+bool test_adaptive_order()
+{
+    //
+    // The expensive contains is written first, but the cheap OR fails the
+    // AND far more often, so it should be moved ahead of it; the answers
+    // mustn't change when it is.
+    //
+
+    bool retval = false;
+    const char* query = "select %1 where %2 contains \"needle\" and (%1 = \"x\" or %3 = \"z\")";
+    growbuf* selectors = growbuf_create(1);
+    compound* root_condition = NULL;
+    order* order = NULL;
+    query_program* program = NULL;
+    query_vm* vm = NULL;
+    query_vm* merged = NULL;
+    char* printed = NULL;
+    size_t printed_len = 0;
+    char haystack[201];
+
+    if (0 != queryparse(query, strlen(query), selectors, &root_condition, &order)) {
+        printf("query didn't parse\n");
+        goto cleanup;
+    }
+
+    program = query_compile(root_condition, selectors, order);
+    vm = query_vm_create(program);
+
+    for (size_t rownum = 0; rownum < 20000; rownum++) {
+        bool has_needle = (0 == rownum % 2);
+        bool is_x = (0 == rownum % 10);
+        csv_field fields[2];
+        csv_row row = { fields, 2 };
+
+        memset(haystack, 'a', sizeof(haystack) - 1);
+        if (has_needle) {
+            memcpy(haystack + 150, "needle", 6);
+        }
+        fields[0].data = is_x ? "x" : "y";
+        fields[0].len = 1;
+        fields[1].data = haystack;
+        fields[1].len = sizeof(haystack) - 1;
+
+        if (query_vm_matches(vm, &row, rownum) != (has_needle && is_x)) {
+            printf("wrong answer on row %zu\n", rownum);
+            goto cleanup;
+        }
+    }
+
+    //
+    // A VM that ran no rows itself, as the main thread's does with -j, takes
+    // the order from what it gathers.
+    //
+
+    merged = query_vm_create(program);
+    query_vm_merge_order(merged, vm);
+
+    FILE* output = open_memstream(&printed, &printed_len);
+    query_vm_print_order(merged, output);
+    fclose(output);
+
+    if (NULL == strstr(printed, "after 20000 rows:\n    and\n        or: ")) {
+        printf("the OR wasn't moved first:\n%s", printed);
+        goto cleanup;
+    }
+
+    retval = true;
+
+cleanup:
+    free(printed);
+    query_vm_free(merged);
+    query_vm_free(vm);
+    query_program_free(program);
+    free_selectors(selectors);
+    free_compound(root_condition);
+    free_order(order);
+    return retval;
+}
+
+typedef struct {
+    growbuf* out;
+    size_t   max_fields;
+} prefix_args;
+
+/**
+ * Row evaluator which serializes the first few fields of each row.
+ */
+static void serialize_prefix(const csv_row* row, size_t rownum, uint64_t byte_offset, void* context)
+{
+    prefix_args* args = (prefix_args*)context;
+    csv_row prefix = *row;
+
+    if (prefix.num_fields > args->max_fields) {
+        prefix.num_fields = args->max_fields;
+    }
+    serialize_row(&prefix, rownum, byte_offset, args->out);
+}
+
+bool test_max_fields()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+    growbuf* expected = growbuf_create(4096);
+    growbuf* actual = growbuf_create(4096);
+
+    srand(6);
+    for (size_t round = 0; round < 100; round++) {
+        random_csv(data, 400);
+
+        csv_input input = {0};
+        input.data = data->buf;
+        input.size = data->size;
+
+        for (size_t max_fields = 2; max_fields < 6; max_fields++) {
+            prefix_args args = { expected, max_fields };
+            csv_reader* reader = csv_reader_create(&input);
+
+            expected->size = 0;
+            read_csv(reader, &serialize_prefix, &args);
+
+            args.out = actual;
+            actual->size = 0;
+            csv_reader_set_max_fields(reader, max_fields);
+            read_csv(reader, &serialize_prefix, &args);
+
+            csv_reader_free(reader);
+
+            if (expected->size != actual->size
+                    || 0 != memcmp(expected->buf, actual->buf, actual->size)) {
+                printf("random input #%zu, %zu fields\n", round, max_fields);
+                goto cleanup;
+            }
+        }
+    }
+
+    retval = true;
+
+cleanup:
+    growbuf_free(data);
+    growbuf_free(expected);
+    growbuf_free(actual);
+    return retval;
+}
+
+/**
+ * Run a query over a buffer, as a mapped file, and return what it printed.
+ */
+static growbuf* select_mapped(const char* data, size_t len, const char* query,
+        const csvsel_options* options)
+{
+    growbuf* out = growbuf_create(64);
+    csv_input input = {0};
+    char* buf = NULL;
+    size_t buf_len = 0;
+
+    input.data = data;
+    input.size = len;
+
+    FILE* output = open_memstream(&buf, &buf_len);
+    csv_select(&input, output, query, strlen(query), options);
+    fclose(output);
+
+    growbuf_append(out, buf, buf_len);
+    free(buf);
+    return out;
+}
+
+bool test_select_rows()
+{
+    //
+    // Rows selected whole come out as they were read, unless some of their
+    // double-quotes weren't needed; those print like any other fields do.
+    // Each one ends up with a newline.
+    //
+
+    const char* input =
+        "a,b\n"
+        "\"x,y\",c\n"
+        "\"q\",r\n"
+        "say \"hi\",t\n"
+        "\"m\"\"n\",o\n"
+        "\"line\nbreak\",\"with \"\"quotes\"\", too\"\n"
+        "last,row";
+    const char* queries[] = { "select", "select %2,%1" };
+    const char* expected[] = {
+        "a,b\n"
+        "\"x,y\",c\n"
+        "q,r\n"
+        "say \"hi\",t\n"
+        "m\"n,o\n"
+        "\"line\nbreak\",\"with \"\"quotes\"\", too\"\n"
+        "last,row\n",
+
+        "b,a\n"
+        "c,\"x,y\"\n"
+        "r,q\n"
+        "t,say \"hi\"\n"
+        "o,m\"n\n"
+        "\"with \"\"quotes\"\", too\",\"line\nbreak\"\n"
+        "row,last\n",
+    };
+
+    for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+        growbuf* out = select_mapped(input, strlen(input), queries[i], NULL);
+        bool same = (strlen(expected[i]) == out->size
+                && 0 == memcmp(expected[i], out->buf, out->size));
+
+        if (!same) {
+            printf("\"%s\" printed:\n%.*s", queries[i], (int)out->size, (char*)out->buf);
+        }
+
+        growbuf_free(out);
+        if (!same) {
+            return false;
+        }
+    }
+
+    //
+    // A double-quote still open at the end of the input would swallow
+    // whatever is printed after it, so that row is printed field by field,
+    // which closes it.
+    //
+
+    const char* open_input = "a,b\nq,\"c,d";
+    const char* open_expected = "a,b\nq,\"c,d\"\n";
+    growbuf* out = select_mapped(open_input, strlen(open_input), "select", NULL);
+    bool same = (strlen(open_expected) == out->size
+            && 0 == memcmp(open_expected, out->buf, out->size));
+
+    if (!same) {
+        printf("unclosed quote printed:\n%.*s", (int)out->size, (char*)out->buf);
+    }
+
+    growbuf_free(out);
+    return same;
+}
+
+static uint32_t read_u32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * Position of a field of a flatbuffer table, or 0 if it's left out.
+ */
+static size_t fb_field_at(const uint8_t* buf, size_t table, size_t id)
+{
+    size_t vtable = table - (int32_t)read_u32(buf + table);
+    uint16_t vtable_size, field_offset;
+
+    memcpy(&vtable_size, buf + vtable, sizeof(vtable_size));
+    if (4 + 2 * id >= vtable_size) {
+        return 0;
+    }
+    memcpy(&field_offset, buf + vtable + 4 + 2 * id, sizeof(field_offset));
+    return (0 == field_offset) ? 0 : table + field_offset;
+}
+
+/**
+ * What an offset field of a flatbuffer table points to.
+ */
+static size_t fb_follow(const uint8_t* buf, size_t table, size_t id)
+{
+    size_t field = fb_field_at(buf, table, id);
+    return field + read_u32(buf + field);
+}
+
+bool test_arrow_output()
+{
+    //
+    // Eight rows in batches of three: a schema, three record batches, and the
+    // end of the stream. The columns decode to the values the rows had.
+    //
+
+    const char* input = "1,a\n2,bb\n3,\n4,\"d,d\"\n5,e\n6,f\n7,g\n-8,h\n";
+    const int64_t expected_nums[] = { 1, 2, 3, 4, 5, 6, 7, -8 };
+    const char* expected_strings = "a|bb||d,d|e|f|g|h|";
+    csvsel_options options = {0};
+    options.output_format = OUTPUT_ARROW;
+    options.batch_rows = 3;
+
+    growbuf* out = select_mapped(input, strlen(input), "select %1.int, %2", &options);
+    growbuf* nums = growbuf_create(64);
+    growbuf* strings = growbuf_create(64);
+    const uint8_t* stream = out->buf;
+    size_t pos = 0;
+    size_t num_messages = 0, num_batches = 0, num_rows = 0;
+    bool pass = true, ended = false;
+
+    while (pass && !ended && pos + 8 <= out->size) {
+        uint32_t meta_len = read_u32(stream + pos + 4);
+        const uint8_t* meta = stream + pos + 8;
+
+        if (0xFFFFFFFF != read_u32(stream + pos) || 0 != meta_len % 8
+                || pos + 8 + meta_len > out->size) {
+            printf("message #%zu is malformed\n", num_messages);
+            pass = false;
+            break;
+        }
+
+        num_messages++;
+        if (0 == meta_len) {
+            ended = true;
+            pos += 8;
+            break;
+        }
+
+        size_t message = read_u32(meta);
+        uint8_t header_type = meta[fb_field_at(meta, message, 1)];
+        size_t header = fb_follow(meta, message, 2);
+        uint64_t body_len;
+        memcpy(&body_len, meta + fb_field_at(meta, message, 3), sizeof(body_len));
+        const uint8_t* body = meta + meta_len;
+
+        if (3 == header_type) {
+            int64_t length;
+            uint64_t offsets[5], lengths[5];
+            size_t buffers = fb_follow(meta, header, 2);
+
+            memcpy(&length, meta + fb_field_at(meta, header, 0), sizeof(length));
+            for (size_t i = 0; i < 5; i++) {
+                memcpy(&offsets[i], meta + buffers + 4 + 16 * i, 8);
+                memcpy(&lengths[i], meta + buffers + 4 + 16 * i + 8, 8);
+            }
+
+            // validity and values of %1; validity, offsets and bytes of %2
+            growbuf_append(nums, body + offsets[1], lengths[1]);
+            const int32_t* ends = (const int32_t*)(body + offsets[3]);
+            for (int64_t i = 0; i < length; i++) {
+                growbuf_append(strings, body + offsets[4] + ends[i], ends[i + 1] - ends[i]);
+                growbuf_append_byte(strings, '|');
+            }
+
+            num_batches++;
+            num_rows += length;
+        }
+
+        pos += 8 + meta_len + body_len;
+    }
+
+    if (pass && (!ended || pos != out->size || 5 != num_messages || 3 != num_batches
+                || 8 != num_rows)) {
+        printf("stream has %zu messages, %zu batches, %zu rows, %s\n",
+                num_messages, num_batches, num_rows,
+                ended ? "and an end" : "and no end");
+        pass = false;
+    }
+
+    if (pass && (sizeof(expected_nums) != nums->size
+                || 0 != memcmp(expected_nums, nums->buf, nums->size))) {
+        printf("int64 column differs\n");
+        pass = false;
+    }
+
+    if (pass && (strlen(expected_strings) != strings->size
+                || 0 != memcmp(expected_strings, strings->buf, strings->size))) {
+        printf("utf8 column is \"%.*s\"\n", (int)strings->size, (char*)strings->buf);
+        pass = false;
+    }
+
+    growbuf_free(out);
+    growbuf_free(nums);
+    growbuf_free(strings);
+    return pass;
+}
+
+bool test_parallel_scan()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+    const char* queries[] = {
+        "select",
+        "select %2,%# where %1 contains \"a\"",
+        "select %1 order by %2",
+        "select %#,%% where %% > 2 order by %# descending",
+    };
+
+    //
+    // Small chunks, so most chunk boundaries are guessed, and many of the
+    // guesses land inside quoted fields with newlines in them.
+    //
+
+    srand(5);
+    for (size_t round = 0; round < 20; round++) {
+        random_csv(data, 1000);
+
+        csvsel_options serial = { 1, 0 };
+        csvsel_options parallel = { 4, 1 + rand() % 64 };
+
+        for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+            growbuf* expected = select_mapped(data->buf, data->size, queries[i], &serial);
+            growbuf* actual = select_mapped(data->buf, data->size, queries[i], &parallel);
+
+            bool same = (expected->size == actual->size
+                    && 0 == memcmp(expected->buf, actual->buf, actual->size));
+
+            growbuf_free(expected);
+            growbuf_free(actual);
+
+            if (!same) {
+                printf("random input #%zu, chunk size %zu: \"%s\" differs\n",
+                        round, parallel.chunk_size, queries[i]);
+                goto cleanup;
+            }
+        }
+    }
+
+    retval = true;
+
+cleanup:
+    growbuf_free(data);
+    return retval;
+}
+
+/**
+ * Append data to a file as one gzip member.
+ */
+static void write_gzip_member(FILE* file, const char* data, size_t len, int level)
+{
+    z_stream zs = {0};
+    unsigned char out[65536];
+
+    deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    zs.next_in = (unsigned char*)data;
+    zs.avail_in = len;
+
+    int ret;
+    do {
+        zs.next_out = out;
+        zs.avail_out = sizeof(out);
+        ret = deflate(&zs, Z_FINISH);
+        fwrite(out, 1, sizeof(out) - zs.avail_out, file);
+    } while (ret == Z_OK);
+
+    deflateEnd(&zs);
+}
+
+bool test_decompress()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+    FILE* file = tmpfile();
+    FILE* stream = NULL;
+    char* buf = malloc(65536);
+
+    //
+    // A few megabytes, many chunks of decompressed data, in two gzip members.
+    //
+
+    srand(7);
+    growbuf* more = growbuf_create(4096);
+    while (data->size < 3 * 1024 * 1024) {
+        random_csv(more, 2000);
+        growbuf_append(data, more->buf, more->size);
+    }
+    growbuf_free(more);
+
+    write_gzip_member(file, data->buf, data->size / 3, 6);
+    write_gzip_member(file, (char*)data->buf + data->size / 3,
+            data->size - data->size / 3, 1);
+    rewind(file);
+
+    stream = decompress_open(file);
+    if (NULL == stream || stream == file) {
+        printf("gzip not detected\n");
+        goto cleanup;
+    }
+    file = NULL;
+
+    growbuf* all = growbuf_create(data->size);
+    size_t n;
+    while ((n = fread(buf, 1, 65536, stream)) > 0) {
+        growbuf_append(all, buf, n);
+    }
+    bool same = (all->size == data->size && 0 == memcmp(all->buf, data->buf, data->size));
+    growbuf_free(all);
+    if (!same) {
+        printf("decompressed data differs\n");
+        goto cleanup;
+    }
+
+    retval = true;
+
+cleanup:
+    if (NULL != stream) {
+        fclose(stream);
+    }
+    if (NULL != file) {
+        fclose(file);
+    }
+    free(buf);
+    growbuf_free(data);
+    return retval;
+}
+
+/**
+ * Read a whole file into a buffer.
+ */
+static growbuf* read_file(const char* path)
+{
+    growbuf* contents = growbuf_create(4096);
+    FILE* file = fopen(path, "rb");
+    char buf[4096];
+    size_t n;
+
+    while (NULL != file && (n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        growbuf_append(contents, buf, n);
+    }
+    if (NULL != file) {
+        fclose(file);
+    }
+    return contents;
+}
+
+bool test_index()
+{
+    bool retval = false;
+    char path[] = "/tmp/csvsel-test-XXXXXX";
+    char* index_path = NULL;
+    growbuf* data = growbuf_create(4096);
+    growbuf* more = growbuf_create(4096);
+    growbuf* full = NULL;
+    const char* queries[] = {
+        // query formats, for snprintf()
+        "select %%#,%%1 where %%# >= %zu and %%# <= %zu",
+        "select %%# where %%# > %zu and %%# < %zu order by %%1",
+        "select %%%%,%%# where %%# = %zu or %%# = %zu",
+    };
+
+    int fd = mkstemp(path);
+    if (-1 == fd) {
+        perror("mkstemp");
+        goto cleanup;
+    }
+    close(fd);
+    asprintf(&index_path, "%s.csvidx", path);
+
+    //
+    // Several thousand rows, with a last one that has no newline, so growing
+    // the file carries it on.
+    //
+
+    srand(11);
+    while (data->size < 512 * 1024) {
+        random_csv(more, 2000);
+        growbuf_append(data, more->buf, more->size);
+    }
+    growbuf_append(data, "last,\"row", 9);
+
+    for (size_t pass = 0; pass < 2; pass++) {
+        FILE* file = fopen(path, "wb");
+        fwrite(data->buf, 1, data->size, file);
+        fclose(file);
+
+        csv_input input = {0};
+        input.data = data->buf;
+        input.size = data->size;
+
+        //
+        // The first time through, the file has no index. The second time,
+        // it has grown, and its index is only good for the rows it had;
+        // bringing it up to date must come out the same as a new one.
+        //
+
+        csvsel_options build = { 4, 1 + rand() % 4096, path };
+        if (0 != csv_build_index(&input, &build)) {
+            printf("building the index failed\n");
+            goto cleanup;
+        }
+
+        if (pass == 1) {
+            growbuf* updated = read_file(index_path);
+            unlink(index_path);
+            csv_build_index(&input, &build);
+            full = read_file(index_path);
+
+            bool same = (updated->size == full->size
+                    && 0 == memcmp(updated->buf, full->buf, full->size));
+            growbuf_free(updated);
+            if (!same) {
+                printf("updated index differs from a new one\n");
+                goto cleanup;
+            }
+        }
+
+        csvsel_options plain = { 1, 0, NULL };
+        csvsel_options indexed = { 1, 0, path };
+
+        for (size_t i = 0; i < 50; i++) {
+            size_t first = rand() % 6000;
+            size_t last = first + rand() % 100;
+            char query[128];
+            snprintf(query, sizeof(query), queries[i % 3], first, last);
+
+            growbuf* expected = select_mapped(data->buf, data->size, query, &plain);
+            growbuf* actual = select_mapped(data->buf, data->size, query, &indexed);
+
+            bool same = (expected->size == actual->size
+                    && 0 == memcmp(expected->buf, actual->buf, actual->size));
+
+            growbuf_free(expected);
+            growbuf_free(actual);
+
+            if (!same) {
+                printf("pass %zu: \"%s\" differs with the index\n", pass, query);
+                goto cleanup;
+            }
+        }
+
+        // finish off the last row, and add some more
+        growbuf_append(data, "\"\n", 2);
+        random_csv(more, 2000);
+        growbuf_append(data, more->buf, more->size);
+    }
+
+    retval = true;
+
+cleanup:
+    unlink(path);
+    if (NULL != index_path) {
+        unlink(index_path);
+    }
+    free(index_path);
+    growbuf_free(full);
+    growbuf_free(more);
+    growbuf_free(data);
+    return retval;
+}
+
+bool test_order_spill()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+    const char* queries[] = {
+        "select %1,%# order by %2",
+        "select %%,%3 where %1 contains \"a\" order by %# descending",
+    };
+
+    //
+    // With hardly any memory, nearly every row is spilled in a run of its
+    // own, and the runs take more than one pass to merge; that must come out
+    // the same as sorting them in memory.
+    //
+
+    srand(13);
+    for (size_t round = 0; round < 20; round++) {
+        random_csv(data, 1000);
+
+        csvsel_options kept = { 1, 0, NULL, 0 };
+        csvsel_options spilled = { 1, 0, NULL, 1 + rand() % 4096 };
+        csvsel_options parallel = { 4, 1 + rand() % 64, NULL, 1 + rand() % 256 };
+
+        for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+            growbuf* expected = select_mapped(data->buf, data->size, queries[i], &kept);
+            growbuf* actual = select_mapped(data->buf, data->size, queries[i], &spilled);
+            growbuf* actual_parallel = select_mapped(data->buf, data->size, queries[i], &parallel);
+
+            bool same = (expected->size == actual->size
+                    && 0 == memcmp(expected->buf, actual->buf, actual->size)
+                    && expected->size == actual_parallel->size
+                    && 0 == memcmp(expected->buf, actual_parallel->buf, actual->size));
+
+            growbuf_free(expected);
+            growbuf_free(actual);
+            growbuf_free(actual_parallel);
+
+            if (!same) {
+                printf("random input #%zu, memory limit %zu: \"%s\" differs\n",
+                        round, spilled.memory_limit, queries[i]);
+                goto cleanup;
+            }
+        }
+    }
+
+    retval = true;
+
+cleanup:
+    growbuf_free(data);
+    return retval;
+}
+
+bool test_order_spill_threads()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+    growbuf* expected = NULL;
+    growbuf* actual = NULL;
+    const char* query = "select %2,%1 order by %2";
+    const size_t memory_limit = 128 * 1024;
+
+    //
+    // Each chunk read ahead is several times the memory limit; between them,
+    // the sorters of all the threads must still keep to it, give or take a
+    // row each.
+    //
+
+    for (size_t i = 0; i < 40000; i++) {
+        char line[64];
+        int len = snprintf(line, sizeof(line), "%zu,%08zx\n", i, (i * 2654435761u) % 100003);
+        growbuf_append(data, line, len);
+    }
+
+    csvsel_options kept = { 1, 0, NULL, 0 };
+    csvsel_options parallel = { 4, 256 * 1024, NULL, memory_limit };
+
+    expected = select_mapped(data->buf, data->size, query, &kept);
+
+    sorter_peak_memory();
+    actual = select_mapped(data->buf, data->size, query, &parallel);
+    size_t peak = sorter_peak_memory();
+
+    if (expected->size != actual->size
+            || 0 != memcmp(expected->buf, actual->buf, actual->size)) {
+        printf("output with 4 threads differs\n");
+        goto cleanup;
+    }
+
+    if (peak > memory_limit + memory_limit / 8) {
+        printf("sorters took %zu bytes, with a limit of %zu\n", peak, memory_limit);
+        goto cleanup;
+    }
+
+    retval = true;
+
+cleanup:
+    growbuf_free(data);
+    growbuf_free(expected);
+    growbuf_free(actual);
+    return retval;
+}
+
+/**
+ * Length of the first n lines of a buffer.
+ */
+static size_t first_lines(const growbuf* buf, size_t n)
+{
+    size_t len = 0;
+    while (n > 0 && len < buf->size) {
+        if (((const char*)buf->buf)[len++] == '\n') {
+            n--;
+        }
+    }
+    return len;
+}
+
+bool test_order_limit()
+{
+    bool retval = false;
+    growbuf* data = growbuf_create(4096);
+    char limit[32];
+    char query[128];
+    const char* queries[] = {
+        "select %%# order by %%2%s",
+        "select %%#,%%%% where %%1 contains \"a\" order by %%3 desc%s",
+    };
+
+    //
+    // Only the rows printed as numbers, so each row is a line, and the first
+    // k lines of the whole sort are what the limit should give.
+    //
+
+    srand(17);
+    for (size_t round = 0; round < 20; round++) {
+        random_csv(data, 1000);
+
+        size_t k = rand() % 40;
+        csvsel_options options[] = {
+            { 1, 0, NULL, 0 },
+            { 4, 1 + rand() % 64, NULL, 0 },
+            { 1, 0, NULL, 1 + rand() % 4096 },
+            { 4, 1 + rand() % 64, NULL, 1 + rand() % 4096 },
+        };
+
+        for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+            snprintf(query, sizeof(query), queries[i], "");
+            growbuf* all = select_mapped(data->buf, data->size, query, &options[0]);
+            size_t expected_len = first_lines(all, k);
+
+            snprintf(limit, sizeof(limit), " limit %zu", k);
+            snprintf(query, sizeof(query), queries[i], limit);
+            for (size_t j = 0; j < sizeof(options) / sizeof(options[0]); j++) {
+                growbuf* actual = select_mapped(data->buf, data->size, query, &options[j]);
+
+                bool same = (expected_len == actual->size
+                        && 0 == memcmp(all->buf, actual->buf, actual->size));
+                growbuf_free(actual);
+
+                if (!same) {
+                    printf("random input #%zu, options #%zu: \"%s\" differs\n",
+                            round, j, query);
+                    growbuf_free(all);
+                    goto cleanup;
+                }
+            }
+            growbuf_free(all);
+        }
+    }
+
+    retval = true;
+
+cleanup:
+    growbuf_free(data);
+    return retval;
+}
+
+/**
+ * Compare two values the way ORDER BY should: by number, or byte by byte.
+ */
+static int compare_sort_values(const val* a, const val* b)
+{
+    if (a->is_num) {
+        return (a->num > b->num) - (a->num < b->num);
+    }
+    else if (a->is_dbl) {
+        return (a->dbl > b->dbl) - (a->dbl < b->dbl);
+    }
+    int c = strcmp(a->str, b->str);
+    return (c > 0) - (c < 0);
+}
+
+bool test_sort_keys()
+{
+    bool retval = false;
+    growbuf* a_key = growbuf_create(64);
+    growbuf* b_key = growbuf_create(64);
+    const long nums[] = { LONG_MIN, -1000, -1, 0, 1, 255, 256, 1000, LONG_MAX };
+    const double dbls[] = { -INFINITY, -1e300, -2.5, -1e-300, -0.0, 0.0, 1e-300, 0.5, 2.5, 1e300, INFINITY };
+    const char* strs[] = { "", "a", "a b", "ab", "abc", "b", "\x7f", "\xc3\xa9" };
+
+    //
+    // Keys of two values each, of the same types, with every combination of
+    // directions: memcmp() of the keys must order them like comparing the
+    // first values, and then the second ones.
+    //
+
+    srand(19);
+    for (size_t round = 0; round < 20000; round++) {
+        val a[2], b[2];
+        bool descending[2];
+
+        for (size_t i = 0; i < 2; i++) {
+            memset(&a[i], 0, sizeof(val));
+            memset(&b[i], 0, sizeof(val));
+            descending[i] = (rand() % 2 == 0);
+
+            switch (rand() % 3) {
+            case 0:
+                a[i].is_num = b[i].is_num = true;
+                a[i].num = nums[rand() % (sizeof(nums) / sizeof(nums[0]))];
+                b[i].num = nums[rand() % (sizeof(nums) / sizeof(nums[0]))];
+                break;
+            case 1:
+                a[i].is_dbl = b[i].is_dbl = true;
+                a[i].dbl = dbls[rand() % (sizeof(dbls) / sizeof(dbls[0]))];
+                b[i].dbl = dbls[rand() % (sizeof(dbls) / sizeof(dbls[0]))];
+                break;
+            case 2:
+                a[i].is_str = b[i].is_str = true;
+                a[i].str = (char*)strs[rand() % (sizeof(strs) / sizeof(strs[0]))];
+                b[i].str = (char*)strs[rand() % (sizeof(strs) / sizeof(strs[0]))];
+                a[i].len = strlen(a[i].str);
+                b[i].len = strlen(b[i].str);
+                break;
+            }
+        }
+
+        a_key->size = b_key->size = 0;
+        for (size_t i = 0; i < 2; i++) {
+            sort_key_append(a_key, &a[i], descending[i]);
+            sort_key_append(b_key, &b[i], descending[i]);
+        }
+
+        int expected = compare_sort_values(&a[0], &b[0]) * (descending[0] ? -1 : 1);
+        if (0 == expected) {
+            expected = compare_sort_values(&a[1], &b[1]) * (descending[1] ? -1 : 1);
+        }
+
+        size_t len = (a_key->size < b_key->size) ? a_key->size : b_key->size;
+        int actual = memcmp(a_key->buf, b_key->buf, len);
+        if (0 == actual) {
+            actual = (a_key->size > b_key->size) - (a_key->size < b_key->size);
+        }
+        actual = (actual > 0) - (actual < 0);
+
+        if (actual != expected) {
+            printf("round %zu: keys compare %d, values %d\n", round, actual, expected);
+            goto cleanup;
+        }
+    }
+
+    retval = true;
+
+cleanup:
+    growbuf_free(a_key);
+    growbuf_free(b_key);
+    return retval;
+}
+
+/**
+ * Kinds of ORDER BY keys, for sorting tests and benchmarks.
+ */
+typedef enum {
+    KEYS_INT, KEYS_FLOAT, KEYS_STRING, KEYS_INT_INT, KEYS_STRING_INT, NUM_KEY_KINDS
+} key_kind;
+
+static const char* key_kind_names[] = {
+    "int", "float", "string", "int, int desc", "string, int",
+};
+
+/**
+ * Sort rows with random keys of a kind, and return what was printed: each
+ * row's number. Values are drawn from a range small enough to repeat, and
+ * strings often share long prefixes.
+ *
+ * Arguments:
+ *   kind	- what the keys are like
+ *   num_rows	- how many rows to sort
+ *   method	- how to sort them
+ *   num_threads - how many threads to sort them with
+ *   seed	- for the random keys
+ *   seconds	- receives how long sorting took, if not NULL
+ */
+static growbuf* sort_random_rows(key_kind kind, size_t num_rows, sort_method method,
+        size_t num_threads, unsigned int seed, double* seconds)
+{
+    growbuf* out = growbuf_create(64);
+    growbuf* key = growbuf_create(64);
+    sorter* s = sorter_create(SIZE_MAX, SIZE_MAX);
+    char str[64];
+    char* buf = NULL;
+    size_t buf_len = 0;
+
+    sorter_set_method(s, method);
+    sorter_set_threads(s, num_threads);
+    srand(seed);
+
+    for (size_t i = 0; i < num_rows; i++) {
+        val v[2];
+        size_t num_values = (kind == KEYS_INT_INT || kind == KEYS_STRING_INT) ? 2 : 1;
+
+        memset(v, 0, sizeof(v));
+        v[num_values - 1].is_num = true;
+        v[num_values - 1].num = (long)(rand() % (num_rows + 1)) - (long)num_rows / 2;
+
+        if (kind == KEYS_FLOAT) {
+            v[0].is_num = false;
+            v[0].is_dbl = true;
+            v[0].dbl = (rand() % 2000 - 1000) / 8.0;
+        }
+        else if (kind == KEYS_STRING || kind == KEYS_STRING_INT) {
+            snprintf(str, sizeof(str), "%s%x", (rand() % 2) ? "prefix/shared/by/half/" : "",
+                    (unsigned int)(rand() % (num_rows + 1)));
+            v[0].is_num = false;
+            v[0].is_str = true;
+            v[0].str = str;
+        }
+        else if (kind == KEYS_INT_INT) {
+            v[0].is_num = true;
+            v[0].num = rand() % 16;
+        }
+
+        key->size = 0;
+        for (size_t j = 0; j < num_values; j++) {
+            sort_key_append(key, &v[j], kind == KEYS_INT_INT && j == 1);
+        }
+
+        fprintf(sorter_begin_row(s), "%zu\n", i);
+        sorter_end_row(s, key);
+    }
+
+    struct timespec start, end;
+    FILE* output = open_memstream(&buf, &buf_len);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sorter_finish(s, output);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fclose(output);
+
+    if (NULL != seconds) {
+        *seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+
+    growbuf_append(out, buf, buf_len);
+    free(buf);
+    sorter_free(s);
+    growbuf_free(key);
+    return out;
+}
+
+bool test_radix_sort()
+{
+    //
+    // The radix sorts must give the same order as qsort(), ties included,
+    // for every kind of key, and for numbers of rows around where the MSD
+    // sort stops and sorts by insertion.
+    //
+
+    const size_t sizes[] = { 1, 2, 31, 32, 33, 100, 5000 };
+
+    for (key_kind kind = 0; kind < NUM_KEY_KINDS; kind++) {
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            growbuf* expected = sort_random_rows(kind, sizes[i], SORT_COMPARISON, 1, 23 + i, NULL);
+            growbuf* actual = sort_random_rows(kind, sizes[i], SORT_RADIX, 1, 23 + i, NULL);
+
+            bool same = (expected->size == actual->size
+                    && 0 == memcmp(expected->buf, actual->buf, actual->size));
+
+            growbuf_free(expected);
+            growbuf_free(actual);
+
+            if (!same) {
+                printf("%s keys, %zu rows: radix sort differs\n",
+                        key_kind_names[kind], sizes[i]);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool test_parallel_sort()
+{
+    //
+    // Sorting on several threads must give the same order as on one, ties
+    // included, however the rows divide between them.
+    //
+
+    const size_t threads[] = { 2, 3 };
+    const size_t num_rows = 200000 + rand() % 1000;
+
+    for (key_kind kind = 0; kind < NUM_KEY_KINDS; kind++) {
+        growbuf* expected = sort_random_rows(kind, num_rows, SORT_AUTO, 1, 31, NULL);
+
+        for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+            growbuf* actual = sort_random_rows(kind, num_rows, SORT_AUTO, threads[i], 31, NULL);
+
+            bool same = (expected->size == actual->size
+                    && 0 == memcmp(expected->buf, actual->buf, actual->size));
+
+            growbuf_free(actual);
+
+            if (!same) {
+                printf("%s keys, %zu threads: sort differs\n",
+                        key_kind_names[kind], threads[i]);
+                growbuf_free(expected);
+                return false;
+            }
+        }
+
+        growbuf_free(expected);
+    }
+
+    return true;
+}
+
+/**
+ * Add rows to a sorter with int keys, printing each one's number.
+ */
+static int add_int_rows(sorter* s, const long* values, size_t num_rows)
+{
+    growbuf* key = growbuf_create(8);
+    int retval = 0;
+
+    for (size_t i = 0; i < num_rows && 0 == retval; i++) {
+        val v;
+        memset(&v, 0, sizeof(v));
+        v.is_num = true;
+        v.num = values[i];
+
+        key->size = 0;
+        sort_key_append(key, &v, false);
+        fprintf(sorter_begin_row(s), "%zu\n", i);
+        retval = sorter_end_row(s, key);
+    }
+
+    growbuf_free(key);
+    return retval;
+}
+
+/**
+ * Sort rows with int keys, and return what was printed.
+ */
+static growbuf* sort_int_rows(const long* values, size_t num_rows, sort_method method)
+{
+    growbuf* out = growbuf_create(64);
+    sorter* s = sorter_create(SIZE_MAX, SIZE_MAX);
+    char* buf = NULL;
+    size_t buf_len = 0;
+
+    sorter_set_method(s, method);
+    add_int_rows(s, values, num_rows);
+
+    FILE* output = open_memstream(&buf, &buf_len);
+    sorter_finish(s, output);
+    fclose(output);
+
+    growbuf_append(out, buf, buf_len);
+    free(buf);
+    sorter_free(s);
+    return out;
+}
+
+bool test_presorted()
+{
+    //
+    // Rows already in order, or out of order in only a few places, must
+    // sort the same as any others, ties included.
+    //
+
+    const size_t num_rows = 10000;
+    const size_t num_swaps[] = { 0, 1, 5, 20, 31, 200 };
+    long* values = malloc(num_rows * sizeof(long));
+    bool pass = true;
+
+    for (size_t i = 0; pass && i < sizeof(num_swaps) / sizeof(num_swaps[0]); i++) {
+        for (size_t j = 0; j < num_rows; j++) {
+            values[j] = j / 3;
+        }
+        for (size_t j = 0; j < num_swaps[i]; j++) {
+            size_t a = rand() % num_rows;
+            size_t b = rand() % num_rows;
+            long t = values[a];
+            values[a] = values[b];
+            values[b] = t;
+        }
+
+        growbuf* expected = sort_int_rows(values, num_rows, SORT_COMPARISON);
+        growbuf* actual = sort_int_rows(values, num_rows, SORT_AUTO);
+
+        if (expected->size != actual->size
+                || 0 != memcmp(expected->buf, actual->buf, actual->size)) {
+            printf("with %zu rows swapped: sort differs\n", num_swaps[i]);
+            pass = false;
+        }
+
+        growbuf_free(expected);
+        growbuf_free(actual);
+    }
+
+    //
+    // Streaming rows prints them as they're added, and stops at the first
+    // one out of order.
+    //
+
+    if (pass) {
+        char* buf = NULL;
+        size_t buf_len = 0;
+        FILE* output = open_memstream(&buf, &buf_len);
+        sorter* s = sorter_create(SIZE_MAX, SIZE_MAX);
+        const long in_order[] = { 1, 2, 2, 5 };
+        const long out_of_order[] = { 4 };
+
+        sorter_stream(s, output);
+
+        if (0 != add_int_rows(s, in_order, 4)) {
+            printf("rows in order weren't streamed\n");
+            pass = false;
+        }
+        fflush(output);
+        if (pass && (buf_len != 8 || 0 != memcmp(buf, "0\n1\n2\n3\n", 8))) {
+            printf("rows weren't printed as they were added\n");
+            pass = false;
+        }
+        if (pass && 0 == add_int_rows(s, out_of_order, 1)) {
+            printf("a row out of order was streamed\n");
+            pass = false;
+        }
+        if (pass && 0 == sorter_finish(s, output)) {
+            printf("streaming rows out of order didn't fail\n");
+            pass = false;
+        }
+
+        sorter_free(s);
+        fclose(output);
+        free(buf);
+    }
+
+    free(values);
+    return pass;
+}
+
+/**
+ * Time sorting rows with qsort() against the radix sorts, and against sorting
+ * them with a thread for each processor, for each kind of key.
+ */
+void bench_sort(size_t num_rows)
+{
+    size_t num_threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    char threads_heading[32];
+    snprintf(threads_heading, sizeof(threads_heading), "%zu threads", num_threads);
+
+    printf("%-14s %12s %12s %12s\n", "keys", "qsort", "radix", threads_heading);
+
+    for (key_kind kind = 0; kind < NUM_KEY_KINDS; kind++) {
+        double comparison, radix;
+        double parallel;
+        growbuf_free(sort_random_rows(kind, num_rows, SORT_COMPARISON, 1, 29, &comparison));
+        growbuf_free(sort_random_rows(kind, num_rows, SORT_RADIX, 1, 29, &radix));
+        growbuf_free(sort_random_rows(kind, num_rows, SORT_AUTO, num_threads, 29, &parallel));
+
+        printf("%-14s %11.3fs %11.3fs %11.3fs\n", key_kind_names[kind], comparison, radix,
+                parallel);
+    }
+}
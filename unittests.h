@@ -8,10 +8,33 @@ bool test_csv_out1();
 bool test_csv_out2();
 bool test_csv_out3();
 bool test_csv_out4();
+bool test_csv_out5();
+bool test_number_output();
+bool test_number_input();
+bool test_select_rows();
+bool test_arrow_output();
+bool test_compiled_queries();
+bool test_query_allocations();
+bool test_adaptive_order();
 bool test_select_columns();
 bool test_substr();
 bool test_upper_lower();
 bool test_order();
+bool test_scan_differential();
+bool test_reader_allocations();
+bool test_parallel_scan();
+bool test_max_fields();
+bool test_decompress();
+bool test_index();
+bool test_order_spill();
+bool test_order_spill_threads();
+bool test_order_limit();
+bool test_sort_keys();
+bool test_radix_sort();
+bool test_parallel_sort();
+bool test_presorted();
+
+void bench_sort(size_t num_rows);
 
 typedef struct {
     bool (*func)(void);
@@ -28,6 +51,27 @@ unittest TESTS[] = {
     {test_substr,   "substr()"},
     {test_upper_lower,      "upper() and lower()"},
     {test_order,    "order"},
+    {test_scan_differential,    "structural scan: simd vs scalar, stream vs mapped"},
+    {test_reader_allocations,   "reader: no allocations per row"},
+    {test_parallel_scan,        "-j: same output as one thread"},
+    {test_max_fields,           "reader: fields past the last one used are skipped"},
+    {test_decompress,           "gzip input: reads across members"},
+    {test_index,                "index: ranges of %# read from the nearest row"},
+    {test_order_spill,          "order by: a small memory limit spills sorted runs"},
+    {test_order_spill_threads,  "order by: threads keep to the memory limit together"},
+    {test_order_limit,          "order by ... limit: the first rows of the whole sort"},
+    {test_sort_keys,            "order by: sort keys compare like their values"},
+    {test_radix_sort,           "order by: radix sorts sort the same as qsort()"},
+    {test_parallel_sort,        "order by: sorting on several threads sorts the same as on one"},
+    {test_presorted,            "order by: rows in order, or nearly, sort the same as others"},
+    {test_csv_out5,             "csv output #5 (quotes in a long field)"},
+    {test_number_output,        "numbers print the same as with printf()"},
+    {test_select_rows,          "select: whole rows and columns print as they were read"},
+    {test_arrow_output,         "arrow output: batches of the selected values"},
+    {test_compiled_queries,     "compiled queries evaluate the same as the parse tree"},
+    {test_query_allocations,    "compiled queries: no allocations per row"},
+    {test_number_input,         "numbers parse the same as with strtod() and atol()"},
+    {test_adaptive_order,       "compiled queries: conditions reorder by cost and selectivity"},
 };
 
 #endif //CSVSEL_UNITTEST_H